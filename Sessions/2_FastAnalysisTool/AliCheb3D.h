@@ -98,17 +98,17 @@ class AliCheb3D: public TNamed
   ~AliCheb3D()                                                                 {Clear();}
   //
   AliCheb3D&   operator=(const AliCheb3D& rhs);
-  void         Eval(const Float_t  *par, Float_t *res);
-  Float_t      Eval(const Float_t  *par,int idim);
-  void         Eval(const Double_t  *par, Double_t *res);
-  Double_t     Eval(const Double_t  *par,int idim);
+  void         Eval(const Float_t  *par, Float_t *res)                   const;
+  Float_t      Eval(const Float_t  *par,int idim)                        const;
+  void         Eval(const Double_t  *par, Double_t *res)                 const;
+  Double_t     Eval(const Double_t  *par,int idim)                       const;
   //
-  void         EvalDeriv(int dimd, const Float_t  *par, Float_t  *res);
-  void         EvalDeriv2(int dimd1, int dimd2, const Float_t  *par,Float_t  *res);
-  Float_t      EvalDeriv(int dimd, const Float_t  *par, int idim);
-  Float_t      EvalDeriv2(int dimd1,int dimd2, const Float_t  *par, int idim);
-  void         EvalDeriv3D(const Float_t *par, Float_t dbdr[3][3]); 
-  void         EvalDeriv3D2(const Float_t *par, Float_t dbdrdr[3][3][3]); 
+  void         EvalDeriv(int dimd, const Float_t  *par, Float_t  *res)   const;
+  void         EvalDeriv2(int dimd1, int dimd2, const Float_t  *par,Float_t  *res) const;
+  Float_t      EvalDeriv(int dimd, const Float_t  *par, int idim)        const;
+  Float_t      EvalDeriv2(int dimd1,int dimd2, const Float_t  *par, int idim) const;
+  void         EvalDeriv3D(const Float_t *par, Float_t dbdr[3][3])       const; 
+  void         EvalDeriv3D2(const Float_t *par, Float_t dbdrdr[3][3][3]) const; 
   void         Print(const Option_t* opt="")                             const;
   Bool_t       IsInside(const Float_t  *par)                             const;
   Bool_t       IsInside(const Double_t *par)                             const;
@@ -169,7 +169,7 @@ class AliCheb3D: public TNamed
   //
   Int_t        fMaxCoefs;          //! max possible number of coefs per parameterization
   Int_t        fNPoints[3];        //! number of used points in each dimension
-  Float_t      fArgsTmp[3];        //! temporary vector for coefs caluclation
+  Float_t      fArgsTmp[3];        //! temporary vector for coefs caluclation (the evaluation uses its own)
   Float_t *    fResTmp;            //! temporary vector for results of user function caluclation
   Float_t *    fGrid;              //! temporary buffer for Chebyshef roots grid
   Int_t        fGridOffs[3];       //! start of grid for each dimension
@@ -198,90 +198,100 @@ inline Bool_t  AliCheb3D::IsInside(const Double_t *par) const
 }
 
 //__________________________________________________________________________________________
-inline void AliCheb3D::Eval(const Float_t  *par, Float_t  *res)
+inline void AliCheb3D::Eval(const Float_t  *par, Float_t  *res) const
 {
   // evaluate Chebyshev parameterization for 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->Eval(fArgsTmp);
+  Float_t args[3]; // mapped arguments, on the stack for the thread safety
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->Eval(args);
   //
 }
 //__________________________________________________________________________________________
-inline void AliCheb3D::Eval(const Double_t  *par, Double_t  *res)
+inline void AliCheb3D::Eval(const Double_t  *par, Double_t  *res) const
 {
   // evaluate Chebyshev parameterization for 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->Eval(fArgsTmp);
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->Eval(args);
   //
 }
 
 //__________________________________________________________________________________________
-inline Double_t AliCheb3D::Eval(const Double_t  *par, int idim)
+inline Double_t AliCheb3D::Eval(const Double_t  *par, int idim) const
 {
   // evaluate Chebyshev parameterization for idim-th output dimension of 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  return GetChebCalc(idim)->Eval(fArgsTmp);
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  return GetChebCalc(idim)->Eval(args);
   //
 }
 
 //__________________________________________________________________________________________
-inline Float_t AliCheb3D::Eval(const Float_t  *par, int idim)
+inline Float_t AliCheb3D::Eval(const Float_t  *par, int idim) const
 {
   // evaluate Chebyshev parameterization for idim-th output dimension of 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  return GetChebCalc(idim)->Eval(fArgsTmp);
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  return GetChebCalc(idim)->Eval(args);
   //
 }
 
 //__________________________________________________________________________________________
-inline void AliCheb3D::EvalDeriv3D(const Float_t *par, Float_t dbdr[3][3])
+inline void AliCheb3D::EvalDeriv3D(const Float_t *par, Float_t dbdr[3][3]) const
 {
   // return gradient matrix
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  for (int ib=3;ib--;) for (int id=3;id--;) dbdr[ib][id] = GetChebCalc(ib)->EvalDeriv(id,fArgsTmp)*fBScale[id];
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  for (int ib=3;ib--;) for (int id=3;id--;) dbdr[ib][id] = GetChebCalc(ib)->EvalDeriv(id,args)*fBScale[id];
 }
 
 //__________________________________________________________________________________________
-inline void AliCheb3D::EvalDeriv3D2(const Float_t *par, Float_t dbdrdr[3][3][3])
+inline void AliCheb3D::EvalDeriv3D2(const Float_t *par, Float_t dbdrdr[3][3][3]) const
 {
   // return gradient matrix
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
   for (int ib=3;ib--;) for (int id=3;id--;)for (int id1=3;id1--;) 
-    dbdrdr[ib][id][id1] = GetChebCalc(ib)->EvalDeriv2(id,id1,fArgsTmp)*fBScale[id]*fBScale[id1];
+    dbdrdr[ib][id][id1] = GetChebCalc(ib)->EvalDeriv2(id,id1,args)*fBScale[id]*fBScale[id1];
 }
 
 //__________________________________________________________________________________________
-inline void AliCheb3D::EvalDeriv(int dimd, const Float_t  *par, Float_t  *res)
+inline void AliCheb3D::EvalDeriv(int dimd, const Float_t  *par, Float_t  *res) const
 {
   // evaluate Chebyshev parameterization derivative for 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->EvalDeriv(dimd,fArgsTmp)*fBScale[dimd];;
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->EvalDeriv(dimd,args)*fBScale[dimd];;
   //
 }
 
 //__________________________________________________________________________________________
-inline void AliCheb3D::EvalDeriv2(int dimd1,int dimd2, const Float_t  *par, Float_t  *res)
+inline void AliCheb3D::EvalDeriv2(int dimd1,int dimd2, const Float_t  *par, Float_t  *res) const
 {
   // evaluate Chebyshev parameterization 2nd derivative over dimd1 and dimd2 dimensions for 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->EvalDeriv2(dimd1,dimd2,fArgsTmp)*fBScale[dimd1]*fBScale[dimd2];
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  for (int i=fDimOut;i--;) res[i] = GetChebCalc(i)->EvalDeriv2(dimd1,dimd2,args)*fBScale[dimd1]*fBScale[dimd2];
   //
 }
 
 //__________________________________________________________________________________________
-inline Float_t AliCheb3D::EvalDeriv(int dimd, const Float_t  *par, int idim)
+inline Float_t AliCheb3D::EvalDeriv(int dimd, const Float_t  *par, int idim) const
 {
   // evaluate Chebyshev parameterization derivative over dimd dimention for idim-th output dimension of 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  return GetChebCalc(idim)->EvalDeriv(dimd,fArgsTmp)*fBScale[dimd];
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  return GetChebCalc(idim)->EvalDeriv(dimd,args)*fBScale[dimd];
   //
 }
 
 //__________________________________________________________________________________________
-inline Float_t AliCheb3D::EvalDeriv2(int dimd1,int dimd2, const Float_t  *par, int idim)
+inline Float_t AliCheb3D::EvalDeriv2(int dimd1,int dimd2, const Float_t  *par, int idim) const
 {
   // evaluate Chebyshev parameterization 2ns derivative over dimd1 and dimd2 dimensions for idim-th output dimension of 3d->DimOut function
-  for (int i=3;i--;) fArgsTmp[i] = MapToInternal(par[i],i);
-  return GetChebCalc(idim)->EvalDeriv2(dimd1,dimd2,fArgsTmp)*fBScale[dimd1]*fBScale[dimd2];
+  Float_t args[3];
+  for (int i=3;i--;) args[i] = MapToInternal(par[i],i);
+  return GetChebCalc(idim)->EvalDeriv2(dimd1,dimd2,args)*fBScale[dimd1]*fBScale[dimd2];
   //
 }
 
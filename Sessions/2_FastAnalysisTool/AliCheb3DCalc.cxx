@@ -168,22 +168,24 @@ Float_t  AliCheb3DCalc::EvalDeriv(int dim, const Float_t  *par) const
   // evaluate Chebyshev parameterization derivative in given dimension  for 3D function.
   // VERY IMPORTANT: par must contain the function arguments ALREADY MAPPED to [-1:1] interval
   //
+  Float_t stackCf[kMaxStackCf];
+  Float_t *tmpCf0 = GetTmpCf(stackCf), *tmpCf1 = tmpCf0+fNRows;
   int ncfRC;
   for (int id0=fNRows;id0--;) {
     int nCLoc = fNColsAtRow[id0];                   // number of significant coefs on this row
-    if (!nCLoc) {fTmpCf0[id0]=0; continue;}
+    if (!nCLoc) {tmpCf0[id0]=0; continue;}
     // 
     int col0  = fColAtRowBg[id0];                   // beginning of local column in the 2D boundary matrix
     for (int id1=nCLoc;id1--;) {
       int id = id1+col0;
-      if (!(ncfRC=fCoefBound2D0[id])) { fTmpCf1[id1]=0; continue;}
-      if (dim==2) fTmpCf1[id1] = ChebEval1Deriv(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
-      else        fTmpCf1[id1] = ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
+      if (!(ncfRC=fCoefBound2D0[id])) { tmpCf1[id1]=0; continue;}
+      if (dim==2) tmpCf1[id1] = ChebEval1Deriv(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
+      else        tmpCf1[id1] = ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
     }
-    if (dim==1)   fTmpCf0[id0] = ChebEval1Deriv(par[1],fTmpCf1,nCLoc);
-    else          fTmpCf0[id0] = ChebEval1D(par[1],fTmpCf1,nCLoc);
+    if (dim==1)   tmpCf0[id0] = ChebEval1Deriv(par[1],tmpCf1,nCLoc);
+    else          tmpCf0[id0] = ChebEval1D(par[1],tmpCf1,nCLoc);
   }
-  return (dim==0) ? ChebEval1Deriv(par[0],fTmpCf0,fNRows) : ChebEval1D(par[0],fTmpCf0,fNRows);
+  return (dim==0) ? ChebEval1Deriv(par[0],tmpCf0,fNRows) : ChebEval1D(par[0],tmpCf0,fNRows);
   //
 }
 
@@ -193,25 +195,27 @@ Float_t  AliCheb3DCalc::EvalDeriv2(int dim1,int dim2, const Float_t  *par) const
   // evaluate Chebyshev parameterization 2n derivative in given dimensions  for 3D function.
   // VERY IMPORTANT: par must contain the function arguments ALREADY MAPPED to [-1:1] interval
   //
+  Float_t stackCf[kMaxStackCf];
+  Float_t *tmpCf0 = GetTmpCf(stackCf), *tmpCf1 = tmpCf0+fNRows;
   Bool_t same = dim1==dim2;
   int ncfRC;
   for (int id0=fNRows;id0--;) {
     int nCLoc = fNColsAtRow[id0];                   // number of significant coefs on this row
-    if (!nCLoc) {fTmpCf0[id0]=0; continue;}
+    if (!nCLoc) {tmpCf0[id0]=0; continue;}
     //
     int col0  = fColAtRowBg[id0];                   // beginning of local column in the 2D boundary matrix
     for (int id1=nCLoc;id1--;) {
       int id = id1+col0;
-      if (!(ncfRC=fCoefBound2D0[id])) { fTmpCf1[id1]=0; continue;}
-      if (dim1==2||dim2==2) fTmpCf1[id1] = same ? ChebEval1Deriv2(par[2],fCoefs + fCoefBound2D1[id], ncfRC) 
+      if (!(ncfRC=fCoefBound2D0[id])) { tmpCf1[id1]=0; continue;}
+      if (dim1==2||dim2==2) tmpCf1[id1] = same ? ChebEval1Deriv2(par[2],fCoefs + fCoefBound2D1[id], ncfRC) 
 			      :                   ChebEval1Deriv(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
-      else        fTmpCf1[id1] = ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
+      else        tmpCf1[id1] = ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC);
     }
-    if (dim1==1||dim2==1) fTmpCf0[id0] = same ? ChebEval1Deriv2(par[1],fTmpCf1,nCLoc):ChebEval1Deriv(par[1],fTmpCf1,nCLoc);
-    else                  fTmpCf0[id0] = ChebEval1D(par[1],fTmpCf1,nCLoc);
+    if (dim1==1||dim2==1) tmpCf0[id0] = same ? ChebEval1Deriv2(par[1],tmpCf1,nCLoc):ChebEval1Deriv(par[1],tmpCf1,nCLoc);
+    else                  tmpCf0[id0] = ChebEval1D(par[1],tmpCf1,nCLoc);
   }
-  return (dim1==0||dim2==0) ? (same ? ChebEval1Deriv2(par[0],fTmpCf0,fNRows):ChebEval1Deriv(par[0],fTmpCf0,fNRows)) : 
-    ChebEval1D(par[0],fTmpCf0,fNRows);
+  return (dim1==0||dim2==0) ? (same ? ChebEval1Deriv2(par[0],tmpCf0,fNRows):ChebEval1Deriv(par[0],tmpCf0,fNRows)) : 
+    ChebEval1D(par[0],tmpCf0,fNRows);
   //
 }
 
@@ -3,6 +3,7 @@
 /* Copyright(c) 1998-1999, ALICE Experiment at CERN, All rights reserved. *
  * See cxx source for full Copyright notice                               */
 #include <TNamed.h>
+#include <vector>
 class TSystem;
 //
 // Author: Ruben Shahoyan
@@ -24,6 +25,8 @@ class TSystem;
 class AliCheb3DCalc: public TNamed
 {
  public:
+  enum {kMaxStackCf=128};        // max rows+cols of the summation scratch kept on the stack by Eval
+  //
   AliCheb3DCalc();
   AliCheb3DCalc(const AliCheb3DCalc& src);
   AliCheb3DCalc(FILE* stream);
@@ -67,6 +70,9 @@ class AliCheb3DCalc: public TNamed
   Double_t   Eval(const Double_t *par)                                  const;
   //
  protected:
+  template <typename T> Float_t EvalCf(const T *par, Float_t *tmpCf0, Float_t *tmpCf1) const;
+  Float_t*   GetTmpCf(Float_t *stackCf)                                 const;
+  //
   Int_t      fNCoefs;            // total number of coeeficients
   Int_t      fNRows;             // number of significant rows in the 3D coeffs matrix
   Int_t      fNCols;             // max number of significant cols in the 3D coeffs matrix
@@ -77,8 +83,8 @@ class AliCheb3DCalc: public TNamed
   UShort_t*  fCoefBound2D1;      //[fNElemBound2D] 2D matrix defining the start beginnig of significant coeffs for col/row
   Float_t *  fCoefs;             //[fNCoefs] array of Chebyshev coefficients
   //
-  Float_t *  fTmpCf1;            //[fNCols] temp. coeffs for 2d summation
-  Float_t *  fTmpCf0;            //[fNRows] temp. coeffs for 1d summation
+  Float_t *  fTmpCf1;            //[fNCols] temp. coeffs for 2d summation (not used by the evaluation, kept for the I/O)
+  Float_t *  fTmpCf0;            //[fNRows] temp. coeffs for 1d summation (not used by the evaluation, kept for the I/O)
   //
   Float_t    fPrec;              // Requested precision
   ClassDef(AliCheb3DCalc,4)      // Class for interpolation of 3D->1 function by Chebyshev parametrization 
@@ -102,9 +108,11 @@ inline Float_t AliCheb3DCalc::ChebEval1D(Float_t  x, const Float_t * array, int
 }
 
 //__________________________________________________________________________________________
-inline Float_t AliCheb3DCalc::Eval(const Float_t  *par) const 
+template <typename T>
+inline Float_t AliCheb3DCalc::EvalCf(const T *par, Float_t *tmpCf0, Float_t *tmpCf1) const 
 {
-  // evaluate Chebyshev parameterization for 3D function.
+  // evaluate Chebyshev parameterization for 3D function, the intermediate sums being
+  // stored in tmpCf0[fNRows] and tmpCf1[fNCols] supplied by the caller
   // VERY IMPORTANT: par must contain the function arguments ALREADY MAPPED to [-1:1] interval
   if (!fNRows) return 0.;
   int ncfRC;
@@ -113,11 +121,33 @@ inline Float_t AliCheb3DCalc::Eval(const Float_t  *par) const
     int col0  = fColAtRowBg[id0];                   // beginning of local column in the 2D boundary matrix
     for (int id1=nCLoc;id1--;) {
       int id = id1+col0;
-      fTmpCf1[id1] = (ncfRC=fCoefBound2D0[id]) ? ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC) : 0.0;
+      tmpCf1[id1] = (ncfRC=fCoefBound2D0[id]) ? ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC) : 0.0;
     }
-    fTmpCf0[id0] = nCLoc>0 ? ChebEval1D(par[1],fTmpCf1,nCLoc):0.0;
+    tmpCf0[id0] = nCLoc>0 ? ChebEval1D(par[1],tmpCf1,nCLoc):0.0;
   }
-  return ChebEval1D(par[0],fTmpCf0,fNRows);
+  return ChebEval1D(par[0],tmpCf0,fNRows);
+}
+
+//__________________________________________________________________________________________
+inline Float_t* AliCheb3DCalc::GetTmpCf(Float_t *stackCf) const
+{
+  // scratch for the summation: stackCf[kMaxStackCf] of the caller if large enough,
+  // otherwise a per-thread buffer, so that the evaluation is thread safe
+  int n = fNRows+fNCols;
+  if (n<=kMaxStackCf) return stackCf;
+  static thread_local std::vector<Float_t> tmpCf;
+  if ((int)tmpCf.size()<n) tmpCf.resize(n);
+  return tmpCf.data();
+}
+
+//__________________________________________________________________________________________
+inline Float_t AliCheb3DCalc::Eval(const Float_t  *par) const 
+{
+  // evaluate Chebyshev parameterization for 3D function.
+  // VERY IMPORTANT: par must contain the function arguments ALREADY MAPPED to [-1:1] interval
+  Float_t stackCf[kMaxStackCf];
+  Float_t *tmpCf = GetTmpCf(stackCf);
+  return EvalCf(par,tmpCf,tmpCf+fNRows);
 }
 
 //__________________________________________________________________________________________
@@ -125,18 +155,9 @@ inline Double_t AliCheb3DCalc::Eval(const Double_t  *par) const
 {
   // evaluate Chebyshev parameterization for 3D function.
   // VERY IMPORTANT: par must contain the function arguments ALREADY MAPPED to [-1:1] interval
-  if (!fNRows) return 0.;
-  int ncfRC;
-  for (int id0=fNRows;id0--;) {
-    int nCLoc = fNColsAtRow[id0];                   // number of significant coefs on this row
-    int col0  = fColAtRowBg[id0];                   // beginning of local column in the 2D boundary matrix
-    for (int id1=nCLoc;id1--;) {
-      int id = id1+col0;
-      fTmpCf1[id1] = (ncfRC=fCoefBound2D0[id]) ? ChebEval1D(par[2],fCoefs + fCoefBound2D1[id], ncfRC) : 0.0;
-    }
-    fTmpCf0[id0] = nCLoc>0 ? ChebEval1D(par[1],fTmpCf1,nCLoc):0.0;
-  }
-  return ChebEval1D(par[0],fTmpCf0,fNRows);
+  Float_t stackCf[kMaxStackCf];
+  Float_t *tmpCf = GetTmpCf(stackCf);
+  return EvalCf(par,tmpCf,tmpCf+fNRows);
 }
 
 #endif
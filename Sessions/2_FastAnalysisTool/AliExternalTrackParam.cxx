@@ -40,7 +40,7 @@
 ClassImp(AliExternalTrackParam)
 
 Double32_t AliExternalTrackParam::fgMostProbablePt=kMostProbablePt;
-Bool_t AliExternalTrackParam::fgUseLogTermMS = kFALSE;; 
+thread_local Bool_t AliExternalTrackParam::fgUseLogTermMS = kFALSE;
 //_____________________________________________________________________________
 AliExternalTrackParam::AliExternalTrackParam() :
   AliVTrack(),
@@ -294,7 +294,7 @@ class AliExternalTrackParam: public AliVTrack {
 
   static Double32_t    fgMostProbablePt; // "Most probable" pt
                                          // (to be used if Bz=0)
-  static Bool_t        fgUseLogTermMS;   // use log term in Mult.Stattering evaluation
+  static thread_local Bool_t fgUseLogTermMS; // use log term in Mult.Stattering evaluation (per thread)
   ClassDef(AliExternalTrackParam, 8)
 };
 
@@ -18,6 +18,7 @@
 #include <TSystem.h>
 #include <TArrayF.h>
 #include <TArrayI.h>
+#include <atomic>
 
 ClassImp(AliMagWrapCheb)
 
@@ -39,9 +40,7 @@ fNParamsSol(0),fNZSegSol(0),fNPSegSol(0),fNRSegSol(0),
   fSegZDip(0),fSegYDip(0),fSegXDip(0),
   fBegSegYDip(0),fNSegYDip(0),fBegSegXDip(0),fNSegXDip(0),fSegIDDip(0),fMinZDip(1.e6),fMaxZDip(-1.e6),fParamsDip(0)
 //
-#ifdef _MAGCHEB_CACHE_
-  ,fCacheSol(0),fCacheDip(0),fCacheTPCInt(0),fCacheTPCRat(0)
-#endif
+  ,fCacheID(NewCacheID())
 //
 {
   // default constructor
@@ -66,9 +65,7 @@ AliMagWrapCheb::AliMagWrapCheb(const AliMagWrapCheb& src) :
   fSegZDip(0),fSegYDip(0),fSegXDip(0),
   fBegSegYDip(0),fNSegYDip(0),fBegSegXDip(0),fNSegXDip(0),fSegIDDip(0),fMinZDip(1.e6),fMaxZDip(-1.e6),fParamsDip(0)
 //
-#ifdef _MAGCHEB_CACHE_
-  ,fCacheSol(0),fCacheDip(0),fCacheTPCInt(0),fCacheTPCRat(0)
-#endif
+  ,fCacheID(NewCacheID())
 {
   // copy constructor
   CopyFrom(src);
@@ -247,21 +244,34 @@ void AliMagWrapCheb::Clear(const Option_t *)
   fMinZDip = 1e6;
   fMaxZDip = -1e6;
   //
-#ifdef _MAGCHEB_CACHE_
-  fCacheSol = 0;
-  fCacheDip = 0;
-  fCacheTPCInt = 0;
-  fCacheTPCRat = 0;
-#endif
+  fCacheID = NewCacheID(); // invalidate the patches cached by the threads
   //
 }
 
 //__________________________________________________________________________________________
-void AliMagWrapCheb::Field(const Double_t *xyz, Double_t *b) const
+UInt_t AliMagWrapCheb::NewCacheID()
+{
+  // unique id of a map state, 0 is never given so that an empty cache matches no map
+  static std::atomic<UInt_t> id(0);
+  return ++id;
+}
+
+//__________________________________________________________________________________________
+AliMagWrapCheb::Cache_t& AliMagWrapCheb::GetThreadCache() const
+{
+  // patches cache of the calling thread, shared by all maps: it is reset by CheckCache
+  // when the thread moves to another map (or to a new state of this one)
+  static thread_local Cache_t cache;
+  return cache;
+}
+
+//__________________________________________________________________________________________
+void AliMagWrapCheb::Field(const Double_t *xyz, Double_t *b, Cache_t& cache) const
 {
   // compute field in cartesian coordinates. If point is outside of the parameterized region
   // get it at closest valid point
   Double_t rphiz[3];
+  CheckCache(cache);
   //
 #ifndef _BRING_TO_BOUNDARY_  // exact matching to fitted volume is requested
   b[0] = b[1] = b[2] = 0;
@@ -271,70 +281,67 @@ void AliMagWrapCheb::Field(const Double_t *xyz, Double_t *b) const
     CartToCyl(xyz,rphiz);
     //
 #ifdef _MAGCHEB_CACHE_
-    if (fCacheSol && fCacheSol->IsInside(rphiz)) 
-      fCacheSol->Eval(rphiz,b);
+    if (cache.fSol && cache.fSol->IsInside(rphiz)) 
+      cache.fSol->Eval(rphiz,b);
     else
 #endif //_MAGCHEB_CACHE_
-      FieldCylSol(rphiz,b);
+      FieldCylSol(rphiz,b,cache);
     // convert field to cartesian system
     CylToCartCylB(rphiz, b,b);
     return;
   }
   //
 #ifdef _MAGCHEB_CACHE_
-  if (fCacheDip && fCacheDip->IsInside(xyz)) {
-    fCacheDip->Eval(xyz,b); // check the cache first
+  if (cache.fDip && cache.fDip->IsInside(xyz)) {
+    cache.fDip->Eval(xyz,b); // check the cache first
     return;
   }
-#else //_MAGCHEB_CACHE_
-  AliCheb3D* fCacheDip = 0;
 #endif //_MAGCHEB_CACHE_
   int iddip = FindDipSegment(xyz);
   if (iddip>=0) {
-    fCacheDip = GetParamDip(iddip);
+    AliCheb3D* par = cache.fDip = GetParamDip(iddip);
     //
 #ifndef _BRING_TO_BOUNDARY_
-    if (!fCacheDip->IsInside(xyz)) return;
+    if (!par->IsInside(xyz)) return;
 #endif //_BRING_TO_BOUNDARY_
     //
-    fCacheDip->Eval(xyz,b); 
+    par->Eval(xyz,b); 
   }
   //
 }
 
 //__________________________________________________________________________________________
-Double_t AliMagWrapCheb::GetBz(const Double_t *xyz) const
+Double_t AliMagWrapCheb::GetBz(const Double_t *xyz, Cache_t& cache) const
 {
   // compute Bz for the point in cartesian coordinates. If point is outside of the parameterized region
   // get it at closest valid point
   Double_t rphiz[3];
+  CheckCache(cache);
   //
   if (xyz[2]>fMinZSol) {
     //
     CartToCyl(xyz,rphiz);
     //
 #ifdef _MAGCHEB_CACHE_
-    if (fCacheSol && fCacheSol->IsInside(rphiz)) return fCacheSol->Eval(rphiz,2);
+    if (cache.fSol && cache.fSol->IsInside(rphiz)) return cache.fSol->Eval(rphiz,2);
 #endif //_MAGCHEB_CACHE_
-    return FieldCylSolBz(rphiz);
+    return FieldCylSolBz(rphiz,cache);
   }
   //
 #ifdef _MAGCHEB_CACHE_
-  if (fCacheDip && fCacheDip->IsInside(xyz)) return fCacheDip->Eval(xyz,2); // check the cache first
+  if (cache.fDip && cache.fDip->IsInside(xyz)) return cache.fDip->Eval(xyz,2); // check the cache first
   //
-#else //_MAGCHEB_CACHE_
-  AliCheb3D* fCacheDip = 0;
 #endif //_MAGCHEB_CACHE_
   //
   int iddip = FindDipSegment(xyz);
   if (iddip>=0) {
-    fCacheDip = GetParamDip(iddip);
+    AliCheb3D* par = cache.fDip = GetParamDip(iddip);
     //
 #ifndef _BRING_TO_BOUNDARY_
-    if (!fCacheDip->IsInside(xyz)) return 0.;
+    if (!par->IsInside(xyz)) return 0.;
 #endif // _BRING_TO_BOUNDARY_
     //
-    return fCacheDip->Eval(xyz,2);
+    return par->Eval(xyz,2);
   //
   }
   //
@@ -342,7 +349,6 @@ Double_t AliMagWrapCheb::GetBz(const Double_t *xyz) const
   //
 }
 
-
 //__________________________________________________________________________________________
 void AliMagWrapCheb::Print(Option_t *) const
 {
@@ -541,11 +547,11 @@ Int_t AliMagWrapCheb::FindTPCRatSegment(const Double_t *rpz) const
 
 
 //__________________________________________________________________________________________
-void AliMagWrapCheb::GetTPCInt(const Double_t *xyz, Double_t *b) const
+void AliMagWrapCheb::GetTPCInt(const Double_t *xyz, Double_t *b, Cache_t& cache) const
 {
   // compute TPC region field integral in cartesian coordinates.
   // If point is outside of the parameterized region get it at closeset valid point
-  static Double_t rphiz[3];
+  Double_t rphiz[3];
   //
   // TPCInt region
   // convert coordinates to cyl system
@@ -555,7 +561,7 @@ void AliMagWrapCheb::GetTPCInt(const Double_t *xyz, Double_t *b) const
        rphiz[0]>GetMaxRTPCInt()) {for (int i=3;i--;) b[i]=0; return;}
 #endif
   //
-  GetTPCIntCyl(rphiz,b);
+  GetTPCIntCyl(rphiz,b,cache);
   //
   // convert field to cartesian system
   CylToCartCylB(rphiz, b,b);
@@ -563,11 +569,11 @@ void AliMagWrapCheb::GetTPCInt(const Double_t *xyz, Double_t *b) const
 }
 
 //__________________________________________________________________________________________
-void AliMagWrapCheb::GetTPCRatInt(const Double_t *xyz, Double_t *b) const
+void AliMagWrapCheb::GetTPCRatInt(const Double_t *xyz, Double_t *b, Cache_t& cache) const
 {
   // compute TPCRat region field integral in cartesian coordinates.
   // If point is outside of the parameterized region get it at closeset valid point
-  static Double_t rphiz[3];
+  Double_t rphiz[3];
   //
   // TPCRatInt region
   // convert coordinates to cyl system
@@ -577,7 +583,7 @@ void AliMagWrapCheb::GetTPCRatInt(const Double_t *xyz, Double_t *b) const
        rphiz[0]>GetMaxRTPCRatInt()) {for (int i=3;i--;) b[i]=0; return;}
 #endif
   //
-  GetTPCRatIntCyl(rphiz,b);
+  GetTPCRatIntCyl(rphiz,b,cache);
   //
   // convert field to cartesian system
   CylToCartCylB(rphiz, b,b);
@@ -585,60 +591,52 @@ void AliMagWrapCheb::GetTPCRatInt(const Double_t *xyz, Double_t *b) const
 }
 
 //__________________________________________________________________________________________
-void AliMagWrapCheb::FieldCylSol(const Double_t *rphiz, Double_t *b) const
+void AliMagWrapCheb::FieldCylSol(const Double_t *rphiz, Double_t *b, Cache_t& cache) const
 {
   // compute Solenoid field in Cylindircal coordinates
   // note: if the point is outside the volume get the field in closest parameterized point
   int id = FindSolSegment(rphiz);
   if (id>=0) {
-#ifndef _MAGCHEB_CACHE_
-    AliCheb3D* fCacheSol = 0;
-#endif
-    fCacheSol = GetParamSol(id);
+    AliCheb3D* par = cache.fSol = GetParamSol(id);
     //
 #ifndef _BRING_TO_BOUNDARY_  // exact matching to fitted volume is requested  
-    if (!fCacheSol->IsInside(rphiz)) return;
+    if (!par->IsInside(rphiz)) return;
 #endif
-    fCacheSol->Eval(rphiz,b);
+    par->Eval(rphiz,b);
   }
   //
 }
 
 //__________________________________________________________________________________________
-Double_t AliMagWrapCheb::FieldCylSolBz(const Double_t *rphiz) const
+Double_t AliMagWrapCheb::FieldCylSolBz(const Double_t *rphiz, Cache_t& cache) const
 {
   // compute Solenoid field in Cylindircal coordinates
   // note: if the point is outside the volume get the field in closest parameterized point
   int id = FindSolSegment(rphiz);
   if (id<0) return 0.;
   //
-#ifndef _MAGCHEB_CACHE_
-  AliCheb3D* fCacheSol = 0;
-#endif
-  //
-  fCacheSol = GetParamSol(id);
+  AliCheb3D* par = cache.fSol = GetParamSol(id);
 #ifndef _BRING_TO_BOUNDARY_  
-  return fCacheSol->IsInside(rphiz) ? fCacheSol->Eval(rphiz,2) : 0;
+  return par->IsInside(rphiz) ? par->Eval(rphiz,2) : 0;
 #else
-  return fCacheSol->Eval(rphiz,2);
+  return par->Eval(rphiz,2);
 #endif
   //
 }
 
 //__________________________________________________________________________________________
-void AliMagWrapCheb::GetTPCIntCyl(const Double_t *rphiz, Double_t *b) const
+void AliMagWrapCheb::GetTPCIntCyl(const Double_t *rphiz, Double_t *b, Cache_t& cache) const
 {
   // compute field integral in TPC region in Cylindircal coordinates
   // note: the check for the point being inside the parameterized region is done outside
   //
+  CheckCache(cache);
 #ifdef _MAGCHEB_CACHE_
   //  
-  if (fCacheTPCInt && fCacheTPCInt->IsInside(rphiz)) {
-    fCacheTPCInt->Eval(rphiz,b);
+  if (cache.fTPCInt && cache.fTPCInt->IsInside(rphiz)) {
+    cache.fTPCInt->Eval(rphiz,b);
     return;
   }
-#else //_MAGCHEB_CACHE_
-  AliCheb3D* fCacheTPCInt = 0; 
 #endif //_MAGCHEB_CACHE_
   //
   int id = FindTPCSegment(rphiz);
@@ -649,9 +647,9 @@ void AliMagWrapCheb::GetTPCIntCyl(const Double_t *rphiz, Double_t *b) const
     //      b[0] = b[1] = b[2] = 0;
     //      return;
     //    }
-    fCacheTPCInt = GetParamTPCInt(id);
-    if (fCacheTPCInt->IsInside(rphiz)) {
-      fCacheTPCInt->Eval(rphiz,b); 
+    AliCheb3D* par = cache.fTPCInt = GetParamTPCInt(id);
+    if (par->IsInside(rphiz)) {
+      par->Eval(rphiz,b); 
       return;
     }
   }
@@ -661,18 +659,17 @@ void AliMagWrapCheb::GetTPCIntCyl(const Double_t *rphiz, Double_t *b) const
 }
 
 //__________________________________________________________________________________________
-void AliMagWrapCheb::GetTPCRatIntCyl(const Double_t *rphiz, Double_t *b) const
+void AliMagWrapCheb::GetTPCRatIntCyl(const Double_t *rphiz, Double_t *b, Cache_t& cache) const
 {
   // compute field integral in TPCRat region in Cylindircal coordinates
   // note: the check for the point being inside the parameterized region is done outside
   //
+  CheckCache(cache);
 #ifdef _MAGCHEB_CACHE_
-  if (fCacheTPCRat && fCacheTPCRat->IsInside(rphiz)) {
-    fCacheTPCRat->Eval(rphiz,b);
+  if (cache.fTPCRat && cache.fTPCRat->IsInside(rphiz)) {
+    cache.fTPCRat->Eval(rphiz,b);
     return;
   }
-#else 
-  AliCheb3D* fCacheTPCRat = 0;
 #endif //_MAGCHEB_CACHE_
   //
   int id = FindTPCRatSegment(rphiz);
@@ -682,9 +679,9 @@ void AliMagWrapCheb::GetTPCRatIntCyl(const Double_t *rphiz, Double_t *b) const
     //      b[0] = b[1] = b[2] = 0;
     //      return;
     //    }
-    fCacheTPCRat = GetParamTPCRatInt(id);
-    if (fCacheTPCRat->IsInside(rphiz)) {
-      fCacheTPCRat->Eval(rphiz,b); 
+    AliCheb3D* par = cache.fTPCRat = GetParamTPCRatInt(id);
+    if (par->IsInside(rphiz)) {
+      par->Eval(rphiz,b); 
       return;
     }
   }
@@ -863,9 +860,7 @@ AliMagWrapCheb::AliMagWrapCheb(const char* inputFile) :
   fNParamsDip(0),fNZSegDip(0),fNYSegDip(0),fNXSegDip(0),
   fSegZDip(0),fSegYDip(0),fSegXDip(0),
   fBegSegYDip(0),fNSegYDip(0),fBegSegXDip(0),fNSegXDip(0),fSegIDDip(0),fMinZDip(1.e6),fMaxZDip(-1.e6),fParamsDip(0)
-#ifdef _MAGCHEB_CACHE_
-  ,fCacheSol(0),fCacheDip(0),fCacheTPCInt(0),fCacheTPCRat(0)
-#endif
+  ,fCacheID(NewCacheID())
 //
 {
   // construct from coeffs from the text file
@@ -940,6 +935,7 @@ void AliMagWrapCheb::ResetDip()
   fNParamsDip = fNZSegDip = fNXSegDip = fNYSegDip = 0;
   fMinZDip = 1e6;
   fMaxZDip = -1e6;
+  fCacheID = NewCacheID();
   //
 }
 
@@ -962,6 +958,7 @@ void AliMagWrapCheb::ResetSol()
   fMinZSol = 1e6;
   fMaxZSol = -1e6;
   fMaxRSol = 0;
+  fCacheID = NewCacheID();
   //
 }
 
@@ -984,6 +981,7 @@ void AliMagWrapCheb::ResetTPCInt()
   fMinZTPC = 1e6;
   fMaxZTPC = -1e6;
   fMaxRTPC = 0;
+  fCacheID = NewCacheID();
   //
 }
 
@@ -1006,6 +1004,7 @@ void AliMagWrapCheb::ResetTPCRatInt()
   fMinZTPCRat = 1e6;
   fMaxZTPCRat = -1e6;
   fMaxRTPCRat = 0;
+  fCacheID = NewCacheID();
   //
 }
 
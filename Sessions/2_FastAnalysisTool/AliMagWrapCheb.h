@@ -32,6 +32,11 @@
 //                                                                               //
 //  The units are kiloGauss and cm.                                              //
 //                                                                               //
+//  The evaluation is thread safe: the last used parameterization patches are    //
+//  kept in a per-thread cache (Cache_t), so one loaded map can be shared by     //
+//  all threads. A caller may also keep its own cache and pass it, e.g.          //
+//    Field(double* xyz, double* bxyz, AliMagWrapCheb::Cache_t& cache);          //
+//                                                                               //
 ///////////////////////////////////////////////////////////////////////////////////
 
 #ifndef ALIMAGWRAPCHEB_H
@@ -44,7 +49,7 @@
 #include "AliCheb3D.h"
 
 #ifndef _MAGCHEB_CACHE_
-#define _MAGCHEB_CACHE_  // use to spead up, but then Field calls are not thread safe
+#define _MAGCHEB_CACHE_  // use to speed up, the last used patches are cached per thread
 #endif
 
 #ifndef _USE_FAST_ATAN2_
@@ -58,6 +63,16 @@ class TArrayI;
 class AliMagWrapCheb: public TNamed
 {
  public:
+  // last used parameterization patches, valid only for the map state with the id fID
+  struct Cache_t {
+    Cache_t() : fID(0),fSol(0),fDip(0),fTPCInt(0),fTPCRat(0) {}
+    UInt_t     fID;        // id of the map state the patches belong to (0: none)
+    AliCheb3D* fSol;       // last used solenoid patch
+    AliCheb3D* fDip;       // last used dipole patch
+    AliCheb3D* fTPCInt;    // last used patch for TPC integral
+    AliCheb3D* fTPCRat;    // last used patch for TPC normalized integral
+  };
+  //
   AliMagWrapCheb();
   AliMagWrapCheb(const AliMagWrapCheb& src);
   ~AliMagWrapCheb() {Clear();}
@@ -108,14 +123,24 @@ class AliMagWrapCheb: public TNamed
 
   virtual void Print(Option_t * = "")                     const;
   //
-  virtual void Field(const Double_t *xyz, Double_t *b)    const;
-  Double_t     GetBz(const Double_t *xyz)                 const;
-  //
-  void FieldCyl(const Double_t *rphiz, Double_t  *b)      const;  
-  void GetTPCInt(const Double_t *xyz, Double_t *b)        const;
-  void GetTPCIntCyl(const Double_t *rphiz, Double_t *b)   const;
-  void GetTPCRatInt(const Double_t *xyz, Double_t *b)     const;
-  void GetTPCRatIntCyl(const Double_t *rphiz, Double_t *b) const;
+  virtual void Field(const Double_t *xyz, Double_t *b)    const {Field(xyz,b,GetThreadCache());}
+  Double_t     GetBz(const Double_t *xyz)                 const {return GetBz(xyz,GetThreadCache());}
+  //
+  void FieldCyl(const Double_t *rphiz, Double_t  *b)      const {FieldCyl(rphiz,b,GetThreadCache());}
+  void GetTPCInt(const Double_t *xyz, Double_t *b)        const {GetTPCInt(xyz,b,GetThreadCache());}
+  void GetTPCIntCyl(const Double_t *rphiz, Double_t *b)   const {GetTPCIntCyl(rphiz,b,GetThreadCache());}
+  void GetTPCRatInt(const Double_t *xyz, Double_t *b)     const {GetTPCRatInt(xyz,b,GetThreadCache());}
+  void GetTPCRatIntCyl(const Double_t *rphiz, Double_t *b) const {GetTPCRatIntCyl(rphiz,b,GetThreadCache());}
+  //
+  // same with the patches cache of the caller
+  void     Field(const Double_t *xyz, Double_t *b, Cache_t& cache)             const;
+  Double_t GetBz(const Double_t *xyz, Cache_t& cache)                          const;
+  void     FieldCyl(const Double_t *rphiz, Double_t  *b, Cache_t& cache)       const;
+  void     GetTPCInt(const Double_t *xyz, Double_t *b, Cache_t& cache)         const;
+  void     GetTPCIntCyl(const Double_t *rphiz, Double_t *b, Cache_t& cache)    const;
+  void     GetTPCRatInt(const Double_t *xyz, Double_t *b, Cache_t& cache)      const;
+  void     GetTPCRatIntCyl(const Double_t *rphiz, Double_t *b, Cache_t& cache) const;
+  Cache_t& GetThreadCache()                                                    const;
   //
   Int_t       FindSolSegment(const Double_t *xyz)         const; 
   Int_t       FindTPCSegment(const Double_t *xyz)         const; 
@@ -158,8 +183,10 @@ class AliMagWrapCheb: public TNamed
   static double useATan2(double y, double x);
   
  protected:
-  void     FieldCylSol(const Double_t *rphiz, Double_t *b)    const;
-  Double_t FieldCylSolBz(const Double_t *rphiz)               const;
+  void     FieldCylSol(const Double_t *rphiz, Double_t *b, Cache_t& cache) const;
+  Double_t FieldCylSolBz(const Double_t *rphiz, Cache_t& cache)            const;
+  void     CheckCache(Cache_t& cache) const {if (cache.fID!=fCacheID) {cache = Cache_t(); cache.fID = fCacheID;}}
+  static UInt_t NewCacheID();
   static double fastATan2(float y, float x);
   static double fastATan2px(float y, float x);
   static double fastATan(float x);
@@ -233,12 +260,7 @@ class AliMagWrapCheb: public TNamed
   Float_t    fMaxZDip;               // Max Z of Dipole parameterization
   TObjArray* fParamsDip;             // Parameterization pieces for Dipole field
   //
-#ifdef _MAGCHEB_CACHE_
-  mutable AliCheb3D* fCacheSol;              //! last used solenoid patch
-  mutable AliCheb3D* fCacheDip;              //! last used dipole patch
-  mutable AliCheb3D* fCacheTPCInt;           //! last used patch for TPC integral
-  mutable AliCheb3D* fCacheTPCRat;           //! last used patch for TPC normalized integral
-#endif 
+  UInt_t     fCacheID;               //! id of the map state in the patches caches, renewed when the parameterizations change
   //
   ClassDef(AliMagWrapCheb,8)         // Wrapper class for the set of Chebishev parameterizations of Alice mag.field
   //
@@ -246,12 +268,13 @@ class AliMagWrapCheb: public TNamed
 
 
 //__________________________________________________________________________________________
-inline void AliMagWrapCheb::FieldCyl(const Double_t *rphiz, Double_t *b) const
+inline void AliMagWrapCheb::FieldCyl(const Double_t *rphiz, Double_t *b, Cache_t& cache) const
 {
   // compute field in Cylindircal coordinates
   //  if (rphiz[2]<GetMinZSol() || rphiz[2]>GetMaxZSol() || rphiz[0]>GetMaxRSol()) {for (int i=3;i--;) b[i]=0; return;}
   b[0] = b[1] = b[2] = 0;
-  FieldCylSol(rphiz,b);
+  CheckCache(cache);
+  FieldCylSol(rphiz,b,cache);
 }
 
 //__________________________________________________________________________________________________
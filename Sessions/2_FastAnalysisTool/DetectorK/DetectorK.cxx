@@ -11,6 +11,12 @@
 #include <TGraphErrors.h>
 
 #include "AliExternalTrackParam.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 /***********************************************************
 
@@ -25,9 +31,183 @@ Changes by S. Rossegger -> see header file
 ***********************************************************/
 Bool_t DetectorK::verboseR = 0;
 
+Int_t TraceK::fgLevel = TraceK::kWarning;
+Bool_t TraceK::fgSinkOpen = kFALSE;
+
+namespace
+{
+FILE* gTraceKSink = 0;
+std::mutex gTraceKSinkMutex;
+} // namespace
+
+Bool_t TraceK::OpenSink(const char* filename)
+{
+  // opens the binary sink of the track records, closing the current one
+  CloseSink();
+  std::lock_guard<std::mutex> lock(gTraceKSinkMutex);
+  gTraceKSink = fopen(filename, "wb");
+  if (!gTraceKSink) {
+    printf("TraceK: cannot open %s\n", filename);
+    return kFALSE;
+  }
+  TraceKSinkHeader_t header;
+  header.recordSize = sizeof(TraceKTrack_t);
+  fwrite(&header, sizeof(header), 1, gTraceKSink);
+  fgSinkOpen = kTRUE;
+  return kTRUE;
+}
+
+void TraceK::CloseSink()
+{
+  std::lock_guard<std::mutex> lock(gTraceKSinkMutex);
+  fgSinkOpen = kFALSE;
+  if (gTraceKSink)
+    fclose(gTraceKSink);
+  gTraceKSink = 0;
+}
+
+void TraceK::Write(const TraceKTrack_t& record)
+{
+  std::lock_guard<std::mutex> lock(gTraceKSinkMutex);
+  if (gTraceKSink)
+    fwrite(&record, sizeof(record), 1, gTraceKSink);
+}
+
+namespace
+{
+// track record of SolveTrack, written to the sink when the track is done
+struct TraceKGuard {
+  TraceKTrack_t record;
+  Bool_t active;
+  TraceKGuard(const TrackSol& ts) : active(TraceK::IsSinkOpen())
+  {
+    if (!active)
+      return;
+    record.pt = ts.fPt;
+    record.eta = ts.fEta;
+    record.mass = ts.fMass;
+    record.charge = ts.fCharge;
+  }
+  ~TraceKGuard()
+  {
+    if (active)
+      TraceK::Write(record);
+  }
+  Bool_t Fail(Int_t failure, Int_t layer = -1)
+  {
+    record.failure = failure;
+    record.failureLayer = layer;
+    return kFALSE;
+  }
+};
+
+// AliExternalTrackParam::Rotate, accumulating its covariance transport in jac
+Bool_t RotateK(AliExternalTrackParam* trc, Double_t alpha, TransportJacobianK* jac)
+{
+  if (!jac)
+    return trc->Rotate(alpha);
+  Double_t da = alpha - trc->GetAlpha();
+  Double_t sf = trc->GetSnp(), cf = TMath::Sqrt((1. - sf) * (1. + sf));
+  if (!trc->Rotate(alpha))
+    return kFALSE;
+  if (cf < kAlmost0) {
+    jac->valid = kFALSE;
+    return kTRUE;
+  }
+  Double_t ca = TMath::Cos(da), sa = TMath::Sin(da);
+  jac->Rotate(ca, ca + sf / cf * sa);
+  return kTRUE;
+}
+
+// AliExternalTrackParam::CorrectForMeanMaterial with the Bethe-Bloch and multiple
+// scattering functions of MaterialTableK: the class method while they are exact, the
+// TrackParK one on the same data once they are tabulated
+Bool_t CorrectForMeanMaterialK(AliExternalTrackParam& trc, Double_t xOverX0, Double_t xTimesRho, Double_t mass)
+{
+  if (!MaterialTableK::IsTabulated())
+    return trc.CorrectForMeanMaterial(xOverX0, xTimesRho, mass, kTRUE, MaterialTableK::BetheBlochSolid);
+  return CorrectForMeanMaterial(AsTrackParK(trc), xOverX0, xTimesRho, mass, kTRUE, MaterialTableK::BetheBlochSolid);
+}
+
+// the probe was recorded for a track of these kinematics on this transport geometry
+Bool_t SameProbeK(const TrackProbeK& probe, const LayerGeometryK& geo, Double_t pt, Double_t eta, Double_t mass, Int_t charge,
+                  Double_t bField, Double_t maxSnp, Double_t minRad)
+{
+  return probe.valid && probe.pt == pt && probe.eta == eta && probe.mass == mass && probe.charge == charge &&
+         probe.bField == bField && probe.maxSnp == maxSnp && probe.minRad == minRad && probe.tabulated == MaterialTableK::IsTabulated() &&
+         probe.geo.radius == geo.radius && probe.geo.radL == geo.radL && probe.geo.xrho == geo.xrho && probe.geo.flags == geo.flags;
+}
+
+void SetProbeK(TrackProbeK& probe, const LayerGeometryK& geo, Double_t pt, Double_t eta, Double_t mass, Int_t charge,
+               Double_t bField, Double_t maxSnp, Double_t minRad)
+{
+  probe.valid = kTRUE;
+  probe.pt = pt;
+  probe.eta = eta;
+  probe.mass = mass;
+  probe.charge = charge;
+  probe.bField = bField;
+  probe.maxSnp = maxSnp;
+  probe.minRad = minRad;
+  probe.tabulated = MaterialTableK::IsTabulated();
+  probe.geo.radius = geo.radius;
+  probe.geo.radL = geo.radL;
+  probe.geo.xrho = geo.xrho;
+  probe.geo.flags = geo.flags;
+}
+} // namespace
+
+//____________________________________
+void TransportJacobianK::Reset()
+{
+  valid = kTRUE;
+  for (int i = 0; i < 5; i++)
+    for (int j = 0; j < 5; j++)
+      jac[i][j] = i == j;
+}
+
+void TransportJacobianK::Multiply(const Double_t m[5][5])
+{
+  Double_t res[5][5];
+  for (int i = 0; i < 5; i++)
+    for (int j = 0; j < 5; j++) {
+      res[i][j] = 0;
+      for (int k = 0; k < 5; k++)
+        res[i][j] += m[i][k] * jac[k][j];
+    }
+  memcpy(jac, res, sizeof(res));
+}
+
+void TransportJacobianK::Rotate(Double_t ca, Double_t rr)
+{
+  for (int j = 0; j < 5; j++) {
+    jac[0][j] *= ca;
+    jac[2][j] *= rr;
+  }
+}
+
+void TransportJacobianK::Apply(Double_t* cov) const
+{
+  Double_t cmat[5][5], jc[5][5];
+  for (int i = 0, k = 0; i < 5; i++)
+    for (int j = 0; j <= i; j++, k++)
+      cmat[i][j] = cmat[j][i] = cov[k];
+  for (int i = 0; i < 5; i++)
+    for (int j = 0; j < 5; j++) {
+      jc[i][j] = 0;
+      for (int m = 0; m < 5; m++)
+        jc[i][j] += jac[i][m] * cmat[m][j];
+    }
+  for (int i = 0, k = 0; i < 5; i++)
+    for (int j = 0; j <= i; j++, k++) {
+      cov[k] = 0;
+      for (int m = 0; m < 5; m++)
+        cov[k] += jc[i][m] * jac[j][m];
+    }
+}
+
 #define RIDICULOUS 999999 // A ridiculously large resolution (cm) to flag a dead detector
 
-#define xrhosteps 100    // steps for dEdx correction
 #define Luminosity 1.e27 // Luminosity of the beam (LHC HI == 1.e27, RHIC II == 8.e27 )
 #define SigmaD 6.0       // Size of the interaction diamond (cm) (LHC = 6.0 cm)
 #define dNdEtaMinB 1     // 950//660//950           // Multiplicity per unit Eta  (AuAu MinBias = 170, Central = 700)
@@ -44,6 +224,14 @@ Bool_t DetectorK::verboseR = 0;
 #define KaonMass 0.498 // Mass of the Kaon
 #define D0Mass 1.865   // Mass of the D0
 
+// Sets the usage of the log term in the multiple scattering of AliExternalTrackParam
+// (a thread-local flag) for the lifetime of the guard, and restores the previous one
+struct LogTermMSGuard {
+  LogTermMSGuard(Bool_t v) : fPrevious(AliExternalTrackParam::GetUseLogTermMS()) { AliExternalTrackParam::SetUseLogTermMS(v); }
+  ~LogTermMSGuard() { AliExternalTrackParam::SetUseLogTermMS(fPrevious); }
+  Bool_t fPrevious;
+};
+
 ClassImp(TrackSol)
 
   const double DetectorK::kPtMinFix = 0.050;
@@ -134,6 +322,44 @@ DetectorK::DetectorK(const char* name, const char* title)
   //  fLayers = new TObjArray();
   SetMaxSnp();
 }
+
+DetectorK::DetectorK(const DetectorK& src)
+  : TNamed(src),
+    fNumberOfLayers(src.fNumberOfLayers),
+    fNumberOfActiveLayers(src.fNumberOfActiveLayers),
+    fNumberOfActiveITSLayers(src.fNumberOfActiveITSLayers),
+    fBField(src.fBField),
+    fLhcUPCscale(src.fLhcUPCscale),
+    fIntegrationTime(src.fIntegrationTime),
+    fConfLevel(src.fConfLevel),
+    fAvgRapidity(src.fAvgRapidity),
+    fParticleMass(src.fParticleMass),
+    fMaxSnp(src.fMaxSnp),
+    fMaxRadiusSlowDet(src.fMaxRadiusSlowDet),
+    fAtLeastHits(src.fAtLeastHits),
+    fAtLeastCorr(src.fAtLeastCorr),
+    fAtLeastFake(src.fAtLeastFake),
+    fMaxSeedRadius(src.fMaxSeedRadius),
+    fptScale(src.fptScale),
+    fdNdEtaCent(src.fdNdEtaCent),
+    kDetLayer(src.kDetLayer),
+    fMinRadTrack(src.fMinRadTrack),
+    fSlowDensityRadius(src.fSlowDensityRadius),
+    fSlowDensity(src.fSlowDensity),
+    fGeometry(src.fGeometry),
+    fScan(src.fScan)
+{
+  //
+  // copy constructor: the layers are cloned and owned by the copy, so that
+  // the copy can be used independently of the original (e.g. one per thread)
+  //
+  fLayers.SetOwner(kTRUE);
+  for (Int_t i = 0; i < src.fLayers.GetEntries(); i++)
+    fLayers.Add(new CylLayerK(*(CylLayerK*)src.fLayers.At(i)));
+  //
+  memcpy(fGoodHitProb, src.fGoodHitProb, sizeof(fGoodHitProb));
+}
+
 DetectorK::~DetectorK()
 { //
   // virtual destructor
@@ -187,6 +413,9 @@ void DetectorK::AddLayer(const char* name, Float_t radius, Float_t radL, Float_t
         fNumberOfActiveITSLayers += 1;
     }
 
+    UpdateHitDensityCache();
+    CompileGeometry();
+
   } else {
     printf("Layer with the name %s does already exist\n", name);
   }
@@ -211,6 +440,7 @@ void DetectorK::KillLayer(const char* name)
       if (IsITSLayer(lname))
         fNumberOfActiveITSLayers -= 1;
     }
+    CompileGeometry();
   }
 }
 
@@ -230,9 +460,10 @@ void DetectorK::SetRadius(const char* name, Float_t radius)
     Float_t tmpXRho = tmp->xrho;
     Float_t tmpPhiRes = tmp->phiRes;
     Float_t tmpZRes = tmp->zRes;
+    Float_t tmpEff = tmp->eff;
 
     RemoveLayer(name); // so that the ordering is correct
-    AddLayer(name, radius, tmpRadL, tmpXRho, tmpPhiRes, tmpZRes);
+    AddLayer(name, radius, tmpRadL, tmpXRho, tmpPhiRes, tmpZRes, tmpEff);
   }
 }
 
@@ -262,6 +493,7 @@ void DetectorK::SetRadiationLength(const char* name, Float_t radL)
     printf("Layer %s not found - cannot set layer material\n", name);
   else {
     tmp->radL = radL;
+    CompileGeometry();
   }
 }
 
@@ -312,6 +544,7 @@ void DetectorK::SetResolution(const char* name, Float_t phiRes, Float_t zRes)
           fNumberOfActiveITSLayers += 1;
       }
     }
+    CompileGeometry();
   }
 }
 
@@ -347,6 +580,7 @@ void DetectorK::SetLayerEfficiency(const char* name, Float_t eff)
     printf("Layer %s not found - cannot set layer efficiency\n", name);
   else {
     tmp->eff = eff;
+    CompileGeometry();
   }
 }
 
@@ -384,6 +618,8 @@ void DetectorK::RemoveLayer(const char* name)
       if (IsITSLayer(lname))
         fNumberOfActiveITSLayers -= 1;
     }
+    UpdateHitDensityCache();
+    CompileGeometry();
   }
 }
 
@@ -631,7 +867,7 @@ Double_t DetectorK::ThetaMCS(Double_t mass, Double_t radLength, Double_t momentu
   return (theta);
 }
 
-Double_t DetectorK::ProbGoodHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ)
+Double_t DetectorK::ProbGoodHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const
 {
   // Based on work by Howard Wieman: http://rnc.lbl.gov/~wieman/GhostTracks.htm
   // and http://rnc.lbl.gov/~wieman/HitFinding2D.htm
@@ -643,17 +879,22 @@ Double_t DetectorK::ProbGoodHit(Double_t radius, Double_t searchRadiusRPhi, Doub
   return (goodHit);
 }
 
-Double_t DetectorK::ProbGoodChiSqHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ)
+Double_t DetectorK::ProbGoodChiSqHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const
+{
+  return ProbGoodChiSqHit(radius, searchRadiusRPhi, searchRadiusZ, fdNdEtaCent);
+}
+
+Double_t DetectorK::ProbGoodChiSqHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ, Int_t dNdEtaCent) const
 {
   // Based on work by Victor Perevoztchikov and Howard Wieman: http://rnc.lbl.gov/~wieman/HitFinding2DXsq.htm
   // This is the probability of getting a good hit using a Chi**2 search on a 2D Gaussian distribution function
   Double_t sx, goodHit;
-  sx = 2 * TMath::Pi() * searchRadiusRPhi * searchRadiusZ * HitDensity(radius);
+  sx = 2 * TMath::Pi() * searchRadiusRPhi * searchRadiusZ * HitDensity(radius, dNdEtaCent);
   goodHit = 1. / (1 + sx);
   return (goodHit);
 }
 
-Double_t DetectorK::ProbGoodChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ)
+Double_t DetectorK::ProbGoodChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const
 {
   // Based on work by Ruben Shahoyen
   // This is the probability of getting a good hit using a Chi**2 search on a 2D Gaussian distribution function
@@ -666,7 +907,7 @@ Double_t DetectorK::ProbGoodChiSqPlusConfHit(Double_t radius, Double_t leff, Dou
   return (goodHit);
 }
 
-Double_t DetectorK::ProbNullChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ)
+Double_t DetectorK::ProbNullChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const
 {
   // Based on work by Ruben Shahoyen
   // This is the probability to not have any match to the track (see also :ProbGoodChiSqPlusConfHit:)
@@ -677,7 +918,12 @@ Double_t DetectorK::ProbNullChiSqPlusConfHit(Double_t radius, Double_t leff, Dou
   return (nullHit);
 }
 
-Double_t DetectorK::HitDensity(Double_t radius)
+Double_t DetectorK::HitDensity(Double_t radius) const
+{
+  return HitDensity(radius, fdNdEtaCent);
+}
+
+Double_t DetectorK::HitDensity(Double_t radius, Int_t dNdEtaCent) const
 {
   // Background (0-1) is included via 'OtherBackground' which multiplies the minBias rate by a scale factor.
   // UPC electrons is a temporary kludge that is based on Kai Schweda's summary of Kai Hainken's MC results
@@ -690,19 +936,107 @@ Double_t DetectorK::HitDensity(Double_t radius)
   Double_t arealDensity = 0;
 
   if (radius > fMaxRadiusSlowDet) {
-    arealDensity = OneEventHitDensity(fdNdEtaCent, radius);                   // Fast detectors see central collision density (only)
+    arealDensity = OneEventHitDensity(dNdEtaCent, radius);                    // Fast detectors see central collision density (only)
     arealDensity += OtherBackground * OneEventHitDensity(dNdEtaMinB, radius); // Increase density due to background
   }
 
   if (radius < fMaxRadiusSlowDet) { // Note that IntegratedHitDensity will always be minB one event, or more, even if integration time => zero.
-    arealDensity = OneEventHitDensity(fdNdEtaCent, radius) + IntegratedHitDensity(dNdEtaMinB, radius) + UpcHitDensity(radius);
-    arealDensity += OtherBackground * IntegratedHitDensity(dNdEtaMinB, radius);
-    // Increase density due to background
+    arealDensity = OneEventHitDensity(dNdEtaCent, radius) + SlowHitDensity(radius);
   }
 
   return (arealDensity);
 }
 
+Double_t DetectorK::SlowHitDensity(Double_t radius) const
+{
+  // Part of the hit density of the slow detectors that does not depend on the multiplicity:
+  // the minBias pile-up, integrated over the vertex distribution by Dist, the UPC electrons
+  // and the background. It is cached at the radii of the layers (UpdateHitDensityCache)
+  // and only computed for other radii
+
+  UInt_t i = std::lower_bound(fSlowDensityRadius.begin(), fSlowDensityRadius.end(), radius) - fSlowDensityRadius.begin();
+  if (i < fSlowDensityRadius.size() && fSlowDensityRadius[i] == radius)
+    return fSlowDensity[i];
+
+  Double_t arealDensity = IntegratedHitDensity(dNdEtaMinB, radius) + UpcHitDensity(radius);
+  arealDensity += OtherBackground * IntegratedHitDensity(dNdEtaMinB, radius); // Increase density due to background
+  return arealDensity;
+}
+
+void DetectorK::UpdateHitDensityCache()
+{
+  // Caches SlowHitDensity at the radii the hit densities are evaluated at: the layer
+  // radii in cm and, as the solvers pass them, 100 times these. Called by the setters
+  // of the layers and of the parameters the density depends on; the multiplicity
+  // dependent part is cheap and always computed
+
+  std::vector<Double_t> radii;
+  for (Int_t i = 0; i < fLayers.GetEntries(); i++) {
+    Double_t radius = ((CylLayerK*)fLayers.At(i))->radius;
+    for (Double_t r : {radius, radius * 100.})
+      if (r > 0 && r < fMaxRadiusSlowDet)
+        radii.push_back(r);
+  }
+  std::sort(radii.begin(), radii.end());
+  radii.erase(std::unique(radii.begin(), radii.end()), radii.end());
+
+  fSlowDensityRadius.clear();
+  fSlowDensity.clear();
+  for (Double_t r : radii) {
+    Double_t density = SlowHitDensity(r);
+    fSlowDensityRadius.push_back(r);
+    fSlowDensity.push_back(density);
+  }
+}
+
+void DetectorK::CompileGeometry()
+{
+  // Freezes the layers into fGeometry, for the track loops. Called by the setters
+  // of the layers; to be called after modifying a layer obtained from FindLayer
+
+  CompileGeometry(fGeometry);
+}
+
+const LayerGeometryK& DetectorK::GetGeometry(LayerGeometryK& geoNow) const
+{
+  // The compiled layers, or the ones compiled into geoNow if they are out of date,
+  // e.g. after streaming
+
+  if (fGeometry.GetEntries() == fLayers.GetEntries())
+    return fGeometry;
+  CompileGeometry(geoNow);
+  return geoNow;
+}
+
+void DetectorK::CompileGeometry(LayerGeometryK& geo) const
+{
+  // Fills geo with the current layers
+
+  Int_t n = fLayers.GetEntries();
+  for (auto* v : {&geo.radius, &geo.radL, &geo.xrho, &geo.phiRes, &geo.zRes, &geo.eff})
+    v->resize(n);
+  geo.flags.resize(n);
+  for (Int_t i = 0; i < n; i++) {
+    CylLayerK* l = (CylLayerK*)fLayers.At(i);
+    TString name(l->GetName());
+    geo.radius[i] = l->radius;
+    geo.radL[i] = l->radL;
+    geo.xrho[i] = l->xrho;
+    geo.phiRes[i] = l->phiRes;
+    geo.zRes[i] = l->zRes;
+    geo.eff[i] = l->eff;
+    geo.flags[i] = 0;
+    if (name.Contains("vertex"))
+      geo.flags[i] |= LayerGeometryK::kVertex;
+    if (name.Contains("tof"))
+      geo.flags[i] |= LayerGeometryK::kTOF;
+    if (l->isDead)
+      geo.flags[i] |= LayerGeometryK::kDead;
+    if (IsITSLayer(name))
+      geo.flags[i] |= LayerGeometryK::kITS;
+  }
+}
+
 double DetectorK::OneEventHitDensity(Double_t multiplicity, Double_t radius) const
 {
   // This is for one event at the vertex.  No smearing.
@@ -718,7 +1052,7 @@ double DetectorK::OneEventHitDensity(Double_t multiplicity, Double_t radius) con
   return den;
 }
 
-double DetectorK::IntegratedHitDensity(Double_t multiplicity, Double_t radius)
+double DetectorK::IntegratedHitDensity(Double_t multiplicity, Double_t radius) const
 {
   // The integral of minBias events smeared over a gaussian vertex distribution.
   // Based on work by Yan Lu 12/20/2006, all radii in centimeters.
@@ -733,7 +1067,7 @@ double DetectorK::IntegratedHitDensity(Double_t multiplicity, Double_t radius)
   return den;
 }
 
-double DetectorK::UpcHitDensity(Double_t radius)
+double DetectorK::UpcHitDensity(Double_t radius) const
 {
   // QED electrons ...
 
@@ -749,7 +1083,7 @@ double DetectorK::UpcHitDensity(Double_t radius)
   return mUPCelectrons;
 }
 
-double DetectorK::Dist(double z, double r)
+double DetectorK::Dist(double z, double r) const
 {
   // Convolute dEta/dZ  distribution with assumed Gaussian of vertex z distribution
   // Based on work by Howard Wieman http://rnc.lbl.gov/~wieman/HitDensityMeasuredLuminosity7.htm
@@ -777,65 +1111,34 @@ double DetectorK::Dist(double z, double r)
 #define EPiZero 0.872 // Energy of the pion from a D0 decay at rest
 #define EKZero 0.993  // Energy of the Kaon from a D0 decay at rest
 
-void DetectorK::SolveViaBilloir(Double_t selPt, double ptmin)
+void BilloirScanK::Reset(Int_t nl, Int_t detLayerScan)
+{
+  // sizes the results for the points of the scan, none solved yet
+  const Int_t n = GetEntries();
+  nLayers = nl;
+  detLayer = detLayerScan;
+  status.assign(n, TraceK::kNotInitialised);
+  momentumRes.assign(n, 0.);
+  resolutionRPhi.assign(n, 0.);
+  resolutionZ.assign(n, 0.);
+  efficiency.assign(n, 0.);
+  fake.assign(n, 0.);
+  efficProlongLay.assign(n, 0.);
+  detPointRes.assign(n * nl, RIDICULOUS);
+  detPointZRes.assign(n * nl, RIDICULOUS);
+}
+
+void DetectorK::SolveViaBilloir(Double_t selPt, double ptmin, Int_t nThreads)
 {
   //
   // Solves the current geometry with the Billoir technique
   // ( see P. Billoir, Nucl. Instr. and Meth. 225 (1984), p. 352. )
   // ABOVE IS OBSOLETE -> NOW, its uses the Aliroot Kalman technique
   //
-  Int_t print = 1;
-  const float kTrackingMargin = 0.1;
-
-  static AliExternalTrackParam probTr; // track to propagate
-  probTr.SetUseLogTermMS(kFALSE);
-
-  Int_t nPt = kNptBins;
-  // Clean up ......
-  for (Int_t j = 0; j < nPt; j++) {
-    for (Int_t i = 0; i < kMaxNumberOfDetectors; i++) {
-      fDetPointRes[i][j] = RIDICULOUS;
-      fDetPointZRes[i][j] = RIDICULOUS;
-    }
-    fTransMomenta[j] = 0;
-    fMomentumRes[j] = 0;
-    fResolutionRPhi[j] = 0;
-  }
-
-  // Calculate track parameters using Billoirs method of matrices
-
-  Double_t pt, tgl, lambda, deltaPoverP;
-  Double_t charge = 1;
-  Int_t printOnce = 1;
-
-  Int_t mStart = 0;
-
-  if (TMath::Abs(charge) > 1.2)
-    fParticleMass = -TMath::Abs(fParticleMass);
-
-  // Prepare Probability Kombinations
-  Int_t nLayer = fNumberOfActiveITSLayers;
-  Int_t base = 3; // null, fake, correct
-
+  // Scan of kNptBins log spaced pt at the average rapidity, kept for the GetGraph* methods
+  //
   printf("N ITS Layers: %d\n", fNumberOfActiveITSLayers);
 
-  TMatrixD probLay(base, fNumberOfActiveITSLayers);
-  TObjArray probKombArr;
-  probKombArr.Expand(nLayer);
-  probKombArr.SetOwner(kTRUE);
-  for (int nl = 3; nl <= nLayer; nl++) {
-    Int_t komb = (Int_t)TMath::Power(base, nl);
-    TMatrixD* probKombP = new TMatrixD(komb, nl);
-    TMatrixD& probKomb = *probKombP;
-    for (Int_t num = 0; num < komb; num++) {
-      for (Int_t l = nl; l--;) {
-        Int_t pow = ((Int_t)TMath::Power(base, l + 1));
-        probKomb(num, nl - 1 - l) = (num % pow) / ((Int_t)TMath::Power(base, l));
-      }
-    }
-    probKombArr[nl - 3] = probKombP;
-  }
-
   CylLayerK* last = (CylLayerK*)fLayers.At((fLayers.GetEntries() - 1));
   if (last->radius > fMinRadTrack) {
     last = 0;
@@ -856,17 +1159,102 @@ void DetectorK::SolveViaBilloir(Double_t selPt, double ptmin)
     if (ptmin < kPtMinFix)
       ptmin = kPtMinFix;
   }
+  Int_t nPt = kNptBins;
   double ptmax = kPtMaxFix;
   double dlpt = log(ptmax / ptmin) / nPt;
-  const double SQRT2 = TMath::Sqrt(2.);
   printf("Will test %d tracks with %f < pt < %f\n", nPt, ptmin, ptmax);
 
+  fScan = BilloirScanK();
+  for (Int_t i = 0; i < nPt; i++) // Starting values based on radius of outermost layer ... log10 steps to ~20 GeV
+    fScan.AddPoint(ptmin * TMath::Exp(dlpt * i), fAvgRapidity);
+
+  // the layer tables are printed from the first pt above selPt, up to 0.25 GeV/c if the outward
+  // fit is done as well
+  Int_t printFirst = nPt, printLast = -1;
+  for (Int_t i = 0; i < nPt; i++) {
+    if (printFirst == nPt && fScan.pt[i] >= selPt)
+      printFirst = i;
+    if (printFirst < nPt && (fNumberOfActiveLayers >= 1500 || fScan.pt[i] > 0.25)) {
+      printLast = i;
+      break;
+    }
+  }
+  SolveViaBilloir(fScan, nThreads, printFirst, printLast);
+}
+
+Int_t DetectorK::SolveViaBilloir(BilloirScanK& scan, Int_t nThreads, Int_t printFirst, Int_t printLast) const
+{
+  //
+  // Solves the points of scan, each independently of the others: the detector is not
+  // modified and a point which fails gets its failure code in scan.status
+  //
+  LayerGeometryK geoNow;
+  const Int_t nLayers = GetGeometry(geoNow).GetEntries();
+  scan.Reset(nLayers, kDetLayer < nLayers ? kDetLayer : -1);
+  const Int_t n = scan.GetEntries();
+  LogTermMSGuard logTermMS(kFALSE);
+  //
+  for (Int_t i = TMath::Max(printFirst, 0); i <= printLast && i < n; i++)
+    SolveBilloirPoint(scan, i, kTRUE);
+  std::atomic<Int_t> next(0);
+  auto worker = [&]() {
+    for (Int_t i = next++; i < n; i = next++)
+      if (i < printFirst || i > printLast)
+        SolveBilloirPoint(scan, i, kFALSE);
+  };
+  if (nThreads <= 0)
+    nThreads = TMath::Max(1u, std::thread::hardware_concurrency());
+  if (nThreads == 1) {
+    worker();
+  } else {
+    std::vector<std::thread> threads;
+    for (Int_t it = 0; it < nThreads; it++)
+      threads.emplace_back(worker);
+    for (auto& thread : threads)
+      thread.join();
+  }
+  //
+  Int_t nSolved = 0;
+  for (Int_t i = 0; i < n; i++) {
+    if (scan.IsOK(i))
+      nSolved++;
+    else
+      scan.efficiency[i] = scan.fake[i] = 0;
+  }
+  return nSolved;
+}
+
+Int_t DetectorK::SolveBilloirPoint(BilloirScanK& scan, Int_t i, Bool_t print) const
+{
+  //
+  // Solves the point i of the scan and returns its status, printing the layer tables if requested
+  //
+  const float kTrackingMargin = 0.1;
+
+  AliExternalTrackParam probTr; // track to propagate
+
+  Int_t& status = scan.status[i];
+  Double_t* detPointRes = scan.GetDetPointRes(i);
+  Double_t* detPointZRes = scan.GetDetPointZRes(i);
+  const Int_t nLayers = scan.nLayers;
+  const Double_t mass = fParticleMass;
+
+  // Calculate track parameters using Billoirs method of matrices
+
+  Double_t pt, tgl, lambda, deltaPoverP;
+  Double_t charge = 1;
+
+  // Hit probabilities per layer
+  Int_t base = 3; // null, fake, correct
+
+  TMatrixD probLay(base, fNumberOfActiveITSLayers);
+
   // PseudoRapidity OK, used as an angle
-  lambda = TMath::Pi() / 2.0 - 2.0 * TMath::ATan(TMath::Exp(-1 * fAvgRapidity));
+  lambda = TMath::Pi() / 2.0 - 2.0 * TMath::ATan(TMath::Exp(-1 * scan.eta[i]));
 
   // find first "active layer" - start tracking at the first active layer
   Int_t firstActiveLayer = 0;
-  for (Int_t j = 0; j <= fLayers.GetEntries(); j++) {
+  for (Int_t j = 0; j < nLayers; j++) {
     CylLayerK* layer = (CylLayerK*)fLayers.At(j);
     if (!(layer->isDead)) { // is alive
       firstActiveLayer = j;
@@ -874,247 +1262,435 @@ void DetectorK::SolveViaBilloir(Double_t selPt, double ptmin)
     }
   }
 
-  for (Int_t i = 0; i < nPt; i++) { // pt loop
+  // Assume track started at (0,0,0) and shoots out on the X axis, and B field is on the Z axis
+  // These are the EndPoint values for y, z, a, b, and d
+  double bGauss = fBField * 10; // field in kgauss
+  pt = scan.pt[i];              // GeV/c
+  tgl = TMath::Tan(lambda);     // dip
+  charge = -1;                  // Assume an electron
+  enum { kY,
+         kZ,
+         kSnp,
+         kTgl,
+         kPtI }; // track parameter aliases
+  enum { kY2,
+         kYZ,
+         kZ2,
+         kYSnp,
+         kZSnp,
+         kSnp2,
+         kYTgl,
+         kZTgl,
+         kSnpTgl,
+         kTgl2,
+         kYPtI,
+         kZPtI,
+         kSnpPtI,
+         kTglPtI,
+         kPtI2 }; // cov.matrix aliases
+  //
+  probTr.Reset();
+  double* trPars = (double*)probTr.GetParameter();
+  double* trCov = (double*)probTr.GetCovariance();
+  trPars[kY] = 0;             // start from Y = 0
+  trPars[kZ] = 0;             //            Z = 0
+  trPars[kSnp] = 0;           //            track along X axis at the vertex
+  trPars[kTgl] = tgl;         //            dip
+  trPars[kPtI] = charge / pt; //            q/pt
+  //
+  // put tiny errors to propagate to the outer radius
+  trCov[kY2] = trCov[kZ2] = trCov[kSnp2] = trCov[kTgl2] = trCov[kPtI2] = 1e-9;
+  //
+  // find max layer this track can reach
+  double rmx = (TMath::Abs(fBField) > 1e-5) ? TMath::Abs(charge) * pt * 100. / (0.3 * TMath::Abs(fBField)) : 9999;
+  Int_t lastActiveLayer = -1;
+  CylLayerK* last = 0;
+  for (Int_t j = nLayers; j--;) {
+    CylLayerK* l = (CylLayerK*)fLayers.At(j);
+    //	printf("at lr %d r: %f vs %f, pt:%f\n",j,l->radius, 2*rmx-2.*kTrackingMargin, pt);
+    if (!(l->isDead) && (l->radius < 2 * rmx - 5.)) {
+      lastActiveLayer = j;
+      last = l;
+      break;
+    }
+  }
+  if (lastActiveLayer < 0) {
+    TRACEK(TraceK::kWarning, "No active layer with radius < %f is found, pt = %f\n", rmx, pt);
+    return status = TraceK::kNoLayer;
+  }
+  TRACEK(TraceK::kInfo, "PT=%f 2Rpt=%f Rlr=%f\n", pt, 2 * rmx, last->radius);
+  //
+  int lastReached = 0;
+  for (int il = 1; il <= lastActiveLayer; il++) {
+    AliExternalTrackParam probTrLast(probTr);
+    CylLayerK* lr = (CylLayerK*)fLayers.At(il);
+    if (!PropagateToR(&probTrLast, lr->radius, bGauss, 1))
+      break;
+    if (!CorrectForMeanMaterialK(probTrLast, lr->radL, 0, mass))
+      break;
+
+    if (lr->xrho > 0 && !CorrectForEnergyLoss(&probTrLast, -lr->xrho, mass))
+      break;
+
+    if (lr->radius > 1e-3 && !lr->isDead &&
+        (!probTrLast.Rotate(probTrLast.PhiPos()) || TMath::Abs(probTrLast.GetSnp()) > fMaxSnp)) {
+      break;
+    }
+    probTr = probTrLast;
+    lastReached = il;
+  }
+  //   if ( ((CylLayerK*)fLayers.At(lastReached))->radius < fMinRadTrack) continue;
+  if (!PropagateToR(&probTr, probTr.GetX() + kTrackingMargin, bGauss, 1))
+    return status = TraceK::kPropagation;
+  //    if (probTr.GetX()<fMinRadTrack) continue;
+  lastActiveLayer = lastReached;
+  if (lastActiveLayer < fNumberOfActiveITSLayers) {
+    return status = TraceK::kMinRadius;
+  }
+
+  //    if (!PropagateToR(&probTr,last->radius + kTrackingMargin,bGauss,1)) continue;
+  // if (!probTr.PropagateTo(last->radius,bGauss)) continue;
+  // reset cov.matrix
+  const double kLargeErr2Coord = 100 * 100;
+  const double kLargeErr2Dir = 1. * 1.;
+  const double kLargeErr2PtI = 30. * 30.;
+  ///*
+  for (int ic = 15; ic--;)
+    trCov[ic] = 0.;
+  trCov[kY2] = trCov[kZ2] = kLargeErr2Coord;
+  trCov[kSnp2] = trCov[kTgl2] = kLargeErr2Dir;
+  trCov[kPtI2] = kLargeErr2PtI * trPars[kPtI] * trPars[kPtI];
+  //*/
+  // probTr.ResetCovariance(1e10);
+  probTr.CheckCovariance();
+  //
+  // Set Detector-Efficiency Storage area to unity
+  Double_t efficiency = 1.0, fake = 0.0;
+  //
+  // Back-propagate the covariance matrix along the track.
+
+  CylLayerK* layer = 0;
+  //      probTr.Print();
+  for (Int_t j = lastActiveLayer + 1; j--;) { // Layer loop
+
+    layer = (CylLayerK*)fLayers.At(j);
+
+    if (layer->radius > fMaxSeedRadius)
+      continue; // no seeding beyond this radius
+
+    TString name(layer->GetName());
+    Bool_t isVertex = name.Contains("vertex");
+    Bool_t isFirstActive = j == firstActiveLayer;
     //
-    // Starting values based on radius of outermost layer ... log10 steps to ~20 GeV
-    //   if (bigRad<61) bigRad=61; // -> min pt around 100 MeV for Bz=0.5T (don't overdo it ... ;-) )
-    fTransMomenta[i] = ptmin * TMath::Exp(dlpt * i);
-    // fTransMomenta[i] = ( 0.3*bigRad*TMath::Abs(fBField)*1e-2 ) - 0.08 - (1./fptScale-0.1) + TMath::Power(10,2.3*i/nPt) / fptScale ;
-
-    // New from here ................
-
-    // Assume track started at (0,0,0) and shoots out on the X axis, and B field is on the Z axis
-    // These are the EndPoint values for y, z, a, b, and d
-    double bGauss = fBField * 10; // field in kgauss
-    pt = fTransMomenta[i];        // GeV/c
-    tgl = TMath::Tan(lambda);     // dip
-    charge = -1;                  // Assume an electron
-    enum { kY,
-           kZ,
-           kSnp,
-           kTgl,
-           kPtI }; // track parameter aliases
-    enum { kY2,
-           kYZ,
-           kZ2,
-           kYSnp,
-           kZSnp,
-           kSnp2,
-           kYTgl,
-           kZTgl,
-           kSnpTgl,
-           kTgl2,
-           kYPtI,
-           kZPtI,
-           kSnpPtI,
-           kTglPtI,
-           kPtI2 }; // cov.matrix aliases
+    if (!PropagateToR(&probTr, layer->radius, bGauss, -1)) {
+      TRACEK(TraceK::kWarning, "Failed inward propagation for bin %d pT=%.2f at lr%d of r=%.2f\n", i, pt, j, layer->radius);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      TRACEK(TraceK::kWarning, "Skipping pT=%.2f bin%d\n", pt, i);
+      return status = TraceK::kPropagation;
+    }
+    //	if (!probTr.PropagateTo(last->radius,bGauss)) exit(1);	//
+    // rotate to frame with X axis normal to the surface
+    if (!isVertex) {
+      double pos[3];
+      probTr.GetXYZ(pos); // lab position
+      double phi = TMath::ATan2(pos[1], pos[0]);
+      if (TMath::Abs(TMath::Abs(phi) - TMath::Pi() / 2) < 1e-3)
+        phi = 0; // TMath::Sign(TMath::Pi()/2 - 1e-3,phi);
+      if (!probTr.Rotate(phi)) {
+        TRACEK(TraceK::kWarning, "Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
+               phi, layer->radius, pos[0], pos[1], pos[2], pt);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return status = TraceK::kRotation;
+      }
+    }
+    // save resolutions at this layer
+    detPointRes[j] = TMath::Sqrt(probTr.GetSigmaY2()) / 100;  // result in meters
+    detPointZRes[j] = TMath::Sqrt(probTr.GetSigmaZ2()) / 100; // result in meters
+    // printf(">> L%d r:%e sy: %e sz: %e\n",j,layer->radius,detPointRes[j],detPointZRes[j]);
+    //  End save
     //
-    probTr.Reset();
-    double* trPars = (double*)probTr.GetParameter();
-    double* trCov = (double*)probTr.GetCovariance();
-    trPars[kY] = 0;             // start from Y = 0
-    trPars[kZ] = 0;             //            Z = 0
-    trPars[kSnp] = 0;           //            track along X axis at the vertex
-    trPars[kTgl] = tgl;         //            dip
-    trPars[kPtI] = charge / pt; //            q/pt
+    if (isVertex)
+      continue;
     //
-    // put tiny errors to propagate to the outer radius
-    trCov[kY2] = trCov[kZ2] = trCov[kSnp2] = trCov[kTgl2] = trCov[kPtI2] = 1e-9;
+    // create fake measurement with the errors assigned to the layer
+    // account for the measurement there
+    double meas[2] = {probTr.GetY(), probTr.GetZ()};
+    double measErr2[3] = {layer->phiRes * layer->phiRes, 0, layer->zRes * layer->zRes};
     //
-    // find max layer this track can reach
-    double rmx = (TMath::Abs(fBField) > 1e-5) ? TMath::Abs(charge) * pt * 100. / (0.3 * TMath::Abs(fBField)) : 9999;
-    Int_t lastActiveLayer = -1;
-    for (Int_t j = fLayers.GetEntries(); j--;) {
-      CylLayerK* l = (CylLayerK*)fLayers.At(j);
-      //	printf("at lr %d r: %f vs %f, pt:%f\n",j,l->radius, 2*rmx-2.*kTrackingMargin, pt);
-      if (!(l->isDead) && (l->radius < 2 * rmx - 5.)) {
-        lastActiveLayer = j;
-        last = l;
-        break;
-      }
+
+    if (!probTr.Update(meas, measErr2)) {
+      TRACEK(TraceK::kWarning, "Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
+             meas[0], meas[1], measErr2[0], measErr2[1], measErr2[2]);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return status = TraceK::kUpdate;
+    }
+    // printf("AfterUpdate "); probTr.Print();
+
+    if (isFirstActive) {
+      deltaPoverP = TMath::Sqrt(probTr.GetSigma1Pt2()) / TMath::Abs(probTr.GetSigned1Pt());
+      // printf("<<<  #%2d pt %f, q/pt:%e err2 %e relres %f\n",i,pt,probTr.GetSigned1Pt() ,probTr.GetSigma1Pt2(),deltaPoverP);
+      scan.momentumRes[i] = 100. * TMath::Abs(deltaPoverP); // results in percent
     }
-    if (lastActiveLayer < 0) {
-      printf("No active layer with radius < %f is found, pt = %f\n", rmx, pt);
-      continue; // return;
+    // correct for materials of this layer
+    // note: if apart from MS we want also e.loss correction, the density*length should be provided as 2nd param
+    if (!CorrectForMeanMaterialK(probTr, layer->radL, 0, mass)) {
+      TRACEK(TraceK::kWarning, "Failed to apply material correction, X/X0=%.4f\n", layer->radL);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return status = TraceK::kMaterial;
     }
-    printf("PT=%f 2Rpt=%f Rlr=%f\n", pt, 2 * rmx, last->radius);
+    if (layer->xrho > 0 && !CorrectForEnergyLoss(&probTr, layer->xrho, mass)) {
+      TRACEK(TraceK::kWarning, "Failed to apply material correction, xrho=%.4f\n", layer->xrho);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return status = TraceK::kMaterial;
+    }
+
+    //      printf("AfterCorr "); probTr.Print();
     //
-    float prepLrOK[lastActiveLayer + 1];
-    for (int il = lastActiveLayer + 1; il--;)
-      prepLrOK[il] = 0;
-    int lastReached = 0;
-    for (int il = 1; il <= lastActiveLayer; il++) {
-      AliExternalTrackParam probTrLast(probTr);
-      CylLayerK* lr = (CylLayerK*)fLayers.At(il);
-      if (!PropagateToR(&probTrLast, lr->radius, bGauss, 1))
-        break;
-      if (!probTrLast.CorrectForMeanMaterial(lr->radL, 0, fParticleMass, kTRUE))
-        break;
+  }
 
-      if (lr->xrho > 0) { // correct in small steps
-        bool elossOK = kTRUE;
-        for (int ise = xrhosteps; ise--;) {
-          if (!probTrLast.CorrectForMeanMaterial(0, -lr->xrho / xrhosteps, fParticleMass, kTRUE)) {
-            elossOK = kFALSE;
-            break;
-          }
-        }
-        if (!elossOK)
-          break;
+  // Pattern recognition is done .... save values like vertex resolution etc.
+
+  // Convert the Convariance matrix parameters into physical quantities
+  // The results are propogated to the previous point but *do not* include the measurement at that point.
+  scan.resolutionRPhi[i] = TMath::Sqrt(probTr.GetSigmaY2()) * 1.e4; // result in microns
+  scan.resolutionZ[i] = TMath::Sqrt(probTr.GetSigmaZ2()) * 1.e4;    // result in microns
+  //      equivalent[i]  =  TMath::Sqrt(resolutionRPhi[i]*resolutionZ[i])           ;  // Equivalent circular radius
+  //
+  if (print) {
+    printf("Number of active layers: %d, last Layer reached: %d\n", fNumberOfActiveLayers, lastActiveLayer);
+    printf("Mass of tracked particle: %f (at pt=%5.0lf MeV)\n", mass, pt * 1000);
+    printf("Name   Radius Thickness PointResOn PointResOnZ  DetRes  DetResZ  Density Efficiency\n");
+  }
+
+  // print out and efficiency calculation
+  Int_t iLayActive = 0;
+  //      for (Int_t j=(fLayers.GetEntries()-1); j>=0; j--) {  // Layer loop
+  for (Int_t j = lastActiveLayer + 1; j--;) { // Layer loop
+
+    layer = (CylLayerK*)fLayers.At(j);
+
+    // Convert to Meters, Tesla, and GeV
+    Float_t radius = layer->radius / 100;
+    Float_t phiRes = layer->phiRes / 100;
+    Float_t zRes = layer->zRes / 100;
+    Float_t radLength = layer->radL;
+    Float_t leff = layer->eff; // basic layer efficiency
+    Bool_t isDead = layer->isDead;
+
+    if ((!isDead && radLength > 0)) {
+
+      Double_t rphiError = TMath::Sqrt(detPointRes[j] * detPointRes[j] +
+                                       phiRes * phiRes) *
+                           100.; // work in cm
+      Double_t zError = TMath::Sqrt(detPointZRes[j] * detPointZRes[j] +
+                                    zRes * zRes) *
+                        100.; // work in cm
+
+      Double_t layerEfficiency = 0;
+      if (EfficiencySearchFlag == 0)
+        layerEfficiency = ProbGoodHit(radius * 100, rphiError, zError);
+      else if (EfficiencySearchFlag == 1)
+        layerEfficiency = ProbGoodChiSqHit(radius * 100, rphiError, zError);
+      else if (EfficiencySearchFlag == 2)
+        layerEfficiency = ProbGoodChiSqPlusConfHit(radius * 100, leff, rphiError, zError);
+
+      TString name(layer->GetName());
+      if (IsITSLayer(name)) {
+        probLay(2, iLayActive) = layerEfficiency;                                                 // Pcorr
+        probLay(0, iLayActive) = ProbNullChiSqPlusConfHit(radius * 100, leff, rphiError, zError); // Pnull
+        probLay(1, iLayActive) = 1 - probLay(2, iLayActive) - probLay(0, iLayActive);             // Pfake
+        iLayActive++;
       }
+      if (!IsITSLayer(name) && (!name.Contains("tpc_0")))
+        continue;
 
-      if (lr->radius > 1e-3 && !lr->isDead &&
-          (!probTrLast.Rotate(probTrLast.PhiPos()) || TMath::Abs(probTrLast.GetSnp()) > fMaxSnp)) {
-        break;
+      if (print) {
+        printf("%s:\t%5.1f %9.4f %10.0f %11.0f %7.0f %8.0f %8.2f ",
+               layer->GetName(), radius * 100, radLength,
+               detPointRes[j] * 1.e6, detPointZRes[j] * 1.e6,
+               phiRes * 1.e6, zRes * 1.e6,
+               HitDensity(radius * 100));
+        if (!name.Contains("tpc"))
+          printf("%10.3f\n", layerEfficiency);
+        else
+          printf("        -  \n");
       }
-      probTr = probTrLast;
-      lastReached = il;
-      prepLrOK[il] = 1.; // flag successfully passed layer
+
+      if (IsITSLayer(name))
+        efficiency *= layerEfficiency;
     }
-    //   if ( ((CylLayerK*)fLayers.At(lastReached))->radius < fMinRadTrack) continue;
-    if (!PropagateToR(&probTr, probTr.GetX() + kTrackingMargin, bGauss, 1))
-      continue;
-    //    if (probTr.GetX()<fMinRadTrack) continue;
-    lastActiveLayer = lastReached;
-    if (lastActiveLayer < fNumberOfActiveITSLayers) {
-      continue;
+  }
+  if (fAtLeastCorr != -1 || fAtLeastHits) {
+    // Calculate probabilities from the hit counts ...
+    Double_t* probs = PrepareEffFakeKombinations(&probLay, iLayActive);
+    efficiency = probs[0]; // efficiency
+    fake = probs[1];       // fake
+    delete[] probs;
+  }
+  if (print)
+    printf("\n");
+
+  if (fNumberOfActiveLayers < 1500) {
+
+    //      printf("Backward PtBin%d pt=%f\n",i,pt);
+
+    // BACKWORD TRACKING +++++++++++++++++
+    // number of layers is quite low ... efficiency calculation was probably nonsense
+    // Tracking outward (backword) to get reliable efficiencies from "smoothed estimates"
+
+    // For below, see paper, NIM A262 (1987) p.444, eqs.12.
+    // Equivalently, one can simply combine the forward and backward estimates. Assuming
+    // pf,Cf and pb,Cb as extrapolated position estimates and errors from fwd and bwd passes one can
+    // use a weighted estimate Cw = (Cf^-1 + Cb^-1)^-1,  pw = Cw (pf Cf^-1 + pb Cb^-1).
+    // Surely, for the most extreme point, where one error matrices is infinite, this does not change anything.
+
+    Bool_t doLikeAliRoot = 0; // don't do the "combined info" but do like in Aliroot
+
+    if (print) {
+      printf("- Numbers of active layer is low (%d):\n    -> \"outward\" fitting done as well to get reliable eff.estimates\n",
+             fNumberOfActiveLayers);
     }
 
-    //    if (!PropagateToR(&probTr,last->radius + kTrackingMargin,bGauss,1)) continue;
-    // if (!probTr.PropagateTo(last->radius,bGauss)) continue;
-    // reset cov.matrix
-    const double kLargeErr2Coord = 100 * 100;
-    const double kLargeErr2Dir = 1. * 1.;
-    const double kLargeErr2PtI = 30. * 30.;
-    ///*
-    for (int ic = 15; ic--;)
-      trCov[ic] = 0.;
-    trCov[kY2] = trCov[kZ2] = kLargeErr2Coord;
-    trCov[kSnp2] = trCov[kTgl2] = kLargeErr2Dir;
-    trCov[kPtI2] = kLargeErr2PtI * trPars[kPtI] * trPars[kPtI];
-    //*/
-    // probTr.ResetCovariance(1e10);
-    probTr.CheckCovariance();
-    /*
-    printf(">>> #%2d pt %f RLMax=%.2f, q/pt:%e err2 %e relres %f\n",i,pt,
-     last->radius,trPars[kPtI],trCov[kPtI2],TMath::Sqrt(trCov[kPtI2])/trPars[kPtI]);
-    probTr.Print();
-    */
-    //
-    // Set Detector-Efficiency Storage area to unity
-    fEfficiency[i] = 1.0;
-    //
-    // Back-propagate the covariance matrix along the track.
+    // RESET Covariance Matrix ( to 10 x the estimate -> as it is done in AliExternalTrackParam)
+    //	mIstar.UnitMatrix(); // start with unity
+    if (doLikeAliRoot) {
+      probTr.ResetCovariance(100);
+    } else {
+      // cannot do complete reset, set to very large errors
+      for (int ic = 15; ic--;)
+        trCov[ic] = 0.;
+      trCov[kY2] = trCov[kZ2] = kLargeErr2Coord;
+      trCov[kSnp2] = trCov[kTgl2] = kLargeErr2Dir;
+      trCov[kPtI2] = kLargeErr2PtI * trPars[kPtI] * trPars[kPtI];
+      probTr.CheckCovariance();
+      //	  cout<<pt<<": "<<kLargeErr2Coord<<" "<<kLargeErr2Dir<<" "<<kLargeErr2PtI*trPars[kPtI]*trPars[kPtI]<<endl;
+    }
+    // Clean up and storing of "forward estimates"
+    std::vector<Double_t> detPointResForw(detPointRes, detPointRes + nLayers), detPointZResForw(detPointZRes, detPointZRes + nLayers);
+    std::vector<Double_t> detPointResBwd(nLayers, RIDICULOUS), detPointZResBwd(nLayers, RIDICULOUS);
+    if (!doLikeAliRoot) {
+      for (Int_t k = 0; k < nLayers; k++)
+        detPointRes[k] = detPointZRes[k] = RIDICULOUS;
+    }
 
-    CylLayerK* layer = 0;
-    //      probTr.Print();
-    Bool_t skipPTBin = kFALSE;
-    for (Int_t j = lastActiveLayer + 1; j--;) { // Layer loop
+    // probTr.Rotate(0);
+    for (Int_t j = firstActiveLayer; j <= lastActiveLayer; j++) { // Layer loop
 
       layer = (CylLayerK*)fLayers.At(j);
-
-      if (layer->radius > fMaxSeedRadius)
-        continue; // no seeding beyond this radius
+      //  CylLayerK *nextlayer = (CylLayerK*)fLayers.At(j+1);
 
       TString name(layer->GetName());
       Bool_t isVertex = name.Contains("vertex");
-      Bool_t isFirstActive = j == firstActiveLayer;
-      //
-      if (!PropagateToR(&probTr, layer->radius, bGauss, -1)) {
-        printf("Failed inward propagation for bin %d pT=%.2f at lr%d of r=%.2f\n", i, pt, j, layer->radius);
-        probTr.Print();
-        skipPTBin = kTRUE;
-        fEfficiency[i] = 0.0;
-        break; // exit(1);
-      }
-      //	if (!probTr.PropagateTo(last->radius,bGauss)) exit(1);	//
-      // rotate to frame with X axis normal to the surface
+      if (!PropagateToR(&probTr, layer->radius, bGauss, 1))
+        return status = TraceK::kPropagation;
+      // if (!probTr.PropagateTo(last->radius,bGauss))  exit(1);
       if (!isVertex) {
+        // rotate to frame with X axis normal to the surface
         double pos[3];
         probTr.GetXYZ(pos); // lab position
         double phi = TMath::ATan2(pos[1], pos[0]);
         if (TMath::Abs(TMath::Abs(phi) - TMath::Pi() / 2) < 1e-3)
           phi = 0; // TMath::Sign(TMath::Pi()/2 - 1e-3,phi);
         if (!probTr.Rotate(phi)) {
-          printf("Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
+          TRACEK(TraceK::kWarning, "Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
                  phi, layer->radius, pos[0], pos[1], pos[2], pt);
-
-          probTr.Print();
-          exit(1);
+          TRACEK_DO(TraceK::kWarning, probTr.Print());
+          return status = TraceK::kRotation;
         }
       }
-      // save resolutions at this layer
-      fDetPointRes[j][i] = TMath::Sqrt(probTr.GetSigmaY2()) / 100;  // result in meters
-      fDetPointZRes[j][i] = TMath::Sqrt(probTr.GetSigmaZ2()) / 100; // result in meters
-      // printf(">> L%d r:%e sy: %e sz: %e\n",j,layer->radius,fDetPointRes[j][i],fDetPointZRes[j][i]);
-      //  End save
       //
-      if (isVertex)
-        continue;
+      detPointResBwd[j] = TMath::Sqrt(probTr.GetSigmaY2()) / 100;  // result in meters
+      detPointZResBwd[j] = TMath::Sqrt(probTr.GetSigmaZ2()) / 100; // result in meters
       //
       // create fake measurement with the errors assigned to the layer
       // account for the measurement there
+      if (isVertex)
+        continue;
       double meas[2] = {probTr.GetY(), probTr.GetZ()};
       double measErr2[3] = {layer->phiRes * layer->phiRes, 0, layer->zRes * layer->zRes};
       //
-
       if (!probTr.Update(meas, measErr2)) {
-        printf("Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
+        TRACEK(TraceK::kWarning, "Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
                meas[0], meas[1], measErr2[0], measErr2[1], measErr2[2]);
-        probTr.Print();
-        exit(1);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return status = TraceK::kUpdate;
       }
       // printf("AfterUpdate "); probTr.Print();
-
-      if (isFirstActive) {
-        deltaPoverP = TMath::Sqrt(probTr.GetSigma1Pt2()) / TMath::Abs(probTr.GetSigned1Pt());
-        // printf("<<<  #%2d pt %f, q/pt:%e err2 %e relres %f\n",i,pt,probTr.GetSigned1Pt() ,probTr.GetSigma1Pt2(),deltaPoverP);
-        fMomentumRes[i] = 100. * TMath::Abs(deltaPoverP); // results in percent
-      }
-      // correct for materials of this layer
-      // note: if apart from MS we want also e.loss correction, the density*length should be provided as 2nd param
-      if (!probTr.CorrectForMeanMaterial(layer->radL, 0, fParticleMass, kTRUE)) {
-        printf("Failed to apply material correction, X/X0=%.4f\n", layer->radL);
-        probTr.Print();
-        exit(1);
+      //  correct for materials of this layer
+      //  note: if apart from MS we want also e.loss correction, the density*length should be provided as 2nd param
+      if (!CorrectForMeanMaterialK(probTr, layer->radL, 0, mass)) {
+        TRACEK(TraceK::kWarning, "Failed to apply material correction, X/X0=%.4f\n", layer->radL);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return status = TraceK::kMaterial;
       }
-      if (layer->xrho > 0) { // correct in small steps
-        for (int ise = xrhosteps; ise--;) {
-          if (!probTr.CorrectForMeanMaterial(0, layer->xrho / xrhosteps, fParticleMass, kTRUE)) {
-            printf("Failed to apply material correction, xrho=%.4f\n", layer->xrho);
-            probTr.Print();
-            exit(1);
-          }
-        }
+      if (layer->xrho > 0 && !CorrectForEnergyLoss(&probTr, -layer->xrho, mass)) {
+        TRACEK(TraceK::kWarning, "Failed to apply material correction, xrho=%.4f\n", -layer->xrho);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return status = TraceK::kMaterial;
       }
 
-      //      printf("AfterCorr "); probTr.Print();
-      //
+      // printf("AfterCorr "); probTr.Print();
     }
 
-    if (skipPTBin) {
-      printf("Skipping pT=%.2f bin%d\n", pt, i);
-      continue;
-    }
-    // Pattern recognition is done .... save values like vertex resolution etc.
+    // Weighted combination of the forward and backward estimates
+    if (!doLikeAliRoot) {
 
-    // Convert the Convariance matrix parameters into physical quantities
-    // The results are propogated to the previous point but *do not* include the measurement at that point.
-    fResolutionRPhi[i] = TMath::Sqrt(probTr.GetSigmaY2()) * 1.e4; // result in microns
-    fResolutionZ[i] = TMath::Sqrt(probTr.GetSigmaZ2()) * 1.e4;    // result in microns
-    //      equivalent[i]  =  TMath::Sqrt(fResolutionRPhi[i]*fResolutionZ[i])           ;  // Equivalent circular radius
-    //
-    if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
-      printf("Number of active layers: %d, last Layer reached: %d\n", fNumberOfActiveLayers, lastActiveLayer);
-      printf("Mass of tracked particle: %f (at pt=%5.0lf MeV)\n", fParticleMass, fTransMomenta[i] * 1000);
-      printf("Name   Radius Thickness PointResOn PointResOnZ  DetRes  DetResZ  Density Efficiency\n");
-      //	printOnce =0;
+      if (print)
+        printf("\nBackward propagation estimates\n");
+
+      for (Int_t j = lastActiveLayer + 1; j--;) {
+        //
+        detPointRes[j] = detPointResForw[j] * detPointResBwd[j] / TMath::Sqrt((detPointResForw[j] * detPointResForw[j]) + (detPointResBwd[j] * detPointResBwd[j]));
+        detPointZRes[j] = detPointZResForw[j] * detPointZResBwd[j] / TMath::Sqrt((detPointZResForw[j] * detPointZResForw[j]) + (detPointZResBwd[j] * detPointZResBwd[j]));
+        //
+        layer = (CylLayerK*)fLayers.At(j);
+
+        TString name(layer->GetName());
+        if (layer->isDead || (!IsITSLayer(name) && (!name.Contains("tpc_0"))))
+          continue;
+
+        if (print) {
+          //
+          Float_t radius = layer->radius / 100;
+          Float_t phiRes = layer->phiRes / 100;
+          Float_t zRes = layer->zRes / 100;
+          Float_t radLength = layer->radL;
+          Float_t leff = layer->eff; // basic layer efficiency
+          Double_t rphiError = TMath::Sqrt(detPointResBwd[j] * detPointResBwd[j] +
+                                           phiRes * phiRes) *
+                               100.; // work in cm
+          Double_t zError = TMath::Sqrt(detPointZResBwd[j] * detPointZResBwd[j] +
+                                        zRes * zRes) *
+                            100.; // work in cm
+          //
+          Double_t layerEfficiency = 0;
+          if (EfficiencySearchFlag == 0)
+            layerEfficiency = ProbGoodHit(radius * 100, rphiError, zError);
+          else if (EfficiencySearchFlag == 1)
+            layerEfficiency = ProbGoodChiSqHit(radius * 100, rphiError, zError);
+          else if (EfficiencySearchFlag == 2)
+            layerEfficiency = ProbGoodChiSqPlusConfHit(radius * 100, leff, rphiError, zError);
+
+          printf("%s:\t%5.1f %9.4f %10.0f %11.0f %7.0f %8.0f %8.2f ",
+                 layer->GetName(), radius * 100, radLength,
+                 detPointResBwd[j] * 1.e6, detPointZResBwd[j] * 1.e6,
+                 phiRes * 1.e6, zRes * 1.e6,
+                 HitDensity(radius * 100));
+          if (IsITSLayer(name))
+            printf("%10.3f\n", layerEfficiency);
+          else
+            printf("        -  \n");
+        }
+      }
     }
+    // Set Detector-Efficiency Storage area to unity
+    efficiency = 1.0;
 
     // print out and efficiency calculation
-    Int_t iLayActive = 0;
-    //      for (Int_t j=(fLayers.GetEntries()-1); j>=0; j--) {  // Layer loop
+    iLayActive = 0;
+    if (print)
+      printf("\n Combined propagation estimates\n");
+
     for (Int_t j = lastActiveLayer + 1; j--;) { // Layer loop
 
       layer = (CylLayerK*)fLayers.At(j);
@@ -1124,19 +1700,17 @@ void DetectorK::SolveViaBilloir(Double_t selPt, double ptmin)
       Float_t phiRes = layer->phiRes / 100;
       Float_t zRes = layer->zRes / 100;
       Float_t radLength = layer->radL;
-      Float_t leff = layer->eff; // basic layer efficiency
+      Float_t leff = layer->eff;
       Bool_t isDead = layer->isDead;
 
+      Double_t layerEfficiency = 0;
       if ((!isDead && radLength > 0)) {
-
-        Double_t rphiError = TMath::Sqrt(fDetPointRes[j][i] * fDetPointRes[j][i] +
+        Double_t rphiError = TMath::Sqrt(detPointRes[j] * detPointRes[j] +
                                          phiRes * phiRes) *
                              100.; // work in cm
-        Double_t zError = TMath::Sqrt(fDetPointZRes[j][i] * fDetPointZRes[j][i] +
+        Double_t zError = TMath::Sqrt(detPointZRes[j] * detPointZRes[j] +
                                       zRes * zRes) *
                           100.; // work in cm
-
-        Double_t layerEfficiency = 0;
         if (EfficiencySearchFlag == 0)
           layerEfficiency = ProbGoodHit(radius * 100, rphiError, zError);
         else if (EfficiencySearchFlag == 1)
@@ -1154,369 +1728,105 @@ void DetectorK::SolveViaBilloir(Double_t selPt, double ptmin)
         if (!IsITSLayer(name) && (!name.Contains("tpc_0")))
           continue;
 
-        if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
+        if (print) {
           printf("%s:\t%5.1f %9.4f %10.0f %11.0f %7.0f %8.0f %8.2f ",
                  layer->GetName(), radius * 100, radLength,
-                 fDetPointRes[j][i] * 1.e6, fDetPointZRes[j][i] * 1.e6,
+                 detPointRes[j] * 1.e6, detPointZRes[j] * 1.e6,
                  phiRes * 1.e6, zRes * 1.e6,
                  HitDensity(radius * 100));
-          if (!name.Contains("tpc"))
+          if (IsITSLayer(name))
             printf("%10.3f\n", layerEfficiency);
           else
             printf("        -  \n");
         }
 
-        if (IsITSLayer(name))
-          fEfficiency[i] *= layerEfficiency;
-      }
-      /*
-      // vertex print
-      if (print == 1 && fTransMomenta[i] >= meanPt && printOnce == 1 && radius==0) {
-      printf("%s:\t -----    ----- %10.0f %11.0f \n", layer->GetName(),fDetPointRes[j][i]*1.e6, fDetPointZRes[j][i]*1.e6);
-      }
-      */
-    }
-    if (fAtLeastCorr != -1 || fAtLeastHits) {
-      // Calculate probabilities from Kombinatorics tree ...
-      TMatrixD* probKombPP = (TMatrixD*)probKombArr[iLayActive - 3];
-      Double_t* probs = PrepareEffFakeKombinations(probKombPP, &probLay, iLayActive);
-      fEfficiency[i] = probs[0]; // efficiency
-      fFake[i] = probs[1];       // fake
-      delete[] probs;
-    }
-    if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
-      if (fNumberOfActiveLayers >= 1500)
-        printOnce = 0;
-      printf("\n");
-    }
-
-    if (fNumberOfActiveLayers < 1500) {
-
-      //      printf("Backward PtBin%d pt=%f\n",i,pt);
-
-      // BACKWORD TRACKING +++++++++++++++++
-      // number of layers is quite low ... efficiency calculation was probably nonsense
-      // Tracking outward (backword) to get reliable efficiencies from "smoothed estimates"
-
-      // For below, see paper, NIM A262 (1987) p.444, eqs.12.
-      // Equivalently, one can simply combine the forward and backward estimates. Assuming
-      // pf,Cf and pb,Cb as extrapolated position estimates and errors from fwd and bwd passes one can
-      // use a weighted estimate Cw = (Cf^-1 + Cb^-1)^-1,  pw = Cw (pf Cf^-1 + pb Cb^-1).
-      // Surely, for the most extreme point, where one error matrices is infinite, this does not change anything.
-
-      Bool_t doLikeAliRoot = 0; // don't do the "combined info" but do like in Aliroot
-
-      if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
-        printf("- Numbers of active layer is low (%d):\n    -> \"outward\" fitting done as well to get reliable eff.estimates\n",
-               fNumberOfActiveLayers);
-      }
-
-      // RESET Covariance Matrix ( to 10 x the estimate -> as it is done in AliExternalTrackParam)
-      //	mIstar.UnitMatrix(); // start with unity
-      if (doLikeAliRoot) {
-        probTr.ResetCovariance(100);
-      } else {
-        // cannot do complete reset, set to very large errors
-        for (int ic = 15; ic--;)
-          trCov[ic] = 0.;
-        trCov[kY2] = trCov[kZ2] = kLargeErr2Coord;
-        trCov[kSnp2] = trCov[kTgl2] = kLargeErr2Dir;
-        trCov[kPtI2] = kLargeErr2PtI * trPars[kPtI] * trPars[kPtI];
-        probTr.CheckCovariance();
-        //	  cout<<pt<<": "<<kLargeErr2Coord<<" "<<kLargeErr2Dir<<" "<<kLargeErr2PtI*trPars[kPtI]*trPars[kPtI]<<endl;
-      }
-      // Clean up and storing of "forward estimates"
-      Double_t detPointResForw[kMaxNumberOfDetectors][kNptBins], detPointZResForw[kMaxNumberOfDetectors][kNptBins];
-      Double_t detPointResBwd[kMaxNumberOfDetectors][kNptBins], detPointZResBwd[kMaxNumberOfDetectors][kNptBins];
-      for (Int_t k = 0; k < kMaxNumberOfDetectors; k++) {
-        for (Int_t l = 0; l < nPt; l++) {
-          detPointResForw[k][l] = fDetPointRes[k][l];
-          if (!doLikeAliRoot)
-            fDetPointRes[k][l] = RIDICULOUS;
-          detPointZResForw[k][l] = fDetPointZRes[k][l];
-          if (!doLikeAliRoot)
-            fDetPointZRes[k][l] = RIDICULOUS;
-          detPointResBwd[k][l] = detPointZResBwd[k][l] = RIDICULOUS;
-        }
-      }
-
-      // probTr.Rotate(0);
-      for (Int_t j = firstActiveLayer; j <= lastActiveLayer; j++) { // Layer loop
-
-        layer = (CylLayerK*)fLayers.At(j);
-        //  CylLayerK *nextlayer = (CylLayerK*)fLayers.At(j+1);
-
-        TString name(layer->GetName());
-        Bool_t isVertex = name.Contains("vertex");
-        if (!PropagateToR(&probTr, layer->radius, bGauss, 1))
-          exit(1);
-        // if (!probTr.PropagateTo(last->radius,bGauss))  exit(1);
-        if (!isVertex) {
-          // rotate to frame with X axis normal to the surface
-          double pos[3];
-          probTr.GetXYZ(pos); // lab position
-          double phi = TMath::ATan2(pos[1], pos[0]);
-          if (TMath::Abs(TMath::Abs(phi) - TMath::Pi() / 2) < 1e-3)
-            phi = 0; // TMath::Sign(TMath::Pi()/2 - 1e-3,phi);
-          if (!probTr.Rotate(phi)) {
-            printf("Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
-                   phi, layer->radius, pos[0], pos[1], pos[2], pt);
-            probTr.Print();
-            exit(1);
-          }
-        }
-        /*
-          if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1)
-          {
-          printf("\nAt lr %d %s R: %f\n ",j,layer->GetName(), layer->radius);
-          probTr.Print();
-          }
-        */
-        //
-        detPointResBwd[j][i] = TMath::Sqrt(probTr.GetSigmaY2()) / 100;  // result in meters
-        detPointZResBwd[j][i] = TMath::Sqrt(probTr.GetSigmaZ2()) / 100; // result in meters
-        //
-        // printf("<< L%d r:%e sy: %e sz: %e\n",j,layer->radius,fDetPointRes[j][i],fDetPointZRes[j][i]);
-        // create fake measurement with the errors assigned to the layer
-        // account for the measurement there
-        if (isVertex)
-          continue;
-        double meas[2] = {probTr.GetY(), probTr.GetZ()};
-        double measErr2[3] = {layer->phiRes * layer->phiRes, 0, layer->zRes * layer->zRes};
-        //
-        if (!probTr.Update(meas, measErr2)) {
-          printf("Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
-                 meas[0], meas[1], measErr2[0], measErr2[1], measErr2[2]);
-          probTr.Print();
-          exit(1);
-        }
-        // printf("AfterUpdate "); probTr.Print();
-        //  correct for materials of this layer
-        //  note: if apart from MS we want also e.loss correction, the density*length should be provided as 2nd param
-        if (!probTr.CorrectForMeanMaterial(layer->radL, 0, fParticleMass, kTRUE)) {
-          printf("Failed to apply material correction, X/X0=%.4f\n", layer->radL);
-          probTr.Print();
-          exit(1);
-        }
-        if (layer->xrho > 0) { // correct in small steps
-          for (int ise = xrhosteps; ise--;) {
-            if (!probTr.CorrectForMeanMaterial(0, -layer->xrho / xrhosteps, fParticleMass, kTRUE)) {
-              printf("Failed to apply material correction, xrho=%.4f\n", -layer->xrho);
-              probTr.Print();
-              exit(1);
-            }
-          }
-        }
-
-        // printf("AfterCorr "); probTr.Print();
-      }
-
-      // values below NOT REALIABLE -> they do not point to the vertex but outwards !!!!!!!
-      // ++++++++++++++
-      // also update the values for the track position ??????
-      /*
-      // Pattern recognition is done .... save values like vertex resolution etc.
-
-      // Invert the Matrix to recover the convariance matrix
-      mIstar.Invert() ;
-      // Convert the Convariance matrix parameters into physical quantities
-      // The results are propogated to the previous point but *do not* include the measurement at that point.
-      deltaPoverP    =  TMath::Sqrt( mIstar(4,4) ) * momentum / 0.3  ;  // Absolute magnitude so ignore charge
-      fMomentumRes[i]      =  100.* TMath::Abs( deltaPoverP )             ;  // results in percent
-      fResolutionRPhi[i]      =  TMath::Sqrt( mIstar(0,0) ) * 1.e6            ;  // result in microns
-      fResolutionZ[i]     =  TMath::Sqrt( mIstar(1,1) ) * 1.e6            ;  // result in microns
-      //      equivalent[i]  =  TMath::Sqrt(fResolutionRPhi[i]*fResolutionZ[i])           ;  // Equivalent circular radius
-      */
-
-      //	deltaPoverP          =  TMath::Sqrt(probTr.GetSigma1Pt2())/TMath::Abs(probTr.GetSigned1Pt());
-      //	fMomentumRes[i]      =  100.* TMath::Abs( deltaPoverP );                    // results in percent
-
-      // Weighted combination of the forward and backward estimates
-      if (!doLikeAliRoot) {
-
-        if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1)
-          printf("\nBackward propagation estimates\n");
-
-        for (Int_t j = lastActiveLayer + 1; j--;) {
-          //
-          fDetPointRes[j][i] = detPointResForw[j][i] * detPointResBwd[j][i] / TMath::Sqrt((detPointResForw[j][i] * detPointResForw[j][i]) + (detPointResBwd[j][i] * detPointResBwd[j][i]));
-          fDetPointZRes[j][i] = detPointZResForw[j][i] * detPointZResBwd[j][i] / TMath::Sqrt((detPointZResForw[j][i] * detPointZResForw[j][i]) + (detPointZResBwd[j][i] * detPointZResBwd[j][i]));
-          //
-          layer = (CylLayerK*)fLayers.At(j);
-
-          TString name(layer->GetName());
-          if (layer->isDead || (!IsITSLayer(name) && (!name.Contains("tpc_0"))))
-            continue;
-
-          if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
-            //
-            Float_t radius = layer->radius / 100;
-            Float_t phiRes = layer->phiRes / 100;
-            Float_t zRes = layer->zRes / 100;
-            Float_t radLength = layer->radL;
-            Float_t leff = layer->eff; // basic layer efficiency
-            Double_t rphiError = TMath::Sqrt(detPointResBwd[j][i] * detPointResBwd[j][i] +
-                                             phiRes * phiRes) *
-                                 100.; // work in cm
-            Double_t zError = TMath::Sqrt(detPointZResBwd[j][i] * detPointZResBwd[j][i] +
-                                          zRes * zRes) *
-                              100.; // work in cm
-            //
-            Double_t layerEfficiency = 0;
-            if (EfficiencySearchFlag == 0)
-              layerEfficiency = ProbGoodHit(radius * 100, rphiError, zError);
-            else if (EfficiencySearchFlag == 1)
-              layerEfficiency = ProbGoodChiSqHit(radius * 100, rphiError, zError);
-            else if (EfficiencySearchFlag == 2)
-              layerEfficiency = ProbGoodChiSqPlusConfHit(radius * 100, leff, rphiError, zError);
-
-            printf("%s:\t%5.1f %9.4f %10.0f %11.0f %7.0f %8.0f %8.2f ",
-                   layer->GetName(), radius * 100, radLength,
-                   detPointResBwd[j][i] * 1.e6, detPointZResBwd[j][i] * 1.e6,
-                   phiRes * 1.e6, zRes * 1.e6,
-                   HitDensity(radius * 100));
-            if (IsITSLayer(name))
-              printf("%10.3f\n", layerEfficiency);
-            else
-              printf("        -  \n");
-          }
-        }
-      }
-      // Set Detector-Efficiency Storage area to unity
-      fEfficiency[i] = 1.0;
-
-      // print out and efficiency calculation
-      iLayActive = 0;
-      if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1)
-        printf("\n Combined propagation estimates\n");
-
-      for (Int_t j = lastActiveLayer + 1; j--;) { // Layer loop
-
-        layer = (CylLayerK*)fLayers.At(j);
-
-        // Convert to Meters, Tesla, and GeV
-        Float_t radius = layer->radius / 100;
-        Float_t phiRes = layer->phiRes / 100;
-        Float_t zRes = layer->zRes / 100;
-        Float_t radLength = layer->radL;
-        Float_t leff = layer->eff;
-        Bool_t isDead = layer->isDead;
-
-        Double_t layerEfficiency = 0;
-        if ((!isDead && radLength > 0)) {
-          Double_t rphiError = TMath::Sqrt(fDetPointRes[j][i] * fDetPointRes[j][i] +
-                                           phiRes * phiRes) *
-                               100.; // work in cm
-          Double_t zError = TMath::Sqrt(fDetPointZRes[j][i] * fDetPointZRes[j][i] +
-                                        zRes * zRes) *
-                            100.; // work in cm
-          if (EfficiencySearchFlag == 0)
-            layerEfficiency = ProbGoodHit(radius * 100, rphiError, zError);
-          else if (EfficiencySearchFlag == 1)
-            layerEfficiency = ProbGoodChiSqHit(radius * 100, rphiError, zError);
-          else if (EfficiencySearchFlag == 2)
-            layerEfficiency = ProbGoodChiSqPlusConfHit(radius * 100, leff, rphiError, zError);
-
-          TString name(layer->GetName());
-          if (IsITSLayer(name)) {
-            probLay(2, iLayActive) = layerEfficiency;                                                 // Pcorr
-            probLay(0, iLayActive) = ProbNullChiSqPlusConfHit(radius * 100, leff, rphiError, zError); // Pnull
-            probLay(1, iLayActive) = 1 - probLay(2, iLayActive) - probLay(0, iLayActive);             // Pfake
-            iLayActive++;
-          }
-          if (!IsITSLayer(name) && (!name.Contains("tpc_0")))
-            continue;
-
-          if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
-            printf("%s:\t%5.1f %9.4f %10.0f %11.0f %7.0f %8.0f %8.2f ",
-                   layer->GetName(), radius * 100, radLength,
-                   fDetPointRes[j][i] * 1.e6, fDetPointZRes[j][i] * 1.e6,
-                   phiRes * 1.e6, zRes * 1.e6,
-                   HitDensity(radius * 100));
-            if (IsITSLayer(name))
-              printf("%10.3f\n", layerEfficiency);
-            else
-              printf("        -  \n");
-          }
-
-          if (j == kDetLayer) { // copy layer specific performances
-            fEfficProlongLay[i] = layerEfficiency;
-          }
-
-          if (IsITSLayer(name))
-            fEfficiency[i] *= layerEfficiency;
+        if (j == scan.detLayer) { // copy layer specific performances
+          scan.efficProlongLay[i] = layerEfficiency;
         }
-      }
-      if (fAtLeastCorr != -1 || fAtLeastHits != -1) {
-        // Calculate probabilities from Kombinatorics tree ...
-        TMatrixD* probKombPP = (TMatrixD*)probKombArr[iLayActive - 3];
-        Double_t* probs = PrepareEffFakeKombinations(probKombPP, &probLay, iLayActive);
-        fEfficiency[i] = probs[0]; // efficiency
-        fFake[i] = probs[1];       // fake
-        delete[] probs;
-      }
 
-      if (print == 1 && fTransMomenta[i] >= selPt && printOnce == 1) {
-        if (pt > 0.25)
-          printOnce = 0;
-        printf("\n");
+        if (IsITSLayer(name))
+          efficiency *= layerEfficiency;
       }
     }
+    if (fAtLeastCorr != -1 || fAtLeastHits != -1) {
+      // Calculate probabilities from the hit counts ...
+      Double_t* probs = PrepareEffFakeKombinations(&probLay, iLayActive);
+      efficiency = probs[0]; // efficiency
+      fake = probs[1];       // fake
+      delete[] probs;
+    }
 
-    fResolutionRPhiLay[i] = fDetPointRes[kDetLayer][i];
-    fResolutionZLay[i] = fDetPointZRes[kDetLayer][i];
-
-  } // pt loop
+    if (print)
+      printf("\n");
+  }
 
-  probTr.SetUseLogTermMS(kFALSE); // Reset of MS term usage to avoid problems since its static
+  scan.efficiency[i] = efficiency;
+  scan.fake[i] = fake;
+  return status = TraceK::kOK;
 }
 
 Bool_t DetectorK::SolveTrack(TrackSol& ts)
 {
   //
-  // Solves the current geometry for single track of given kinematics
+  // Solves the track as the const version, then keeps its good hit probabilities
+  //
+  Bool_t ok = static_cast<const DetectorK*>(this)->SolveTrack(ts);
+  for (int i = 0; i < kMaxNumberOfDetectors; ++i)
+    fGoodHitProb[i] = ts.fGoodHitProb[i];
+  return ok;
+}
+
+Bool_t DetectorK::SolveTrack(TrackSol& ts) const
+{
+  //
+  // Solves the current geometry for single track of given kinematics.
+  // All the per-track state is local or kept in ts: the function is reentrant
   //
   double ptTr = ts.fPt;
   double etaTr = ts.fEta;
   double mass = ts.fMass;
   double charge = ts.fCharge;
+  TraceKGuard trace(ts);
 
   // reset good hit probability
-  for (int i = 0; i < kMaxNumberOfDetectors; ++i)
-    fGoodHitProb[i] = -1.;
-  fGoodHitProb[0] = 1.; // we use layer zero to accumulate
+  ts.fGoodHitProb.Set(kMaxNumberOfDetectors);
+  ts.fGoodHitProb.Reset(-1.);
+  ts.fGoodHitProb[0] = 1.; // we use layer zero to accumulate
+  ts.ClearPar();           // no layer of a previous track is reported as reached
 
   if (ptTr < 0) {
-    printf("Input track is not initialized");
-    return kFALSE;
+    TRACEK(TraceK::kError, "Input track is not initialized\n");
+    return trace.Fail(TraceK::kNotInitialised);
   }
 
   const float kTrackingMargin = 0.1;
 
-  static AliExternalTrackParam probTr; // track to propagate
-  probTr.SetUseLogTermMS(kTRUE);
+  AliExternalTrackParam probTr; // track to propagate
+  LogTermMSGuard logTermMS(kTRUE);
   //
-  TClonesArray& saveParInward = ts.fTrackInw;
-  TClonesArray& saveParOutwardB = ts.fTrackOutB;
-  TClonesArray& saveParOutwardA = ts.fTrackOutA;
-  TClonesArray& saveParComb = ts.fTrackCmb;
+  LayerGeometryK geoNow;
+  const LayerGeometryK& geo = GetGeometry(geoNow);
+  const Int_t nLayers = geo.GetEntries();
+  if (nLayers > TrackSol::kMaxLayers) {
+    TRACEK(TraceK::kError, "%d layers, the track solution holds at most %d\n", nLayers, (Int_t)TrackSol::kMaxLayers);
+    return trace.Fail(TraceK::kNoLayer);
+  }
 
   Double_t pt, lambda;
   //
-  CylLayerK* last = (CylLayerK*)fLayers.At((fLayers.GetEntries() - 1));
-  double maxR = last->radius + kTrackingMargin * 2;
+  Int_t last = nLayers - 1;
+  double maxR = geo.radius[last] + kTrackingMargin * 2;
   double minRad = (fMinRadTrack > 0 && fMinRadTrack < maxR) ? fMinRadTrack : maxR;
   //
-  if (last->radius > minRad) {
-    last = 0;
-    for (Int_t i = 0; i < fLayers.GetEntries(); i++) {
-      CylLayerK* l = (CylLayerK*)fLayers.At(i);
-      if (/*!(l->isDead) && */ (l->radius < minRad))
-        last = l;
+  if (geo.radius[last] > minRad) {
+    last = -1;
+    for (Int_t i = 0; i < nLayers; i++) {
+      if (/*!(geo.Is(i, LayerGeometryK::kDead)) && */ (geo.radius[i] < minRad))
+        last = i;
     }
-    if (!last) {
-      printf("No layer with radius < %f is found\n", minRad);
-      return kFALSE;
+    if (last < 0) {
+      TRACEK(TraceK::kWarning, "No layer with radius < %f is found\n", minRad);
+      return trace.Fail(TraceK::kNoLayer);
     }
   }
   //
@@ -1563,45 +1873,77 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
   double rmx = (TMath::Abs(fBField) > 1e-5) ? pt * 100. / (0.3 * TMath::Abs(fBField)) : 9999;
   //  if (2*rmx-5. < minRad && minRad>0) {
   if (minRad / (2. * rmx) > fMaxSnp - 0.01 && minRad > 0) {
-    //    printf("Track of pt=%.3f cannot be tracked to min. r=%f\n",pt,minRad);
-    return kFALSE;
+    TRACEK(TraceK::kDebug, "Track of pt=%.3f cannot be tracked to min. r=%f\n", pt, minRad);
+    return trace.Fail(TraceK::kLowPt);
   }
   Int_t lastActiveLayer = -1, lastReachedLayer = -1;
-  for (Int_t j = fLayers.GetEntries(); j--;) {
-    CylLayerK* l = (CylLayerK*)fLayers.At(j);
-    if (/*!(l->isDead) && */ (l->radius <= 2 * (rmx - 5))) {
+  for (Int_t j = nLayers; j--;) {
+    if (/*!(geo.Is(j, LayerGeometryK::kDead)) && */ (geo.radius[j] <= 2 * (rmx - 5))) {
       lastActiveLayer = j;
-      last = l;
       break;
     }
   }
   if (lastActiveLayer < 0) {
-    printf("No active layer with radius < %f is found, pt = %f\n", rmx, pt);
-    return kFALSE;
+    TRACEK(TraceK::kWarning, "No active layer with radius < %f is found, pt = %f\n", rmx, pt);
+    return trace.Fail(TraceK::kNoLayer);
   }
-  //
-  for (int il = 1; il <= lastActiveLayer; il++) {
-    CylLayerK* lr = (CylLayerK*)fLayers.At(il);
+  trace.record.lastActiveLayer = lastActiveLayer;
+  //
+  // The outward probe records the nominal trajectory: the covariance transport between
+  // the layers and the material noise, replayed by the Kalman passes at the layers where
+  // they are in the same frame, since the fake measurements do not move the track.
+  // It only depends on the track and on the transport geometry: with ts.fProbe.reuse the
+  // one of the previous track is taken as it is if they are the same
+  TrackProbeK& probe = ts.fProbe;
+  std::vector<LayerTransportK>& transport = probe.transport;
+  const Bool_t reuseProbe = probe.reuse && SameProbeK(probe, geo, pt, etaTr, mass, ts.fCharge, fBField, fMaxSnp, minRad);
+  if (reuseProbe) {
+    const double cov[15] = {0};
+    probTr.Set(probe.x, probe.alpha, probe.par, cov);
+    lastReachedLayer = probe.lastReachedLayer;
+  } else {
+    probe.valid = kFALSE;
+    transport.assign(nLayers, LayerTransportK());
+  }
+  for (int il = 1; !reuseProbe && il <= lastActiveLayer; il++) {
     AliExternalTrackParam probTrLast(probTr);
-    bool ok = PropagateToR(&probTrLast, lr->radius, bGauss, 1);
-    if (ok)
-      ok = probTrLast.CorrectForMeanMaterial(lr->radL, 0, mass, kTRUE);
-    if (ok && lr->xrho > 0) {
-      for (int ise = xrhosteps; ise--;) {
-        ok = probTrLast.CorrectForMeanMaterial(0, -lr->xrho / xrhosteps, mass, kTRUE);
-        if (!ok)
-          break;
-      }
+    LayerTransportK& tr = transport[il];
+    tr.transport.Reset();
+    bool ok = PropagateToR(&probTrLast, geo.radius[il], bGauss, 1, 0, &tr.transport);
+    double phi = 0;
+    if (ok) {
+      double pos[3];
+      probTrLast.GetXYZ(pos);
+      phi = TMath::ATan2(pos[1], pos[0]);
+      tr.x = probTrLast.GetX();
+      tr.alpha = probTrLast.GetAlpha();
+      memcpy(tr.parIn, probTrLast.GetParameter(), sizeof(tr.parIn));
+      memcpy(tr.msNoise, probTrLast.GetCovariance(), sizeof(tr.msNoise));
+      ok = CorrectForMeanMaterialK(probTrLast, geo.radL[il], 0, mass);
     }
-    if (ok && lr->radius > 1e-3 && !lr->isDead) {
+    if (ok) {
+      for (int ic = 15; ic--;)
+        tr.msNoise[ic] = probTrLast.GetCovariance()[ic] - tr.msNoise[ic];
+    }
+    if (ok && geo.xrho[il] > 0) {
+      double c44 = probTrLast.GetCovariance()[kPtI2];
+      ok = CorrectForEnergyLoss(&probTrLast, -geo.xrho[il], mass);
+      tr.elossNoise = probTrLast.GetCovariance()[kPtI2] - c44;
+    }
+    tr.ptInvOut = probTrLast.GetParameter()[kPtI];
+    if (ok && geo.radius[il] > 1e-3 && !geo.Is(il, LayerGeometryK::kDead)) {
       ok = probTrLast.Rotate(probTrLast.PhiPos()) && TMath::Abs(probTrLast.GetSnp()) < fMaxSnp;
     }
+    // same frame as the passes: rotated to the layer by PropagateToR, phi away from pi/2
+    tr.nominal = ok && geo.radius[il] > 0.5 && !geo.Is(il, LayerGeometryK::kVertex) &&
+                 TMath::Abs(TMath::Abs(phi) - TMath::Pi() / 2) >= 1e-3;
+    tr.cached = tr.nominal && tr.transport.valid && transport[il - 1].nominal;
     // was there a problem on this layer?
     if (!ok) { // may fail to reach target layer due to the eloss
-      Printf("Trying to recover track");
+      TRACEK(TraceK::kDebug, "Trying to recover track\n");
       double rad2 = probTr.GetX() * probTr.GetX() + probTr.GetY() * probTr.GetY();
       if (rad2 - minRad * minRad < kTrackingMargin * kTrackingMargin) { // check previously reached layer
-        return kFALSE;                                                  // did not reach min requested layer
+        return trace.Fail(TraceK::kMinRadius, il);                     // did not reach min requested layer
       } else {
         break;
       }
@@ -1609,12 +1951,22 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
     probTr = probTrLast;
     lastReachedLayer = il;
   }
-  Printf("Last active layer: %d, last reached layer: %d", lastActiveLayer, lastReachedLayer);
+  TRACEK(TraceK::kDebug, "Last active layer: %d, last reached layer: %d\n", lastActiveLayer, lastReachedLayer);
+  trace.record.lastReachedLayer = lastReachedLayer;
   // do tiny overshoot for the safety of the back-propagation
-  if (!PropagateToR(&probTr, probTr.GetX() + kTrackingMargin, bGauss, 1))
-    return kFALSE;
-  if (!probTr.Rotate(probTr.PhiPos()))
-    return kFALSE;
+  if (!reuseProbe) {
+    if (!PropagateToR(&probTr, probTr.GetX() + kTrackingMargin, bGauss, 1))
+      return trace.Fail(TraceK::kPropagation, lastReachedLayer);
+    if (!probTr.Rotate(probTr.PhiPos()))
+      return trace.Fail(TraceK::kRotation, lastReachedLayer);
+    if (probe.reuse) {
+      SetProbeK(probe, geo, pt, etaTr, mass, ts.fCharge, fBField, fMaxSnp, minRad);
+      probe.lastReachedLayer = lastReachedLayer;
+      probe.x = probTr.GetX();
+      probe.alpha = probTr.GetAlpha();
+      memcpy(probe.par, probTr.GetParameter(), sizeof(probe.par));
+    }
+  }
   //
   const double kLargeErr2Coord = 5 * 5;
   const double kLargeErr2Dir = 0.7 * 0.7;
@@ -1627,21 +1979,20 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
   probTr.CheckCovariance();
   //
   // Back-propagate the covariance matrix along the track.
-  CylLayerK* layer = 0;
   // inward propagation
+  Bool_t inwardNominal = kTRUE; // the track retraces the probe
   for (Int_t j = lastReachedLayer + 1; j--;) { // Layer loop
 
-    layer = (CylLayerK*)fLayers.At(j);
-
-    if (layer->radius > fMaxSeedRadius)
+    if (geo.radius[j] > fMaxSeedRadius) {
+      if (geo.xrho[j] > 0)
+        inwardNominal = kFALSE;
       continue; // no seeding beyond this radius
+    }
 
-    TString name(layer->GetName());
-    Bool_t isVertex = name.Contains("vertex");
-    Bool_t isTOF = name.Contains("tof");
+    Bool_t isVertex = geo.Is(j, LayerGeometryK::kVertex);
     //
-    if (!PropagateToR(&probTr, layer->radius, bGauss, -1))
-      return kFALSE; // exit(1);
+    if (!PropagateToR(&probTr, geo.radius[j], bGauss, -1))
+      return trace.Fail(TraceK::kPropagation, j);
     if (!isVertex) {
       double pos[3];
       probTr.GetXYZ(pos); // lab position
@@ -1649,54 +2000,54 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
       if (TMath::Abs(TMath::Abs(phi) - TMath::Pi() / 2) < 1e-3)
         phi = 0; // TMath::Sign(TMath::Pi()/2 - 1e-3,phi);
       if (!probTr.Rotate(phi)) {
-        printf("Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
-               phi, layer->radius, pos[0], pos[1], pos[2], pt);
-        probTr.Print();
-        return kFALSE; // exit(1);
+        TRACEK(TraceK::kWarning, "Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
+               phi, geo.radius[j], pos[0], pos[1], pos[2], pt);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return trace.Fail(TraceK::kRotation, j);
       }
     }
     // save inward parameters at this layer: before the update!
-    new (saveParInward[j]) AliExternalTrackParam(probTr);
+    ts.SetPar(TrackSol::kParInw, j, AsTrackParK(probTr));
     if (verboseR) {
-      printf("SaveInw %d (%f)  ", j, layer->radius);
+      printf("SaveInw %d (%f)  ", j, geo.radius[j]);
       probTr.Print();
     }
     //
-    if (!isVertex && !isTOF && !layer->isDead) {
+    if (geo.IsMeasured(j)) {
       //
       // create fake measurement with the errors assigned to the layer
       // account for the measurement there
       double meas[2] = {probTr.GetY(), probTr.GetZ()};
-      double measErr2[3] = {layer->phiRes * layer->phiRes, 0, layer->zRes * layer->zRes};
+      double measErr2[3] = {geo.phiRes[j] * geo.phiRes[j], 0, geo.zRes[j] * geo.zRes[j]};
       //
       if (!probTr.Update(meas, measErr2)) {
-        printf("Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
+        TRACEK(TraceK::kWarning, "Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
                meas[0], meas[1], measErr2[0], measErr2[1], measErr2[2]);
-        probTr.Print();
-        return kFALSE; // exit(1);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return trace.Fail(TraceK::kUpdate, j);
       }
     }
     // correct for materials of this layer
     // note: if apart from MS we want also e.loss correction, the density*length should be provided as 2nd param
-    if (layer->radL > 0 && !probTr.CorrectForMeanMaterial(layer->radL, 0, mass, kTRUE)) {
-      printf("Failed to apply material correction, X/X0=%.4f\n", layer->radL);
-      probTr.Print();
-      return kFALSE; // exit(1);
-    }
-    if (layer->xrho > 0) { // correct in small steps
-      for (int ise = xrhosteps; ise--;) {
-        if (!probTr.CorrectForMeanMaterial(0, layer->xrho / xrhosteps, mass, kTRUE)) {
-          printf("Failed to apply material correction, xrho=%.4f\n", layer->xrho);
-          probTr.Print();
-          return kFALSE; // exit(1);
-        }
-      }
+    if (geo.radL[j] > 0 && !CorrectForMeanMaterialK(probTr, geo.radL[j], 0, mass)) {
+      TRACEK(TraceK::kWarning, "Failed to apply material correction, X/X0=%.4f\n", geo.radL[j]);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return trace.Fail(TraceK::kMaterial, j);
+    }
+    if (geo.xrho[j] > 0 && inwardNominal && transport[j].nominal) {
+      trPars[kPtI] = transport[j].parIn[kPtI]; // back to the probe momentum
+      trCov[kPtI2] += transport[j].elossNoise;
+      probTr.CheckCovariance();
+    } else if (geo.xrho[j] > 0 && !CorrectForEnergyLoss(&probTr, geo.xrho[j], mass)) {
+      TRACEK(TraceK::kWarning, "Failed to apply material correction, xrho=%.4f\n", geo.xrho[j]);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return trace.Fail(TraceK::kMaterial, j);
     }
   }
   
   // Track at the end of the inward pass
-  Printf("Track at the end of the inward pass:");
-  probTr.Print();
+  TRACEK(TraceK::kDebug, "Track at the end of the inward pass:\n");
+  TRACEK_DO(TraceK::kDebug, probTr.Print());
   //
   // BACKWORD TRACKING +++++++++++++++++
   // number of layers is quite low ... efficiency calculation was probably nonsense
@@ -1726,8 +2077,7 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
   // find first "active layer" - start tracking at the first active layer
   Int_t firstActiveLayer = 0;
   for (Int_t j = 0; j <= lastActiveLayer; j++) {
-    layer = (CylLayerK*)fLayers.At(j);
-    if (!(layer->isDead)) { // is alive
+    if (!geo.Is(j, LayerGeometryK::kDead)) { // is alive
       firstActiveLayer = j;
       break;
     }
@@ -1735,14 +2085,19 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
   // probTr.Rotate(0);
   for (Int_t j = 0; j <= lastReachedLayer; j++) { // Layer loop
     //
-    layer = (CylLayerK*)fLayers.At(j);
-    TString name(layer->GetName());
-    Bool_t isVertex = name.Contains("vertex");
-    Bool_t isTOF = name.Contains("tof");
-    if (!PropagateToR(&probTr, layer->radius, bGauss, 1))
-      return kFALSE; // exit(1);
+    const LayerTransportK& tr = transport[j];
+    Bool_t replay = inwardNominal && tr.nominal;
+    Bool_t isVertex = geo.Is(j, LayerGeometryK::kVertex);
+    if (replay && tr.cached) {
+      // transport recorded by the probe, already in the frame of the layer
+      double cov[15];
+      memcpy(cov, trCov, sizeof(cov));
+      tr.transport.Apply(cov);
+      probTr.Set(tr.x, tr.alpha, tr.parIn, cov);
+    } else if (!PropagateToR(&probTr, geo.radius[j], bGauss, 1))
+      return trace.Fail(TraceK::kPropagation, j);
     //
-    if (!isVertex) {
+    if (!isVertex && !(replay && tr.cached)) {
       // rotate to frame with X axis normal to the surface
       double pos[3];
       probTr.GetXYZ(pos); // lab position
@@ -1750,138 +2105,231 @@ Bool_t DetectorK::SolveTrack(TrackSol& ts)
       if (TMath::Abs(TMath::Abs(phi) - TMath::Pi() / 2) < 1e-3)
         phi = 0; // TMath::Sign(TMath::Pi()/2 - 1e-3,phi);
       if (!probTr.Rotate(phi)) {
-        printf("Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
-               phi, layer->radius, pos[0], pos[1], pos[2], pt);
-        probTr.Print();
-        return kFALSE; // exit(1);
+        TRACEK(TraceK::kWarning, "Failed to rotate to the frame (phi:%+.3f)of layer at %.2f at XYZ: %+.3f %+.3f %+.3f (pt=%+.3f)\n",
+               phi, geo.radius[j], pos[0], pos[1], pos[2], pt);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return trace.Fail(TraceK::kRotation, j);
       }
     }
     //
     // save outward parameters at this layer: before the update
-    new (saveParOutwardB[j]) AliExternalTrackParam(probTr);
+    ts.SetPar(TrackSol::kParOutB, j, AsTrackParK(probTr));
     //
-    // combined in-out prediction
-    new (saveParComb[j]) AliExternalTrackParam(*(AliExternalTrackParam*)saveParInward[j]);
-    double* covInw = (double*)((AliExternalTrackParam*)saveParInward[j])->GetCovariance();
-    double* covOut = (double*)probTr.GetCovariance();
-    double* covCmb = (double*)((AliExternalTrackParam*)saveParComb[j])->GetCovariance();
-    covCmb[0] = covInw[0] * covOut[0] / (covInw[0] + covOut[0]);
-    covCmb[2] = covInw[2] * covOut[2] / (covInw[2] + covOut[2]);
-    covCmb[1] = 0;
+    // combined in-out prediction, the outward one alone beyond the max seed radius
+    const TrackParK* parInw = ts.GetPar(TrackSol::kParInw, j);
+    if (parInw) {
+      TrackParK parCmb = *parInw;
+      const double* covInw = parInw->c;
+      const double* covOut = probTr.GetCovariance();
+      double* covCmb = parCmb.c;
+      covCmb[0] = covInw[0] * covOut[0] / (covInw[0] + covOut[0]);
+      covCmb[2] = covInw[2] * covOut[2] / (covInw[2] + covOut[2]);
+      covCmb[1] = 0;
+      ts.SetPar(TrackSol::kParCmb, j, parCmb);
+    } else
+      ts.SetPar(TrackSol::kParCmb, j, AsTrackParK(probTr));
     // create fake measurement with the errors assigned to the layer
     // account for the measurement there
-    if (!isVertex && !isTOF && !layer->isDead) {
+    if (geo.IsMeasured(j)) {
       double meas[2] = {probTr.GetY(), probTr.GetZ()};
-      double measErr2[3] = {layer->phiRes * layer->phiRes, 0, layer->zRes * layer->zRes};
+      double measErr2[3] = {geo.phiRes[j] * geo.phiRes[j], 0, geo.zRes[j] * geo.zRes[j]};
       //
       if (!probTr.Update(meas, measErr2)) {
-        printf("Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
+        TRACEK(TraceK::kWarning, "Failed to update the track by measurement {%.3f,%3f} err {%.3e %.3e %.3e}\n",
                meas[0], meas[1], measErr2[0], measErr2[1], measErr2[2]);
-        probTr.Print();
-        return kFALSE; // exit(1);
+        TRACEK_DO(TraceK::kWarning, probTr.Print());
+        return trace.Fail(TraceK::kUpdate, j);
       }
     }
     // note: if apart from MS we want also e.loss correction, the density*length should be provided as 2nd param
-    if (layer->radL > 0 && !probTr.CorrectForMeanMaterial(layer->radL, 0, mass, kTRUE)) {
-      printf("Failed to apply material correction, X/X0=%.4f\n", layer->radL);
-      probTr.Print();
-      return kFALSE; // exit(1);
-    }
-    if (layer->xrho > 0) { // correct in small steps
-      for (int ise = xrhosteps; ise--;) {
-        if (!probTr.CorrectForMeanMaterial(0, -layer->xrho / xrhosteps, mass, kTRUE)) {
-          printf("Failed to apply material correction, xrho=%.4f\n", -layer->xrho);
-          probTr.Print();
-          return kFALSE; // exit(1);
-        }
+    if (replay) {
+      // material noise of the probe, at the same parameters
+      for (int ic = 15; ic--;)
+        trCov[ic] += tr.msNoise[ic];
+      if (geo.xrho[j] > 0) {
+        trPars[kPtI] = tr.ptInvOut;
+        trCov[kPtI2] += tr.elossNoise;
       }
+      probTr.CheckCovariance();
+    } else if (geo.radL[j] > 0 && !CorrectForMeanMaterialK(probTr, geo.radL[j], 0, mass)) {
+      TRACEK(TraceK::kWarning, "Failed to apply material correction, X/X0=%.4f\n", geo.radL[j]);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return trace.Fail(TraceK::kMaterial, j);
     }
-    // save outward parameters at this layer: after the update
-    new (saveParOutwardA[j]) AliExternalTrackParam(probTr);
-    //
-    // good hit probability calculation
-    if (!isVertex && !layer->isDead) {
-      AliExternalTrackParam* trCmb = (AliExternalTrackParam*)ts.fTrackCmb[j];
-      double sigYCmb = TMath::Sqrt(trCmb->GetSigmaY2() + layer->phiRes * layer->phiRes);
-      double sigZCmb = TMath::Sqrt(trCmb->GetSigmaZ2() + layer->zRes * layer->zRes);
-      fGoodHitProb[j] = ProbGoodChiSqHit(layer->radius * 100., sigYCmb * 100., sigZCmb * 100.);
-      if (!isTOF)
-        fGoodHitProb[0] *= fGoodHitProb[j];
+    if (!replay && geo.xrho[j] > 0 && !CorrectForEnergyLoss(&probTr, -geo.xrho[j], mass)) {
+      TRACEK(TraceK::kWarning, "Failed to apply material correction, xrho=%.4f\n", -geo.xrho[j]);
+      TRACEK_DO(TraceK::kWarning, probTr.Print());
+      return trace.Fail(TraceK::kMaterial, j);
     }
+    // save outward parameters at this layer: after the update
+    ts.SetPar(TrackSol::kParOutA, j, AsTrackParK(probTr));
   }
   //
-  probTr.SetUseLogTermMS(kFALSE); // Reset of MS term usage to avoid problems since its static
+  // good hit probability calculation
+  CalcGoodHitProb(ts);
   //
   return kTRUE;
 }
 
+Int_t DetectorK::GetCmbSigma2(const TrackSol& ts, Double_t* sigY2, Double_t* sigZ2) const
+{
+  //
+  // Y and Z variances of the combined track solution at each layer,
+  // negative for the layers the track did not reach; returns the number of layers
+  //
+  Int_t nLayers = TMath::Min(fLayers.GetEntries(), (Int_t)kMaxNumberOfDetectors);
+  for (Int_t j = 0; j < nLayers; j++) {
+    const TrackParK* trCmb = ts.GetPar(TrackSol::kParCmb, j);
+    sigY2[j] = trCmb ? trCmb->GetSigmaY2() : -1.;
+    sigZ2[j] = trCmb ? trCmb->GetSigmaZ2() : -1.;
+  }
+  return nLayers;
+}
+
+void DetectorK::CalcGoodHitProb(TrackSol& ts) const
+{
+  //
+  // Good hit probabilities from the combined track solution of SolveTrack.
+  // Only this part depends on the multiplicity: after a change of ts.fdNdEta
+  // there is no need to solve the track again
+  //
+  Double_t sigY2[kMaxNumberOfDetectors], sigZ2[kMaxNumberOfDetectors];
+  Int_t nLayers = GetCmbSigma2(ts, sigY2, sigZ2);
+  CalcGoodHitProb(ts, nLayers, sigY2, sigZ2);
+}
+
+void DetectorK::CalcGoodHitProb(TrackSol& ts, Int_t nLayers, const Double_t* sigY2, const Double_t* sigZ2) const
+{
+  //
+  // Good hit probabilities for the multiplicity of ts, given the Y and Z variances
+  // of the combined track at each layer (negative for the layers the track did not reach)
+  //
+  ts.fGoodHitProb.Set(kMaxNumberOfDetectors);
+  FillGoodHitProb(ts.fGoodHitProb.GetArray(), nLayers, sigY2, sigZ2, ts.fdNdEta < 0 ? fdNdEtaCent : ts.fdNdEta);
+}
+
+void DetectorK::UpdateGoodHitProb(const TrackSol& ts)
+{
+  //
+  // Good hit probabilities from the combined track solution of SolveTrack,
+  // for the current multiplicity of the detector
+  //
+  Double_t sigY2[kMaxNumberOfDetectors], sigZ2[kMaxNumberOfDetectors];
+  Int_t nLayers = GetCmbSigma2(ts, sigY2, sigZ2);
+  UpdateGoodHitProb(nLayers, sigY2, sigZ2);
+}
+
+void DetectorK::UpdateGoodHitProb(Int_t nLayers, const Double_t* sigY2, const Double_t* sigZ2)
+{
+  //
+  // Good hit probabilities for the current multiplicity of the detector, given the Y and Z
+  // variances of the combined track at each layer (negative for the layers the track did not reach)
+  //
+  FillGoodHitProb(fGoodHitProb, nLayers, sigY2, sigZ2, fdNdEtaCent);
+}
+
+void DetectorK::FillGoodHitProb(Double_t* prob, Int_t nLayers, const Double_t* sigY2, const Double_t* sigZ2, Int_t dNdEtaCent) const
+{
+  //
+  // Fills the kMaxNumberOfDetectors good hit probabilities of prob
+  //
+  for (int i = 0; i < kMaxNumberOfDetectors; ++i)
+    prob[i] = -1.;
+  prob[0] = 1.; // we use layer zero to accumulate
+  //
+  LayerGeometryK geoNow;
+  const LayerGeometryK& geo = GetGeometry(geoNow);
+  nLayers = TMath::Min(nLayers, TMath::Min(geo.GetEntries(), (Int_t)kMaxNumberOfDetectors));
+  for (Int_t j = 0; j < nLayers; j++) {
+    if (sigY2[j] < 0)
+      continue;
+    if (!geo.Is(j, LayerGeometryK::kVertex | LayerGeometryK::kDead)) {
+      double sigYCmb = TMath::Sqrt(sigY2[j] + geo.phiRes[j] * geo.phiRes[j]);
+      double sigZCmb = TMath::Sqrt(sigZ2[j] + geo.zRes[j] * geo.zRes[j]);
+      prob[j] = ProbGoodChiSqHit(geo.radius[j] * 100., sigYCmb * 100., sigZCmb * 100., dNdEtaCent);
+      if (!geo.Is(j, LayerGeometryK::kTOF))
+        prob[0] *= prob[j];
+    }
+  }
+}
+
 Bool_t DetectorK::CalcITSEff(TrackSol& ts, Bool_t verbose)
 {
-  // Prepare Probability Kombinations
+  // Hit probabilities per layer
   Int_t nLayer = fNumberOfActiveITSLayers;
   Int_t base = 3; // null, fake, correct
-  Int_t komb = (Int_t)TMath::Power(base, nLayer);
   TMatrixD probLayInw(base, fNumberOfActiveITSLayers);
   TMatrixD probLayOut(base, fNumberOfActiveITSLayers);
   TMatrixD probLayCmb(base, fNumberOfActiveITSLayers);
-  TMatrixD probKomb(komb, nLayer);
-  for (Int_t num = 0; num < komb; num++) {
-    for (Int_t l = nLayer; l--;) {
-      Int_t pow = ((Int_t)TMath::Power(base, l + 1));
-      probKomb(num, nLayer - 1 - l) = (num % pow) / ((Int_t)TMath::Power(base, l));
-    }
-  }
   int nITSAct = 0, ilr = 0;
   if (verbose)
     printf("Lr:  \t rad   x/x0   h.dens | Inw sY sZ  ->  Pr.Corr | Out sY sZ  ->  Pr.Corr | Cmb sY sZ  ->  Pr.Corr |\n");
 
+  LayerGeometryK geoNow;
+  const LayerGeometryK& geo = GetGeometry(geoNow);
   while (nITSAct < nLayer) {
-    CylLayerK* l = (CylLayerK*)fLayers.At(ilr);
-    TString name(l->GetName());
-    if (l->isDead || !IsITSLayer(name)) {
+    if (geo.Is(ilr, LayerGeometryK::kDead) || !geo.Is(ilr, LayerGeometryK::kITS)) {
       ilr++;
       continue;
     }
     //
-    AliExternalTrackParam* trInw = (AliExternalTrackParam*)ts.fTrackInw[ilr];
-    AliExternalTrackParam* trOut = (AliExternalTrackParam*)ts.fTrackOutB[ilr];
-    AliExternalTrackParam* trCmb = (AliExternalTrackParam*)ts.fTrackCmb[ilr];
+    const TrackParK* trInw = ts.GetPar(TrackSol::kParInw, ilr);
+    const TrackParK* trOut = ts.GetPar(TrackSol::kParOutB, ilr);
+    const TrackParK* trCmb = ts.GetPar(TrackSol::kParCmb, ilr);
     //
-    double sigYInw = TMath::Sqrt(trInw->GetSigmaY2() + l->phiRes * l->phiRes);
-    double sigZInw = TMath::Sqrt(trInw->GetSigmaZ2() + l->zRes * l->zRes);
-    probLayInw(2, nITSAct) = ProbGoodChiSqPlusConfHit(l->radius, l->eff, sigYInw, sigZInw); // corr hit prob
-    probLayInw(0, nITSAct) = ProbNullChiSqPlusConfHit(l->radius, l->eff, sigYInw, sigZInw); // no hit prob
+    double sigYInw = 0, sigZInw = 0;
+    if (trInw) {
+      sigYInw = TMath::Sqrt(trInw->GetSigmaY2() + geo.phiRes[ilr] * geo.phiRes[ilr]);
+      sigZInw = TMath::Sqrt(trInw->GetSigmaZ2() + geo.zRes[ilr] * geo.zRes[ilr]);
+      probLayInw(2, nITSAct) = ProbGoodChiSqPlusConfHit(geo.radius[ilr], geo.eff[ilr], sigYInw, sigZInw); // corr hit prob
+      probLayInw(0, nITSAct) = ProbNullChiSqPlusConfHit(geo.radius[ilr], geo.eff[ilr], sigYInw, sigZInw); // no hit prob
+    } else { // layer not reached: no hit
+      probLayInw(2, nITSAct) = 0;
+      probLayInw(0, nITSAct) = 1;
+    }
     probLayInw(1, nITSAct) = 1. - probLayInw(2, nITSAct) - probLayInw(0, nITSAct);
     //
-    double sigYOut = TMath::Sqrt(trOut->GetSigmaY2() + l->phiRes * l->phiRes);
-    double sigZOut = TMath::Sqrt(trOut->GetSigmaZ2() + l->zRes * l->zRes);
-    probLayOut(2, nITSAct) = ProbGoodChiSqPlusConfHit(l->radius, l->eff, sigYOut, sigZOut); // corr hit prob
-    probLayOut(0, nITSAct) = ProbNullChiSqPlusConfHit(l->radius, l->eff, sigYOut, sigZOut); // no hit prob
+    double sigYOut = 0, sigZOut = 0;
+    if (trOut) {
+      sigYOut = TMath::Sqrt(trOut->GetSigmaY2() + geo.phiRes[ilr] * geo.phiRes[ilr]);
+      sigZOut = TMath::Sqrt(trOut->GetSigmaZ2() + geo.zRes[ilr] * geo.zRes[ilr]);
+      probLayOut(2, nITSAct) = ProbGoodChiSqPlusConfHit(geo.radius[ilr], geo.eff[ilr], sigYOut, sigZOut); // corr hit prob
+      probLayOut(0, nITSAct) = ProbNullChiSqPlusConfHit(geo.radius[ilr], geo.eff[ilr], sigYOut, sigZOut); // no hit prob
+    } else { // layer not reached: no hit
+      probLayOut(2, nITSAct) = 0;
+      probLayOut(0, nITSAct) = 1;
+    }
     probLayOut(1, nITSAct) = 1. - probLayOut(2, nITSAct) - probLayOut(0, nITSAct);
     //
-    double sigYCmb = TMath::Sqrt(trCmb->GetSigmaY2() + l->phiRes * l->phiRes);
-    double sigZCmb = TMath::Sqrt(trCmb->GetSigmaZ2() + l->zRes * l->zRes);
-    probLayCmb(2, nITSAct) = ProbGoodChiSqPlusConfHit(l->radius, l->eff, sigYCmb, sigZCmb); // corr hit prob
-    probLayCmb(0, nITSAct) = ProbNullChiSqPlusConfHit(l->radius, l->eff, sigYCmb, sigZCmb); // no hit prob
+    double sigYCmb = 0, sigZCmb = 0;
+    if (trCmb) {
+      sigYCmb = TMath::Sqrt(trCmb->GetSigmaY2() + geo.phiRes[ilr] * geo.phiRes[ilr]);
+      sigZCmb = TMath::Sqrt(trCmb->GetSigmaZ2() + geo.zRes[ilr] * geo.zRes[ilr]);
+      probLayCmb(2, nITSAct) = ProbGoodChiSqPlusConfHit(geo.radius[ilr], geo.eff[ilr], sigYCmb, sigZCmb); // corr hit prob
+      probLayCmb(0, nITSAct) = ProbNullChiSqPlusConfHit(geo.radius[ilr], geo.eff[ilr], sigYCmb, sigZCmb); // no hit prob
+    } else { // layer not reached: no hit
+      probLayCmb(2, nITSAct) = 0;
+      probLayCmb(0, nITSAct) = 1;
+    }
     probLayCmb(1, nITSAct) = 1. - probLayCmb(2, nITSAct) - probLayCmb(0, nITSAct);
     //
     if (verbose) {
       const double kCnv = 1e4;
       printf("%s:\t%5.1f %.4f %7.0f | %6.0f %6.0f -> %.3f | %6.0f %6.0f -> %.3f | %6.0f %6.0f -> %.3f --> %.3f --> %.3f \n",
-             l->GetName(), l->radius, l->radL, HitDensity(l->radius),
+             fLayers.At(ilr)->GetName(), geo.radius[ilr], geo.radL[ilr], HitDensity(geo.radius[ilr]),
              sigYInw * kCnv, sigZInw * kCnv, probLayInw(2, nITSAct),
              sigYOut * kCnv, sigZOut * kCnv, probLayOut(2, nITSAct),
              sigYCmb * kCnv, sigZCmb * kCnv, probLayCmb(2, nITSAct),
-             ProbGoodHit(l->radius, sigYCmb, sigZCmb),
-             ProbGoodChiSqHit(l->radius, sigYCmb, sigZCmb));
+             trCmb ? ProbGoodHit(geo.radius[ilr], sigYCmb, sigZCmb) : 0.,
+             trCmb ? ProbGoodChiSqHit(geo.radius[ilr], sigYCmb, sigZCmb) : 0.);
     }
     nITSAct++;
     ilr++;
     //
   }
-  PrepareEffFakeKombinations(&probKomb, &probLayInw, nLayer, (double*)ts.fProb[TrackSol::kInw]);
-  PrepareEffFakeKombinations(&probKomb, &probLayOut, nLayer, (double*)ts.fProb[TrackSol::kOut]);
-  PrepareEffFakeKombinations(&probKomb, &probLayCmb, nLayer, (double*)ts.fProb[TrackSol::kCmb]);
+  PrepareEffFakeKombinations(&probLayInw, nLayer, (double*)ts.fProb[TrackSol::kInw]);
+  PrepareEffFakeKombinations(&probLayOut, nLayer, (double*)ts.fProb[TrackSol::kOut]);
+  PrepareEffFakeKombinations(&probLayCmb, nLayer, (double*)ts.fProb[TrackSol::kCmb]);
   if (verbose) {
     printf("Corr/Fake probs:             |    %.4f/%.4f       |     %.4f/%.4f      |     %.4f/%.4f\n",
            ts.fProb[TrackSol::kInw][0], ts.fProb[TrackSol::kInw][1],
@@ -1937,7 +2385,7 @@ Bool_t DetectorK::ExtrapolateToR(AliExternalTrackParam* probTr, double rTgt, dou
     CylLayerK* l = (CylLayerK*)fLayers.At(ilr);
     if (!PropagateToR(probTr, l->radius, bGauss, dir))
       return kFALSE;
-    if (!probTr->CorrectForMeanMaterial(l->radL, 0, mass, kTRUE))
+    if (!CorrectForMeanMaterialK(*probTr, l->radL, 0, mass))
       return kFALSE;
     if (verboseR) {
       printf("\nGot to layer %d | ", ilr);
@@ -1956,13 +2404,26 @@ Bool_t DetectorK::ExtrapolateToR(AliExternalTrackParam* probTr, double rTgt, dou
   return kTRUE;
 }
 
-TGraph* DetectorK::GetGraphMomentumResolution(Int_t color, Int_t linewidth)
+namespace
+{
+// graph of a result of the solved points of a scan
+TGraph* MakeScanGraph(const BilloirScanK& scan, const std::vector<Double_t>& res, Double_t scale = 1)
+{
+  TGraph* graph = new TGraph();
+  for (Int_t i = 0; i < scan.GetEntries(); i++)
+    if (scan.IsOK(i))
+      graph->SetPoint(graph->GetN(), scan.pt[i], res[i] * scale);
+  return graph;
+}
+} // namespace
+
+TGraph* DetectorK::GetGraphMomentumResolution(const BilloirScanK& scan, Int_t color, Int_t linewidth) const
 {
   //
   // returns the momentum resolution
   //
 
-  TGraph* graph = new TGraph(kNptBins, fTransMomenta, fMomentumRes);
+  TGraph* graph = MakeScanGraph(scan, scan.momentumRes);
   graph->SetTitle("Momentum Resolution .vs. Pt");
   //  graph->GetXaxis()->SetRangeUser(0.,5.0) ;
   graph->GetXaxis()->SetTitle("Transverse Momentum (GeV/c)");
@@ -1981,7 +2442,7 @@ TGraph* DetectorK::GetGraphMomentumResolution(Int_t color, Int_t linewidth)
   return graph;
 }
 
-TGraph* DetectorK::GetGraphPointingResolution(Int_t axis, Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphPointingResolution(const BilloirScanK& scan, Int_t axis, Int_t color, Int_t linewidth) const
 {
 
   // Returns the pointing resolution
@@ -1992,11 +2453,11 @@ TGraph* DetectorK::GetGraphPointingResolution(Int_t axis, Int_t color, Int_t lin
   TGraph* graph = 0;
 
   if (axis == 0) {
-    graph = new TGraph(kNptBins, fTransMomenta, fResolutionRPhi);
+    graph = MakeScanGraph(scan, scan.resolutionRPhi);
     graph->SetTitle("R-#phi Pointing Resolution .vs. Pt");
     graph->GetYaxis()->SetTitle("R-#phi Pointing Resolution (#mum)");
   } else {
-    graph = new TGraph(kNptBins, fTransMomenta, fResolutionZ);
+    graph = MakeScanGraph(scan, scan.resolutionZ);
     graph->SetTitle("Z Pointing Resolution .vs. Pt");
     graph->GetYaxis()->SetTitle("Z Pointing Resolution (#mum)");
   }
@@ -2016,7 +2477,7 @@ TGraph* DetectorK::GetGraphPointingResolution(Int_t axis, Int_t color, Int_t lin
   return graph;
 }
 
-TGraph* DetectorK::GetGraphLayerInfo(Int_t plot, Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphLayerInfo(const BilloirScanK& scan, Int_t plot, Int_t color, Int_t linewidth) const
 {
 
   // Returns the pointing resolution
@@ -2025,19 +2486,23 @@ TGraph* DetectorK::GetGraphLayerInfo(Int_t plot, Int_t color, Int_t linewidth)
   // plot = 2 ... prolongation efficiency (outwards)
   //
 
-  Double_t fDet[kNptBins];
-  for (Int_t i = 0; i < kNptBins; i++) { // pt loop
+  if (scan.detLayer < 0) {
+    printf("No layer for the details is set (kDetLayer)\n");
+    return 0;
+  }
+  TGraph* graph = new TGraph();
+  for (Int_t i = 0; i < scan.GetEntries(); i++) { // pt loop
+    if (!scan.IsOK(i))
+      continue;
     if (plot == 0)
-      fDet[i] = fResolutionRPhiLay[i] * 1e6; // in microns
+      graph->SetPoint(graph->GetN(), scan.pt[i], scan.GetDetPointRes(i)[scan.detLayer] * 1e6); // in microns
     else if (plot == 1)
-      fDet[i] = fResolutionZLay[i] * 1e6; // in microns
+      graph->SetPoint(graph->GetN(), scan.pt[i], scan.GetDetPointZRes(i)[scan.detLayer] * 1e6); // in microns
     else
-      fDet[i] = fEfficProlongLay[i] * 100; // in percent
+      graph->SetPoint(graph->GetN(), scan.pt[i], scan.efficProlongLay[i] * 100); // in percent
   }
 
-  CylLayerK* l = (CylLayerK*)fLayers.At(kDetLayer);
-  TGraph* graph = 0;
-  graph = new TGraph(kNptBins, fTransMomenta, fDet);
+  CylLayerK* l = (CylLayerK*)fLayers.At(scan.detLayer);
   if (plot == 0) {
     graph->SetTitle(Form("R-#phi Pointing Resolution onto layer \"%s\"", (char*)l->GetName()));
     graph->GetYaxis()->SetTitle("R-#phi Pointing Resolution (#mum)");
@@ -2064,7 +2529,7 @@ TGraph* DetectorK::GetGraphLayerInfo(Int_t plot, Int_t color, Int_t linewidth)
   return graph;
 }
 
-TGraph* DetectorK::GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphPointingResolutionTeleEqu(const BilloirScanK& scan, Int_t axis, Int_t color, Int_t linewidth) const
 {
   //
   // returns the Pointing resolution (accoring to Telescope equation)
@@ -2072,7 +2537,8 @@ TGraph* DetectorK::GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, In
   // axis =1 ... in z
   //
 
-  Double_t resolution[kNptBins];
+  const Int_t nPt = scan.GetEntries();
+  std::vector<Double_t> resolution(nPt);
 
   Double_t layerResolution[2];
   Double_t layerRadius[2];
@@ -2101,9 +2567,9 @@ TGraph* DetectorK::GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, In
   Double_t pt, momentum, thickness, aMCS;
   Double_t lambda = TMath::Pi() / 2.0 - 2.0 * TMath::ATan(TMath::Exp(-1 * fAvgRapidity));
 
-  for (Int_t i = 0; i < kNptBins; i++) {
+  for (Int_t i = 0; i < nPt; i++) {
     // Reference data as if first two layers were acting all alone
-    pt = fTransMomenta[i];
+    pt = scan.pt[i];
     momentum = pt / TMath::Cos(lambda); // Total momentum
     resolution[i] = layerResolution[0] * layerResolution[0] * layerRadius[1] * layerRadius[1] + layerResolution[1] * layerResolution[1] * layerRadius[0] * layerRadius[0];
     resolution[i] /= (layerRadius[1] - layerRadius[0]) * (layerRadius[1] - layerRadius[0]);
@@ -2113,7 +2579,7 @@ TGraph* DetectorK::GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, In
     resolution[i] = TMath::Sqrt(resolution[i]) * 10000.0; // result in microns
   }
 
-  TGraph* graph = new TGraph(kNptBins, fTransMomenta, resolution);
+  TGraph* graph = new TGraph(nPt, scan.pt.data(), resolution.data());
 
   if (axis == 0) {
     graph->SetTitle("RPhi Pointing Resolution .vs. Pt");
@@ -2138,16 +2604,16 @@ TGraph* DetectorK::GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, In
   return graph;
 }
 
-TGraph* DetectorK::GetGraphRecoEfficiency(Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphRecoEfficiency(const BilloirScanK& scan, Int_t color, Int_t linewidth) const
 {
   //
-  Double_t particleEfficiency[kNptBins] = {0};
+  std::vector<Double_t> particleEfficiency(scan.GetEntries());
 
-  for (Int_t j = 0; j < kNptBins; j++) {
-    particleEfficiency[j] = fEfficiency[j] * 100;
+  for (Int_t j = 0; j < scan.GetEntries(); j++) {
+    particleEfficiency[j] = scan.efficiency[j] * 100;
   }
 
-  TGraph* graph = new TGraph(kNptBins, fTransMomenta, particleEfficiency); // choosen mass
+  TGraph* graph = new TGraph(scan.GetEntries(), scan.pt.data(), particleEfficiency.data()); // choosen mass
   graph->SetLineWidth(1);
 
   graph->GetXaxis()->SetTitle("Transverse Momentum (GeV/c)");
@@ -2167,16 +2633,16 @@ TGraph* DetectorK::GetGraphRecoEfficiency(Int_t color, Int_t linewidth)
   return graph;
 }
 
-TGraph* DetectorK::GetGraphRecoFakes(Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphRecoFakes(const BilloirScanK& scan, Int_t color, Int_t linewidth) const
 {
   //
 
-  Double_t particleFake[kNptBins]; // with chosen particle mass
-  for (Int_t j = 0; j < kNptBins; j++) {
-    particleFake[j] = fFake[j] * 100;
+  std::vector<Double_t> particleFake(scan.GetEntries()); // with chosen particle mass
+  for (Int_t j = 0; j < scan.GetEntries(); j++) {
+    particleFake[j] = scan.fake[j] * 100;
   }
   TGraph* graph = 0;
-  graph = new TGraph(kNptBins, fTransMomenta, particleFake); // choosen mass
+  graph = new TGraph(scan.GetEntries(), scan.pt.data(), particleFake.data()); // choosen mass
   graph->SetLineWidth(1);
 
   graph->GetXaxis()->SetTitle("Transverse Momentum (GeV/c)");
@@ -2196,18 +2662,18 @@ TGraph* DetectorK::GetGraphRecoFakes(Int_t color, Int_t linewidth)
   return graph;
 }
 
-TGraph* DetectorK::GetGraphRecoPurity(Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphRecoPurity(const BilloirScanK& scan, Int_t color, Int_t linewidth) const
 {
   //
 
-  Double_t particleFake[kNptBins]; // with chosen particle mass
-  for (Int_t j = 0; j < kNptBins; j++) {
-    particleFake[j] = fFake[j] * 100;
+  std::vector<Double_t> particleFake(scan.GetEntries()); // with chosen particle mass
+  for (Int_t j = 0; j < scan.GetEntries(); j++) {
+    particleFake[j] = scan.fake[j] * 100;
     // NOTE: Decay factor (see kaon) should be included to be realiable
   }
 
   TGraph* graph = 0;
-  graph = new TGraph(kNptBins, fTransMomenta, particleFake); // choosen mass
+  graph = new TGraph(scan.GetEntries(), scan.pt.data(), particleFake.data()); // choosen mass
   graph->SetLineWidth(1);
 
   graph->GetXaxis()->SetTitle("Transverse Momentum (GeV/c)");
@@ -2227,7 +2693,7 @@ TGraph* DetectorK::GetGraphRecoPurity(Int_t color, Int_t linewidth)
   return graph;
 }
 
-TGraph* DetectorK::GetGraphImpactParam(Int_t mode, Int_t axis, Int_t color, Int_t linewidth)
+TGraph* DetectorK::GetGraphImpactParam(const BilloirScanK& scan, Int_t mode, Int_t axis, Int_t color, Int_t linewidth) const
 {
   //
   // returns the Impact Parameter d0 (convolution of pointing resolution and vtx resolution)
@@ -2241,7 +2707,7 @@ TGraph* DetectorK::GetGraphImpactParam(Int_t mode, Int_t axis, Int_t color, Int_
   TFormula vtxResRPhi("vtxRes", "35/(x+1)+10"); //
   TFormula vtxResZ("vtxResZ", "600/(x+6)+10");  //
 
-  TGraph* trackRes = GetGraphPointingResolution(axis, 1);
+  TGraph* trackRes = GetGraphPointingResolution(scan, axis, 1);
   Double_t* pt = trackRes->GetX();
   Double_t* trRes = trackRes->GetY();
   for (Int_t ip = 0; ip < trackRes->GetN(); ip++) {
@@ -2495,7 +2961,7 @@ Bool_t DetectorK::GetXatLabR(AliExternalTrackParam* tr, Double_t r, Double_t& x,
     x = 0;
     return kTRUE;
   }
-  tr->Print();
+  TRACEK_DO(TraceK::kDebug, tr->Print());
 
   const double* pars = tr->GetParameter();
   const Double_t &fy = pars[0], &sn = pars[2];
@@ -2658,85 +3124,78 @@ Bool_t DetectorK::GetXatLabR(AliExternalTrackParam* tr, Double_t r, Double_t& x,
   return kTRUE;
 }
 
-Double_t* DetectorK::PrepareEffFakeKombinations(TMatrixD* probKomb, TMatrixD* probLay, int nLayer, double* probs)
+Double_t* DetectorK::PrepareEffFakeKombinations(const TMatrixD* probLay, int nLayer, double* probs) const
 {
-
+  //
+  // Efficiency (at least fAtLeastCorr correct hits and no fake one) and fake probability
+  // (at least fAtLeastFake fake hits) of a track with at least fAtLeastHits hits, given the
+  // null (row 0), fake (1) and correct (2) hit probabilities of each of the nLayer layers.
+  // Rather than summing over the 3^nLayer outcomes, the distribution of the hit counts is
+  // built layer by layer. The counts are capped at the thresholds, all that the cuts need:
+  // O(nLayer^2) operations for the efficiency and, with the usual fAtLeastFake of 1, the fakes
+  //
   if (!probLay) {
     printf("Error: Layer tracking efficiencies not set \n");
     return 0;
   }
-
-  TMatrixD& tProbKomb = *probKomb;
-  TMatrixD& tProbLay = *probLay;
-
-  //  Int_t base = tProbLay.GetNcols(); // 3? null, fake, correct
-  //  Int_t nLayer = tProbKomb.GetNcols(); // nlayer? - number of ITS layers
-  Int_t komb = tProbKomb.GetNrows(); // 3^nlayer? - number of kombinations
-
-  // Fill probabilities
-
-  Double_t probEff = 0;
-  Double_t probFake = 0;
-  for (Int_t num = 0; num < komb; num++) {
-    Int_t flCorr = 0, flFake = 0, flNull = 0;
-    for (Int_t l = 0; l < nLayer; l++) {
-      if (tProbKomb(num, l) == 0)
-        flNull++;
-      else if (tProbKomb(num, l) == 1)
-        flFake++;
-      else if (tProbKomb(num, l) == 2)
-        flCorr++;
-      else
-        printf("Error: unexpected values in combinatorics table\n");
-    }
-
-    Int_t fkAtLeastHits = fAtLeastHits;
-    Int_t fkAtLeastCorr = fAtLeastCorr;
-    if (fAtLeastHits == -1)
-      fkAtLeastHits = nLayer; // all hits are "correct"
-    if (fAtLeastCorr == -1)
-      fkAtLeastCorr = nLayer; // all hits are "correct"
-    //
-    if (flCorr + flFake < fAtLeastHits)
-      continue;
-
-    if (flCorr >= fkAtLeastCorr && flFake == 0) { // at least correct but zero fake
-      Double_t probEffLayer = 1;
-      for (Int_t l = 0; l < nLayer; l++) {
-        probEffLayer *= tProbLay((Int_t)tProbKomb(num, l), l);
-        //	cout<<a(num,l)<<" ";
-      }
-      //      cout<<endl;
-      probEff += probEffLayer;
+  const TMatrixD& tProbLay = *probLay;
+
+  Int_t fkAtLeastCorr = fAtLeastCorr;
+  if (fAtLeastCorr == -1)
+    fkAtLeastCorr = nLayer; // all hits are "correct"
+  // thresholds as counts in [0, nLayer + 1], nLayer + 1 being out of reach
+  const Int_t kHits = TMath::Min(TMath::Max(fAtLeastHits, 0), nLayer + 1);
+  const Int_t kCorr = TMath::Min(TMath::Max(TMath::Max(fkAtLeastCorr, fAtLeastHits), 0), nLayer + 1);
+  const Int_t kFake = TMath::Min(TMath::Max(fAtLeastFake, 0), nLayer + 1);
+
+  // efficiency: without fake hits, the number of hits is the number of correct ones
+  std::vector<Double_t> pCorr(kCorr + 1, 0.), pCorrNext(kCorr + 1);
+  pCorr[0] = 1.;
+  // fakes: probability of (min(number of fake hits, kFake), min(number of hits, kHits))
+  std::vector<Double_t> pFake((kFake + 1) * (kHits + 1), 0.), pFakeNext(pFake.size());
+  pFake[0] = 1.;
+
+  for (Int_t l = 0; l < nLayer; l++) {
+    const Double_t pNull = tProbLay(0, l), pFk = tProbLay(1, l), pCr = tProbLay(2, l);
+    std::fill(pCorrNext.begin(), pCorrNext.end(), 0.);
+    for (Int_t c = 0; c <= kCorr; c++) {
+      pCorrNext[c] += pCorr[c] * pNull;
+      pCorrNext[TMath::Min(c + 1, kCorr)] += pCorr[c] * pCr;
     }
-
-    if (flFake >= fAtLeastFake) {
-      Double_t probFakeLayer = 1;
-      for (Int_t l = 0; l < nLayer; l++) {
-        probFakeLayer *= tProbLay((Int_t)tProbKomb(num, l), l);
-        //	cout<<a(num,l)<<" ";
+    pCorr.swap(pCorrNext);
+    std::fill(pFakeNext.begin(), pFakeNext.end(), 0.);
+    for (Int_t f = 0; f <= kFake; f++) {
+      for (Int_t h = 0; h <= kHits; h++) {
+        const Double_t p = pFake[f * (kHits + 1) + h];
+        const Int_t h1 = TMath::Min(h + 1, kHits);
+        pFakeNext[f * (kHits + 1) + h] += p * pNull;
+        pFakeNext[f * (kHits + 1) + h1] += p * pCr;
+        pFakeNext[TMath::Min(f + 1, kFake) * (kHits + 1) + h1] += p * pFk;
       }
-      //      cout<<endl;
-      probFake += probFakeLayer;
     }
+    pFake.swap(pFakeNext);
   }
+
   if (!probs)
     probs = new Double_t[2];
-  probs[0] = probEff;
-  probs[1] = probFake;
+  probs[0] = pCorr[kCorr];
+  probs[1] = pFake[kFake * (kHits + 1) + kHits];
   return probs;
 }
 
 //____________________________________
-Bool_t DetectorK::PropagateToR(AliExternalTrackParam* trc, double r, double b, int dir, double maxStep)
+Bool_t DetectorK::PropagateToR(AliExternalTrackParam* trc, double r, double b, int dir, double maxStep, TransportJacobianK* jac)
 {
   // go to radius R
+  // If jac is given, the covariance transport of the exact steps and rotations is
+  // accumulated in it, and it is flagged invalid if the small steps had to be used
   //
   double xToGo = 0;
   double rr = r * r;
   int iter = 0;
   const double kTiny = 1e-6;
   const Double_t kEpsilonX = 0.00001, kEpsilonR = 0.01;
+  const Double_t kMaxStepNearSingularity = 2.0;
   //
   if (verboseR) {
     printf("Prop to %f d=%d  ", r, dir);
@@ -2745,16 +3204,21 @@ Bool_t DetectorK::PropagateToR(AliExternalTrackParam* trc, double r, double b, i
   while (1) {
 
     if (!GetXatLabR(trc, r, xToGo, b, dir)) {
-      trc->Print();
-      Printf("r %f, xToGo %f dir %d, b %f", r, xToGo, dir, b);
-      printf("Track with pt=%f cannot reach radius %f\n", trc->Pt(), r);
+      TRACEK_DO(TraceK::kWarning, trc->Print());
+      TRACEK(TraceK::kWarning, "r %f, xToGo %f dir %d, b %f\n", r, xToGo, dir, b);
+      TRACEK(TraceK::kWarning, "Track with pt=%f cannot reach radius %f\n", trc->Pt(), r);
       return kFALSE;
     }
 
     Double_t xpos = trc->GetX();
     dir = (xpos < xToGo) ? 1 : -1;
-    while ((xToGo - xpos) * dir > kEpsilonX) {
-      Double_t step = dir * TMath::Min(TMath::Abs(xToGo - xpos), maxStep);
+    if (maxStep <= 0 && (xToGo - xpos) * dir > kEpsilonX && PropagateToX(trc, xToGo, b, jac))
+      xpos = trc->GetX();
+    if (jac && (xToGo - xpos) * dir > kEpsilonX)
+      jac->valid = kFALSE;
+    const double step0 = maxStep > 0 ? maxStep : kMaxStepNearSingularity;
+    while ((xToGo - xpos) * dir > kEpsilonX) { // small steps, or too close to |snp| = 1 for a single one
+      Double_t step = dir * TMath::Min(TMath::Abs(xToGo - xpos), step0);
       Double_t x = xpos + step;
       //      Double_t xyz0[3],xyz1[3],param[7];
       //      trc->GetXYZ(xyz0);   //starting global position
@@ -2766,24 +3230,24 @@ Bool_t DetectorK::PropagateToR(AliExternalTrackParam* trc, double r, double b, i
     double drreal = r - TMath::Sqrt(xpos * xpos + trc->GetY() * trc->GetY());
     if (!iter && ((dir > 0 && drreal > kEpsilonR) || (dir < 0 && drreal < -kEpsilonR))) { // apparently the phase changes by more than pi/2
       iter++;
-      if (!trc->Rotate(trc->Phi())) {
-        printf("Failed to rotate to track local frame %f in the large phase change mode| ", trc->Phi());
-        trc->Print();
+      if (!RotateK(trc, trc->Phi(), jac)) {
+        TRACEK(TraceK::kWarning, "Failed to rotate to track local frame %f in the large phase change mode| ", trc->Phi());
+        TRACEK_DO(TraceK::kWarning, trc->Print());
         return kFALSE;
       }
       continue; // another iteration
     }
     //  printf("Rtgt=%f Rreal=%f\n",r,rreal);
     if (r > 0.5) {
-      if (!trc->Rotate(trc->PhiPos())) {
-        printf("Failed to rotate to layer local frame %f | ", trc->PhiPos());
-        trc->Print();
+      if (!RotateK(trc, trc->PhiPos(), jac)) {
+        TRACEK(TraceK::kWarning, "Failed to rotate to layer local frame %f | ", trc->PhiPos());
+        TRACEK_DO(TraceK::kWarning, trc->Print());
         return kFALSE;
       }
     } else {
-      if (!trc->Rotate(trc->Phi())) {
-        printf("Failed to rotate to track local frame %f | ", trc->Phi());
-        trc->Print();
+      if (!RotateK(trc, trc->Phi(), jac)) {
+        TRACEK(TraceK::kWarning, "Failed to rotate to track local frame %f | ", trc->Phi());
+        TRACEK_DO(TraceK::kWarning, trc->Print());
         return kFALSE;
       }
     }
@@ -2792,8 +3256,144 @@ Bool_t DetectorK::PropagateToR(AliExternalTrackParam* trc, double r, double b, i
   return kTRUE;
 }
 
+//____________________________________
+Bool_t DetectorK::PropagateToX(AliExternalTrackParam* trc, double xk, double b, TransportJacobianK* stepJac)
+{
+  // propagate to the plane X=xk in a single step along the exact helix, transporting the
+  // covariance matrix with the exact jacobian, unlike AliExternalTrackParam::PropagateTo
+  // which linearises it at the start of the step. Returns kFALSE, leaving the track
+  // untouched, if the track does not get there or gets too close to |snp| = 1.
+  //
+  // With u = crv*dx the curvature times the step, snp goes from f1 to f2 = f1+u,
+  // y by dx*(f1+f2)/(r1+r2) with r = sqrt(1-f^2), and z by tgl times the transverse
+  // path s = dx*(asin(f2)-asin(f1))/u. For small u, s and its derivative in q/pt
+  // come from their Taylor expansions to avoid the cancellations. The expansion of
+  // asin around f1 converges for |u| < 1-|f1|: the switch is |u| < kSmallU*r1^2,
+  // i.e. relative to the distance to |snp| = 1, not an absolute one.
+  // The jacobian of the step is multiplied into stepJac if given
+  const double kMinCosPhi = 1e-3, kSmallU = 1e-3;
+  const double* par = trc->GetParameter();
+  double dx = xk - trc->GetX();
+  if (TMath::Abs(dx) <= kAlmost0)
+    return kTRUE;
+  double bc = TMath::Abs(b) < kAlmost0Field ? 0. : b * kB2C; // crv = bc*q/pt
+  double f1 = par[2], u = par[4] * bc * dx, f2 = f1 + u;
+  if (TMath::Abs(f1) >= kAlmost1 || TMath::Abs(f2) >= kAlmost1 || TMath::Abs(par[4]) < kAlmost0)
+    return kFALSE;
+  double r1 = TMath::Sqrt((1. - f1) * (1. + f1)), r2 = TMath::Sqrt((1. - f2) * (1. + f2));
+  if (r1 < kMinCosPhi || r2 < kMinCosPhi)
+    return kFALSE;
+  //
+  // y: dy/dx and its derivatives in f1 and f2
+  double rs = r1 + r2, dydx = (f1 + f2) / rs;
+  double dydx1 = (rs + (f1 + f2) * f1 / r1) / (rs * rs), dydx2 = (rs + (f1 + f2) * f2 / r2) / (rs * rs);
+  // z: transverse path and its derivatives in f1 and q/pt
+  double sT, dsdk;
+  double ri = 1. / r1, ri3 = ri * ri * ri, ri5 = ri3 * ri * ri, ri7 = ri5 * ri * ri;
+  if (TMath::Abs(u) < kSmallU * r1 * r1) {
+    sT = dx * (ri + u * (0.5 * f1 * ri3 + u * ((1. + 2. * f1 * f1) * ri5 / 6. + u * f1 * (3. + 2. * f1 * f1) * ri7 / 8.)));
+    dsdk = bc * dx * dx * (0.5 * f1 * ri3 + u * ((1. + 2. * f1 * f1) * ri5 / 3. + u * 3. * f1 * (3. + 2. * f1 * f1) * ri7 / 8.));
+  } else {
+    double dphi = TMath::ASin(f2) - TMath::ASin(f1);
+    sT = dx * dphi / u;
+    dsdk = bc * dx * dx * (u / r2 - dphi) / (u * u);
+  }
+  double dsdf = dx * (f1 + f2) / (r1 * r2 * rs);
+  //
+  double jac[5][5] = {{1, 0, dx * (dydx1 + dydx2), 0, dx * dx * bc * dydx2},
+                      {0, 1, par[3] * dsdf, sT, par[3] * dsdk},
+                      {0, 0, 1, 0, bc * dx},
+                      {0, 0, 0, 1, 0},
+                      {0, 0, 0, 0, 1}};
+  double parNew[5] = {par[0] + dx * dydx, par[1] + par[3] * sT, f2, par[3], par[4]};
+  //
+  // C' = J C J^T
+  const double* cov = trc->GetCovariance();
+  double cmat[5][5], jc[5][5], covNew[15];
+  for (int i = 0, k = 0; i < 5; i++)
+    for (int j = 0; j <= i; j++, k++)
+      cmat[i][j] = cmat[j][i] = cov[k];
+  for (int i = 0; i < 5; i++)
+    for (int j = 0; j < 5; j++) {
+      jc[i][j] = 0;
+      for (int m = i; m < 5; m++) // jac is upper triangular
+        jc[i][j] += jac[i][m] * cmat[m][j];
+    }
+  for (int i = 0, k = 0; i < 5; i++)
+    for (int j = 0; j <= i; j++, k++) {
+      covNew[k] = 0;
+      for (int m = j; m < 5; m++)
+        covNew[k] += jc[i][m] * jac[j][m];
+    }
+  trc->Set(xk, trc->GetAlpha(), parNew, covNew);
+  if (stepJac)
+    stepJac->Multiply(jac);
+  return kTRUE;
+}
+
+//____________________________________
+Bool_t DetectorK::CorrectForEnergyLoss(AliExternalTrackParam* trc, double xrho, double mass)
+{
+  // energy loss and its fluctuation in xrho (g/cm^2, negative when going outward) of material,
+  // as CorrectForMeanMaterial(0, xrho, mass, kTRUE) applied in infinitesimal steps:
+  // dE/ds = BetheBlochSolid (MaterialTableK) and dC44/ds = k^2 dE/ds (E/p^2 P4)^2 with P4*p constant,
+  // integrated with RK4 in steps of at most kMaxStepLoss relative momentum change.
+  // Negative mass means charge=2 particle.
+  const double kMaxStepLoss = 0.01, kFluct = 0.07;
+  if (xrho == 0)
+    return kTRUE;
+  if (mass < -990)
+    return kFALSE;
+  double* par = (double*)trc->GetParameter();
+  double* cov = (double*)trc->GetCovariance();
+  const bool q2 = mass < 0;
+  const double m = TMath::Abs(mass), m2 = m * m;
+  const double angle = TMath::Sqrt((1. + par[3] * par[3]) / ((1. - par[2]) * (1. + par[2])));
+  const double x = TMath::Abs(xrho * angle), sgn = xrho < 0 ? -1. : 1.;
+  const double p0 = q2 ? 2 * trc->GetP() : trc->GetP();
+  const double p4p = par[4] * p0; // invariant
+  //
+  // dE/ds and dC44/ds at energy e
+  auto deriv = [&](double e, double& dc44) {
+    double p2 = e * e - m2;
+    if (p2 <= 0) {
+      dc44 = 0;
+      return 0.;
+    }
+    double dedx = MaterialTableK::BetheBlochSolid(TMath::Sqrt(p2) / m);
+    if (q2)
+      dedx *= 4;
+    double f = kFluct * e / p2 * p4p / TMath::Sqrt(p2);
+    dc44 = dedx * f * f;
+    return dedx;
+  };
+  //
+  double e = TMath::Sqrt(p0 * p0 + m2), c44 = 0, done = 0;
+  while (done < x) {
+    double c1, c2, c3, c4;
+    double d1 = deriv(e, c1);
+    double h = TMath::Min(x - done, kMaxStepLoss * (e * e - m2) / (e * TMath::Abs(d1)));
+    double hs = sgn * h;
+    double d2 = deriv(e + 0.5 * hs * d1, c2);
+    double d3 = deriv(e + 0.5 * hs * d2, c3);
+    double d4 = deriv(e + hs * d3, c4);
+    e += hs * (d1 + 2 * d2 + 2 * d3 + d4) / 6;
+    if (e <= m)
+      return kFALSE; // stopped
+    c44 += h * (c1 + 2 * c2 + 2 * c3 + c4) / 6;
+    done += h;
+  }
+  double p4 = p4p / TMath::Sqrt(e * e - m2);
+  if (TMath::Abs(p4) > 100.)
+    return kFALSE; // do not track below 10 MeV/c
+  par[4] = p4;
+  cov[14] += c44;
+  trc->CheckCovariance();
+  return kTRUE;
+}
+
 //_________________________________________
-Bool_t DetectorK::IsITSLayer(const TString& lname)
+Bool_t DetectorK::IsITSLayer(const TString& lname) const
 {
   // return true for ITS layers
   return !(lname.Contains("tpc") || lname.Contains("trd"));
@@ -3,10 +3,13 @@
 
 #include <TNamed.h>
 #include <TClonesArray.h>
+#include <TArrayD.h>
 #include <TList.h>
 #include <TGraph.h>
 #include <Riostream.h>
+#include <vector>
 #include "HistoManager.h"
+#include "TrackParK.h"
 
 /***********************************************************
 
@@ -50,6 +53,155 @@ Dec. 2010 - Translation into C++ class format
 class AliExternalTrackParam;
 #include <TMatrixD.h>
 
+// Diagnostic tracing of the track solver and of the LUT writer.
+// TRACEK(level, format, ...) prints as printf if the level is enabled at compile
+// time (level <= TRACEK_MAX_LEVEL, the other trace points are compiled out) and at
+// run time (TraceK::SetLevel, warnings and errors by default); a trace point disabled
+// at run time costs one comparison. TRACEK_DO(level, statement) does the same for
+// any statement, e.g. printing a track.
+// With a sink open (TraceK::OpenSink), SolveTrack also writes one TraceKTrack_t per
+// track, with the layers reached and the reason of a failure, to a binary file:
+// a TraceKSinkHeader_t followed by the records
+#ifndef TRACEK_MAX_LEVEL
+#define TRACEK_MAX_LEVEL 3 // TraceK::kDebug
+#endif
+
+#define TRACEK(level, ...)                                         \
+  do {                                                             \
+    if ((level) <= TRACEK_MAX_LEVEL && TraceK::IsEnabled(level))   \
+      printf(__VA_ARGS__);                                         \
+  } while (false)
+
+#define TRACEK_DO(level, statement)                                \
+  do {                                                             \
+    if ((level) <= TRACEK_MAX_LEVEL && TraceK::IsEnabled(level)) { \
+      statement;                                                   \
+    }                                                              \
+  } while (false)
+
+struct TraceKTrack_t;
+
+class TraceK
+{
+ public:
+  enum { kError,
+         kWarning,
+         kInfo,
+         kDebug };
+  enum { kOK,            // failure reasons of the track records
+         kNotInitialised, // track without kinematics
+         kNoLayer,       // no layer below the min. radius or within reach
+         kLowPt,         // cannot reach the min. radius
+         kMinRadius,     // lost before the min. radius
+         kPropagation,   // failed to propagate to the layer
+         kRotation,      // failed to rotate to the layer frame
+         kUpdate,        // failed to update with the layer measurement
+         kMaterial };    // failed to correct for the layer material
+  //
+  static Int_t GetLevel() { return fgLevel; }
+  static void SetLevel(Int_t level) { fgLevel = level; }
+  static Bool_t IsEnabled(Int_t level) { return level <= fgLevel; }
+  //
+  static Bool_t OpenSink(const char* filename);
+  static void CloseSink();
+  static Bool_t IsSinkOpen() { return fgSinkOpen; }
+  static void Write(const TraceKTrack_t& record); // thread safe
+  //
+ private:
+  static Int_t fgLevel;     // run time level
+  static Bool_t fgSinkOpen; // a sink is open
+};
+
+struct TraceKSinkHeader_t {
+  char magic[8] = {'T', 'R', 'A', 'C', 'E', 'K', '0', '1'};
+  Int_t recordSize = 0; // sizeof(TraceKTrack_t)
+  Int_t reserved = 0;
+};
+
+struct TraceKTrack_t {
+  Float_t pt = 0;
+  Float_t eta = 0;
+  Float_t mass = 0;
+  Int_t charge = 0;
+  Int_t lastActiveLayer = -1;  // outermost layer within reach
+  Int_t lastReachedLayer = -1; // outermost layer reached by the outward propagation
+  Int_t failure = TraceK::kOK;
+  Int_t failureLayer = -1; // layer of the failure, if any
+};
+
+// Layers of a DetectorK frozen into contiguous arrays by DetectorK::CompileGeometry,
+// ordered by radius as fLayers, with the roles given by the layer names resolved
+// once into bit flags: the track loops run over these without string handling
+struct LayerGeometryK {
+  enum { kVertex = BIT(0),
+         kTOF = BIT(1),
+         kDead = BIT(2),
+         kITS = BIT(3) };
+  //
+  Int_t GetEntries() const { return radius.size(); }
+  Bool_t Is(Int_t i, UInt_t role) const { return (flags[i] & role) != 0; }
+  Bool_t IsMeasured(Int_t i) const { return !(flags[i] & (kVertex | kTOF | kDead)); } // layer with a measurement
+  //
+  std::vector<Float_t> radius;
+  std::vector<Float_t> radL;
+  std::vector<Float_t> xrho;
+  std::vector<Float_t> phiRes;
+  std::vector<Float_t> zRes;
+  std::vector<Float_t> eff;
+  std::vector<UInt_t> flags;
+};
+
+// Jacobian J of a covariance transport C -> J C J^T, accumulated over the
+// steps and rotations of a propagation (DetectorK::PropagateToR)
+struct TransportJacobianK {
+  Bool_t valid = kFALSE; // all the steps were accumulated
+  Double_t jac[5][5];
+  //
+  void Reset();
+  void Multiply(const Double_t m[5][5]); // J = m J
+  void Rotate(Double_t ca, Double_t rr); // J = diag(ca, 1, rr, 1, 1) J, as AliExternalTrackParam::Rotate
+  void Apply(Double_t* cov) const;       // cov = J cov J^T, lower triangle as in AliExternalTrackParam
+};
+
+// Nominal trajectory of a track at a layer, recorded by the outward probe of
+// DetectorK::SolveTrack with the covariance transport from the previous layer and
+// the material noise, which the Kalman passes replay rather than recompute
+struct LayerTransportK {
+  Bool_t nominal = kFALSE; // the passes reach the layer with parIn, in the same frame
+  Bool_t cached = kFALSE;  // the transport from the previous layer is recorded
+  TransportJacobianK transport;
+  Double_t x = 0, alpha = 0;
+  Double_t parIn[5];        // parameters arriving at the layer, before its material
+  Double_t msNoise[15];     // multiple scattering noise at parIn
+  Double_t elossNoise = 0;  // C44 noise of the energy loss
+  Double_t ptInvOut = 0;    // q/pt after the energy loss
+};
+
+// Outward probe of DetectorK::SolveTrack: the nominal trajectory and the track at its
+// end, which depend on the kinematics and on the transport geometry (radii, material,
+// roles of the layers, field) but not on the resolutions. With reuse set, SolveTrack
+// takes it as it is for a track of the same kinematics on the same transport geometry,
+// e.g. on a detector differing only in the layer resolutions (designScan)
+struct TrackProbeK {
+  Bool_t reuse = kFALSE; // reuse the probe if it matches
+  Bool_t valid = kFALSE; // recorded to be reused, for the track and geometry below
+  Double_t pt = 0, eta = 0, mass = 0;
+  Int_t charge = 0;
+  LayerGeometryK geo; // radius, radL, xrho and flags, the only ones used by the probe
+  Double_t bField = 0, maxSnp = 0, minRad = 0;
+  Bool_t tabulated = kFALSE; // MaterialTableK mode
+  //
+  Int_t lastReachedLayer = -1;
+  Double_t x = 0, alpha = 0; // track at the end of the probe
+  Double_t par[5];
+  std::vector<LayerTransportK> transport;
+};
+
+// Solution of a single track, also the workspace of DetectorK::SolveTrack:
+// all the per-track state lives here, so that several threads can solve
+// tracks on the same detector, each one with its own TrackSol. The track
+// parameters at the layers are plain data in fixed size arrays, for the
+// workspace to be reused from track to track without allocations
 class TrackSol : public TObject
 {
  public:
@@ -57,35 +209,65 @@ class TrackSol : public TObject
          kOut,
          kCmb };
   //
+  enum { kParInw,  // inward, before the update
+         kParOutB, // outward, before the update
+         kParOutA, // outward, after the update
+         kParCmb,  // combined inward and outward
+         kNPar };
+  enum { kMaxLayers = 200 }; // as DetectorK::kMaxNumberOfDetectors
+  //
   TrackSol(int nL, double pt, double eta, int q, double m = 0.140)
-    : fPt(nL > 0 ? pt : -1), fEta(eta), fMass(m), fCharge(q), fTrackInw("AliExternalTrackParam", nL), fTrackOutB("AliExternalTrackParam", nL), fTrackOutA("AliExternalTrackParam", nL), fTrackCmb("AliExternalTrackParam", nL)
+    : fPt(nL > 0 ? pt : -1), fEta(eta), fMass(m), fCharge(q), fdNdEta(-1), fGoodHitProb()
   {
     for (int i = 3; i--;)
       fProb[i][0] = fProb[i][1] = 0;
+    ClearPar();
   }
   //
-  void Clear(Option_t*)
+  void Clear(Option_t*) // the multiplicity is kept
   {
-    fTrackInw.Clear();
-    fTrackOutB.Clear();
-    fTrackOutA.Clear();
-    fTrackCmb.Clear();
+    ClearPar();
     fPt = -1;
     for (int i = 3; i--;)
       fProb[i][0] = fProb[i][1] = 0;
+    fGoodHitProb.Reset(-1.);
+  }
+  //
+  // track parameters of the given kind at a layer, null if the track did not get there
+  const TrackParK* GetPar(Int_t kind, Int_t layer) const
+  {
+    return (layer >= 0 && layer < kMaxLayers && (fParSet[layer] & (1 << kind))) ? &fPar[kind][layer] : nullptr;
+  }
+  Bool_t GetPar(Int_t kind, Int_t layer, AliExternalTrackParam& trc) const
+  {
+    const TrackParK* par = GetPar(kind, layer);
+    if (par)
+      AsTrackParK(trc) = *par;
+    return par != nullptr;
+  }
+  void SetPar(Int_t kind, Int_t layer, const TrackParK& par)
+  {
+    fPar[kind][layer] = par;
+    fParSet[layer] |= 1 << kind;
+  }
+  void ClearPar()
+  {
+    for (int i = kMaxLayers; i--;)
+      fParSet[i] = 0;
   }
   //
   Double_t fPt;
   Double_t fEta;
   Double_t fMass;
   Int_t fCharge;
+  Int_t fdNdEta;        // multiplicity for the good hit probabilities, the one of the detector if negative
   Double_t fProb[3][2]; // corr/fake prob for inw,out and cmb tracking
-  TClonesArray fTrackInw;
-  TClonesArray fTrackOutB; // outward before update
-  TClonesArray fTrackOutA; // outward after update
-  TClonesArray fTrackCmb;
+  TArrayD fGoodHitProb; // good hit probability per layer, the product over the layers in [0]
+  TrackParK fPar[kNPar][kMaxLayers]; //! track parameters per kind and layer
+  UChar_t fParSet[kMaxLayers];       //! bit per kind of the parameters set at each layer
+  TrackProbeK fProbe;                //! outward probe of the last solved track
   //
-  ClassDef(TrackSol, 1)
+  ClassDef(TrackSol, 4)
 };
 
 class CylLayerK : public TNamed
@@ -112,12 +294,46 @@ class CylLayerK : public TNamed
   ClassDef(CylLayerK, 1);
 };
 
+// Points of a pt scan of DetectorK::SolveViaBilloir and their results: the (pt, eta)
+// points are the input, the results are sized by Reset and filled per point, with
+// status the TraceK failure code of the point (TraceK::kOK if it was solved)
+struct BilloirScanK {
+  std::vector<Double_t> pt; // GeV/c
+  std::vector<Double_t> eta;
+  //
+  Int_t nLayers = 0;
+  Int_t detLayer = -1;                   // layer of efficProlongLay and GetDetPointRes(i)[detLayer]
+  std::vector<Int_t> status;             // per point
+  std::vector<Double_t> momentumRes;     // in percent
+  std::vector<Double_t> resolutionRPhi;  // at the vertex, in microns
+  std::vector<Double_t> resolutionZ;     // at the vertex, in microns
+  std::vector<Double_t> efficiency;      // of the ITS layers
+  std::vector<Double_t> fake;            // fake probability
+  std::vector<Double_t> efficProlongLay; // prolongation efficiency onto detLayer
+  std::vector<Double_t> detPointRes;     // rphi resolution per point and layer, [i * nLayers + layer], in m
+  std::vector<Double_t> detPointZRes;    // z resolution per point and layer, in m
+  //
+  void AddPoint(Double_t ptPoint, Double_t etaPoint)
+  {
+    pt.push_back(ptPoint);
+    eta.push_back(etaPoint);
+  }
+  Int_t GetEntries() const { return pt.size(); }
+  Bool_t IsOK(Int_t i) const { return status[i] == TraceK::kOK; }
+  Double_t* GetDetPointRes(Int_t i) { return &detPointRes[i * nLayers]; }
+  Double_t* GetDetPointZRes(Int_t i) { return &detPointZRes[i * nLayers]; }
+  const Double_t* GetDetPointRes(Int_t i) const { return &detPointRes[i * nLayers]; }
+  const Double_t* GetDetPointZRes(Int_t i) const { return &detPointZRes[i * nLayers]; }
+  void Reset(Int_t nl, Int_t detLayerScan);
+};
+
 class DetectorK : public TNamed
 {
 
  public:
   DetectorK();
   DetectorK(const char* name, const char* title);
+  DetectorK(const DetectorK& src);
   virtual ~DetectorK();
 
   enum { kNptBins = 50 }; // less then 400 !!
@@ -149,17 +365,33 @@ class DetectorK : public TNamed
 
   void SetBField(Float_t bfield) { fBField = bfield; }
   Float_t GetBField() const { return fBField; }
-  void SetLhcUPCscale(Float_t lhcUPCscale) { fLhcUPCscale = lhcUPCscale; }
+  void SetLhcUPCscale(Float_t lhcUPCscale)
+  {
+    fLhcUPCscale = lhcUPCscale;
+    UpdateHitDensityCache();
+  }
   Float_t GetLhcUPCscale() const { return fLhcUPCscale; }
   void SetParticleMass(Float_t particleMass) { fParticleMass = particleMass; }
   Float_t GetParticleMass() const { return fParticleMass; }
   void SetMaxSnp(Float_t snp = 0.85) { fMaxSnp = snp; }
   Float_t GetMaxSnp() const { return fMaxSnp; }
-  void SetIntegrationTime(Float_t integrationTime) { fIntegrationTime = integrationTime; }
+  void SetIntegrationTime(Float_t integrationTime)
+  {
+    fIntegrationTime = integrationTime;
+    UpdateHitDensityCache();
+  }
   Float_t GetIntegrationTime() const { return fIntegrationTime; }
-  void SetMaxRadiusOfSlowDetectors(Float_t maxRadiusSlowDet) { fMaxRadiusSlowDet = maxRadiusSlowDet; }
+  void SetMaxRadiusOfSlowDetectors(Float_t maxRadiusSlowDet)
+  {
+    fMaxRadiusSlowDet = maxRadiusSlowDet;
+    UpdateHitDensityCache();
+  }
   Float_t GetMaxRadiusOfSlowDetectors() const { return fMaxRadiusSlowDet; }
-  void SetAvgRapidity(Float_t avgRapidity) { fAvgRapidity = avgRapidity; }
+  void SetAvgRapidity(Float_t avgRapidity)
+  {
+    fAvgRapidity = avgRapidity;
+    UpdateHitDensityCache();
+  }
   Float_t GetAvgRapidity() const { return fAvgRapidity; }
   void SetConfidenceLevel(Float_t confLevel) { fConfLevel = confLevel; }
   Float_t GetConfidenceLevel() const { return fConfLevel; }
@@ -185,9 +417,23 @@ class DetectorK : public TNamed
   Float_t GetNumberOfActiveLayers() const { return fNumberOfActiveLayers; }
   Float_t GetNumberOfActiveITSLayers() const { return fNumberOfActiveITSLayers; }
 
-  void SolveViaBilloir(Double_t selPt = 0.1, double ptmin = -1);
+  void SolveViaBilloir(Double_t selPt = 0.1, double ptmin = -1, Int_t nThreads = 1);
   //
+  // reentrant scan of the (pt, eta) points of scan on nThreads threads (0: all cores),
+  // returns the number of solved points. The points printFirst to printLast are solved
+  // first on the calling thread, printing their layer tables
+  Int_t SolveViaBilloir(BilloirScanK& scan, Int_t nThreads = 1, Int_t printFirst = -1, Int_t printLast = -1) const;
+  const BilloirScanK& GetBilloirScan() const { return fScan; }
+  //
+  // reentrant solution: the detector is not modified and the results,
+  // good hit probabilities included, are only stored in the TrackSol
+  Bool_t SolveTrack(TrackSol& ts) const;
+  void CalcGoodHitProb(TrackSol& ts) const;
+  void CalcGoodHitProb(TrackSol& ts, Int_t nLayers, const Double_t* sigY2, const Double_t* sigZ2) const;
+  // as above, also keeping the good hit probabilities in the detector (GetGoodHitProb)
   Bool_t SolveTrack(TrackSol& ts);
+  void UpdateGoodHitProb(const TrackSol& ts);
+  void UpdateGoodHitProb(Int_t nLayers, const Double_t* sigY2, const Double_t* sigZ2);
   Bool_t CalcITSEff(TrackSol& ts, Bool_t verbose = kTRUE);
   Bool_t ExtrapolateToR(AliExternalTrackParam* probTr, double rTgt, double mass = 0.14);
   //
@@ -198,28 +444,46 @@ class DetectorK : public TNamed
   //
   // Helper functions
   Double_t ThetaMCS(Double_t mass, Double_t RadLength, Double_t momentum) const;
-  Double_t ProbGoodHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ);
-  Double_t ProbGoodChiSqHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ);
-  Double_t ProbGoodChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ);
-  Double_t ProbNullChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ);
+  Double_t ProbGoodHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const;
+  Double_t ProbGoodChiSqHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const;
+  Double_t ProbGoodChiSqHit(Double_t radius, Double_t searchRadiusRPhi, Double_t searchRadiusZ, Int_t dNdEtaCent) const;
+  Double_t ProbGoodChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const;
+  Double_t ProbNullChiSqPlusConfHit(Double_t radius, Double_t leff, Double_t searchRadiusRPhi, Double_t searchRadiusZ) const;
 
   // Howard W. hit distribution and convolution integral
-  Double_t Dist(Double_t Z, Double_t radius);
-  Double_t HitDensity(Double_t radius);
-  Double_t UpcHitDensity(Double_t radius);
-  Double_t IntegratedHitDensity(Double_t multiplicity, Double_t radius);
+  Double_t Dist(Double_t Z, Double_t radius) const;
+  Double_t HitDensity(Double_t radius) const;
+  Double_t HitDensity(Double_t radius, Int_t dNdEtaCent) const;
+  Double_t UpcHitDensity(Double_t radius) const;
+  Double_t IntegratedHitDensity(Double_t multiplicity, Double_t radius) const;
   Double_t OneEventHitDensity(Double_t multiplicity, Double_t radius) const;
-
-  TGraph* GetGraphMomentumResolution(Int_t color, Int_t linewidth = 1);
-  TGraph* GetGraphPointingResolution(Int_t axis, Int_t color, Int_t linewidth = 1);
-  TGraph* GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, Int_t linewidth = 1);
-  TGraph* GetGraphLayerInfo(Int_t plot, Int_t color, Int_t linewidth = 1);
-
-  TGraph* GetGraphImpactParam(Int_t mode, Int_t axis, Int_t color, Int_t linewidth = 1);
-
-  TGraph* GetGraphRecoEfficiency(Int_t color, Int_t linewidth = 1);
-  TGraph* GetGraphRecoFakes(Int_t color, Int_t linewidth);
-  TGraph* GetGraphRecoPurity(Int_t color, Int_t linewidth);
+  Double_t SlowHitDensity(Double_t radius) const;
+  void UpdateHitDensityCache();
+  void CompileGeometry();
+  void CompileGeometry(LayerGeometryK& geo) const;
+
+  // graphs of a scan; the points which failed are left out of the resolutions
+  // and have zero efficiency
+  TGraph* GetGraphMomentumResolution(const BilloirScanK& scan, Int_t color, Int_t linewidth = 1) const;
+  TGraph* GetGraphPointingResolution(const BilloirScanK& scan, Int_t axis, Int_t color, Int_t linewidth = 1) const;
+  TGraph* GetGraphPointingResolutionTeleEqu(const BilloirScanK& scan, Int_t axis, Int_t color, Int_t linewidth = 1) const;
+  TGraph* GetGraphLayerInfo(const BilloirScanK& scan, Int_t plot, Int_t color, Int_t linewidth = 1) const;
+  TGraph* GetGraphImpactParam(const BilloirScanK& scan, Int_t mode, Int_t axis, Int_t color, Int_t linewidth = 1) const;
+  TGraph* GetGraphRecoEfficiency(const BilloirScanK& scan, Int_t color, Int_t linewidth = 1) const;
+  TGraph* GetGraphRecoFakes(const BilloirScanK& scan, Int_t color, Int_t linewidth) const;
+  TGraph* GetGraphRecoPurity(const BilloirScanK& scan, Int_t color, Int_t linewidth) const;
+
+  // graphs of the last SolveViaBilloir(selPt, ptmin)
+  TGraph* GetGraphMomentumResolution(Int_t color, Int_t linewidth = 1) { return GetGraphMomentumResolution(fScan, color, linewidth); }
+  TGraph* GetGraphPointingResolution(Int_t axis, Int_t color, Int_t linewidth = 1) { return GetGraphPointingResolution(fScan, axis, color, linewidth); }
+  TGraph* GetGraphPointingResolutionTeleEqu(Int_t axis, Int_t color, Int_t linewidth = 1) { return GetGraphPointingResolutionTeleEqu(fScan, axis, color, linewidth); }
+  TGraph* GetGraphLayerInfo(Int_t plot, Int_t color, Int_t linewidth = 1) { return GetGraphLayerInfo(fScan, plot, color, linewidth); }
+
+  TGraph* GetGraphImpactParam(Int_t mode, Int_t axis, Int_t color, Int_t linewidth = 1) { return GetGraphImpactParam(fScan, mode, axis, color, linewidth); }
+
+  TGraph* GetGraphRecoEfficiency(Int_t color, Int_t linewidth = 1) { return GetGraphRecoEfficiency(fScan, color, linewidth); }
+  TGraph* GetGraphRecoFakes(Int_t color, Int_t linewidth) { return GetGraphRecoFakes(fScan, color, linewidth); }
+  TGraph* GetGraphRecoPurity(Int_t color, Int_t linewidth) { return GetGraphRecoPurity(fScan, color, linewidth); }
 
   void MakeStandardPlots(Bool_t add = 0, Int_t color = 1, Int_t linewidth = 1, const char* outGr = "");
   void MakeStandardPlots(Bool_t add = 0, Int_t color = 1, Int_t linewidth = 1, Bool_t onlyPionEff = 0)
@@ -229,12 +493,14 @@ class DetectorK : public TNamed
 
   // method to extend AliExternalTrackParam functionality
   static Bool_t GetXatLabR(AliExternalTrackParam* tr, Double_t r, Double_t& x, Double_t bz, Int_t dir = 0);
-  static Bool_t PropagateToR(AliExternalTrackParam* trc, double r, double b, int dir = 0, double maxStep = 2.0);
-  Double_t* PrepareEffFakeKombinations(TMatrixD* probKomb, TMatrixD* probLay, int nl, double* prob = 0);
+  static Bool_t PropagateToR(AliExternalTrackParam* trc, double r, double b, int dir = 0, double maxStep = 0, TransportJacobianK* jac = 0); // maxStep > 0: steps of at most maxStep cm
+  static Bool_t PropagateToX(AliExternalTrackParam* trc, double xk, double b, TransportJacobianK* stepJac = 0);
+  static Bool_t CorrectForEnergyLoss(AliExternalTrackParam* trc, double xrho, double mass);
+  Double_t* PrepareEffFakeKombinations(const TMatrixD* probLay, int nl, double* prob = 0) const;
 
-  Bool_t IsITSLayer(const TString& lname);
+  Bool_t IsITSLayer(const TString& lname) const;
 
-  Double_t GetGoodHitProb(Int_t i) { return fGoodHitProb[i]; };
+  Double_t GetGoodHitProb(Int_t i) const { return fGoodHitProb[i]; };
 
   static Bool_t verboseR;
 
@@ -264,27 +530,26 @@ class DetectorK : public TNamed
 
   enum { kMaxNumberOfDetectors = 200 };
 
-  Double_t fTransMomenta[kNptBins];                        // array of transverse momenta
-  Double_t fMomentumRes[kNptBins];                         // array of momentum resolution
-  Double_t fResolutionRPhi[kNptBins];                      // array of rphi resolution
-  Double_t fResolutionZ[kNptBins];                         // array of z resolution
-  Double_t fDetPointRes[kMaxNumberOfDetectors][kNptBins];  // array of rphi resolution per layer
-  Double_t fDetPointZRes[kMaxNumberOfDetectors][kNptBins]; // array of z resolution per layer
-  Double_t fEfficiency[kNptBins];                          // efficiency
-  Double_t fFake[kNptBins];                                // fake prob
-  Double_t fGoodHitProb[kMaxNumberOfDetectors];            // array of good hit probability per layer
-
-  Int_t kDetLayer;                       // layer for which a few more details are extracted
-  Double_t fResolutionRPhiLay[kNptBins]; // array of rphi resolution
-  Double_t fResolutionZLay[kNptBins];    // array of z resolution
-  Double_t fEfficProlongLay[kNptBins];   // array of z resolution
+  Double_t fGoodHitProb[kMaxNumberOfDetectors]; // array of good hit probability per layer
+
+  Int_t kDetLayer; // layer for which a few more details are extracted
 
   Double_t fMinRadTrack;
 
+  std::vector<Double_t> fSlowDensityRadius; //! radii of the cached slow detector hit densities, increasing
+  std::vector<Double_t> fSlowDensity;       //! cached SlowHitDensity at these radii
+  LayerGeometryK fGeometry;                 //! layers compiled by CompileGeometry
+  BilloirScanK fScan;                       //! pt scan of the last SolveViaBilloir(selPt, ptmin)
+
+  Int_t GetCmbSigma2(const TrackSol& ts, Double_t* sigY2, Double_t* sigZ2) const;
+  void FillGoodHitProb(Double_t* prob, Int_t nLayers, const Double_t* sigY2, const Double_t* sigZ2, Int_t dNdEtaCent) const;
+  const LayerGeometryK& GetGeometry(LayerGeometryK& geoNow) const;
+  Int_t SolveBilloirPoint(BilloirScanK& scan, Int_t i, Bool_t print) const;
+
   static const Double_t kPtMinFix;
   static const Double_t kPtMaxFix;
 
-  ClassDef(DetectorK, 1);
+  ClassDef(DetectorK, 2);
 };
 
 #endif
@@ -0,0 +1,129 @@
+#include "MaterialTableK.h"
+#include <TMath.h>
+#include <cmath>
+#include "AliExternalTrackParam.h"
+
+Bool_t MaterialTableK::fgTabulated = kFALSE;
+
+//__________________________________________________________________________
+MaterialTableK::MaterialTableK(Double_t (*f)(Double_t), Int_t minExp, Int_t maxExp)
+  : fFunction(f), fMinExp(minExp), fMaxExp(maxExp)
+{
+  // nodes uniform within each octave, the mantissa of the nodes of an octave
+  // being 0.5 + j / (2 kNodesPerOctave)
+  const Int_t n = (maxExp - minExp) * kNodesPerOctave + 1;
+  fX.resize(n);
+  fY.resize(n);
+  fD.resize(n);
+  fInvH.resize(n);
+  for (Int_t k = 0; k < n; k++) {
+    fX[k] = std::ldexp(0.5 + 0.5 * (k % kNodesPerOctave) / kNodesPerOctave, minExp + k / kNodesPerOctave);
+    fY[k] = f(fX[k]);
+  }
+  // Fritsch-Butland slopes: weighted harmonic mean of the secants, zero at the extrema
+  std::vector<Double_t> h(n - 1), s(n - 1);
+  for (Int_t k = 0; k < n - 1; k++) {
+    h[k] = fX[k + 1] - fX[k];
+    fInvH[k] = 1. / h[k];
+    s[k] = (fY[k + 1] - fY[k]) / h[k];
+  }
+  fInvH[n - 1] = 0;
+  fD[0] = s[0];
+  fD[n - 1] = s[n - 2];
+  for (Int_t k = 1; k < n - 1; k++) {
+    if (s[k - 1] * s[k] <= 0) {
+      fD[k] = 0;
+      continue;
+    }
+    const Double_t w1 = 2 * h[k] + h[k - 1], w2 = h[k] + 2 * h[k - 1];
+    fD[k] = (w1 + w2) / (w1 / s[k - 1] + w2 / s[k]);
+  }
+}
+
+//__________________________________________________________________________
+Double_t MaterialTableK::MaxRelativeError(Int_t nSamples, Double_t* where) const
+{
+  Double_t maxErr = 0;
+  const Double_t lmin = TMath::Log(GetMin()), lmax = TMath::Log(GetMax());
+  for (Int_t i = 0; i < nSamples; i++) {
+    Double_t x = TMath::Exp(lmin + (lmax - lmin) * (i + 0.5) / nSamples);
+    Double_t exact = fFunction(x);
+    Double_t err = exact != 0 ? TMath::Abs(Eval(x) / exact - 1) : TMath::Abs(Eval(x));
+    if (err > maxErr) {
+      maxErr = err;
+      if (where)
+        *where = x;
+    }
+  }
+  return maxErr;
+}
+
+//__________________________________________________________________________
+Double_t MaterialTableK::ExactMSFactor(Double_t xOverX0)
+{
+  // x/X0 dependence of theta0^2, as CorrectForMeanMaterialdEdx with the log term
+  Double_t x = TMath::Abs(xOverX0);
+  Double_t lt = 1 + 0.038 * TMath::Log(x);
+  return lt > 0 ? x * (lt * lt) : x;
+}
+
+//__________________________________________________________________________
+const MaterialTableK& MaterialTableK::GetBetheBlochSolidTable()
+{
+  static const MaterialTableK table(AliExternalTrackParam::BetheBlochSolid, -4, 17);
+  return table;
+}
+
+const MaterialTableK& MaterialTableK::GetBetheBlochGasTable()
+{
+  static const MaterialTableK table(AliExternalTrackParam::BetheBlochGas, -4, 17);
+  return table;
+}
+
+const MaterialTableK& MaterialTableK::GetMSFactorTable()
+{
+  static const MaterialTableK table(ExactMSFactor, -23, 4);
+  return table;
+}
+
+//__________________________________________________________________________
+Double_t MaterialTableK::BetheBlochSolid(Double_t bg)
+{
+  return fgTabulated ? GetBetheBlochSolidTable().Eval(bg) : AliExternalTrackParam::BetheBlochSolid(bg);
+}
+
+Double_t MaterialTableK::BetheBlochGas(Double_t bg)
+{
+  return fgTabulated ? GetBetheBlochGasTable().Eval(bg) : AliExternalTrackParam::BetheBlochGas(bg);
+}
+
+Double_t MaterialTableK::MSFactor(Double_t xOverX0)
+{
+  return fgTabulated ? GetMSFactorTable().Eval(TMath::Abs(xOverX0)) : ExactMSFactor(xOverX0);
+}
+
+//__________________________________________________________________________
+Bool_t MaterialTableK::Check(Bool_t verbose)
+{
+  struct {
+    const char* name;
+    const MaterialTableK& table;
+    Double_t bound;
+  } checks[] = {{"BetheBlochSolid", GetBetheBlochSolidTable(), kBetheMaxError},
+                {"BetheBlochGas", GetBetheBlochGasTable(), kBetheMaxError},
+                {"MSFactor", GetMSFactorTable(), kMSMaxError}};
+  Bool_t ok = kTRUE;
+  for (auto& check : checks) {
+    Double_t where = 0;
+    Double_t err = check.table.MaxRelativeError(1000000, &where);
+    // the exact evaluation outside the range
+    for (Double_t x : {check.table.GetMin() * 0.5, check.table.GetMax() * 2})
+      if (check.table.Eval(x) != check.table.fFunction(x))
+        err = 1;
+    if (verbose)
+      printf("%-16s %5d nodes in [%.3g, %.3g]: max rel. error %.2e at %.3g, bound %.0e %s\n", check.name, (Int_t)check.table.fX.size(),
+             check.table.GetMin(), check.table.GetMax(), err, where, check.bound, err < check.bound ? "OK" : "FAILED");
+    ok &= err < check.bound;
+  }
+  return ok;
+}
@@ -0,0 +1,78 @@
+#ifndef MATERIALTABLEK_H
+#define MATERIALTABLEK_H
+
+#include <Rtypes.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Tables of the functions of the material corrections: the mean energy loss
+// (GeV/(g/cm^2)) of the Bethe-Bloch parameterisations of AliExternalTrackParam
+// versus beta*gamma, and the x/X0 dependence of the multiple scattering angle,
+// theta0^2 = (0.0136 / (beta p))^2 f(x/X0) with f(x) = x (1 + 0.038 ln x)^2 as in
+// CorrectForMeanMaterialdEdx with the log term.
+//
+// A table has kNodesPerOctave nodes per octave of its argument, the node being
+// found from the binary exponent and mantissa, without any log, and interpolates
+// them by monotone cubics (Fritsch-Butland slopes), which do not overshoot around
+// the minimum of dE/dx. Outside its range the function is evaluated exactly.
+// Relative accuracy, checked by Check():
+//   BetheBlochSolid, BetheBlochGas: below kBetheMaxError for 0.031 < bg < 65536
+//   MSFactor: below kMSMaxError for 6e-8 < x/X0 < 8
+//
+// The static functions below are exact by default and are used by DetectorK,
+// TrackParK and TrackBatchK in the place of the AliExternalTrackParam ones.
+// SetTabulated(kTRUE) switches them to the tables, before starting the threads.
+class MaterialTableK
+{
+ public:
+  enum { kNodesPerOctave = 64,
+         kLog2NodesPerOctave = 6 };
+  static constexpr Double_t kBetheMaxError = 5e-5;
+  static constexpr Double_t kMSMaxError = 5e-6;
+  //
+  // table of f for 2^(minExp - 1) <= x < 2^(maxExp - 1)
+  MaterialTableK(Double_t (*f)(Double_t), Int_t minExp, Int_t maxExp);
+  //
+  Double_t Eval(Double_t x) const
+  {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    const Int_t e = Int_t((bits >> 52) & 0x7ff) - 1022; // x = m 2^e, 0.5 <= m < 1
+    if (!(x > 0) || e < fMinExp || e >= fMaxExp)
+      return fFunction(x);
+    const Int_t k = (e - fMinExp) * kNodesPerOctave + Int_t((bits >> (52 - kLog2NodesPerOctave)) & (kNodesPerOctave - 1));
+    const Double_t h = fX[k + 1] - fX[k], t = (x - fX[k]) * fInvH[k];
+    const Double_t t2 = t * t, t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * fY[k] + (t3 - 2 * t2 + t) * h * fD[k] + (3 * t2 - 2 * t3) * fY[k + 1] + (t3 - t2) * h * fD[k + 1];
+  }
+  Double_t GetMin() const { return fX.front(); }
+  Double_t GetMax() const { return fX.back(); }
+  // max relative deviation from the function at nSamples log spaced points of the range
+  Double_t MaxRelativeError(Int_t nSamples = 100000, Double_t* where = 0) const;
+  //
+  static void SetTabulated(Bool_t v) { fgTabulated = v; }
+  static Bool_t IsTabulated() { return fgTabulated; }
+  static Double_t BetheBlochSolid(Double_t bg);
+  static Double_t BetheBlochGas(Double_t bg);
+  static Double_t MSFactor(Double_t xOverX0); // |x| (1 + 0.038 ln|x|)^2, |x| if the log term is negative
+  static Double_t ExactMSFactor(Double_t xOverX0);
+  static const MaterialTableK& GetBetheBlochSolidTable();
+  static const MaterialTableK& GetBetheBlochGasTable();
+  static const MaterialTableK& GetMSFactorTable();
+  // checks the tables against the accuracy bounds
+  static Bool_t Check(Bool_t verbose = kTRUE);
+  //
+ protected:
+  Double_t (*fFunction)(Double_t);
+  Int_t fMinExp;
+  Int_t fMaxExp;
+  std::vector<Double_t> fX;    // nodes
+  std::vector<Double_t> fY;    // function at the nodes
+  std::vector<Double_t> fD;    // slopes at the nodes
+  std::vector<Double_t> fInvH; // inverse node spacings
+  //
+  static Bool_t fgTabulated;
+};
+
+#endif
@@ -0,0 +1,794 @@
+#include "TrackBatchK.h"
+#include "TrackParK.h"
+#include <TMath.h>
+#include <algorithm>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Ports of the AliExternalTrackParam methods. Each track of the batch is processed
+// without early returns and stored back only if it succeeded, its failure flag is
+// the OR of the scalar return conditions, written as negations of these so that
+// NaNs pass or fail them as in the scalar code. The math functions are evaluated
+// in a first pass over the tracks which need them, leaving the main loops without
+// calls or branches. The constants are converted to the precision of the batch as
+// in TrackParK.h, which leaves the double arithmetic as it is.
+//
+// The main loops are written once, in the kernels below, for a lane type: one track
+// in plain arithmetic (ScalarLaneK), or four double or eight float tracks in the AVX2
+// registers (AVX2LaneK), used when the processor has them. The vector operations are
+// the IEEE ones of the scalar code and the comparisons have the C semantics (ordered,
+// != unordered), so that each lane gives the scalar result bit for bit. The loops
+// over the parameters are unrolled for the arrays of the kernels to stay in registers.
+
+#if defined(__x86_64__)
+#define TRACKBATCHK_AVX2 __attribute__((target("avx2")))
+#endif
+#define TRACKBATCHK_INLINE inline __attribute__((always_inline))
+
+template <typename T>
+Bool_t TrackBatchT<T>::fgUseSIMD = kTRUE;
+
+namespace
+{
+//__________________________________________________________________________
+// one track at the time
+template <typename T>
+struct ScalarLaneK {
+  typedef T scalar;
+  typedef T value;
+  typedef Bool_t mask;
+  static const Int_t kSize = 1;
+  static value Load(const T* p) { return *p; }
+  static void Store(T* p, value v) { *p = v; }
+  template <typename M>
+  static mask LoadMask(const M* p) { return *p != 0; }
+  template <typename M>
+  static void StoreMask(M* p, mask m) { *p = m; }
+  static Int_t Count(mask m) { return m; }
+};
+
+using ::SqrtK; // of TrackParK.h, overloaded for the vector lanes below
+inline Double_t AbsK(Double_t v) { return TMath::Abs(v); }
+inline Float_t AbsK(Float_t v) { return TMath::Abs(v); }
+inline Double_t SelectK(Bool_t m, Double_t a, Double_t b) { return m ? a : b; }
+inline Float_t SelectK(Bool_t m, Float_t a, Float_t b) { return m ? a : b; }
+inline Bool_t AnyK(Bool_t m) { return m; }
+
+#if defined(__x86_64__)
+//__________________________________________________________________________
+// four double tracks in an AVX2 register
+struct Vec4dK {
+  __m256d v;
+  Vec4dK() = default;
+  TRACKBATCHK_AVX2 Vec4dK(__m256d a) : v(a) {}
+  TRACKBATCHK_AVX2 Vec4dK(Double_t a) : v(_mm256_set1_pd(a)) {}
+  TRACKBATCHK_AVX2 Vec4dK& operator+=(Vec4dK a) { v = _mm256_add_pd(v, a.v); return *this; }
+  TRACKBATCHK_AVX2 Vec4dK& operator-=(Vec4dK a) { v = _mm256_sub_pd(v, a.v); return *this; }
+  TRACKBATCHK_AVX2 Vec4dK& operator*=(Vec4dK a) { v = _mm256_mul_pd(v, a.v); return *this; }
+};
+struct Mask4dK {
+  __m256d m;
+};
+TRACKBATCHK_AVX2 inline Vec4dK operator+(Vec4dK a, Vec4dK b) { return _mm256_add_pd(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec4dK operator-(Vec4dK a, Vec4dK b) { return _mm256_sub_pd(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec4dK operator*(Vec4dK a, Vec4dK b) { return _mm256_mul_pd(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec4dK operator/(Vec4dK a, Vec4dK b) { return _mm256_div_pd(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec4dK operator-(Vec4dK a) { return _mm256_xor_pd(a.v, _mm256_set1_pd(-0.)); }
+TRACKBATCHK_AVX2 inline Mask4dK operator<(Vec4dK a, Vec4dK b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator<=(Vec4dK a, Vec4dK b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator>(Vec4dK a, Vec4dK b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator>=(Vec4dK a, Vec4dK b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator!=(Vec4dK a, Vec4dK b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_NEQ_UQ)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator&(Mask4dK a, Mask4dK b) { return {_mm256_and_pd(a.m, b.m)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator|(Mask4dK a, Mask4dK b) { return {_mm256_or_pd(a.m, b.m)}; }
+TRACKBATCHK_AVX2 inline Mask4dK operator!(Mask4dK a) { return {_mm256_xor_pd(a.m, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)))}; }
+TRACKBATCHK_AVX2 inline Vec4dK AbsK(Vec4dK a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.), a.v); }
+TRACKBATCHK_AVX2 inline Vec4dK SqrtK(Vec4dK a) { return _mm256_sqrt_pd(a.v); }
+TRACKBATCHK_AVX2 inline Vec4dK SelectK(Mask4dK m, Vec4dK a, Vec4dK b) { return _mm256_blendv_pd(b.v, a.v, m.m); }
+TRACKBATCHK_AVX2 inline Bool_t AnyK(Mask4dK m) { return _mm256_movemask_pd(m.m) != 0; }
+
+//__________________________________________________________________________
+// eight float tracks in an AVX2 register
+struct Vec8fK {
+  __m256 v;
+  Vec8fK() = default;
+  TRACKBATCHK_AVX2 Vec8fK(__m256 a) : v(a) {}
+  TRACKBATCHK_AVX2 Vec8fK(Float_t a) : v(_mm256_set1_ps(a)) {}
+  TRACKBATCHK_AVX2 Vec8fK& operator+=(Vec8fK a) { v = _mm256_add_ps(v, a.v); return *this; }
+  TRACKBATCHK_AVX2 Vec8fK& operator-=(Vec8fK a) { v = _mm256_sub_ps(v, a.v); return *this; }
+  TRACKBATCHK_AVX2 Vec8fK& operator*=(Vec8fK a) { v = _mm256_mul_ps(v, a.v); return *this; }
+};
+struct Mask8fK {
+  __m256 m;
+};
+TRACKBATCHK_AVX2 inline Vec8fK operator+(Vec8fK a, Vec8fK b) { return _mm256_add_ps(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec8fK operator-(Vec8fK a, Vec8fK b) { return _mm256_sub_ps(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec8fK operator*(Vec8fK a, Vec8fK b) { return _mm256_mul_ps(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec8fK operator/(Vec8fK a, Vec8fK b) { return _mm256_div_ps(a.v, b.v); }
+TRACKBATCHK_AVX2 inline Vec8fK operator-(Vec8fK a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)); }
+TRACKBATCHK_AVX2 inline Mask8fK operator<(Vec8fK a, Vec8fK b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator<=(Vec8fK a, Vec8fK b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator>(Vec8fK a, Vec8fK b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator>=(Vec8fK a, Vec8fK b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator!=(Vec8fK a, Vec8fK b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator&(Mask8fK a, Mask8fK b) { return {_mm256_and_ps(a.m, b.m)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator|(Mask8fK a, Mask8fK b) { return {_mm256_or_ps(a.m, b.m)}; }
+TRACKBATCHK_AVX2 inline Mask8fK operator!(Mask8fK a) { return {_mm256_xor_ps(a.m, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))}; }
+TRACKBATCHK_AVX2 inline Vec8fK AbsK(Vec8fK a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+TRACKBATCHK_AVX2 inline Vec8fK SqrtK(Vec8fK a) { return _mm256_sqrt_ps(a.v); }
+TRACKBATCHK_AVX2 inline Vec8fK SelectK(Mask8fK m, Vec8fK a, Vec8fK b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+TRACKBATCHK_AVX2 inline Bool_t AnyK(Mask8fK m) { return _mm256_movemask_ps(m.m) != 0; }
+
+//__________________________________________________________________________
+// the tracks of an AVX2 register, the masks of the batch being of the width of the parameters
+template <typename T>
+struct AVX2LaneK;
+
+template <>
+struct AVX2LaneK<Double_t> {
+  typedef Double_t scalar;
+  typedef Vec4dK value;
+  typedef Mask4dK mask;
+  static const Int_t kSize = 4;
+  TRACKBATCHK_AVX2 static value Load(const Double_t* p) { return _mm256_loadu_pd(p); }
+  TRACKBATCHK_AVX2 static void Store(Double_t* p, value v) { _mm256_storeu_pd(p, v.v); }
+  TRACKBATCHK_AVX2 static mask LoadMask(const Long64_t* p)
+  {
+    const __m256i zero = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_setzero_si256());
+    return !Mask4dK{_mm256_castsi256_pd(zero)};
+  }
+  TRACKBATCHK_AVX2 static void StoreMask(Long64_t* p, mask m)
+  {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_and_si256(_mm256_castpd_si256(m.m), _mm256_set1_epi64x(1)));
+  }
+  TRACKBATCHK_AVX2 static Int_t Count(mask m) { return __builtin_popcount(_mm256_movemask_pd(m.m)); }
+};
+
+template <>
+struct AVX2LaneK<Float_t> {
+  typedef Float_t scalar;
+  typedef Vec8fK value;
+  typedef Mask8fK mask;
+  static const Int_t kSize = 8;
+  TRACKBATCHK_AVX2 static value Load(const Float_t* p) { return _mm256_loadu_ps(p); }
+  TRACKBATCHK_AVX2 static void Store(Float_t* p, value v) { _mm256_storeu_ps(p, v.v); }
+  TRACKBATCHK_AVX2 static mask LoadMask(const Int_t* p)
+  {
+    const __m256i zero = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_setzero_si256());
+    return !Mask8fK{_mm256_castsi256_ps(zero)};
+  }
+  TRACKBATCHK_AVX2 static void StoreMask(Int_t* p, mask m)
+  {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_and_si256(_mm256_castps_si256(m.m), _mm256_set1_epi32(1)));
+  }
+  TRACKBATCHK_AVX2 static Int_t Count(mask m) { return __builtin_popcount(_mm256_movemask_ps(m.m)); }
+};
+
+inline Bool_t HasAVX2K()
+{
+  static const Bool_t avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+// the lanes of the AVX2 registers, the remaining tracks one at the time
+template <typename T, typename Kernel>
+TRACKBATCHK_AVX2 Int_t RunAVX2K(const Kernel& kernel, Int_t n)
+{
+  typedef AVX2LaneK<T> L;
+  Int_t nActive = 0, i = 0;
+  for (; i + L::kSize <= n; i += L::kSize)
+    nActive += kernel.template Run<L>(i);
+  for (; i < n; i++)
+    nActive += kernel.template Run<ScalarLaneK<T>>(i);
+  return nActive;
+}
+#endif
+
+// runs the main loop of an operation over the tracks and returns the number of active ones
+template <typename T, typename Kernel>
+Int_t RunK(const Kernel& kernel, Int_t n)
+{
+#if defined(__x86_64__)
+  if (TrackBatchT<T>::GetUseSIMD())
+    return RunAVX2K<T>(kernel, n);
+#endif
+  Int_t nActive = 0;
+  for (Int_t i = 0; i < n; i++)
+    nActive += kernel.template Run<ScalarLaneK<T>>(i);
+  return nActive;
+}
+
+//__________________________________________________________________________
+// forces the diagonal element to be positive and within the limit, as AliExternalTrackParam::CheckCovariance
+template <typename L>
+TRACKBATCHK_INLINE void ClampDiagonalK(typename L::value* c, Int_t id, Double_t cmaxIn, Int_t i0, Int_t i1, Int_t i2, Int_t i3)
+{
+  typedef typename L::scalar T;
+  typedef typename L::value V;
+  const V cmax = T(cmaxIn);
+  c[id] = AbsK(c[id]);
+  const auto big = c[id] > cmax;
+  if (!AnyK(big)) // as a rule, no square root nor division then
+    return;
+  const V scl = SqrtK(cmax / c[id]);
+  c[id] = SelectK(big, cmax, c[id]);
+  c[i0] = SelectK(big, c[i0] * scl, c[i0]);
+  c[i1] = SelectK(big, c[i1] * scl, c[i1]);
+  c[i2] = SelectK(big, c[i2] * scl, c[i2]);
+  c[i3] = SelectK(big, c[i3] * scl, c[i3]);
+}
+
+template <typename L>
+TRACKBATCHK_INLINE void CheckCovarianceK(typename L::value* c)
+{
+  ClampDiagonalK<L>(c, 0, kC0max, 1, 3, 6, 10);
+  ClampDiagonalK<L>(c, 2, kC2max, 1, 4, 7, 11);
+  ClampDiagonalK<L>(c, 5, kC5max, 3, 4, 8, 12);
+  ClampDiagonalK<L>(c, 9, kC9max, 6, 7, 8, 13);
+  ClampDiagonalK<L>(c, 14, kC14max, 10, 11, 12, 13);
+}
+
+// alpha in [-pi, pi), as in AliExternalTrackParam::Rotate
+inline Double_t NormalizeAlphaK(Double_t alpha)
+{
+  return alpha < -TMath::Pi() ? alpha + 2 * TMath::Pi() : (alpha >= TMath::Pi() ? alpha - 2 * TMath::Pi() : alpha);
+}
+
+// track momentum, as AliExternalTrackParam::GetP
+template <typename L>
+TRACKBATCHK_INLINE typename L::value GetPK(typename L::value p3, typename L::value p4)
+{
+  typedef typename L::scalar T;
+  return SelectK(AbsK(p4) <= T(kAlmost0), T(kVeryBig), SqrtK(T(1.) + p3 * p3) / AbsK(p4));
+}
+
+//__________________________________________________________________________
+// the main loop of PropagateTo
+template <typename T>
+struct PropagateKernelK {
+  T *fx, *fp[5], *fc[15];
+  typename TrackBatchT<T>::mask_type* fok;
+  const T *xk, *rotArc;
+  T b;
+  Bool_t noField;
+
+  template <typename L>
+  TRACKBATCHK_INLINE Int_t Run(Int_t i) const
+  {
+    typedef typename L::value V;
+    const auto active = L::LoadMask(fok + i);
+    const V fP0 = L::Load(fp[0] + i), fP1 = L::Load(fp[1] + i), fP2 = L::Load(fp[2] + i), fP3 = L::Load(fp[3] + i), fP4 = L::Load(fp[4] + i);
+    V c[15];
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      c[ic] = L::Load(fc[ic] + i);
+    const V
+      &fC20 = c[3], &fC21 = c[4], &fC22 = c[5],
+      &fC30 = c[6], &fC31 = c[7], &fC32 = c[8], &fC33 = c[9],
+      &fC40 = c[10], &fC41 = c[11], &fC42 = c[12], &fC43 = c[13], &fC44 = c[14];
+
+    const V x = L::Load(fx + i), xTo = L::Load(xk + i);
+    V dx = xTo - x;
+    const auto still = AbsK(dx) <= T(kAlmost0); // nothing to do, and no failure
+
+    V crv = noField ? V(T(0.)) : fP4 * b * T(kB2C);
+    V x2r = crv * dx;
+    V f1 = fP2, f2 = f1 + x2r;
+    V r1 = SqrtK((T(1.) - f1) * (T(1.) + f1)), r2 = SqrtK((T(1.) - f2) * (T(1.) + f2));
+    const auto ok = active & !still &
+                    !(AbsK(f1) >= T(kAlmost1)) & !(AbsK(f2) >= T(kAlmost1)) & !(AbsK(fP4) < T(kAlmost0)) &
+                    !(AbsK(r1) < T(kAlmost0)) & !(AbsK(r2) < T(kAlmost0));
+
+    V dy2dx = (f1 + f2) / (r1 + r2);
+    V p0 = fP0 + dx * dy2dx;
+    V p2 = fP2 + x2r;
+    V p1 = SelectK(AbsK(x2r) < T(0.05), fP1 + dx * (r2 + f2 * dy2dx) * fP3, fP1 + fP3 / crv * L::Load(rotArc + i));
+
+    V rinv = T(1.) / r1;
+    V r3inv = rinv * rinv * rinv;
+    V f24 = x2r / fP4;
+    V f02 = dx * r3inv;
+    V f04 = T(0.5) * f24 * f02;
+    V f12 = f02 * fP3 * f1;
+    V f14 = T(0.5) * f24 * f02 * fP3 * f1;
+    V f13 = dx * rinv;
+
+    //b = C*ft
+    V b00 = f02 * fC20 + f04 * fC40, b01 = f12 * fC20 + f14 * fC40 + f13 * fC30;
+    V b02 = f24 * fC40;
+    V b10 = f02 * fC21 + f04 * fC41, b11 = f12 * fC21 + f14 * fC41 + f13 * fC31;
+    V b12 = f24 * fC41;
+    V b20 = f02 * fC22 + f04 * fC42, b21 = f12 * fC22 + f14 * fC42 + f13 * fC32;
+    V b22 = f24 * fC42;
+    V b40 = f02 * fC42 + f04 * fC44, b41 = f12 * fC42 + f14 * fC44 + f13 * fC43;
+    V b42 = f24 * fC44;
+    V b30 = f02 * fC32 + f04 * fC43, b31 = f12 * fC32 + f14 * fC43 + f13 * fC33;
+    V b32 = f24 * fC43;
+
+    //a = f*b = f*C*ft
+    V a00 = f02 * b20 + f04 * b40, a01 = f02 * b21 + f04 * b41, a02 = f02 * b22 + f04 * b42;
+    V a11 = f12 * b21 + f14 * b41 + f13 * b31, a12 = f12 * b22 + f14 * b42 + f13 * b32;
+    V a22 = f24 * b42;
+
+    //F*C*Ft = C + (b + bt + a)
+    V cn[15];
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      cn[ic] = c[ic];
+    cn[0] += b00 + b00 + a00;
+    cn[1] += b10 + b01 + a01;
+    cn[3] += b20 + b02 + a02;
+    cn[6] += b30;
+    cn[10] += b40;
+    cn[2] += b11 + b11 + a11;
+    cn[4] += b21 + b12 + a12;
+    cn[7] += b31;
+    cn[11] += b41;
+    cn[5] += b22 + b22 + a22;
+    cn[8] += b32;
+    cn[12] += b42;
+    CheckCovarianceK<L>(cn);
+
+    L::Store(fx + i, SelectK(ok, xTo, x));
+    L::Store(fp[0] + i, SelectK(ok, p0, fP0));
+    L::Store(fp[1] + i, SelectK(ok, p1, fP1));
+    L::Store(fp[2] + i, SelectK(ok, p2, fP2));
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      L::Store(fc[ic] + i, SelectK(ok, cn[ic], c[ic]));
+    const auto okOut = ok | (active & still);
+    L::StoreMask(fok + i, okOut);
+    return L::Count(okOut);
+  }
+};
+
+//__________________________________________________________________________
+// the main loop of Rotate
+template <typename T>
+struct RotateKernelK {
+  T *fx, *falpha, *fp[5], *fc[15];
+  typename TrackBatchT<T>::mask_type* fok;
+  const T *alpha, *cosRot, *sinRot;
+
+  template <typename L>
+  TRACKBATCHK_INLINE Int_t Run(Int_t i) const
+  {
+    typedef typename L::value V;
+    const V fP0 = L::Load(fp[0] + i), fP2 = L::Load(fp[2] + i);
+    V x = L::Load(fx + i);
+    V ca = L::Load(cosRot + i), sa = L::Load(sinRot + i);
+    V sf = fP2, cf = SqrtK((T(1.) - fP2) * (T(1.) + fP2)); // Improve precision
+    V tmp = sf * ca - cf * sa;
+    const auto active = L::LoadMask(fok + i);
+    const auto ok = active & !(AbsK(fP2) >= T(kAlmost1)) & !((cf * ca + sf * sa) < T(0)) & !(AbsK(tmp) >= T(kAlmost1));
+
+    cf = SelectK(AbsK(cf) < T(kAlmost0), T(kAlmost0), cf);
+    V rr = (ca + sf / cf * sa);
+
+    V c[15], cn[15];
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      cn[ic] = c[ic] = L::Load(fc[ic] + i);
+    cn[0] *= (ca * ca);
+    cn[1] *= ca;
+    cn[3] *= ca * rr;
+    cn[4] *= rr;
+    cn[5] *= rr * rr;
+    cn[6] *= ca;
+    cn[8] *= rr;
+    cn[10] *= ca;
+    cn[12] *= rr;
+    CheckCovarianceK<L>(cn);
+
+    L::Store(falpha + i, SelectK(ok, L::Load(alpha + i), L::Load(falpha + i)));
+    L::Store(fx + i, SelectK(ok, x * ca + fP0 * sa, x));
+    L::Store(fp[0] + i, SelectK(ok, -x * sa + fP0 * ca, fP0));
+    L::Store(fp[2] + i, SelectK(ok, tmp, fP2));
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      L::Store(fc[ic] + i, SelectK(ok, cn[ic], c[ic]));
+    L::StoreMask(fok + i, ok);
+    return L::Count(ok);
+  }
+};
+
+//__________________________________________________________________________
+// the main loop of Update
+template <typename T>
+struct UpdateKernelK {
+  T *fp[5], *fc[15];
+  typename TrackBatchT<T>::mask_type* fok;
+  const T *y, *z;
+  T cov00, cov01, cov11;
+
+  template <typename L>
+  TRACKBATCHK_INLINE Int_t Run(Int_t i) const
+  {
+    typedef typename L::value V;
+    const V fP0 = L::Load(fp[0] + i), fP1 = L::Load(fp[1] + i), fP2 = L::Load(fp[2] + i);
+    V c[15], cn[15];
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      cn[ic] = c[ic] = L::Load(fc[ic] + i);
+    V &fC00 = cn[0],
+      &fC10 = cn[1], &fC11 = cn[2],
+      &fC20 = cn[3], &fC21 = cn[4], &fC22 = cn[5],
+      &fC30 = cn[6], &fC31 = cn[7], &fC32 = cn[8], &fC33 = cn[9],
+      &fC40 = cn[10], &fC41 = cn[11], &fC42 = cn[12], &fC43 = cn[13], &fC44 = cn[14];
+
+    V r00 = cov00, r01 = cov01, r11 = cov11;
+    r00 += fC00;
+    r01 += fC10;
+    r11 += fC11;
+    V det = r00 * r11 - r01 * r01;
+
+    V tmp = r00;
+    r00 = r11 / det;
+    r11 = tmp / det;
+    r01 = -r01 / det;
+
+    V k00 = fC00 * r00 + fC10 * r01, k01 = fC00 * r01 + fC10 * r11;
+    V k10 = fC10 * r00 + fC11 * r01, k11 = fC10 * r01 + fC11 * r11;
+    V k20 = fC20 * r00 + fC21 * r01, k21 = fC20 * r01 + fC21 * r11;
+    V k30 = fC30 * r00 + fC31 * r01, k31 = fC30 * r01 + fC31 * r11;
+    V k40 = fC40 * r00 + fC41 * r01, k41 = fC40 * r01 + fC41 * r11;
+
+    V dy = L::Load(y + i) - fP0, dz = L::Load(z + i) - fP1;
+    V sf = fP2 + k20 * dy + k21 * dz;
+    const auto ok = L::LoadMask(fok + i) & !(AbsK(det) < T(kAlmost0)) & !(AbsK(sf) > T(kAlmost1));
+
+    const V pIn[5] = {fP0, fP1, fP2, L::Load(fp[3] + i), L::Load(fp[4] + i)};
+    V p[5] = {fP0, fP1, sf, pIn[3], pIn[4]};
+    p[0] += k00 * dy + k01 * dz;
+    p[1] += k10 * dy + k11 * dz;
+    p[3] += k30 * dy + k31 * dz;
+    p[4] += k40 * dy + k41 * dz;
+
+    V c01 = fC10, c02 = fC20, c03 = fC30, c04 = fC40;
+    V c12 = fC21, c13 = fC31, c14 = fC41;
+
+    fC00 -= k00 * fC00 + k01 * fC10;
+    fC10 -= k00 * c01 + k01 * fC11;
+    fC20 -= k00 * c02 + k01 * c12;
+    fC30 -= k00 * c03 + k01 * c13;
+    fC40 -= k00 * c04 + k01 * c14;
+
+    fC11 -= k10 * c01 + k11 * fC11;
+    fC21 -= k10 * c02 + k11 * c12;
+    fC31 -= k10 * c03 + k11 * c13;
+    fC41 -= k10 * c04 + k11 * c14;
+
+    fC22 -= k20 * c02 + k21 * c12;
+    fC32 -= k20 * c03 + k21 * c13;
+    fC42 -= k20 * c04 + k21 * c14;
+
+    fC33 -= k30 * c03 + k31 * c13;
+    fC43 -= k30 * c04 + k31 * c14;
+
+    fC44 -= k40 * c04 + k41 * c14;
+    CheckCovarianceK<L>(cn);
+
+#pragma GCC unroll 5
+
+    for (Int_t ip = 0; ip < 5; ip++)
+      L::Store(fp[ip] + i, SelectK(ok, p[ip], pIn[ip]));
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      L::Store(fc[ic] + i, SelectK(ok, cn[ic], c[ic]));
+    L::StoreMask(fok + i, ok);
+    return L::Count(ok);
+  }
+};
+
+//__________________________________________________________________________
+// the main loop of CorrectForMeanMaterialdEdx
+template <typename T>
+struct MaterialKernelK {
+  T *fp[5], *fc[15];
+  typename TrackBatchT<T>::mask_type* fok;
+  const T *dEdx, *logTerm2;
+  T xOverX0In, xTimesRhoIn, mass;
+  Bool_t anglecorr, useLogTerm;
+
+  template <typename L>
+  TRACKBATCHK_INLINE Int_t Run(Int_t i) const
+  {
+    typedef typename L::value V;
+    const V fP2 = L::Load(fp[2] + i), fP3 = L::Load(fp[3] + i), fP4 = L::Load(fp[4] + i);
+
+    //Apply angle correction, if requested
+    V xOverX0 = xOverX0In, xTimesRho = xTimesRhoIn;
+    V angle = SqrtK((T(1.) + fP3 * fP3) / ((T(1) - fP2) * (T(1.) + fP2)));
+    xOverX0 = anglecorr ? xOverX0 * angle : xOverX0;
+    xTimesRho = anglecorr ? xTimesRho * angle : xTimesRho;
+
+    V p = GetPK<L>(fP3, fP4);
+    if (mass < T(0))
+      p += p; // q=2 particle
+    V p2 = p * p;
+    V beta2 = p2 / (p2 + mass * mass);
+
+    //Calculating the multiple scattering corrections******************
+    const auto scatter = xOverX0 != T(0);
+    V theta2 = T(0.0136 * 0.0136) / (beta2 * p2) * AbsK(xOverX0);
+    theta2 = useLogTerm ? theta2 * L::Load(logTerm2 + i) : theta2;
+    if (mass < T(0))
+      theta2 *= T(4); // q=2 particle
+    V cC22 = SelectK(scatter, theta2 * ((T(1.) - fP2) * (T(1.) + fP2)) * (T(1.) + fP3 * fP3), T(0.));
+    V cC33 = SelectK(scatter, theta2 * (T(1.) + fP3 * fP3) * (T(1.) + fP3 * fP3), T(0.));
+    V cC43 = SelectK(scatter, theta2 * fP3 * fP4 * (T(1.) + fP3 * fP3), T(0.));
+    V cC44 = SelectK(scatter, theta2 * fP3 * fP4 * fP3 * fP4, T(0.));
+
+    //Calculating the energy loss corrections************************
+    const auto loss = (xTimesRho != T(0.)) & (beta2 < T(1.));
+    V dE = L::Load(dEdx + i) * xTimesRho;
+    V e = SqrtK(p2 + mass * mass);
+    V cP4 = SelectK(loss, T(1.) / SqrtK(T(1.) + dE / p2 * (dE + T(2) * e)), T(1.)); //A precise formula by Ruben !
+    // Approximate energy loss fluctuation (M.Ivanov)
+    const T knst = T(0.07); // To be tuned.
+    V sigmadE = knst * SqrtK(AbsK(dE));
+    cC44 = SelectK(loss, cC44 + ((sigmadE * e / p2 * fP4) * (sigmadE * e / p2 * fP4)), cC44);
+
+    const auto ok = L::LoadMask(fok + i) &
+                    !(scatter & (theta2 > T(TMath::Pi() * TMath::Pi()))) &
+                    !(loss & (AbsK(dE) > T(0.3) * e)) &                   //30% energy loss is too much!
+                    !(loss & ((T(1.) + dE / p2 * (dE + T(2) * e)) < T(0.))) &
+                    !(loss & (AbsK(fP4 * cP4) > T(100.)));                //Do not track below 10 MeV/c
+
+    //Applying the corrections*****************************
+    V c[15], cn[15];
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      cn[ic] = c[ic] = L::Load(fc[ic] + i);
+    cn[5] += cC22;
+    cn[9] += cC33;
+    cn[13] += cC43;
+    cn[14] += cC44;
+    CheckCovarianceK<L>(cn);
+
+    L::Store(fp[4] + i, SelectK(ok, fP4 * cP4, fP4));
+#pragma GCC unroll 15
+    for (Int_t ic = 0; ic < 15; ic++)
+      L::Store(fc[ic] + i, SelectK(ok, cn[ic], c[ic]));
+    L::StoreMask(fok + i, ok);
+    return L::Count(ok);
+  }
+};
+} // namespace
+
+//__________________________________________________________________________
+template <typename T>
+void TrackBatchT<T>::Resize(Int_t n)
+{
+  fX.resize(n);
+  fAlpha.resize(n);
+  for (Int_t ip = 0; ip < 5; ip++)
+    fP[ip].resize(n);
+  for (Int_t ic = 0; ic < 15; ic++)
+    fC[ic].resize(n);
+  fOK.resize(n);
+  for (Int_t iw = 0; iw < 4; iw++)
+    fWork[iw].resize(n);
+}
+
+//__________________________________________________________________________
+template <typename T>
+Bool_t TrackBatchT<T>::GetUseSIMD()
+{
+#if defined(__x86_64__)
+  return fgUseSIMD && HasAVX2K();
+#else
+  return kFALSE;
+#endif
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::GetNActive() const
+{
+  Int_t n = 0;
+  for (auto ok : fOK)
+    n += ok != 0;
+  return n;
+}
+
+//__________________________________________________________________________
+template <typename T>
+void TrackBatchT<T>::Load(Int_t i, const AliExternalTrackParam& trc)
+{
+  fX[i] = T(trc.GetX());
+  fAlpha[i] = T(trc.GetAlpha());
+  for (Int_t ip = 0; ip < 5; ip++)
+    fP[ip][i] = T(trc.GetParameter()[ip]);
+  for (Int_t ic = 0; ic < 15; ic++)
+    fC[ic][i] = T(trc.GetCovariance()[ic]);
+  fOK[i] = kTRUE;
+}
+
+//__________________________________________________________________________
+template <typename T>
+void TrackBatchT<T>::Store(Int_t i, AliExternalTrackParam& trc) const
+{
+  // the covariance of a processed track is already checked, Set leaves it as it is
+  Double_t p[5], c[15];
+  for (Int_t ip = 0; ip < 5; ip++)
+    p[ip] = fP[ip][i];
+  for (Int_t ic = 0; ic < 15; ic++)
+    c[ic] = fC[ic][i];
+  trc.Set(Double_t(fX[i]), Double_t(fAlpha[i]), p, c);
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::PropagateTo(Double_t xk, Double_t b)
+{
+  std::fill(fWork[2].begin(), fWork[2].end(), T(xk));
+  return PropagateTo(fWork[2].data(), b);
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::PropagateTo(const T* xk, Double_t bz)
+{
+  // AliExternalTrackParam::PropagateTo(xk, b) for the active tracks, to xk[i]
+  const Int_t n = GetSize();
+  PropagateKernelK<T> kernel;
+  kernel.fx = fX.data();
+  GetArrays(kernel.fp, kernel.fc);
+  kernel.fok = fOK.data();
+  kernel.xk = xk;
+  kernel.b = T(bz);
+  kernel.noField = TMath::Abs(kernel.b) < T(kAlmost0Field);
+  const T b = kernel.b;
+  const Bool_t noField = kernel.noField;
+  T *fx = kernel.fx, **fp = kernel.fp;
+  const mask_type* fok = kernel.fok;
+
+  // arc angle of the tracks with large dx/R, for the Z propagation
+  T* rotArc = fWork[0].data();
+  for (Int_t i = 0; i < n; i++) {
+    rotArc[i] = T(0.);
+    T crv = noField ? T(0.) : fp[4][i] * b * T(kB2C);
+    T x2r = crv * (xk[i] - fx[i]);
+    T f1 = fp[2][i], f2 = f1 + x2r;
+    if (!fok[i] || TMath::Abs(x2r) < T(0.05) || TMath::Abs(f1) >= T(kAlmost1) || TMath::Abs(f2) >= T(kAlmost1))
+      continue;
+    T r1 = SqrtK((T(1.) - f1) * (T(1.) + f1)), r2 = SqrtK((T(1.) - f2) * (T(1.) + f2));
+    T rot = ASinK(r1 * f2 - r2 * f1);                   // more economic version from Yura.
+    if (f1 * f1 + f2 * f2 > T(1) && f1 * f2 < T(0)) {   // special cases of large rotations or large abs angles
+      if (f2 > T(0))
+        rot = T(TMath::Pi()) - rot;
+      else
+        rot = T(-TMath::Pi()) - rot;
+    }
+    rotArc[i] = rot;
+  }
+  kernel.rotArc = rotArc;
+
+  return RunK<T>(kernel, n);
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::Rotate(Double_t alpha)
+{
+  std::fill(fWork[2].begin(), fWork[2].end(), T(alpha));
+  return Rotate(fWork[2].data());
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::Rotate(const T* alphaIn)
+{
+  // AliExternalTrackParam::Rotate(alpha) for the active tracks, to alphaIn[i]
+  const Int_t n = GetSize();
+  RotateKernelK<T> kernel;
+  kernel.fx = fX.data();
+  kernel.falpha = fAlpha.data();
+  GetArrays(kernel.fp, kernel.fc);
+  kernel.fok = fOK.data();
+  const mask_type* fok = kernel.fok;
+
+  // rotation angle
+  T *alpha = fWork[3].data(), *cosRot = fWork[0].data(), *sinRot = fWork[1].data();
+  for (Int_t i = 0; i < n; i++) {
+    alpha[i] = T(NormalizeAlphaK(alphaIn[i]));
+    cosRot[i] = fok[i] ? CosK(alpha[i] - fAlpha[i]) : T(1.);
+    sinRot[i] = fok[i] ? SinK(alpha[i] - fAlpha[i]) : T(0.);
+  }
+  kernel.alpha = alpha;
+  kernel.cosRot = cosRot;
+  kernel.sinRot = sinRot;
+
+  return RunK<T>(kernel, n);
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::Update(const T* y, const T* z, const Double_t cov[3])
+{
+  // AliExternalTrackParam::Update(p, cov) for the active tracks, with p = {y[i], z[i]}
+  UpdateKernelK<T> kernel;
+  GetArrays(kernel.fp, kernel.fc);
+  kernel.fok = fOK.data();
+  kernel.y = y;
+  kernel.z = z;
+  kernel.cov00 = T(cov[0]);
+  kernel.cov01 = T(cov[1]);
+  kernel.cov11 = T(cov[2]);
+  return RunK<T>(kernel, GetSize());
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::CorrectForMeanMaterial(Double_t xOverX0, Double_t xTimesRho, Double_t massIn, Bool_t anglecorr,
+                                             Double_t (*Bethe)(Double_t))
+{
+  // AliExternalTrackParam::CorrectForMeanMaterial for the active tracks, with the
+  // energy loss of each from Bethe (in double)
+  const Int_t n = GetSize();
+  if (massIn < -990) { // unknown PID particle
+    for (Int_t i = 0; i < n; i++)
+      fOK[i] = kFALSE;
+    return 0;
+  }
+  const T mass = T(massIn);
+  T* dEdx = fWork[0].data();
+  for (Int_t i = 0; i < n; i++) {
+    if (!fOK[i])
+      continue;
+    T bg = GetPK<ScalarLaneK<T>>(fP[3][i], fP[4][i]) / mass;
+    if (mass < T(0))
+      bg = T(-2) * bg;
+    dEdx[i] = T(Bethe(bg));
+    if (mass < T(0))
+      dEdx[i] *= T(4);
+  }
+  return CorrectForMeanMaterialdEdx(xOverX0, xTimesRho, massIn, dEdx, anglecorr);
+}
+
+//__________________________________________________________________________
+template <typename T>
+Int_t TrackBatchT<T>::CorrectForMeanMaterialdEdx(Double_t xOverX0In, Double_t xTimesRhoIn, Double_t massIn, const T* dEdx, Bool_t anglecorr)
+{
+  // AliExternalTrackParam::CorrectForMeanMaterialdEdx for the active tracks, with the
+  // mean energy loss dEdx[i] (GeV/(g/cm^2))
+  const Int_t n = GetSize();
+  MaterialKernelK<T> kernel;
+  GetArrays(kernel.fp, kernel.fc);
+  kernel.fok = fOK.data();
+  kernel.dEdx = dEdx;
+  kernel.xOverX0In = T(xOverX0In);
+  kernel.xTimesRhoIn = T(xTimesRhoIn);
+  kernel.mass = T(massIn);
+  kernel.anglecorr = anglecorr;
+  kernel.useLogTerm = AliExternalTrackParam::GetUseLogTermMS();
+  T** fp = kernel.fp;
+  const mask_type* fok = kernel.fok;
+
+  // factor of the log term of the multiple scattering, if requested
+  const Bool_t tabulated = MaterialTableK::IsTabulated();
+  T* logTerm2 = fWork[1].data();
+  for (Int_t i = 0; i < n; i++) {
+    logTerm2[i] = T(1.);
+    if (!kernel.useLogTerm || !fok[i])
+      continue;
+    T xOverX0 = T(xOverX0In);
+    if (anglecorr)
+      xOverX0 *= SqrtK((T(1.) + fp[3][i] * fp[3][i]) / ((T(1) - fp[2][i]) * (T(1.) + fp[2][i])));
+    if (tabulated) {
+      if (xOverX0 != T(0))
+        logTerm2[i] = T(MaterialTableK::MSFactor(xOverX0)) / TMath::Abs(xOverX0);
+      continue;
+    }
+    T lt = T(1) + T(0.038) * LogK(TMath::Abs(xOverX0));
+    logTerm2[i] = lt > T(0) ? lt * lt : T(1.);
+  }
+  kernel.logTerm2 = logTerm2;
+
+  return RunK<T>(kernel, n);
+}
+
+template class TrackBatchT<Double_t>;
+template class TrackBatchT<Float_t>;
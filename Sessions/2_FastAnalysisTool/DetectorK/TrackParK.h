@@ -0,0 +1,473 @@
+#ifndef TRACKPARK_H
+#define TRACKPARK_H
+
+#include <Rtypes.h>
+#include <TMath.h>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+#include "AliExternalTrackParam.h"
+#include "MaterialTableK.h"
+
+// Track state of the fast tracker as plain data: the parameters and covariance of
+// AliExternalTrackParam, in the same layout, without the TObject/AliVTrack bases.
+// PropagateTo, Rotate, Update, CorrectForMeanMaterial(dEdx) and CheckCovariance
+// below are the AliExternalTrackParam methods as free functions, with the same
+// arithmetic in the same order, so the results are bit for bit the same. Unlike
+// the class methods, they do not log on failure.
+//
+// The state and the functions are templated on the precision: TrackParK is the
+// double one, as AliExternalTrackParam, while TrackParT<Float_t> does the same
+// math in single precision (lutPrecision.cc measures its deviations from the
+// double one). The arguments which are not track data (target X and alpha, field,
+// measurement, material) are given in double and converted. The Bethe-Bloch and
+// multiple scattering functions are those of MaterialTableK, exact or tabulated.
+template <typename T>
+struct TrackParT {
+  typedef T value_type;
+  T x = 0;      // X coordinate for the point of parametrisation
+  T alpha = 0;  // local <--> global coor.system rotation angle
+  T p[5] = {};  // y, z, sin(phi), tan(lambda), q/pt
+  T c[15] = {}; // lower triangle of the covariance
+  //
+  T GetSigmaY2() const { return c[0]; }
+  T GetSigmaZ2() const { return c[2]; }
+};
+
+typedef TrackParT<Double_t> TrackParK;
+
+static_assert(std::is_trivially_copyable<TrackParK>::value, "TrackParK must be trivially copyable");
+static_assert(std::is_trivially_copyable<TrackParT<Float_t>>::value, "TrackParT must be trivially copyable");
+static_assert(sizeof(TrackParK) == 22 * sizeof(Double_t), "TrackParK must have the layout of the AliExternalTrackParam data");
+
+// Zero copy views of the data members of an AliExternalTrackParam, which are 22
+// contiguous doubles as TrackParK, e.g. AsTrackParK(trc) = par to set trc from par
+struct TrackParAccessK : public AliExternalTrackParam {
+  static Double32_t AliExternalTrackParam::*X() { return &TrackParAccessK::fX; }
+  static Double32_t (AliExternalTrackParam::*C())[15] { return &TrackParAccessK::fC; }
+};
+
+inline TrackParK& AsTrackParK(AliExternalTrackParam& trc)
+{
+  Double_t* data = &(trc.*TrackParAccessK::X());
+  assert((trc.*TrackParAccessK::C()) == data + 7);
+  return *reinterpret_cast<TrackParK*>(data);
+}
+
+inline const TrackParK& AsTrackParK(const AliExternalTrackParam& trc)
+{
+  return AsTrackParK(const_cast<AliExternalTrackParam&>(trc));
+}
+
+// the same track in another precision
+template <typename T, typename U>
+inline void ConvertTrackPar(const TrackParT<U>& from, TrackParT<T>& to)
+{
+  to.x = T(from.x);
+  to.alpha = T(from.alpha);
+  for (int i = 0; i < 5; i++)
+    to.p[i] = T(from.p[i]);
+  for (int i = 0; i < 15; i++)
+    to.c[i] = T(from.c[i]);
+}
+
+// math functions in the precision of the argument, the TMath ones in double
+inline Double_t SqrtK(Double_t v) { return TMath::Sqrt(v); }
+inline Float_t SqrtK(Float_t v) { return std::sqrt(v); }
+inline Double_t LogK(Double_t v) { return TMath::Log(v); }
+inline Float_t LogK(Float_t v) { return std::log(v); }
+inline Double_t CosK(Double_t v) { return TMath::Cos(v); }
+inline Float_t CosK(Float_t v) { return std::cos(v); }
+inline Double_t SinK(Double_t v) { return TMath::Sin(v); }
+inline Float_t SinK(Float_t v) { return std::sin(v); }
+inline Double_t ASinK(Double_t v) { return TMath::ASin(v); }
+inline Float_t ASinK(Float_t v) { return v < -1.f ? Float_t(-TMath::Pi() / 2) : (v > 1.f ? Float_t(TMath::Pi() / 2) : std::asin(v)); } // as TMath::ASin
+
+//__________________________________________________________________________
+template <typename T>
+inline void CheckCovariance(TrackParT<T>& t)
+{
+  // as AliExternalTrackParam::CheckCovariance
+  T* fC = t.c;
+  fC[0] = TMath::Abs(fC[0]);
+  if (fC[0] > T(kC0max)) {
+    T scl = SqrtK(T(kC0max) / fC[0]);
+    fC[0] = T(kC0max);
+    fC[1] *= scl;
+    fC[3] *= scl;
+    fC[6] *= scl;
+    fC[10] *= scl;
+  }
+  fC[2] = TMath::Abs(fC[2]);
+  if (fC[2] > T(kC2max)) {
+    T scl = SqrtK(T(kC2max) / fC[2]);
+    fC[2] = T(kC2max);
+    fC[1] *= scl;
+    fC[4] *= scl;
+    fC[7] *= scl;
+    fC[11] *= scl;
+  }
+  fC[5] = TMath::Abs(fC[5]);
+  if (fC[5] > T(kC5max)) {
+    T scl = SqrtK(T(kC5max) / fC[5]);
+    fC[5] = T(kC5max);
+    fC[3] *= scl;
+    fC[4] *= scl;
+    fC[8] *= scl;
+    fC[12] *= scl;
+  }
+  fC[9] = TMath::Abs(fC[9]);
+  if (fC[9] > T(kC9max)) {
+    T scl = SqrtK(T(kC9max) / fC[9]);
+    fC[9] = T(kC9max);
+    fC[6] *= scl;
+    fC[7] *= scl;
+    fC[8] *= scl;
+    fC[13] *= scl;
+  }
+  fC[14] = TMath::Abs(fC[14]);
+  if (fC[14] > T(kC14max)) {
+    T scl = SqrtK(T(kC14max) / fC[14]);
+    fC[14] = T(kC14max);
+    fC[10] *= scl;
+    fC[11] *= scl;
+    fC[12] *= scl;
+    fC[13] *= scl;
+  }
+}
+
+//__________________________________________________________________________
+template <typename T>
+inline T GetP(const TrackParT<T>& t)
+{
+  // track momentum, as AliExternalTrackParam::GetP
+  if (TMath::Abs(t.p[4]) <= T(kAlmost0))
+    return T(kVeryBig);
+  return SqrtK(T(1.) + t.p[3] * t.p[3]) / TMath::Abs(t.p[4]);
+}
+
+//__________________________________________________________________________
+template <typename T>
+inline Bool_t PropagateTo(TrackParT<T>& t, Double_t xTo, Double_t bz)
+{
+  // as AliExternalTrackParam::PropagateTo(xk, b): to the plane X=xk (cm) in the field b (kG)
+  const T xk = T(xTo), b = T(bz);
+  T dx = xk - t.x;
+  if (TMath::Abs(dx) <= T(kAlmost0))
+    return kTRUE;
+
+  T crv = t.p[4] * b * T(kB2C);
+  if (TMath::Abs(b) < T(kAlmost0Field))
+    crv = T(0.);
+
+  T x2r = crv * dx;
+  T f1 = t.p[2], f2 = f1 + x2r;
+  if (TMath::Abs(f1) >= T(kAlmost1))
+    return kFALSE;
+  if (TMath::Abs(f2) >= T(kAlmost1))
+    return kFALSE;
+  if (TMath::Abs(t.p[4]) < T(kAlmost0))
+    return kFALSE;
+
+  T &fP0 = t.p[0], &fP1 = t.p[1], &fP2 = t.p[2], &fP3 = t.p[3], &fP4 = t.p[4];
+  T &fC00 = t.c[0],
+    &fC10 = t.c[1], &fC11 = t.c[2],
+    &fC20 = t.c[3], &fC21 = t.c[4], &fC22 = t.c[5],
+    &fC30 = t.c[6], &fC31 = t.c[7], &fC32 = t.c[8], &fC33 = t.c[9],
+    &fC40 = t.c[10], &fC41 = t.c[11], &fC42 = t.c[12], &fC43 = t.c[13], &fC44 = t.c[14];
+
+  T r1 = SqrtK((T(1.) - f1) * (T(1.) + f1)), r2 = SqrtK((T(1.) - f2) * (T(1.) + f2));
+  if (TMath::Abs(r1) < T(kAlmost0))
+    return kFALSE;
+  if (TMath::Abs(r2) < T(kAlmost0))
+    return kFALSE;
+
+  t.x = xk;
+  T dy2dx = (f1 + f2) / (r1 + r2);
+  fP0 += dx * dy2dx;
+  fP2 += x2r;
+  if (TMath::Abs(x2r) < T(0.05))
+    fP1 += dx * (r2 + f2 * dy2dx) * fP3;
+  else {
+    T rot = ASinK(r1 * f2 - r2 * f1); // arc angle, see AliExternalTrackParam::PropagateTo
+    if (f1 * f1 + f2 * f2 > T(1) && f1 * f2 < T(0)) {
+      if (f2 > T(0))
+        rot = T(TMath::Pi()) - rot;
+      else
+        rot = T(-TMath::Pi()) - rot;
+    }
+    fP1 += fP3 / crv * rot;
+  }
+
+  //f = F - 1
+  T rinv = T(1.) / r1;
+  T r3inv = rinv * rinv * rinv;
+  T f24 = x2r / fP4;
+  T f02 = dx * r3inv;
+  T f04 = T(0.5) * f24 * f02;
+  T f12 = f02 * fP3 * f1;
+  T f14 = T(0.5) * f24 * f02 * fP3 * f1;
+  T f13 = dx * rinv;
+
+  //b = C*ft
+  T b00 = f02 * fC20 + f04 * fC40, b01 = f12 * fC20 + f14 * fC40 + f13 * fC30;
+  T b02 = f24 * fC40;
+  T b10 = f02 * fC21 + f04 * fC41, b11 = f12 * fC21 + f14 * fC41 + f13 * fC31;
+  T b12 = f24 * fC41;
+  T b20 = f02 * fC22 + f04 * fC42, b21 = f12 * fC22 + f14 * fC42 + f13 * fC32;
+  T b22 = f24 * fC42;
+  T b40 = f02 * fC42 + f04 * fC44, b41 = f12 * fC42 + f14 * fC44 + f13 * fC43;
+  T b42 = f24 * fC44;
+  T b30 = f02 * fC32 + f04 * fC43, b31 = f12 * fC32 + f14 * fC43 + f13 * fC33;
+  T b32 = f24 * fC43;
+
+  //a = f*b = f*C*ft
+  T a00 = f02 * b20 + f04 * b40, a01 = f02 * b21 + f04 * b41, a02 = f02 * b22 + f04 * b42;
+  T a11 = f12 * b21 + f14 * b41 + f13 * b31, a12 = f12 * b22 + f14 * b42 + f13 * b32;
+  T a22 = f24 * b42;
+
+  //F*C*Ft = C + (b + bt + a)
+  fC00 += b00 + b00 + a00;
+  fC10 += b10 + b01 + a01;
+  fC20 += b20 + b02 + a02;
+  fC30 += b30;
+  fC40 += b40;
+  fC11 += b11 + b11 + a11;
+  fC21 += b21 + b12 + a12;
+  fC31 += b31;
+  fC41 += b41;
+  fC22 += b22 + b22 + a22;
+  fC32 += b32;
+  fC42 += b42;
+
+  CheckCovariance(t);
+  return kTRUE;
+}
+
+//__________________________________________________________________________
+template <typename T>
+inline Bool_t Rotate(TrackParT<T>& t, Double_t alphaTo)
+{
+  // as AliExternalTrackParam::Rotate: to the local frame rotated by alpha (rad)
+  if (TMath::Abs(t.p[2]) >= T(kAlmost1))
+    return kFALSE;
+
+  if (alphaTo < -TMath::Pi())
+    alphaTo += 2 * TMath::Pi();
+  else if (alphaTo >= TMath::Pi())
+    alphaTo -= 2 * TMath::Pi();
+  const T alpha = T(alphaTo);
+
+  T& fP0 = t.p[0];
+  T& fP2 = t.p[2];
+  T* fC = t.c;
+
+  T x = t.x;
+  T ca = CosK(alpha - t.alpha), sa = SinK(alpha - t.alpha);
+  T sf = fP2, cf = SqrtK((T(1.) - fP2) * (T(1.) + fP2)); // Improve precision
+  // the local cos(phi) must stay positive
+  if ((cf * ca + sf * sa) < T(0))
+    return kFALSE;
+
+  T tmp = sf * ca - cf * sa;
+  if (TMath::Abs(tmp) >= T(kAlmost1))
+    return kFALSE;
+  t.alpha = alpha;
+  t.x = x * ca + fP0 * sa;
+  fP0 = -x * sa + fP0 * ca;
+  fP2 = tmp;
+
+  if (TMath::Abs(cf) < T(kAlmost0))
+    cf = T(kAlmost0);
+
+  T rr = (ca + sf / cf * sa);
+
+  fC[0] *= (ca * ca);
+  fC[1] *= ca;
+  fC[3] *= ca * rr;
+  fC[4] *= rr;
+  fC[5] *= rr * rr;
+  fC[6] *= ca;
+  fC[8] *= rr;
+  fC[10] *= ca;
+  fC[12] *= rr;
+
+  CheckCovariance(t);
+  return kTRUE;
+}
+
+//__________________________________________________________________________
+template <typename T>
+inline Bool_t Update(TrackParT<T>& t, const Double_t p[2], const Double_t cov[3])
+{
+  // as AliExternalTrackParam::Update: with the space point p of covariance cov
+  T &fP0 = t.p[0], &fP1 = t.p[1], &fP2 = t.p[2], &fP3 = t.p[3], &fP4 = t.p[4];
+  T &fC00 = t.c[0],
+    &fC10 = t.c[1], &fC11 = t.c[2],
+    &fC20 = t.c[3], &fC21 = t.c[4], &fC22 = t.c[5],
+    &fC30 = t.c[6], &fC31 = t.c[7], &fC32 = t.c[8], &fC33 = t.c[9],
+    &fC40 = t.c[10], &fC41 = t.c[11], &fC42 = t.c[12], &fC43 = t.c[13], &fC44 = t.c[14];
+
+  T r00 = T(cov[0]), r01 = T(cov[1]), r11 = T(cov[2]);
+  r00 += fC00;
+  r01 += fC10;
+  r11 += fC11;
+  T det = r00 * r11 - r01 * r01;
+
+  if (TMath::Abs(det) < T(kAlmost0))
+    return kFALSE;
+
+  T tmp = r00;
+  r00 = r11 / det;
+  r11 = tmp / det;
+  r01 = -r01 / det;
+
+  T k00 = fC00 * r00 + fC10 * r01, k01 = fC00 * r01 + fC10 * r11;
+  T k10 = fC10 * r00 + fC11 * r01, k11 = fC10 * r01 + fC11 * r11;
+  T k20 = fC20 * r00 + fC21 * r01, k21 = fC20 * r01 + fC21 * r11;
+  T k30 = fC30 * r00 + fC31 * r01, k31 = fC30 * r01 + fC31 * r11;
+  T k40 = fC40 * r00 + fC41 * r01, k41 = fC40 * r01 + fC41 * r11;
+
+  T dy = T(p[0]) - fP0, dz = T(p[1]) - fP1;
+  T sf = fP2 + k20 * dy + k21 * dz;
+  if (TMath::Abs(sf) > T(kAlmost1))
+    return kFALSE;
+
+  fP0 += k00 * dy + k01 * dz;
+  fP1 += k10 * dy + k11 * dz;
+  fP2 = sf;
+  fP3 += k30 * dy + k31 * dz;
+  fP4 += k40 * dy + k41 * dz;
+
+  T c01 = fC10, c02 = fC20, c03 = fC30, c04 = fC40;
+  T c12 = fC21, c13 = fC31, c14 = fC41;
+
+  fC00 -= k00 * fC00 + k01 * fC10;
+  fC10 -= k00 * c01 + k01 * fC11;
+  fC20 -= k00 * c02 + k01 * c12;
+  fC30 -= k00 * c03 + k01 * c13;
+  fC40 -= k00 * c04 + k01 * c14;
+
+  fC11 -= k10 * c01 + k11 * fC11;
+  fC21 -= k10 * c02 + k11 * c12;
+  fC31 -= k10 * c03 + k11 * c13;
+  fC41 -= k10 * c04 + k11 * c14;
+
+  fC22 -= k20 * c02 + k21 * c12;
+  fC32 -= k20 * c03 + k21 * c13;
+  fC42 -= k20 * c04 + k21 * c14;
+
+  fC33 -= k30 * c03 + k31 * c13;
+  fC43 -= k30 * c04 + k31 * c14;
+
+  fC44 -= k40 * c04 + k41 * c14;
+
+  CheckCovariance(t);
+  return kTRUE;
+}
+
+//__________________________________________________________________________
+template <typename T>
+inline Bool_t CorrectForMeanMaterialdEdx(TrackParT<T>& t, Double_t xOverX0In, Double_t xTimesRhoIn, Double_t massIn,
+                                         Double_t dEdxIn, Bool_t anglecorr = kFALSE)
+{
+  // as AliExternalTrackParam::CorrectForMeanMaterialdEdx, see there for the arguments
+  T xOverX0 = T(xOverX0In), xTimesRho = T(xTimesRhoIn);
+  const T mass = T(massIn), dEdx = T(dEdxIn);
+  T& fP2 = t.p[2];
+  T& fP3 = t.p[3];
+  T& fP4 = t.p[4];
+
+  T& fC22 = t.c[5];
+  T& fC33 = t.c[9];
+  T& fC43 = t.c[13];
+  T& fC44 = t.c[14];
+
+  //Apply angle correction, if requested
+  if (anglecorr) {
+    T angle = SqrtK((T(1.) + fP3 * fP3) / ((T(1) - fP2) * (T(1.) + fP2)));
+    xOverX0 *= angle;
+    xTimesRho *= angle;
+  }
+
+  T p = GetP(t);
+  if (mass < T(0))
+    p += p; // q=2 particle
+  T p2 = p * p;
+  T beta2 = p2 / (p2 + mass * mass);
+
+  //Calculating the multiple scattering corrections******************
+  T cC22 = T(0.);
+  T cC33 = T(0.);
+  T cC43 = T(0.);
+  T cC44 = T(0.);
+  if (xOverX0 != T(0)) {
+    T theta2 = T(0.0136 * 0.0136) / (beta2 * p2) * TMath::Abs(xOverX0);
+    if (AliExternalTrackParam::GetUseLogTermMS() && MaterialTableK::IsTabulated()) {
+      theta2 = T(0.0136 * 0.0136) / (beta2 * p2) * T(MaterialTableK::MSFactor(xOverX0));
+    } else if (AliExternalTrackParam::GetUseLogTermMS()) {
+      T lt = T(1) + T(0.038) * LogK(TMath::Abs(xOverX0));
+      if (lt > T(0))
+        theta2 *= lt * lt;
+    }
+    if (mass < T(0))
+      theta2 *= T(4); // q=2 particle
+    if (theta2 > T(TMath::Pi() * TMath::Pi()))
+      return kFALSE;
+    cC22 = theta2 * ((T(1.) - fP2) * (T(1.) + fP2)) * (T(1.) + fP3 * fP3);
+    cC33 = theta2 * (T(1.) + fP3 * fP3) * (T(1.) + fP3 * fP3);
+    cC43 = theta2 * fP3 * fP4 * (T(1.) + fP3 * fP3);
+    cC44 = theta2 * fP3 * fP4 * fP3 * fP4;
+  }
+
+  //Calculating the energy loss corrections************************
+  T cP4 = T(1.);
+  if ((xTimesRho != T(0.)) && (beta2 < T(1.))) {
+    T dE = dEdx * xTimesRho;
+    T e = SqrtK(p2 + mass * mass);
+    if (TMath::Abs(dE) > T(0.3) * e)
+      return kFALSE; //30% energy loss is too much!
+    if ((T(1.) + dE / p2 * (dE + T(2) * e)) < T(0.))
+      return kFALSE;
+    cP4 = T(1.) / SqrtK(T(1.) + dE / p2 * (dE + T(2) * e)); //A precise formula by Ruben !
+    if (TMath::Abs(fP4 * cP4) > T(100.))
+      return kFALSE; //Do not track below 10 MeV/c
+
+    // Approximate energy loss fluctuation (M.Ivanov)
+    const T knst = T(0.07); // To be tuned.
+    T sigmadE = knst * SqrtK(TMath::Abs(dE));
+    cC44 += ((sigmadE * e / p2 * fP4) * (sigmadE * e / p2 * fP4));
+  }
+
+  //Applying the corrections*****************************
+  fC22 += cC22;
+  fC33 += cC33;
+  fC43 += cC43;
+  fC44 += cC44;
+  fP4 *= cP4;
+
+  CheckCovariance(t);
+  return kTRUE;
+}
+
+//__________________________________________________________________________
+template <typename T>
+inline Bool_t CorrectForMeanMaterial(TrackParT<T>& t, Double_t xOverX0, Double_t xTimesRho, Double_t massIn, Bool_t anglecorr = kFALSE,
+                                     Double_t (*Bethe)(Double_t) = MaterialTableK::BetheBlochSolid)
+{
+  // as AliExternalTrackParam::CorrectForMeanMaterial, with the energy loss from Bethe (in double)
+  const T mass = T(massIn);
+  T bg = GetP(t) / mass;
+  if (mass < T(0)) {
+    if (mass < T(-990))
+      return kFALSE; // unknown PID particle
+    bg = T(-2) * bg;
+  }
+  T dEdx = T(Bethe(bg));
+  if (mass < T(0))
+    dEdx *= T(4);
+
+  return CorrectForMeanMaterialdEdx(t, xOverX0, xTimesRho, massIn, dEdx, anglecorr);
+}
+
+#endif
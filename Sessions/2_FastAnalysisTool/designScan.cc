@@ -0,0 +1,304 @@
+#ifndef designScan_CC
+#define designScan_CC
+#include "lutWrite.cc"
+#include <TFile.h>
+#include <TTree.h>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+/// scan of detector designs around the current FAT layout
+///
+/// Each axis varies one parameter of one or more layers (comma separated names)
+/// or the B field over a list of values. The designs are the points of the
+/// Cartesian grid of the axes, or a random sample of them, and each one is
+/// evaluated at the given (pt, eta) points by the same solver as the LUTs. The
+/// designs are solved on nThreads threads and filled in order, as they are
+/// done, into a TTree with one entry per design and point, the parameter
+/// values included. The layer efficiency is not an axis: the good hit
+/// probabilities of the FAT solver do not depend on it.
+///
+/// The radius, x0 and B field axes change the transport of the tracks (the outward
+/// probe of DetectorK::SolveTrack, see TrackProbeK), the resolution axes only the
+/// Kalman updates and the hit probabilities. The resolution axes are therefore moved
+/// after the others, to be the fastest ones of the design index, and the consecutive
+/// designs differing only in resolutions are solved together by one thread, which
+/// reuses the probe of each point from one design to the next one.
+///
+/// e.g. designScan("scan.root", {{kDesignX0, "ddd4,ddd5", {0.003, 0.005}}, {kDesignBField, "", {0.5, 1.}}},
+///                 {{0.1, 0.}, {1., 0.}, {1., 1.}});
+
+enum designParam_t {
+  kDesignRadius,     // layer radius (cm), changes the transport
+  kDesignX0,         // layer material (x/X0), changes the transport
+  kDesignResolution, // layer rphi and z resolutions (cm), only the updates
+  kDesignResRPhi,    // layer rphi resolution (cm), only the updates
+  kDesignResZ,       // layer z resolution (cm), only the updates
+  kDesignEfficiency, // layer efficiency, not supported: no effect on the FAT solver
+  kDesignBField,     // B field (T), changes the transport
+  kNDesignParams
+};
+
+const char* designParamName[kNDesignParams] = {"radius", "x0", "res", "resRPhi", "resZ", "eff", "bfield"};
+
+struct designAxis_t {
+  int param = kDesignRadius;
+  std::string layers; // comma separated layer names, none for the B field
+  std::vector<float> values;
+
+  /// the axis changes the transport of the tracks, not only the resolutions
+  bool transport() const { return param != kDesignResolution && param != kDesignResRPhi && param != kDesignResZ; };
+
+  std::vector<std::string> layerNames() const
+  {
+    std::vector<std::string> names;
+    std::stringstream ss(layers);
+    std::string name;
+    while (std::getline(ss, name, ','))
+      if (!name.empty())
+        names.push_back(name);
+    return names;
+  };
+
+  /// the branch name, e.g. x0_ddd4_ddd5
+  std::string name() const
+  {
+    std::string name = param >= 0 && param < kNDesignParams ? designParamName[param] : "unknown";
+    for (auto& layer : layerNames())
+      name += "_" + layer;
+    return name;
+  };
+};
+
+struct designPoint_t {
+  float pt = 0.;
+  float eta = 0.;
+};
+
+// results of a design at a point
+struct designResult_t {
+  int valid = 0;
+  float ptres = 0.; // relative pt resolution
+  float dcaxy = 0.; // cm
+  float dcaz = 0.;  // cm
+  float eff = 0.;
+  float eff2 = 0.;
+};
+
+bool designCheckAxes(const DetectorK& base, const std::vector<designAxis_t>& axes)
+{
+  for (auto& axis : axes) {
+    if (axis.param < 0 || axis.param >= kNDesignParams) {
+      Printf("Unknown design parameter %d", axis.param);
+      return false;
+    }
+    if (axis.param == kDesignEfficiency) {
+      Printf("The layer efficiency is not a design axis: the FAT good hit probabilities do not depend on it");
+      return false;
+    }
+    if (axis.values.empty()) {
+      Printf("No values for the design axis %s", axis.name().c_str());
+      return false;
+    }
+    if (axis.param == kDesignBField)
+      continue;
+    if (axis.layerNames().empty()) {
+      Printf("No layer for the design axis %s", axis.name().c_str());
+      return false;
+    }
+    for (auto& layer : axis.layerNames())
+      if (!base.FindLayer(layer.c_str())) {
+        Printf("Layer %s of the design axis %s not found", layer.c_str(), axis.name().c_str());
+        return false;
+      }
+  }
+  return true;
+}
+
+void designApply(DetectorK& det, const designAxis_t& axis, float value)
+{
+  if (axis.param == kDesignBField) {
+    det.SetBField(value);
+    return;
+  }
+  for (auto& layer : axis.layerNames()) {
+    const char* name = layer.c_str();
+    switch (axis.param) {
+      case kDesignRadius:
+        det.SetRadius(name, value);
+        break;
+      case kDesignX0:
+        det.SetRadiationLength(name, value);
+        break;
+      case kDesignResolution:
+        det.SetResolution(name, value, value);
+        break;
+      case kDesignResRPhi:
+        det.SetResolution(name, value, det.GetResolution(name, 1));
+        break;
+      case kDesignResZ:
+        det.SetResolution(name, det.GetResolution(name, 0), value);
+        break;
+    }
+  }
+}
+
+bool designScan(const char* filename, std::vector<designAxis_t> axes, std::vector<designPoint_t> points, int pdg = 211, long nsamples = 0, unsigned int seed = 0)
+{
+  lutHeader_t lutHeader;
+  int q = 0;
+  if (!lutMakeHeader(lutHeader, q, pdg, fat.GetBField()))
+    return false;
+  if (points.empty() || !designCheckAxes(fat, axes))
+    return false;
+
+  // design index, the first axis being the slowest, after the resolution axes are moved last:
+  // the designs id / nresolution share the same transport
+  std::stable_partition(axes.begin(), axes.end(), [](const designAxis_t& axis) { return axis.transport(); });
+  Long64_t ndesigns = 1, nresolution = 1;
+  for (auto& axis : axes) {
+    ndesigns *= axis.values.size();
+    if (!axis.transport())
+      nresolution *= axis.values.size();
+  }
+
+  // designs, all or sampled
+  std::vector<Long64_t> designs;
+  if (nsamples <= 0 || nsamples >= ndesigns) {
+    for (Long64_t id = 0; id < ndesigns; ++id)
+      designs.push_back(id);
+  } else {
+    std::mt19937_64 generator(seed);
+    std::uniform_int_distribution<Long64_t> uniform(0, ndesigns - 1);
+    std::set<Long64_t> sample;
+    while ((long)sample.size() < nsamples)
+      sample.insert(uniform(generator));
+    designs.assign(sample.begin(), sample.end());
+  }
+  const int ndone = designs.size();
+  std::cout << " --- design scan: " << ndone << " of " << ndesigns << " designs, " << points.size() << " points" << std::endl;
+
+  // output
+  TFile file(filename, "RECREATE");
+  if (file.IsZombie()) {
+    Printf("Cannot open %s", filename);
+    return false;
+  }
+  TTree* tree = new TTree("designScan", "FAT detector design scan"); // owned by the file
+  Long64_t design = 0;
+  std::vector<float> values(axes.size());
+  designPoint_t point;
+  designResult_t result;
+  tree->Branch("design", &design, "design/L");
+  for (size_t ia = 0; ia < axes.size(); ++ia)
+    tree->Branch(axes[ia].name().c_str(), &values[ia], (axes[ia].name() + "/F").c_str());
+  tree->Branch("pt", &point.pt, "pt/F");
+  tree->Branch("eta", &point.eta, "eta/F");
+  tree->Branch("valid", &result.valid, "valid/I");
+  tree->Branch("ptres", &result.ptres, "ptres/F");
+  tree->Branch("dcaxy", &result.dcaxy, "dcaxy/F");
+  tree->Branch("dcaz", &result.dcaz, "dcaz/F");
+  tree->Branch("eff", &result.eff, "eff/F");
+  tree->Branch("eff2", &result.eff2, "eff2/F");
+
+  auto designValues = [&](Long64_t id, std::vector<float>& vals) {
+    for (int k = axes.size(); k--;) {
+      vals[k] = axes[k].values[id % axes[k].values.size()];
+      id /= axes[k].values.size();
+    }
+  };
+
+  // groups of consecutive designs with the same transport
+  std::vector<int> groups;
+  for (int i = 0; i < ndone; ++i)
+    if (i == 0 || designs[i] / nresolution != designs[i - 1] / nresolution)
+      groups.push_back(i);
+  groups.push_back(ndone);
+  const int ngroups = groups.size() - 1;
+
+  // solve, each thread one group at the time, with its own detector and workspace. The
+  // transport axes are applied once per group, the resolution ones for each design, and
+  // the outward probe of each point is kept from one design to the next one
+  lutTrace_t lutTrace;
+  MaterialTableK::SetTabulated(useMaterialTables);
+  const int nthreads = std::min(lutNThreads(), std::max(1, ngroups));
+  if (nthreads > 1)
+    ROOT::EnableThreadSafety();
+  std::vector<std::vector<designResult_t>> results(ndone);
+  std::vector<char> done(ndone, false);
+  std::mutex doneMutex;
+  std::condition_variable doneCondition;
+  std::atomic<int> nextGroup(0);
+  auto worker = [&]() {
+    TrackSol ws(fat.GetNumberOfLayers(), 0., 0., q, lutHeader.mass);
+    ws.fdNdEta = fat.GetdNdEtaCent();
+    std::vector<TrackProbeK> probes(points.size());
+    for (auto& probe : probes)
+      probe.reuse = kTRUE;
+    std::vector<float> vals(axes.size());
+    for (int ig = nextGroup++; ig < ngroups; ig = nextGroup++) {
+      DetectorK det(fat);
+      designValues(designs[groups[ig]], vals);
+      for (size_t ia = 0; ia < axes.size(); ++ia)
+        if (axes[ia].transport())
+          designApply(det, axes[ia], vals[ia]);
+      for (int i = groups[ig]; i < groups[ig + 1]; ++i) {
+        std::vector<designResult_t> designResults;
+        designValues(designs[i], vals);
+        for (size_t ia = 0; ia < axes.size(); ++ia)
+          if (!axes[ia].transport())
+            designApply(det, axes[ia], vals[ia]);
+        for (size_t ip = 0; ip < points.size(); ++ip) {
+          lutEntry_t lutEntry;
+          designResult_t res;
+          std::swap(ws.fProbe, probes[ip]);
+          const bool solved = fatSolve(det, ws, lutEntry, points[ip].pt, points[ip].eta, lutHeader.mass, 0, 0, q);
+          std::swap(ws.fProbe, probes[ip]);
+          if (solved) {
+            res.valid = 1;
+            res.ptres = sqrt(lutEntry.covm[14]) * points[ip].pt;
+            res.dcaxy = sqrt(lutEntry.covm[0]);
+            res.dcaz = sqrt(lutEntry.covm[2]);
+            res.eff = lutEntry.eff;
+            res.eff2 = lutEntry.eff2;
+          }
+          designResults.push_back(res);
+        }
+        std::lock_guard<std::mutex> lock(doneMutex);
+        results[i].swap(designResults);
+        done[i] = true;
+        doneCondition.notify_one();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int ithread = 0; ithread < nthreads; ++ithread)
+    threads.emplace_back(worker);
+
+  // write the designs in order as they are done
+  for (int i = 0; i < ndone; ++i) {
+    std::vector<designResult_t> designResults;
+    {
+      std::unique_lock<std::mutex> lock(doneMutex);
+      doneCondition.wait(lock, [&] { return done[i]; });
+      designResults.swap(results[i]);
+    }
+    design = designs[i];
+    designValues(design, values);
+    for (size_t ip = 0; ip < points.size(); ++ip) {
+      point = points[ip];
+      result = designResults[ip];
+      tree->Fill();
+    }
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  file.cd();
+  tree->Write();
+  file.Close();
+  return true;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+#include "lutCovm.hh"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// LUT bundle (LUTBUNDLE_VERSION)
+///
+/// All the species of a setup in a single file: a lutBundleHeader_t, one lutBundleEntry_t
+/// per species and the LUT files of the species, copied as they are (any version) at
+/// offsets aligned to lutBundleAlign, so that a reader maps only the species it needs.
+/// The version number takes the place of the LUT one at the start of the file.
+
+#define LUTBUNDLE_VERSION 20261018
+
+const int64_t lutBundleAlign = 4096;
+
+struct lutBundleHeader_t {
+  int version = LUTBUNDLE_VERSION;
+  int nspecies = 0;
+};
+
+struct lutBundleEntry_t {
+  int pdg = 0;
+  int reserved = 0;
+  int64_t offset = 0; // from the beginning of the bundle
+  int64_t size = 0;   // in bytes
+};
+
+/// writes the bundle of the given LUT files, one per pdg code
+inline bool lutBundleWrite(const char* filename, const std::vector<int>& pdgs, const std::vector<std::string>& lutnames)
+{
+  if (pdgs.empty() || pdgs.size() != lutnames.size())
+    return false;
+  lutBundleHeader_t bundleHeader;
+  bundleHeader.nspecies = pdgs.size();
+  std::vector<lutBundleEntry_t> bundleEntries(pdgs.size());
+  std::vector<std::ifstream> lutFiles(pdgs.size());
+  auto align = [](int64_t offset) { return (offset + lutBundleAlign - 1) / lutBundleAlign * lutBundleAlign; };
+  int64_t offset = align(sizeof(lutBundleHeader_t) + pdgs.size() * sizeof(lutBundleEntry_t));
+  for (size_t is = 0; is < pdgs.size(); ++is) {
+    lutFiles[is].open(lutnames[is], std::ifstream::binary | std::ifstream::ate);
+    if (!lutFiles[is].is_open()) {
+      printf("lutBundleWrite: cannot open %s \n", lutnames[is].c_str());
+      return false;
+    }
+    bundleEntries[is].pdg = pdgs[is];
+    bundleEntries[is].offset = offset;
+    bundleEntries[is].size = lutFiles[is].tellg();
+    lutFiles[is].seekg(0);
+    offset = align(offset + bundleEntries[is].size);
+  }
+
+  std::ofstream bundleFile(filename, std::ofstream::binary);
+  if (!bundleFile.is_open()) {
+    printf("lutBundleWrite: cannot open %s \n", filename);
+    return false;
+  }
+  bundleFile.write(reinterpret_cast<char*>(&bundleHeader), sizeof(lutBundleHeader_t));
+  bundleFile.write(reinterpret_cast<char*>(bundleEntries.data()), bundleEntries.size() * sizeof(lutBundleEntry_t));
+  const std::vector<char> zeros(lutBundleAlign, 0);
+  for (size_t is = 0; is < pdgs.size(); ++is) {
+    bundleFile.write(zeros.data(), bundleEntries[is].offset - bundleFile.tellp());
+    bundleFile << lutFiles[is].rdbuf();
+  }
+  return bundleFile.good() && bundleFile.tellp() == bundleEntries.back().offset + bundleEntries.back().size;
+}
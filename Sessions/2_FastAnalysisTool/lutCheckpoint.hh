@@ -0,0 +1,182 @@
+#pragma once
+#include "lutChecksum.hh"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/// checkpoints of the LUT writer, one per nch slice
+///
+/// The entries are streamed in the original layout (header, then the nch slices)
+/// to a data file, the output file itself for the original format. After a slice
+/// is flushed its checksum is appended to the journal, <data file>.journal, which
+/// starts with a checksum of the writer setup (lutSetupChecksum). On restart with
+/// the same setup, the journalled slices found intact in the data file are kept,
+/// the rest is truncated and the writer resumes from there. Once the file is
+/// complete, the slice checksums and a lutFooter_t are appended and the journal is
+/// removed, or closed by a completion record if the file is kept for a caller: a
+/// rerun then takes the file as it is, provided its checksums and footer are intact,
+/// and otherwise resumes from its intact slices.
+
+const int lutJournalComplete = -1; // islice of the completion record, whose checksum is the one of the slice checksums
+
+struct lutJournalRecord_t {
+  int islice = 0;
+  int reserved = 0;
+  uint64_t checksum = 0;
+};
+
+struct lutCheckpoint_t {
+  std::string dataname;
+  std::string journalname;
+  size_t sliceSize = 0;            // in bytes
+  std::vector<uint64_t> checksums; // of the complete slices
+  bool complete = false;           // the file of a previous run is complete, nothing is to be written
+
+  /// opens the data file for slices of the given number of entries and returns the
+  /// number of complete slices of a previous run, which are kept, or -1 on error
+  int open(const char* filename, const lutHeader_t& lutHeader, uint64_t setup, size_t nentries)
+  {
+    dataname = filename;
+    journalname = dataname + ".journal";
+    sliceSize = nentries * sizeof(lutEntry_t);
+    checksums.clear();
+    complete = false;
+
+    // slices of a previous run
+    std::ifstream journal(journalname, std::ifstream::binary);
+    uint64_t previous = 0;
+    if (journal.read(reinterpret_cast<char*>(&previous), sizeof(previous)) && previous == setup) {
+      std::ifstream data(dataname, std::ifstream::binary);
+      data.seekg(sizeof(lutHeader_t));
+      std::vector<char> buffer(sliceSize);
+      lutJournalRecord_t record;
+      bool marked = false;
+      while (journal.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        if (record.islice == lutJournalComplete) {
+          marked = !checksums.empty() && record.checksum == lutChecksum(checksums.data(), checksums.size() * sizeof(uint64_t));
+          break;
+        }
+        if (record.islice != (int)checksums.size() || !data.read(buffer.data(), sliceSize) || lutChecksum(buffer.data(), sliceSize) != record.checksum)
+          break;
+        checksums.push_back(record.checksum);
+      }
+      // a completed file ends with the slice checksums and the footer, footer-less files are resumed
+      if (marked) {
+        std::vector<uint64_t> stored(checksums.size());
+        lutFooter_t lutFooter;
+        lutFooter.magic = 0;
+        complete = data.read(reinterpret_cast<char*>(stored.data()), stored.size() * sizeof(uint64_t)) &&
+                   data.read(reinterpret_cast<char*>(&lutFooter), sizeof(lutFooter_t)) && data.peek() == EOF &&
+                   lutFooter.magic == LUTFOOTER_MAGIC && lutFooter.nslices == (int)checksums.size() && stored == checksums;
+      }
+    }
+    journal.close();
+    if (complete) {
+      printf("lutCheckpoint: %s is complete from a previous run \n", dataname.c_str());
+      return checksums.size();
+    }
+
+    // start over or after the complete slices
+    if (checksums.empty()) {
+      std::ofstream data(dataname, std::ofstream::binary | std::ofstream::trunc);
+      data.write(reinterpret_cast<const char*>(&lutHeader), sizeof(lutHeader_t));
+      if (!data.good()) {
+        printf("lutCheckpoint: cannot write %s \n", dataname.c_str());
+        return -1;
+      }
+    } else {
+      if (truncate(dataname.c_str(), sizeof(lutHeader_t) + checksums.size() * sliceSize) != 0) {
+        printf("lutCheckpoint: cannot truncate %s \n", dataname.c_str());
+        return -1;
+      }
+      printf("lutCheckpoint: resuming %s after %zu complete slices \n", dataname.c_str(), checksums.size());
+    }
+    std::ofstream newJournal(journalname, std::ofstream::binary | std::ofstream::trunc);
+    newJournal.write(reinterpret_cast<const char*>(&setup), sizeof(setup));
+    for (size_t islice = 0; islice < checksums.size(); ++islice) {
+      lutJournalRecord_t record;
+      record.islice = islice;
+      record.checksum = checksums[islice];
+      newJournal.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    newJournal.close();
+
+    mData.open(dataname, std::ofstream::binary | std::ofstream::app);
+    mJournal.open(journalname, std::ofstream::binary | std::ofstream::app);
+    if (!mData.is_open() || !mJournal.is_open()) {
+      printf("lutCheckpoint: cannot open %s \n", dataname.c_str());
+      return -1;
+    }
+    return checksums.size();
+  };
+
+  /// reads back a complete slice
+  bool read(int islice, lutEntry_t* entries) const
+  {
+    std::ifstream data(dataname, std::ifstream::binary);
+    data.seekg(sizeof(lutHeader_t) + islice * sliceSize);
+    return (size_t)islice < checksums.size() && data.read(reinterpret_cast<char*>(entries), sliceSize).good();
+  };
+
+  /// appends the next slice, complete once it is in the journal
+  bool commit(const lutEntry_t* entries)
+  {
+    lutJournalRecord_t record;
+    record.islice = checksums.size();
+    record.checksum = lutChecksum(entries, sliceSize);
+    mData.write(reinterpret_cast<const char*>(entries), sliceSize);
+    mData.flush();
+    if (!mData.good())
+      return false;
+    mJournal.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    mJournal.flush();
+    checksums.push_back(record.checksum);
+    return mJournal.good();
+  };
+
+  /// completes the data file with the checksums and the footer. With keep the journal
+  /// is closed by the completion record, for the files to be removed by remove() once
+  /// they are no longer needed, otherwise it is removed, as is the data file if it was
+  /// only a checkpoint
+  bool finish(bool checkpoint, bool keep = false)
+  {
+    bool ok = true;
+    if (!complete) {
+      lutFooter_t lutFooter;
+      lutFooter.nslices = checksums.size();
+      mData.write(reinterpret_cast<const char*>(checksums.data()), checksums.size() * sizeof(uint64_t));
+      mData.write(reinterpret_cast<const char*>(&lutFooter), sizeof(lutFooter_t));
+      mData.flush();
+      ok = mData.good();
+    }
+    if (ok && keep && !complete) {
+      lutJournalRecord_t record;
+      record.islice = lutJournalComplete;
+      record.checksum = lutChecksum(checksums.data(), checksums.size() * sizeof(uint64_t));
+      mJournal.write(reinterpret_cast<const char*>(&record), sizeof(record));
+      mJournal.flush();
+      ok = mJournal.good();
+    }
+    mData.close();
+    mJournal.close();
+    if (ok && !keep) {
+      if (checkpoint)
+        std::remove(dataname.c_str());
+      std::remove(journalname.c_str());
+    }
+    return ok;
+  };
+
+  /// removes a data file and its journal
+  static void remove(const std::string& filename)
+  {
+    std::remove(filename.c_str());
+    std::remove((filename + ".journal").c_str());
+  };
+
+ private:
+  std::ofstream mData;
+  std::ofstream mJournal;
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include "lutCovm.hh"
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+/// integrity checks of the LUT files
+///
+/// Files in the original format (LUTCOVM_VERSION) written by lutWrite() end with
+/// the checksums of the nch slices, one uint64_t per slice, and a lutFooter_t.
+/// Older files without footer are still read, without checks. Compact files
+/// (LUTCOVM_VERSION_V2) carry the checksums of their sections in a kLutChecksum section.
+
+#define LUTFOOTER_MAGIC 0x52544f4f4654554cULL // "LUTFOOTR"
+
+struct lutFooter_t {
+  uint64_t magic = LUTFOOTER_MAGIC;
+  int nslices = 0;
+  int reserved = 0;
+};
+
+/// 64-bit FNV-1a, on 8-byte words for speed, continuing from a previous checksum if given
+inline uint64_t lutChecksum(const void* data, size_t size, uint64_t checksum = 0xcbf29ce484222325ULL)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word = 0;
+    for (int k = 0; k < 8; ++k)
+      word |= uint64_t(bytes[i + k]) << (8 * k);
+    checksum = (checksum ^ word) * 0x100000001b3ULL;
+  }
+  for (; i < size; ++i)
+    checksum = (checksum ^ bytes[i]) * 0x100000001b3ULL;
+  return checksum;
+}
+
+/// checksum of the header fields, independent of the padding bytes
+inline uint64_t lutChecksum(const lutHeader_t& lutHeader)
+{
+  uint64_t checksum = lutChecksum(&lutHeader.version, sizeof(int));
+  checksum = lutChecksum(&lutHeader.pdg, sizeof(int), checksum);
+  checksum = lutChecksum(&lutHeader.mass, sizeof(float), checksum);
+  checksum = lutChecksum(&lutHeader.field, sizeof(float), checksum);
+  for (const map_t* map : {&lutHeader.nchmap, &lutHeader.radmap, &lutHeader.etamap, &lutHeader.ptmap}) {
+    const int log = map->log;
+    checksum = lutChecksum(&map->nbins, sizeof(int), checksum);
+    checksum = lutChecksum(&map->min, sizeof(float), checksum);
+    checksum = lutChecksum(&map->max, sizeof(float), checksum);
+    checksum = lutChecksum(&log, sizeof(int), checksum);
+  }
+  return checksum;
+}
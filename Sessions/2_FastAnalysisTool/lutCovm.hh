@@ -9,13 +9,13 @@ struct map_t {
   float min = 0.;
   float max = 1.e6;
   bool log = false;
-  float eval(int bin) {
+  float eval(int bin) const {
     float width = (max - min) / nbins;
     float val = min + (bin + 0.5) * width;
     if (log) return std::pow(10., val);
     return val;
   };
-  int find(float val) {
+  int find(float val) const {
     float width = (max - min) / nbins;
     int bin;
     if (log) bin = (int)((log10(val) - min) / width);
@@ -24,7 +24,7 @@ struct map_t {
     if (bin > nbins - 1) return nbins - 1;
     return bin;
   };
-  void print() { printf("nbins = %d, min = %f, max = %f, log = %s \n", nbins, min, max, log ? "on" : "off"); };
+  void print() const { printf("nbins = %d, min = %f, max = %f, log = %s \n", nbins, min, max, log ? "on" : "off"); };
 };
 
 struct lutHeader_t {
@@ -36,10 +36,10 @@ struct lutHeader_t {
   map_t radmap;
   map_t etamap;
   map_t ptmap;
-  bool check_version() {
+  bool check_version() const {
     return (version == LUTCOVM_VERSION);
   };
-  void print() {
+  void print() const {
     printf(" version: %d \n", version);
     printf("     pdg: %d \n", pdg);
     printf("   field: %f \n", field);
@@ -63,7 +63,7 @@ struct lutEntry_t {
   float eigval[5] = {0.};
   float eigvec[5][5] = {0.};
   float eiginv[5][5] = {0.};
-  void print() {
+  void print() const {
     printf(" --- lutEntry: pt = %f, eta = %f (%s)\n", pt, eta, valid ? "valid" : "not valid");
     printf("     efficiency: %f\n", eff);
     printf("     covMatix: ");
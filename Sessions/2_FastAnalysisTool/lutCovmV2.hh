@@ -0,0 +1,299 @@
+#pragma once
+#include "lutCovm.hh"
+#include "lutChecksum.hh"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+/// Compact LUT format (LUTCOVM_VERSION_V2)
+///
+/// The file starts with a lutHeader_t as the original format (with the new version
+/// number), followed by a section table and by the sections it points to. The bin
+/// coordinates are not stored, they follow from the header maps, and every section
+/// lists the entries in the usual (nch, rad, eta, pt) order.
+///
+///   kLutValid      1 byte per entry
+///   kLutEff        eff, eff2, itof, otof per entry (float)
+///   kLutCovm       15 covariance terms per entry, float or 16-bit codes (see below)
+///   kLutCovmQuant  two parameters per covariance term for the 16-bit codes (float)
+///   kLutEigen      eigval[5], eigvec[5][5], eiginv[5][5] per entry (float); optional,
+///                  when missing the readers rebuild the decomposition from the covariance
+///   kLutAxis       nbins + 1 bin edges of a non-uniform axis (float), in the variable of
+///                  the header map (log10 for log maps); the section format is the axis,
+///                  kLutAxisNch to kLutAxisPt. Optional, the map of the header describes
+///                  uniform axes and, for the others, nbins and the first and last edges.
+///   kLutChecksum   checksum (lutChecksum, uint64_t) of each of the other sections, in order
+///
+/// Covariance storage and error bounds:
+///   kLutFloat32  float, as in the original format (exact)
+///   kLutFloat16  IEEE half precision of the term times a power of two (parameter 0)
+///                chosen to bring the largest |term| of the table just below 2^15.
+///                Relative error <= 2^-11 (4.9e-4) for terms down to 2^-28 (~8.4 decades)
+///                of the largest one, absolute error <= 2^-25 / scale below.
+///   kLutLog16    sign bit + 15-bit code of ln|term| in [lmin, lmin + 32766 step]
+///                (parameters 0 and 1, taken from the nonzero terms of the table),
+///                code 0 being an exact zero. Relative error <= exp(step / 2) - 1,
+///                i.e. 3.5e-4 for terms spanning 10 decades, 7.0e-4 for 20.
+/// Quantised matrices of strongly correlated parameters are not guaranteed to stay
+/// positive definite, the eigenvalues rebuilt from them are to be checked.
+
+#define LUTCOVM_VERSION_V2 20261017
+
+enum lutSectionType_t { kLutValid = 1,
+                        kLutEff,
+                        kLutCovm,
+                        kLutCovmQuant,
+                        kLutEigen,
+                        kLutAxis,
+                        kLutChecksum };
+
+enum lutAxisIndex_t { kLutAxisNch = 0,
+                      kLutAxisRad,
+                      kLutAxisEta,
+                      kLutAxisPt,
+                      kLutNAxes };
+
+enum lutCovmFormat_t { kLutFloat32 = 0,
+                       kLutFloat16,
+                       kLutLog16 };
+
+struct lutSection_t {
+  int type = 0;
+  int format = 0;
+  int64_t offset = 0; // from the beginning of the file
+  int64_t size = 0;   // in bytes
+};
+
+struct lutSectionTable_t {
+  int nsections = 0;
+  int reserved = 0;
+};
+
+/// axis of a LUT, the header map with the bin edges when they are not uniform
+struct lutAxis_t {
+  map_t map;
+  const float* edges = nullptr; // map.nbins + 1 edges in the map variable, nullptr if uniform
+
+  lutAxis_t() = default;
+  lutAxis_t(const map_t& m, const float* e = nullptr) : map(m), edges(e){};
+  int nbins() const { return map.nbins; };
+  /// bin centre
+  float eval(int bin) const
+  {
+    if (!edges)
+      return map.eval(bin);
+    float val = 0.5 * (edges[bin] + edges[bin + 1]);
+    if (map.log)
+      return std::pow(10., val);
+    return val;
+  };
+  /// bin containing the value, clamped to the axis edges
+  int find(float val) const
+  {
+    if (!edges)
+      return map.find(val);
+    if (map.log)
+      val = log10(val);
+    return std::upper_bound(edges + 1, edges + map.nbins, val) - edges - 1;
+  };
+};
+
+inline uint16_t lutFloatToHalf(float val)
+{
+  uint32_t x;
+  memcpy(&x, &val, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  int32_t exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff) // inf or nan
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if (exp >= 31) // overflow
+    return sign | 0x7c00;
+  if (exp <= 0) { // subnormal or zero
+    if (exp < -10)
+      return sign;
+    mant |= 0x800000;
+    int shift = 14 - exp;
+    uint32_t h = mant >> shift, rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+    if (rem > half || (rem == half && (h & 1)))
+      ++h;
+    return sign | h;
+  }
+  uint32_t h = ((uint32_t)exp << 10) | (mant >> 13), rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+    ++h; // rounding to nearest even, may carry into the exponent
+  return sign | h;
+}
+
+inline float lutHalfToFloat(uint16_t h)
+{
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  if (exp == 0) {
+    float val = std::ldexp((float)mant, -24);
+    return sign ? -val : val;
+  }
+  uint32_t x = exp == 31 ? (sign | 0x7f800000 | (mant << 13)) : (sign | ((exp - 15 + 127) << 23) | (mant << 13));
+  float val;
+  memcpy(&val, &x, sizeof(val));
+  return val;
+}
+
+inline uint16_t lutFloatToLog16(float val, float lmin, float step)
+{
+  if (val == 0.)
+    return 0;
+  long code = 1 + std::lround((std::log(std::fabs(val)) - lmin) / step);
+  if (code < 1)
+    code = 1;
+  if (code > 0x7fff)
+    code = 0x7fff;
+  return (val < 0. ? 0x8000 : 0) | (uint16_t)code;
+}
+
+inline float lutLog16ToFloat(uint16_t code, float lmin, float step)
+{
+  if ((code & 0x7fff) == 0)
+    return 0.;
+  float val = std::exp(lmin + ((code & 0x7fff) - 1) * step);
+  return (code & 0x8000) ? -val : val;
+}
+
+/// decodes the covariance of an entry from the kLutCovm section
+inline void lutDecodeCovm(const void* data, int format, const float* quant, size_t ientry, float* covm)
+{
+  if (format == kLutFloat32) {
+    memcpy(covm, reinterpret_cast<const float*>(data) + ientry * 15, 15 * sizeof(float));
+    return;
+  }
+  const uint16_t* codes = reinterpret_cast<const uint16_t*>(data) + ientry * 15;
+  for (int i = 0; i < 15; ++i) {
+    if (format == kLutFloat16)
+      covm[i] = lutHalfToFloat(codes[i]) / quant[i];
+    else
+      covm[i] = lutLog16ToFloat(codes[i], quant[i], quant[15 + i]);
+  }
+}
+
+/// collects the entries in the (nch, rad, eta, pt) order and writes them in the compact format
+struct lutWriterV2_t {
+  int covmFormat = kLutFloat32;
+  bool storeEigen = true;
+  std::vector<uint8_t> valid;
+  std::vector<float> eff;
+  std::vector<float> covm;
+  std::vector<float> eigen;
+  std::vector<float> axes[kLutNAxes]; // bin edges of the non-uniform axes, empty otherwise
+
+  void add(const lutEntry_t& lutEntry)
+  {
+    valid.push_back(lutEntry.valid);
+    eff.insert(eff.end(), {lutEntry.eff, lutEntry.eff2, lutEntry.itof, lutEntry.otof});
+    covm.insert(covm.end(), lutEntry.covm, lutEntry.covm + 15);
+    if (storeEigen) {
+      eigen.insert(eigen.end(), lutEntry.eigval, lutEntry.eigval + 5);
+      eigen.insert(eigen.end(), &lutEntry.eigvec[0][0], &lutEntry.eigvec[0][0] + 25);
+      eigen.insert(eigen.end(), &lutEntry.eiginv[0][0], &lutEntry.eiginv[0][0] + 25);
+    }
+  };
+
+  bool write(std::ofstream& lutFile, lutHeader_t lutHeader)
+  {
+    const size_t nentries = valid.size();
+    if (nentries != (size_t)lutHeader.nchmap.nbins * lutHeader.radmap.nbins * lutHeader.etamap.nbins * lutHeader.ptmap.nbins) {
+      printf("lutWriterV2: %zu entries do not match the header maps \n", nentries);
+      return false;
+    }
+    lutHeader.version = LUTCOVM_VERSION_V2;
+    map_t* maps[kLutNAxes] = {&lutHeader.nchmap, &lutHeader.radmap, &lutHeader.etamap, &lutHeader.ptmap};
+    for (int iaxis = 0; iaxis < kLutNAxes; ++iaxis) {
+      if (axes[iaxis].empty())
+        continue;
+      if (axes[iaxis].size() != (size_t)maps[iaxis]->nbins + 1 || !std::is_sorted(axes[iaxis].begin(), axes[iaxis].end())) {
+        printf("lutWriterV2: the edges of axis %d do not match the header maps \n", iaxis);
+        return false;
+      }
+      maps[iaxis]->min = axes[iaxis].front();
+      maps[iaxis]->max = axes[iaxis].back();
+    }
+
+    // covariance quantisation
+    std::vector<float> quant(30, 0.);
+    std::vector<uint16_t> codes;
+    if (covmFormat != kLutFloat32) {
+      for (int i = 0; i < 15; ++i) {
+        float amax = 0., amin = 0.;
+        for (size_t ie = 0; ie < nentries; ++ie) {
+          float a = std::fabs(covm[ie * 15 + i]);
+          if (a > 0. && (amin == 0. || a < amin))
+            amin = a;
+          amax = std::max(amax, a);
+        }
+        if (covmFormat == kLutFloat16) {
+          quant[i] = amax > 0. ? std::ldexp(1.f, std::min(14 - std::ilogb(amax), 127)) : 1.f;
+          printf("lutWriterV2: covm[%2d] float16, scale = %e, relative error < 4.9e-04 above %e \n", i, quant[i], std::ldexp(1.f, -14) / quant[i]);
+        } else {
+          quant[i] = amax > 0. ? std::log(amin) : 0.;
+          quant[15 + i] = amax > amin ? (std::log(amax) - std::log(amin)) / 32766.f : 1.f;
+          printf("lutWriterV2: covm[%2d] log16, range [%e, %e], relative error < %e \n", i, amin, amax, std::exp(quant[15 + i] / 2.) - 1.);
+        }
+      }
+      codes.resize(nentries * 15);
+      for (size_t ie = 0; ie < nentries; ++ie)
+        for (int i = 0; i < 15; ++i)
+          codes[ie * 15 + i] = covmFormat == kLutFloat16 ? lutFloatToHalf(covm[ie * 15 + i] * quant[i]) : lutFloatToLog16(covm[ie * 15 + i], quant[i], quant[15 + i]);
+    }
+
+    // section table
+    std::vector<lutSection_t> sections;
+    std::vector<const void*> payloads;
+    auto addSection = [&](int type, int format, const void* data, size_t size) {
+      lutSection_t section;
+      section.type = type;
+      section.format = format;
+      section.size = size;
+      sections.push_back(section);
+      payloads.push_back(data);
+    };
+    addSection(kLutValid, 0, valid.data(), valid.size());
+    addSection(kLutEff, 0, eff.data(), eff.size() * sizeof(float));
+    if (covmFormat == kLutFloat32)
+      addSection(kLutCovm, covmFormat, covm.data(), covm.size() * sizeof(float));
+    else {
+      addSection(kLutCovm, covmFormat, codes.data(), codes.size() * sizeof(uint16_t));
+      addSection(kLutCovmQuant, covmFormat, quant.data(), quant.size() * sizeof(float));
+    }
+    if (storeEigen)
+      addSection(kLutEigen, 0, eigen.data(), eigen.size() * sizeof(float));
+    for (int iaxis = 0; iaxis < kLutNAxes; ++iaxis)
+      if (!axes[iaxis].empty())
+        addSection(kLutAxis, iaxis, axes[iaxis].data(), axes[iaxis].size() * sizeof(float));
+    std::vector<uint64_t> checksums;
+    for (size_t is = 0; is < sections.size(); ++is)
+      checksums.push_back(lutChecksum(payloads[is], sections[is].size));
+    addSection(kLutChecksum, 0, checksums.data(), checksums.size() * sizeof(uint64_t));
+    auto align = [](int64_t offset) { return (offset + 7) & ~int64_t(7); };
+    lutSectionTable_t table;
+    table.nsections = sections.size();
+    int64_t offset = align(sizeof(lutHeader_t) + sizeof(lutSectionTable_t) + sections.size() * sizeof(lutSection_t));
+    for (auto& section : sections) {
+      section.offset = offset;
+      offset = align(offset + section.size);
+    }
+
+    // write
+    const char zeros[8] = {0};
+    lutFile.write(reinterpret_cast<char*>(&lutHeader), sizeof(lutHeader_t));
+    lutFile.write(reinterpret_cast<char*>(&table), sizeof(lutSectionTable_t));
+    lutFile.write(reinterpret_cast<char*>(sections.data()), sections.size() * sizeof(lutSection_t));
+    for (size_t is = 0; is < sections.size(); ++is) {
+      lutFile.write(zeros, sections[is].offset - lutFile.tellp());
+      lutFile.write(reinterpret_cast<const char*>(payloads[is]), sections[is].size);
+    }
+    return lutFile.good();
+  };
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include "lutCovm.hh"
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/// eigen decomposition of the covariance matrix of a LUT entry,
+/// used by the writers and by the readers of files without eigen data
+///
+/// The symmetric 5x5 matrix is diagonalised by cyclic Jacobi rotations on the
+/// stack, without allocations; the eigenvalues are sorted in decreasing order as
+/// TMatrixDSymEigen does and, the eigenvector matrix being orthogonal, its inverse
+/// is its transpose. The rotations go on until every off-diagonal term is negligible
+/// with respect to its diagonal ones, which keeps the small eigenvalues of the
+/// covariance matrices (spanning many decades) to relative precision. An entry
+/// whose rotations do not converge (in practice a covariance with NaNs)
+/// is marked as not valid. The batch version runs the same rotations on four entries
+/// at the time, one per lane of the AVX registers, with the same arithmetic: the
+/// results are bit for bit those of the scalar one.
+/// lutEigenCheck.C compares the results with TMatrixDSymEigen.
+
+/// eigenvalues in decreasing order, as TMatrixDSymEigen, with their eigenvectors
+template <typename T, int N = 5>
+inline void lutSortEigen(T eigval[N], T eigvec[N][N])
+{
+  for (int i = 0; i < N - 1; ++i) {
+    int imax = i;
+    for (int j = i + 1; j < N; ++j)
+      if (eigval[j] > eigval[imax])
+        imax = j;
+    if (imax == i)
+      continue;
+    std::swap(eigval[i], eigval[imax]);
+    for (int k = 0; k < N; ++k)
+      std::swap(eigvec[k][i], eigvec[k][imax]);
+  }
+}
+
+/// eigenvalues and eigenvectors (columns of eigvec) of the symmetric matrix a,
+/// which is overwritten; returns false if the rotations did not converge
+template <typename T, int N = 5>
+inline bool lutSymEigen(T a[N][N], T eigval[N], T eigvec[N][N])
+{
+  for (int i = 0; i < N; ++i)
+    for (int j = 0; j < N; ++j)
+      eigvec[i][j] = i == j ? 1 : 0;
+
+  const T eps = std::numeric_limits<T>::epsilon();
+  bool converged = false;
+  for (int sweep = 0; sweep < 50 && !converged; ++sweep) {
+    converged = true;
+    for (int p = 0; p < N - 1; ++p)
+      for (int q = p + 1; q < N; ++q) {
+        const T apq = a[p][q];
+        if (std::fabs(apq) <= eps * std::sqrt(std::fabs(a[p][p] * a[q][q])))
+          continue;
+        converged = false;
+        const T theta = (a[q][q] - a[p][p]) / (2 * apq);
+        const T t = std::fabs(theta) > 1 / eps ? 1 / (2 * theta) : (theta >= 0 ? 1 : -1) / (std::fabs(theta) + std::sqrt(theta * theta + 1));
+        const T c = 1 / std::sqrt(t * t + 1);
+        const T s = t * c;
+        for (int k = 0; k < N; ++k) { // columns
+          const T akp = a[k][p], akq = a[k][q];
+          a[k][p] = c * akp - s * akq;
+          a[k][q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < N; ++k) { // rows
+          const T apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c * apk - s * aqk;
+          a[q][k] = s * apk + c * aqk;
+        }
+        a[p][q] = a[q][p] = 0;
+        for (int k = 0; k < N; ++k) {
+          const T vkp = eigvec[k][p], vkq = eigvec[k][q];
+          eigvec[k][p] = c * vkp - s * vkq;
+          eigvec[k][q] = s * vkp + c * vkq;
+        }
+      }
+  }
+
+  for (int i = 0; i < N; ++i)
+    eigval[i] = a[i][i];
+  lutSortEigen<T, N>(eigval, eigvec);
+  return converged;
+}
+
+/// covariance matrix of an entry
+inline void lutCovmMatrix(const lutEntry_t& lutEntry, double fcovm[5][5])
+{
+  for (int i = 0, k = 0; i < 5; ++i)
+    for (int j = 0; j < i + 1; ++j, ++k) {
+      fcovm[i][j] = lutEntry.covm[k];
+      fcovm[j][i] = lutEntry.covm[k];
+    }
+}
+
+/// stores the decomposition in the entry, not valid if it did not converge
+inline bool lutSetEigen(lutEntry_t& lutEntry, const double eigval[5], const double eigvec[5][5], bool converged)
+{
+  for (int i = 0; i < 5; ++i) {
+    lutEntry.eigval[i] = eigval[i];
+    for (int j = 0; j < 5; ++j) {
+      lutEntry.eigvec[i][j] = eigvec[i][j];
+      lutEntry.eiginv[j][i] = eigvec[i][j];
+    }
+  }
+  if (!converged)
+    lutEntry.valid = false;
+  return converged;
+}
+
+/// returns false, and marks the entry as not valid, if the decomposition did not converge
+inline bool diagonalise(lutEntry_t& lutEntry)
+{
+  double fcovm[5][5], eigval[5], eigvec[5][5];
+  lutCovmMatrix(lutEntry, fcovm);
+  const bool converged = lutSymEigen(fcovm, eigval, eigvec);
+  return lutSetEigen(lutEntry, eigval, eigvec, converged);
+}
+
+#if defined(__x86_64__)
+inline bool lutHasAVX()
+{
+  static const bool avx = __builtin_cpu_supports("avx");
+  return avx;
+}
+
+/// the rotations of lutSymEigen on four entries at the time, one per lane: a lane
+/// is left as it is where the scalar version skips the rotation, and the sweeps go on
+/// until all the lanes have converged; returns the number of entries which did not
+__attribute__((target("avx"))) inline int lutDiagonalise4(lutEntry_t* lutEntries)
+{
+  const int N = 5;
+  __m256d a[N][N], v[N][N];
+  {
+    double fcovm[4][N][N];
+    for (int l = 0; l < 4; ++l)
+      lutCovmMatrix(lutEntries[l], fcovm[l]);
+    for (int i = 0; i < N; ++i)
+      for (int j = 0; j < N; ++j) {
+        a[i][j] = _mm256_set_pd(fcovm[3][i][j], fcovm[2][i][j], fcovm[1][i][j], fcovm[0][i][j]);
+        v[i][j] = _mm256_set1_pd(i == j ? 1. : 0.);
+      }
+  }
+
+  const double eps = std::numeric_limits<double>::epsilon();
+  const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.), two = _mm256_set1_pd(2.);
+  const __m256d veps = _mm256_set1_pd(eps), vbig = _mm256_set1_pd(1 / eps);
+  const __m256d absmask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+  int converged = 0; // lanes which did a sweep without rotations
+  for (int sweep = 0; sweep < 50 && converged != 0xf; ++sweep) {
+    __m256d rotated = zero;
+    for (int p = 0; p < N - 1; ++p)
+      for (int q = p + 1; q < N; ++q) {
+        const __m256d apq = a[p][q];
+        const __m256d limit = _mm256_mul_pd(veps, _mm256_sqrt_pd(_mm256_and_pd(_mm256_mul_pd(a[p][p], a[q][q]), absmask)));
+        // rotate unless |apq| <= limit, NaNs included as in the scalar comparison
+        const __m256d rot = _mm256_cmp_pd(_mm256_and_pd(apq, absmask), limit, _CMP_NLE_UQ);
+        if (!_mm256_movemask_pd(rot))
+          continue;
+        rotated = _mm256_or_pd(rotated, rot);
+        const __m256d theta = _mm256_div_pd(_mm256_sub_pd(a[q][q], a[p][p]), _mm256_mul_pd(two, apq));
+        const __m256d atheta = _mm256_and_pd(theta, absmask);
+        const __m256d sign = _mm256_blendv_pd(_mm256_set1_pd(-1.), one, _mm256_cmp_pd(theta, zero, _CMP_GE_OQ));
+        const __m256d tbig = _mm256_div_pd(one, _mm256_mul_pd(two, theta));
+        const __m256d tsmall = _mm256_div_pd(sign, _mm256_add_pd(atheta, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(theta, theta), one))));
+        const __m256d t = _mm256_blendv_pd(tsmall, tbig, _mm256_cmp_pd(atheta, vbig, _CMP_GT_OQ));
+        const __m256d c = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(t, t), one)));
+        const __m256d s = _mm256_mul_pd(t, c);
+        for (int k = 0; k < N; ++k) { // columns
+          const __m256d akp = a[k][p], akq = a[k][q];
+          a[k][p] = _mm256_blendv_pd(akp, _mm256_sub_pd(_mm256_mul_pd(c, akp), _mm256_mul_pd(s, akq)), rot);
+          a[k][q] = _mm256_blendv_pd(akq, _mm256_add_pd(_mm256_mul_pd(s, akp), _mm256_mul_pd(c, akq)), rot);
+        }
+        for (int k = 0; k < N; ++k) { // rows
+          const __m256d apk = a[p][k], aqk = a[q][k];
+          a[p][k] = _mm256_blendv_pd(apk, _mm256_sub_pd(_mm256_mul_pd(c, apk), _mm256_mul_pd(s, aqk)), rot);
+          a[q][k] = _mm256_blendv_pd(aqk, _mm256_add_pd(_mm256_mul_pd(s, apk), _mm256_mul_pd(c, aqk)), rot);
+        }
+        a[p][q] = a[q][p] = _mm256_blendv_pd(a[p][q], zero, rot);
+        for (int k = 0; k < N; ++k) {
+          const __m256d vkp = v[k][p], vkq = v[k][q];
+          v[k][p] = _mm256_blendv_pd(vkp, _mm256_sub_pd(_mm256_mul_pd(c, vkp), _mm256_mul_pd(s, vkq)), rot);
+          v[k][q] = _mm256_blendv_pd(vkq, _mm256_add_pd(_mm256_mul_pd(s, vkp), _mm256_mul_pd(c, vkq)), rot);
+        }
+      }
+    converged |= ~_mm256_movemask_pd(rotated) & 0xf;
+  }
+
+  double diag[N][4], vec[N][N][4];
+  for (int i = 0; i < N; ++i) {
+    _mm256_storeu_pd(diag[i], a[i][i]);
+    for (int j = 0; j < N; ++j)
+      _mm256_storeu_pd(vec[i][j], v[i][j]);
+  }
+  int nfailed = 0;
+  for (int l = 0; l < 4; ++l) {
+    double eigval[N], eigvec[N][N];
+    for (int i = 0; i < N; ++i) {
+      eigval[i] = diag[i][l];
+      for (int j = 0; j < N; ++j)
+        eigvec[i][j] = vec[i][j][l];
+    }
+    lutSortEigen(eigval, eigvec);
+    nfailed += !lutSetEigen(lutEntries[l], eigval, eigvec, converged >> l & 1);
+  }
+  return nfailed;
+}
+#endif
+
+/// decomposition of consecutive entries, e.g. the bins of a tile of the writer,
+/// four at the time where AVX is available; returns the number of entries which
+/// did not converge, marked as not valid
+inline size_t diagonalise(lutEntry_t* lutEntries, size_t n)
+{
+  size_t i = 0, nfailed = 0;
+#if defined(__x86_64__)
+  if (lutHasAVX())
+    for (; i + 4 <= n; i += 4)
+      nfailed += lutDiagonalise4(lutEntries + i);
+#endif
+  for (; i < n; ++i)
+    nfailed += !diagonalise(lutEntries[i]);
+  return nfailed;
+}
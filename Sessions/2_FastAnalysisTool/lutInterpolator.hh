@@ -0,0 +1,330 @@
+#pragma once
+#include "lutReader.hh"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/// multilinear interpolation of a LUT for bulk smearing, e.g.
+///   lutReader_t lut("lutCovm.pi.dat");
+///   lutInterpolator_t interp(lut);
+///   interp.interpolate(n, nch, eta, pt, covm, eff);
+///
+/// The covariance terms, the efficiency and eff2 of all bins are copied at construction
+/// in a structure of arrays, one contiguous array per term. The tracks are taken in
+/// chunks: the bin coordinates are computed first (uniform axes take a multiplication
+/// by the precomputed reciprocal bin width, log axes a polynomial logarithm, values
+/// beyond the first and last bin centres are clamped), then the tracks of the chunk are
+/// ordered by (nch, eta) row of their lower corner with a counting sort, so that the
+/// gathers of the 8 (nch, eta, pt) corners from each term array sweep the table instead
+/// of jumping over it, and the results are put back in the input order at the end.
+/// With AVX2 the coordinates and the corners are computed for 8 tracks at the time,
+/// otherwise one at the time; the two differ by rounding only.
+///
+/// The covariance is averaged over the valid corners only (the terms of invalid bins
+/// are zero, the valid ones have a positive covm[0]), with renormalised weights, and
+/// stays positive semi-definite; the efficiencies are averaged over all corners, as they
+/// are zero in the invalid bins. The radius is not interpolated.
+
+struct lutInterpolator_t {
+
+  lutInterpolator_t() = default;
+  lutInterpolator_t(const lutReader_t& lut) { init(lut); };
+
+  bool init(const lutReader_t& lut)
+  {
+    mEntries = 0;
+    if (!lut.is_open())
+      return false;
+    mNrad = lut.nrad;
+    mAxes[0].init(lut.nchaxis);
+    mAxes[1].init(lut.etaaxis);
+    mAxes[2].init(lut.ptaxis);
+    mStride[2] = 1;
+    mStride[1] = lut.npt;
+    mStride[0] = lut.npt * lut.neta * lut.nrad;
+    mStrideRad = lut.npt * lut.neta;
+    mEntries = lut.nentries();
+    mTable.assign(kNTerms * mEntries, 0.);
+    lutEntry_t lutEntry;
+    for (int inch = 0; inch < lut.nnch; ++inch)
+      for (int irad = 0; irad < lut.nrad; ++irad)
+        for (int ieta = 0; ieta < lut.neta; ++ieta)
+          for (int ipt = 0; ipt < lut.npt; ++ipt) {
+            const long i = lut.index(inch, irad, ieta, ipt);
+            lut.get(inch, irad, ieta, ipt, lutEntry, false);
+            const bool valid = lutEntry.valid && lutEntry.covm[0] > 0.;
+            for (int k = 0; k < 15; ++k)
+              mTable[k * mEntries + i] = valid ? lutEntry.covm[k] : 0.;
+            mTable[kEff * mEntries + i] = lutEntry.eff;
+            mTable[kEff2 * mEntries + i] = lutEntry.eff2;
+          }
+    return true;
+  };
+
+  bool is_init() const { return mEntries > 0; };
+
+  /// interpolates n tracks, the outputs are n values each except covm: 15 arrays of n values
+  /// one after the other (covm[k * n + itrack]); eff2 and valid (1 if any valid corner, 0
+  /// otherwise) are optional. The tracks are interpolated at the radius bin irad
+  void interpolate(size_t n, const float* nch, const float* eta, const float* pt, float* covm, float* eff, float* eff2 = nullptr, float* valid = nullptr, int irad = 0) const
+  {
+    if (!is_init())
+      return;
+    irad = std::min(std::max(irad, 0), mNrad - 1);
+    int32_t corner[8];
+    for (int c = 0; c < 8; ++c)
+      corner[c] = irad * mStrideRad + (c >> 2 & 1) * mAxes[0].step * mStride[0] + (c >> 1 & 1) * mAxes[1].step * mStride[1] + (c & 1) * mAxes[2].step;
+    const int nout = eff2 ? kNTerms : kEff2; // terms to interpolate
+    const long nrows = mEntries / mStride[1];
+    const size_t nchunk = std::min(n, kChunk);
+    std::vector<int32_t> base(2 * nchunk), rank(nchunk), first(nrows + 1);
+    std::vector<float> w(6 * nchunk), out((kValid + 1) * nchunk);
+    int32_t* sbase = base.data() + nchunk; // in the row order
+    float* sw = w.data() + 3 * nchunk;
+    for (size_t cbegin = 0; cbegin < n; cbegin += kChunk) {
+      const size_t nc = std::min(kChunk, n - cbegin);
+
+      // coordinates in the input order
+      for (size_t begin = 0; begin < nc; begin += kBlock) {
+        const int nblock = std::min<size_t>(kBlock, nc - begin);
+        coordinates(mAxes[0], nblock, nch + cbegin + begin, mStride[0], base.data() + begin, w.data() + begin, true);
+        coordinates(mAxes[1], nblock, eta + cbegin + begin, mStride[1], base.data() + begin, w.data() + nchunk + begin, false);
+        coordinates(mAxes[2], nblock, pt + cbegin + begin, mStride[2], base.data() + begin, w.data() + 2 * nchunk + begin, false);
+      }
+
+      // row order
+      std::fill(first.begin(), first.end(), 0);
+      for (size_t i = 0; i < nc; ++i)
+        ++first[base[i] / mStride[1] + 1];
+      for (long row = 0; row < nrows; ++row)
+        first[row + 1] += first[row];
+      for (size_t i = 0; i < nc; ++i) {
+        const int32_t j = first[base[i] / mStride[1]]++;
+        rank[i] = j;
+        sbase[j] = base[i];
+        for (int a = 0; a < 3; ++a)
+          sw[a * nchunk + j] = w[a * nchunk + i];
+      }
+
+      // corners in the row order, 8 tracks at the time and the rest one by one
+      int j = 0;
+#if defined(__x86_64__)
+      if (hasAVX2())
+        j = interpolate8(nc, sbase, sw, sw + nchunk, sw + 2 * nchunk, corner, out.data(), nchunk, nout, valid);
+#endif
+      for (; j < (int)nc; ++j)
+        interpolate1(sbase[j], sw[j], sw[nchunk + j], sw[2 * nchunk + j], corner, out.data() + j, nchunk, nout, valid);
+
+      // back to the input order
+      for (int k = 0; k < nout; ++k) {
+        float* to = (k < kEff ? covm + k * n : (k == kEff ? eff : eff2)) + cbegin;
+        const float* from = out.data() + k * nchunk;
+        for (size_t i = 0; i < nc; ++i)
+          to[i] = from[rank[i]];
+      }
+      if (valid)
+        for (size_t i = 0; i < nc; ++i)
+          valid[cbegin + i] = out[kValid * nchunk + rank[i]];
+    }
+  };
+
+ private:
+  enum { kEff = 15,
+         kEff2,
+         kNTerms,
+         kValid = kNTerms };             // output row of valid
+  static const int kBlock = 256;         // tracks whose coordinates are computed together
+  static constexpr size_t kChunk = 1 << 16; // tracks ordered together
+
+  /// log10 to float precision, without library calls so that it vectorises:
+  /// x = 2^e m with m in [sqrt(1/2), sqrt(2)) and ln m from the series of atanh
+  static inline float fastLog10(float x)
+  {
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int32_t e = ((bits >> 23) & 0xff) - 127;
+    bits = (bits & 0x7fffff) | 0x3f800000; // m in [1, 2)
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    const bool high = m > 1.41421356f;
+    m = high ? 0.5f * m : m;
+    e = high ? e + 1 : e;
+    const float s = (m - 1.f) / (m + 1.f), s2 = s * s;
+    const float lnm = 2.f * s * (1.f + s2 * (1.f / 3.f + s2 * (1.f / 5.f + s2 * (1.f / 7.f))));
+    return 0.30102999566f * e + 0.43429448190f * lnm;
+  };
+
+  struct axis_t {
+    bool log = false;
+    int n = 1;
+    int step = 0;      // 1 if there is a next bin to interpolate with, 0 for single bin axes
+    float c0 = 0.;     // first bin centre, in the map variable
+    float invw = 0.;   // reciprocal bin width, uniform axes
+    std::vector<float> centres; // bin centres in the map variable, non-uniform axes
+
+    void init(const lutAxis_t& axis)
+    {
+      log = axis.map.log;
+      n = axis.nbins();
+      step = n > 1 ? 1 : 0;
+      centres.clear();
+      if (axis.edges) {
+        for (int i = 0; i < n; ++i)
+          centres.push_back(0.5 * (axis.edges[i] + axis.edges[i + 1]));
+        c0 = centres[0];
+      } else {
+        const float width = (axis.map.max - axis.map.min) / n;
+        c0 = axis.map.min + 0.5 * width;
+        invw = 1. / width;
+      }
+    };
+
+    /// lower corner and weight of the upper one, the lower corner offset
+    /// (bin index times stride) is set or added to base
+    void coordinates(int nblock, const float* val, long stride, int32_t* base, float* w, bool set) const
+    {
+      float t[kBlock];
+      if (centres.empty()) {
+        for (int j = 0; j < nblock; ++j)
+          t[j] = ((log ? fastLog10(val[j]) : val[j]) - c0) * invw;
+      } else {
+        for (int j = 0; j < nblock; ++j) {
+          const float u = log ? fastLog10(val[j]) : val[j];
+          int i = std::upper_bound(centres.begin(), centres.end(), u) - centres.begin() - 1;
+          i = std::min(std::max(i, 0), n - 2 + (1 - step));
+          t[j] = step ? i + (u - centres[i]) / (centres[i + 1] - centres[i]) : 0.f;
+        }
+      }
+      const float tmax = n - 1;
+      for (int j = 0; j < nblock; ++j) {
+        const float tc = std::min(std::max(t[j], 0.f), tmax);
+        const int i = std::min((int)tc, n - 1 - step);
+        w[j] = tc - i;
+        base[j] = (set ? 0 : base[j]) + i * (int32_t)stride;
+      }
+    };
+  };
+
+  /// coordinates of a block on an axis, the uniform ones 8 tracks at the time with AVX2
+  static void coordinates(const axis_t& axis, int nblock, const float* val, long stride, int32_t* base, float* w, bool set)
+  {
+    int j = 0;
+#if defined(__x86_64__)
+    if (axis.centres.empty() && hasAVX2())
+      j = coordinates8(axis, nblock, val, stride, base, w, set);
+#endif
+    if (j < nblock)
+      axis.coordinates(nblock - j, val + j, stride, base + j, w + j, set);
+  };
+
+  /// one track from the lower corner base, the upper corner weights and the corner offsets;
+  /// the terms are written to out[k * stride] for the first nout terms, then valid if wanted
+  void interpolate1(int32_t base, float w0, float w1, float w2, const int32_t* corner, float* out, size_t stride, int nout, bool valid) const
+  {
+    const float* entry = mTable.data() + base;
+    float wall[8], wcov[8], wsum = 0.f;
+    for (int c = 0; c < 8; ++c) {
+      wall[c] = (c & 4 ? w0 : 1.f - w0) * (c & 2 ? w1 : 1.f - w1) * (c & 1 ? w2 : 1.f - w2);
+      wcov[c] = entry[corner[c]] > 0.f ? wall[c] : 0.f;
+      wsum += wcov[c];
+    }
+    const float norm = wsum > 0.f ? 1.f / wsum : 0.f;
+    for (int k = 0; k < nout; ++k) {
+      const float* term = entry + k * mEntries;
+      const float* wk = k < kEff ? wcov : wall;
+      float acc = 0.f;
+      for (int c = 0; c < 8; ++c)
+        acc += wk[c] * term[corner[c]];
+      out[k * stride] = k < kEff ? acc * norm : acc;
+    }
+    if (valid)
+      out[kValid * stride] = wsum > 0.f ? 1.f : 0.f;
+  };
+
+#if defined(__x86_64__)
+  static bool hasAVX2()
+  {
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return avx2;
+  };
+
+  /// as axis_t::coordinates for a uniform axis 8 tracks at the time, returns the number done
+  __attribute__((target("avx2,fma"))) static int coordinates8(const axis_t& axis, int nblock, const float* val, long stride, int32_t* base, float* w, bool set)
+  {
+    const __m256 c0 = _mm256_set1_ps(axis.c0), invw = _mm256_set1_ps(axis.invw), tmax = _mm256_set1_ps(axis.n - 1), zero = _mm256_setzero_ps();
+    const __m256i imax = _mm256_set1_epi32(axis.n - 1 - axis.step), istride = _mm256_set1_epi32(stride);
+    int j = 0;
+    for (; j + 8 <= nblock; j += 8) {
+      __m256 u = _mm256_loadu_ps(val + j);
+      if (axis.log) {
+        // fastLog10
+        const __m256i bits = _mm256_castps_si256(u);
+        __m256i e = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)), _mm256_set1_epi32(127));
+        __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7fffff)), _mm256_set1_epi32(0x3f800000)));
+        const __m256 high = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+        m = _mm256_blendv_ps(m, _mm256_mul_ps(_mm256_set1_ps(0.5f), m), high);
+        e = _mm256_sub_epi32(e, _mm256_castps_si256(high)); // high is -1
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 s = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one)), s2 = _mm256_mul_ps(s, s);
+        __m256 p = _mm256_add_ps(_mm256_set1_ps(1.f / 5.f), _mm256_mul_ps(s2, _mm256_set1_ps(1.f / 7.f)));
+        p = _mm256_add_ps(_mm256_set1_ps(1.f / 3.f), _mm256_mul_ps(s2, p));
+        p = _mm256_add_ps(one, _mm256_mul_ps(s2, p));
+        const __m256 lnm = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.f), s), p);
+        u = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.30102999566f), _mm256_cvtepi32_ps(e)), _mm256_mul_ps(_mm256_set1_ps(0.43429448190f), lnm));
+      }
+      const __m256 tc = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(u, c0), invw), zero), tmax);
+      const __m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(tc), imax);
+      _mm256_storeu_ps(w + j, _mm256_sub_ps(tc, _mm256_cvtepi32_ps(i)));
+      __m256i b = _mm256_mullo_epi32(i, istride);
+      if (!set)
+        b = _mm256_add_epi32(b, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + j)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(base + j), b);
+    }
+    return j;
+  };
+
+  /// as interpolate1 for n tracks 8 at the time, to out[k * stride + j], returns the number done
+  __attribute__((target("avx2,fma"))) int interpolate8(int n, const int32_t* base, const float* w0, const float* w1, const float* w2, const int32_t* corner, float* out, size_t stride, int nout, bool valid) const
+  {
+    const float* table = mTable.data();
+    const __m256 one = _mm256_set1_ps(1.f), zero = _mm256_setzero_ps();
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + j));
+      const __m256 u0 = _mm256_loadu_ps(w0 + j), u1 = _mm256_loadu_ps(w1 + j), u2 = _mm256_loadu_ps(w2 + j);
+      __m256i index[8];
+      __m256 wall[8], wcov[8], c00[8], wsum = zero;
+      for (int c = 0; c < 8; ++c) {
+        index[c] = _mm256_add_epi32(b, _mm256_set1_epi32(corner[c]));
+        wall[c] = _mm256_mul_ps(_mm256_mul_ps(c & 4 ? u0 : _mm256_sub_ps(one, u0), c & 2 ? u1 : _mm256_sub_ps(one, u1)), c & 1 ? u2 : _mm256_sub_ps(one, u2));
+        c00[c] = _mm256_i32gather_ps(table, index[c], 4);
+        wcov[c] = _mm256_and_ps(wall[c], _mm256_cmp_ps(c00[c], zero, _CMP_GT_OQ));
+        wsum = _mm256_add_ps(wsum, wcov[c]);
+      }
+      const __m256 any = _mm256_cmp_ps(wsum, zero, _CMP_GT_OQ);
+      const __m256 norm = _mm256_and_ps(_mm256_div_ps(one, wsum), any);
+      for (int k = 0; k < nout; ++k) {
+        const float* term = table + k * mEntries;
+        const __m256* wk = k < kEff ? wcov : wall;
+        __m256 acc = zero;
+        for (int c = 0; c < 8; ++c)
+          acc = _mm256_fmadd_ps(wk[c], k ? _mm256_i32gather_ps(term, index[c], 4) : c00[c], acc);
+        _mm256_storeu_ps(out + k * stride + j, k < kEff ? _mm256_mul_ps(acc, norm) : acc);
+      }
+      if (valid)
+        _mm256_storeu_ps(out + kValid * stride + j, _mm256_and_ps(one, any));
+    }
+    return j;
+  };
+#endif
+
+  axis_t mAxes[3]; // nch, eta, pt
+  long mStride[3] = {0, 0, 0};
+  long mStrideRad = 0;
+  int mNrad = 1;
+  size_t mEntries = 0;
+  std::vector<float> mTable; // covm terms, eff and eff2 of the entries in the file order, one array of mEntries each
+};
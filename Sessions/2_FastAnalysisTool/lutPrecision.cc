@@ -0,0 +1,252 @@
+#ifndef lutPrecision_CC
+#define lutPrecision_CC
+#include "lutWrite.cc"
+#include <cfloat>
+
+/// precision of the single precision Kalman kernels (TrackParT<Float_t>) on the LUT grid
+///
+/// At each (eta, pt) point of the standard LUT grid (lutMakeHeader) the track is
+/// solved in double by the FAT solver, then its inward pass is redone by the
+/// kernels of TrackParK.h in double and in float, from the same parameters at the
+/// outermost layer: rotation and propagation to the inward parameters saved at each
+/// layer, update with the layer resolution and material. The deviation of the float
+/// covariance at the innermost layer, the one of the LUT, from the double one is
+/// relative to |c_ii| for the diagonal elements and to sqrt(c_ii c_jj) for the
+/// others. The max deviations over the grid are printed per element, with the point
+/// where they are reached, and per pt decade, and the overall max is returned. The
+/// points where the float pass fails and the double one does not are counted.
+///
+/// e.g. fatInit_detector(); lutPrecision(211);
+
+// max deviations of the float kernels over the grid
+struct lutPrecision_t {
+  double maxdev[15] = {0.}; // per covariance element
+  float eta[15] = {0.};     // where maxdev is reached
+  float pt[15] = {0.};
+  std::vector<double> decade; // max over the elements, per pt decade
+  long npoints = 0;           // solved in double
+  long nfailed = 0;           // of which the float pass failed
+
+  void merge(const lutPrecision_t& other)
+  {
+    for (int i = 0; i < 15; ++i)
+      if (other.maxdev[i] > maxdev[i]) {
+        maxdev[i] = other.maxdev[i];
+        eta[i] = other.eta[i];
+        pt[i] = other.pt[i];
+      }
+    decade.resize(std::max(decade.size(), other.decade.size()), 0.);
+    for (size_t i = 0; i < other.decade.size(); ++i)
+      decade[i] = std::max(decade[i], other.decade[i]);
+    npoints += other.npoints;
+    nfailed += other.nfailed;
+  };
+};
+
+// inward pass over the layers of the solution ws in the precision of t, from the
+// inward parameters at the outermost layer; returns the innermost layer, -1 if it failed
+template <typename T>
+int lutPrecisionPass(const LayerGeometryK& geo, const TrackSol& ws, double bGauss, double mass, TrackParT<T>& t)
+{
+  int last = -1;
+  for (int j = geo.GetEntries(); j--;) {
+    const TrackParK* inw = ws.GetPar(TrackSol::kParInw, j);
+    if (!inw)
+      continue;
+    if (last < 0)
+      ConvertTrackPar(*inw, t);
+    else if (!Rotate(t, inw->alpha) || !PropagateTo(t, inw->x, bGauss))
+      return -1;
+    last = j;
+    if (geo.IsMeasured(j)) {
+      double meas[2] = {double(t.p[0]), double(t.p[1])};
+      double measErr2[3] = {geo.phiRes[j] * geo.phiRes[j], 0, geo.zRes[j] * geo.zRes[j]};
+      if (!Update(t, meas, measErr2))
+        return -1;
+    }
+    if (geo.radL[j] > 0 && !CorrectForMeanMaterial(t, geo.radL[j], 0, mass, kTRUE))
+      return -1;
+    if (geo.xrho[j] > 0 && !CorrectForMeanMaterial(t, 0, geo.xrho[j], mass, kTRUE))
+      return -1;
+  }
+  return last;
+}
+
+float lutPrecision(int pdg = 211)
+{
+  lutHeader_t lutHeader;
+  int q = 0;
+  if (!lutMakeHeader(lutHeader, q, pdg, fat.GetBField()))
+    return -1.;
+  const DetectorK& det = fat; // the const solver, shared by the threads
+  LayerGeometryK geo;
+  det.CompileGeometry(geo);
+  const double bGauss = det.GetBField() * 10.;
+  const float mass = q > 1 ? -lutHeader.mass : lutHeader.mass;
+  const map_t& etamap = lutHeader.etamap;
+  const map_t& ptmap = lutHeader.ptmap;
+  const int ndecades = std::max(1, (int)std::ceil(ptmap.max - ptmap.min));
+
+  // each thread one eta row at the time, with its own workspace
+  lutTrace_t lutTrace;
+  const int nthreads = std::min(lutNThreads(), etamap.nbins);
+  if (nthreads > 1)
+    ROOT::EnableThreadSafety();
+  std::vector<lutPrecision_t> results(nthreads);
+  std::atomic<int> nextRow(0);
+  auto worker = [&](lutPrecision_t& res) {
+    TrackSol ws(det.GetNumberOfLayers(), 0., 0., q, mass);
+    res.decade.assign(ndecades, 0.);
+    for (int ieta = nextRow++; ieta < etamap.nbins; ieta = nextRow++) {
+      for (int ipt = 0; ipt < ptmap.nbins; ++ipt) {
+        const float eta = etamap.eval(ieta), pt = ptmap.eval(ipt);
+        ws.Clear("");
+        ws.fPt = pt;
+        ws.fEta = eta;
+        ws.fMass = mass;
+        ws.fCharge = q;
+        if (!det.SolveTrack(ws))
+          continue;
+        TrackParK trkD;
+        TrackParT<Float_t> trkF;
+        if (lutPrecisionPass(geo, ws, bGauss, mass, trkD) < 0)
+          continue;
+        res.npoints++;
+        if (lutPrecisionPass(geo, ws, bGauss, mass, trkF) < 0) {
+          res.nfailed++;
+          continue;
+        }
+        const int idecade = std::min(ndecades - 1, (int)((ipt + 0.5) / ptmap.nbins * ndecades));
+        for (int i = 0, k = 0; i < 5; ++i)
+          for (int j = 0; j <= i; ++j, ++k) {
+            const double norm = TMath::Sqrt(TMath::Abs(trkD.c[i * (i + 3) / 2] * trkD.c[j * (j + 3) / 2]));
+            const double dev = norm > 0. ? TMath::Abs(trkF.c[k] - trkD.c[k]) / norm : 0.;
+            if (dev > res.maxdev[k]) {
+              res.maxdev[k] = dev;
+              res.eta[k] = eta;
+              res.pt[k] = pt;
+            }
+            res.decade[idecade] = std::max(res.decade[idecade], dev);
+          }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int ithread = 1; ithread < nthreads; ++ithread)
+    threads.emplace_back(worker, std::ref(results[ithread]));
+  worker(results[0]);
+  for (auto& thread : threads)
+    thread.join();
+  lutPrecision_t result;
+  for (auto& res : results)
+    result.merge(res);
+
+  // report
+  Printf(" --- float kernels vs double on the LUT grid (pdg %d): %ld points, float pass failed on %ld", pdg, result.npoints, result.nfailed);
+  Printf("    element  max rel. dev.        eta         pt");
+  double maxdev = 0.;
+  for (int i = 0, k = 0; i < 5; ++i)
+    for (int j = 0; j <= i; ++j, ++k) {
+      Printf("    c[%2d] %d%d  %12.3e  %9.3f  %9.3f", k, i, j, result.maxdev[k], result.eta[k], result.pt[k]);
+      maxdev = std::max(maxdev, result.maxdev[k]);
+    }
+  for (int id = 0; id < ndecades; ++id)
+    Printf("    pt [%8.3f, %8.3f]  %12.3e", std::pow(10., ptmap.min + id), std::pow(10., std::min<double>(ptmap.min + id + 1, ptmap.max)), result.decade[id]);
+  Printf("    max rel. dev. %.3e (float epsilon %.3e)", maxdev, FLT_EPSILON);
+  return maxdev;
+}
+
+/// deviation of the tabulated material functions (MaterialTableK) on the LUT grid
+///
+/// At each (eta, pt) point of the standard LUT grid the track is solved by the FAT
+/// solver with the exact Bethe-Bloch and multiple scattering functions and again
+/// with the tabulated ones. The deviation of the covariance at the innermost layer
+/// of the inward pass is relative as in lutPrecision, its max over the grid is
+/// printed per element and returned. The points solved by only one of the two are
+/// counted. The tables are within 5e-5 (Bethe-Bloch) and 5e-6 (multiple scattering)
+/// of the functions; at high pt, where the updates cancel most of the covariance,
+/// the deviation of c44 is a few times larger.
+///
+/// e.g. fatInit_detector(); lutMaterialTables(211);
+
+float lutMaterialTables(int pdg = 211)
+{
+  lutHeader_t lutHeader;
+  int q = 0;
+  if (!lutMakeHeader(lutHeader, q, pdg, fat.GetBField()))
+    return -1.;
+  const DetectorK& det = fat;
+  const float mass = q > 1 ? -lutHeader.mass : lutHeader.mass;
+  const map_t& etamap = lutHeader.etamap;
+  const map_t& ptmap = lutHeader.ptmap;
+  const int npoints = etamap.nbins * ptmap.nbins;
+
+  // innermost inward parameters on the grid, the tables being switched between the passes
+  lutTrace_t lutTrace;
+  auto solve = [&](bool tabulated, std::vector<TrackParK>& pars, std::vector<char>& valid) {
+    MaterialTableK::SetTabulated(tabulated);
+    TrackSol ws(det.GetNumberOfLayers(), 0., 0., q, mass);
+    pars.assign(npoints, TrackParK());
+    valid.assign(npoints, false);
+    for (int ieta = 0; ieta < etamap.nbins; ++ieta)
+      for (int ipt = 0; ipt < ptmap.nbins; ++ipt) {
+        const int k = ieta * ptmap.nbins + ipt;
+        ws.Clear("");
+        ws.fPt = ptmap.eval(ipt);
+        ws.fEta = etamap.eval(ieta);
+        ws.fMass = mass;
+        ws.fCharge = q;
+        if (!det.SolveTrack(ws))
+          continue;
+        for (int j = 0; j < det.GetNumberOfLayers() && !valid[k]; ++j)
+          if (const TrackParK* inw = ws.GetPar(TrackSol::kParInw, j)) {
+            pars[k] = *inw;
+            valid[k] = true;
+          }
+      }
+  };
+  const bool tabulated = MaterialTableK::IsTabulated();
+  std::vector<TrackParK> exact, table;
+  std::vector<char> validExact, validTable;
+  solve(false, exact, validExact);
+  solve(true, table, validTable);
+  MaterialTableK::SetTabulated(tabulated);
+
+  double maxdev[15] = {0.};
+  float maxeta[15] = {0.}, maxpt[15] = {0.};
+  long nsolved = 0, nmismatch = 0;
+  for (int ieta = 0; ieta < etamap.nbins; ++ieta)
+    for (int ipt = 0; ipt < ptmap.nbins; ++ipt) {
+      const int n = ieta * ptmap.nbins + ipt;
+      if (validExact[n] != validTable[n])
+        nmismatch++;
+      if (!validExact[n] || !validTable[n])
+        continue;
+      nsolved++;
+      const TrackParK &trkE = exact[n], &trkT = table[n];
+      for (int i = 0, k = 0; i < 5; ++i)
+        for (int j = 0; j <= i; ++j, ++k) {
+          const double norm = TMath::Sqrt(TMath::Abs(trkE.c[i * (i + 3) / 2] * trkE.c[j * (j + 3) / 2]));
+          const double dev = norm > 0. ? TMath::Abs(trkT.c[k] - trkE.c[k]) / norm : 0.;
+          if (dev > maxdev[k]) {
+            maxdev[k] = dev;
+            maxeta[k] = etamap.eval(ieta);
+            maxpt[k] = ptmap.eval(ipt);
+          }
+        }
+    }
+
+  // report
+  Printf(" --- tabulated material vs exact on the LUT grid (pdg %d): %ld points, solved by only one on %ld", pdg, nsolved, nmismatch);
+  Printf("    element  max rel. dev.        eta         pt");
+  double dev = 0.;
+  for (int i = 0, k = 0; i < 5; ++i)
+    for (int j = 0; j <= i; ++j, ++k) {
+      Printf("    c[%2d] %d%d  %12.3e  %9.3f  %9.3f", k, i, j, maxdev[k], maxeta[k], maxpt[k]);
+      dev = std::max(dev, maxdev[k]);
+    }
+  Printf("    max rel. dev. %.3e", dev);
+  return dev;
+}
+
+#endif
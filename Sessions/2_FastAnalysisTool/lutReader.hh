@@ -0,0 +1,334 @@
+#pragma once
+#include "lutCovm.hh"
+#include "lutCovmV2.hh"
+#include "lutBundle.hh"
+#include "lutEigen.hh"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/// read-only access to a LUT file without parsing it: the file is memory mapped
+/// and entries are addressed directly from the bin indices, so that several
+/// processes on the same node share the page-cached copy of the tables.
+/// Both the original format (LUTCOVM_VERSION), where entry() gives a direct
+/// pointer, and the compact one (LUTCOVM_VERSION_V2), decoded by get(), are read.
+/// From a bundle (LUTBUNDLE_VERSION) only the table of the requested species is mapped.
+/// The bins are to be looked up on the axes, which are not uniform in adaptive LUTs.
+/// Truncated or incomplete files are refused, verify() checks the checksums (lutChecksum.hh).
+
+struct lutReader_t {
+  const lutHeader_t* header = nullptr;
+  const lutEntry_t* entries = nullptr; // original format only
+  int version = 0;
+  int nnch = 0;
+  int nrad = 0;
+  int neta = 0;
+  int npt = 0;
+  lutAxis_t nchaxis;
+  lutAxis_t radaxis;
+  lutAxis_t etaaxis;
+  lutAxis_t ptaxis;
+
+  lutReader_t() = default;
+  lutReader_t(const char* filename, int pdg = 0) { open(filename, pdg); };
+  lutReader_t(const lutReader_t&) = delete;
+  lutReader_t& operator=(const lutReader_t&) = delete;
+  ~lutReader_t() { close(); };
+
+  /// the pdg code selects the species of a bundle, it is ignored for single LUT files
+  bool open(const char* filename, int pdg = 0)
+  {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+      printf("lutReader: cannot open %s \n", filename);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(lutHeader_t)) {
+      printf("lutReader: %s is too short to contain a LUT header \n", filename);
+      ::close(fd);
+      return false;
+    }
+    off_t offset = 0;
+    size_t size = st.st_size;
+    if (!findSpecies(fd, st.st_size, pdg, offset, size)) {
+      printf("lutReader: %s does not contain a LUT for pdg code %d \n", filename, pdg);
+      ::close(fd);
+      return false;
+    }
+    const off_t page = sysconf(_SC_PAGESIZE);
+    const off_t mapOffset = offset / page * page;
+    mMapSize = size + (offset - mapOffset);
+    void* addr = mmap(nullptr, mMapSize, PROT_READ, MAP_SHARED, fd, mapOffset);
+    ::close(fd); // the mapping stays valid
+    if (addr == MAP_FAILED) {
+      printf("lutReader: cannot map %s \n", filename);
+      mMapSize = 0;
+      return false;
+    }
+    mMap = addr;
+    mData = reinterpret_cast<char*>(addr) + (offset - mapOffset);
+    mSize = size;
+    header = reinterpret_cast<const lutHeader_t*>(mData);
+    version = header->version;
+    if (version != LUTCOVM_VERSION && version != LUTCOVM_VERSION_V2) {
+      printf("lutReader: %s has version %d, expected %d or %d \n", filename, version, LUTCOVM_VERSION, LUTCOVM_VERSION_V2);
+      close();
+      return false;
+    }
+    nnch = header->nchmap.nbins;
+    nrad = header->radmap.nbins;
+    neta = header->etamap.nbins;
+    npt = header->ptmap.nbins;
+    nchaxis = lutAxis_t(header->nchmap);
+    radaxis = lutAxis_t(header->radmap);
+    etaaxis = lutAxis_t(header->etamap);
+    ptaxis = lutAxis_t(header->ptmap);
+    bool ok = nnch > 0 && nrad > 0 && neta > 0 && npt > 0;
+    if (ok && version == LUTCOVM_VERSION) {
+      // entries, followed by the slice checksums and the footer unless the file predates them
+      const char* base = reinterpret_cast<const char*>(mData);
+      const size_t size = sizeof(lutHeader_t) + nentries() * sizeof(lutEntry_t);
+      const size_t sizeFooter = size + nnch * sizeof(uint64_t) + sizeof(lutFooter_t);
+      auto footer = reinterpret_cast<const lutFooter_t*>(base + sizeFooter - sizeof(lutFooter_t));
+      if (mSize == sizeFooter && footer->magic == LUTFOOTER_MAGIC && footer->nslices == nnch)
+        mChecksums = reinterpret_cast<const uint64_t*>(base + size);
+      else
+        ok = mSize == size;
+      entries = reinterpret_cast<const lutEntry_t*>(base + sizeof(lutHeader_t));
+    } else if (ok) {
+      ok = openSections();
+    }
+    if (!ok) {
+      printf("lutReader: %s is truncated, incomplete or has an invalid header \n", filename);
+      close();
+      return false;
+    }
+    return true;
+  };
+
+  void close()
+  {
+    if (mMap)
+      munmap(mMap, mMapSize);
+    mMap = nullptr;
+    mMapSize = 0;
+    mData = nullptr;
+    mSize = 0;
+    header = nullptr;
+    entries = nullptr;
+    version = nnch = nrad = neta = npt = 0;
+    nchaxis = radaxis = etaaxis = ptaxis = lutAxis_t();
+    mValid = nullptr;
+    mEff = nullptr;
+    mCovm = nullptr;
+    mCovmQuant = nullptr;
+    mEigen = nullptr;
+    mCovmFormat = kLutFloat32;
+    mSections = nullptr;
+    mNsections = 0;
+    mChecksums = nullptr;
+  };
+
+  bool is_open() const { return mData != nullptr; };
+
+  /// checks the content against the checksums stored in the file, if any
+  bool verify() const
+  {
+    if (!is_open())
+      return false;
+    if (!mChecksums) {
+      printf("lutReader: no checksums, the file is not verified \n");
+      return true;
+    }
+    const char* base = reinterpret_cast<const char*>(mData);
+    if (entries) {
+      const size_t sliceSize = nentries() / nnch * sizeof(lutEntry_t);
+      for (int inch = 0; inch < nnch; ++inch)
+        if (lutChecksum(base + sizeof(lutHeader_t) + inch * sliceSize, sliceSize) != mChecksums[inch]) {
+          printf("lutReader: checksum mismatch in nch slice %d \n", inch);
+          return false;
+        }
+      return true;
+    }
+    for (int is = 0, ic = 0; is < mNsections; ++is) {
+      if (mSections[is].type == kLutChecksum)
+        continue;
+      if (lutChecksum(base + mSections[is].offset, mSections[is].size) != mChecksums[ic++]) {
+        printf("lutReader: checksum mismatch in section %d \n", is);
+        return false;
+      }
+    }
+    return true;
+  };
+  size_t nentries() const { return (size_t)nnch * nrad * neta * npt; };
+
+  /// linear index of a bin, -1 if out of range
+  long index(int inch, int irad, int ieta, int ipt) const
+  {
+    if (inch < 0 || inch >= nnch || irad < 0 || irad >= nrad || ieta < 0 || ieta >= neta || ipt < 0 || ipt >= npt)
+      return -1;
+    return ((long(inch) * nrad + irad) * neta + ieta) * npt + ipt;
+  };
+
+  /// entry from the bin indices, nullptr if out of range or if the file is in the compact format
+  const lutEntry_t* entry(int inch, int irad, int ieta, int ipt) const
+  {
+    long i = index(inch, irad, ieta, ipt);
+    if (!entries || i < 0)
+      return nullptr;
+    return &entries[i];
+  };
+
+  /// entry of the bin containing the given values, clamped to the table edges
+  const lutEntry_t* find(float nch, float rad, float eta, float pt) const
+  {
+    if (!entries)
+      return nullptr;
+    return entry(nchaxis.find(nch), radaxis.find(rad), etaaxis.find(eta), ptaxis.find(pt));
+  };
+
+  /// copy of the entry from the bin indices, in any format; the eigen decomposition
+  /// is rebuilt from the covariance when the file does not store it and eigen is requested
+  bool get(int inch, int irad, int ieta, int ipt, lutEntry_t& lutEntry, bool eigen = true) const
+  {
+    long i = index(inch, irad, ieta, ipt);
+    if (!is_open() || i < 0)
+      return false;
+    if (entries) {
+      lutEntry = entries[i];
+      return true;
+    }
+    lutEntry = lutEntry_t();
+    lutEntry.nch = nchaxis.eval(inch);
+    lutEntry.eta = etaaxis.eval(ieta);
+    lutEntry.pt = ptaxis.eval(ipt);
+    lutEntry.valid = mValid[i];
+    lutEntry.eff = mEff[4 * i];
+    lutEntry.eff2 = mEff[4 * i + 1];
+    lutEntry.itof = mEff[4 * i + 2];
+    lutEntry.otof = mEff[4 * i + 3];
+    lutDecodeCovm(mCovm, mCovmFormat, mCovmQuant, i, lutEntry.covm);
+    if (mEigen) {
+      const float* e = mEigen + 55 * i;
+      memcpy(lutEntry.eigval, e, 5 * sizeof(float));
+      memcpy(lutEntry.eigvec, e + 5, 25 * sizeof(float));
+      memcpy(lutEntry.eiginv, e + 30, 25 * sizeof(float));
+    } else if (eigen) {
+      diagonalise(lutEntry);
+    }
+    return true;
+  };
+
+  /// copy of the entry of the bin containing the given values, clamped to the table edges
+  bool find(float nch, float rad, float eta, float pt, lutEntry_t& lutEntry, bool eigen = true) const
+  {
+    if (!is_open())
+      return false;
+    return get(nchaxis.find(nch), radaxis.find(rad), etaaxis.find(eta), ptaxis.find(pt), lutEntry, eigen);
+  };
+
+ private:
+  /// region of the LUT in the file: the whole file, or the species of a bundle
+  static bool findSpecies(int fd, off_t fileSize, int pdg, off_t& offset, size_t& size)
+  {
+    lutBundleHeader_t bundleHeader;
+    if (pread(fd, &bundleHeader, sizeof(bundleHeader), 0) != sizeof(bundleHeader))
+      return false;
+    if (bundleHeader.version != LUTBUNDLE_VERSION)
+      return true;
+    if (bundleHeader.nspecies <= 0 || fileSize < (off_t)(sizeof(lutBundleHeader_t) + bundleHeader.nspecies * sizeof(lutBundleEntry_t)))
+      return false;
+    std::vector<lutBundleEntry_t> bundleEntries(bundleHeader.nspecies);
+    const size_t nbytes = bundleEntries.size() * sizeof(lutBundleEntry_t);
+    if (pread(fd, bundleEntries.data(), nbytes, sizeof(lutBundleHeader_t)) != (ssize_t)nbytes)
+      return false;
+    for (auto& bundleEntry : bundleEntries) {
+      if (bundleEntry.pdg != pdg)
+        continue;
+      if (bundleEntry.offset < 0 || bundleEntry.size < (int64_t)sizeof(lutHeader_t) || bundleEntry.offset + bundleEntry.size > fileSize)
+        return false;
+      offset = bundleEntry.offset;
+      size = bundleEntry.size;
+      return true;
+    }
+    return false;
+  };
+
+  bool openSections()
+  {
+    const char* base = reinterpret_cast<const char*>(mData);
+    if (mSize < sizeof(lutHeader_t) + sizeof(lutSectionTable_t))
+      return false;
+    auto table = reinterpret_cast<const lutSectionTable_t*>(base + sizeof(lutHeader_t));
+    if (table->nsections < 0 || mSize < sizeof(lutHeader_t) + sizeof(lutSectionTable_t) + table->nsections * sizeof(lutSection_t))
+      return false;
+    auto sections = reinterpret_cast<const lutSection_t*>(base + sizeof(lutHeader_t) + sizeof(lutSectionTable_t));
+    mSections = sections;
+    mNsections = table->nsections;
+    const size_t n = nentries();
+    for (int is = 0; is < table->nsections; ++is) {
+      const lutSection_t& section = sections[is];
+      if (section.offset < 0 || section.size < 0 || (size_t)(section.offset + section.size) > mSize)
+        return false;
+      const char* data = base + section.offset;
+      size_t expected = 0;
+      switch (section.type) {
+        case kLutValid:
+          mValid = reinterpret_cast<const uint8_t*>(data);
+          expected = n;
+          break;
+        case kLutEff:
+          mEff = reinterpret_cast<const float*>(data);
+          expected = 4 * n * sizeof(float);
+          break;
+        case kLutCovm:
+          mCovm = data;
+          mCovmFormat = section.format;
+          expected = 15 * n * (section.format == kLutFloat32 ? sizeof(float) : sizeof(uint16_t));
+          break;
+        case kLutCovmQuant:
+          mCovmQuant = reinterpret_cast<const float*>(data);
+          expected = 30 * sizeof(float);
+          break;
+        case kLutEigen:
+          mEigen = reinterpret_cast<const float*>(data);
+          expected = 55 * n * sizeof(float);
+          break;
+        case kLutAxis: {
+          lutAxis_t* axes[kLutNAxes] = {&nchaxis, &radaxis, &etaaxis, &ptaxis};
+          if (section.format < 0 || section.format >= kLutNAxes)
+            return false;
+          axes[section.format]->edges = reinterpret_cast<const float*>(data);
+          expected = (axes[section.format]->nbins() + 1) * sizeof(float);
+          break;
+        }
+        case kLutChecksum:
+          mChecksums = reinterpret_cast<const uint64_t*>(data);
+          expected = (table->nsections - 1) * sizeof(uint64_t);
+          break;
+        default: // unknown sections are skipped
+          expected = section.size;
+      }
+      if ((size_t)section.size != expected)
+        return false;
+    }
+    return mValid && mEff && mCovm && (mCovmFormat == kLutFloat32 || mCovmQuant);
+  };
+
+  void* mMap = nullptr; // page aligned mapping
+  size_t mMapSize = 0;
+  void* mData = nullptr; // the LUT within the mapping
+  size_t mSize = 0;
+  const uint8_t* mValid = nullptr;
+  const float* mEff = nullptr;
+  const void* mCovm = nullptr;
+  const float* mCovmQuant = nullptr;
+  const float* mEigen = nullptr;
+  int mCovmFormat = kLutFloat32;
+  const lutSection_t* mSections = nullptr;
+  int mNsections = 0;
+  const uint64_t* mChecksums = nullptr; // of the nch slices or of the sections
+};
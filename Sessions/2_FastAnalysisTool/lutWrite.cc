@@ -4,16 +4,94 @@
 #ifndef lutWrite_CC
 #define lutWrite_CC
 #include "lutCovm.hh"
+#include "lutCovmV2.hh"
+#include "lutBundle.hh"
+#include "lutCheckpoint.hh"
+#include "lutEigen.hh"
 #include "fwdRes/fwdRes.C"
+#include <TROOT.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 DetectorK fat;
-void diagonalise(lutEntry_t& lutEntry);
 static float etaMaxBarrel = 1.75;
 
 bool usePara = true;        // use fwd parameterisation
 bool useDipole = false;     // use dipole i.e. flat parametrization for efficiency and momentum resolution
 bool useFlatDipole = false; // use dipole i.e. flat parametrization outside of the barrel
 
+bool useSplitSolve = true;  // solve the tracks once per (eta, pt) and only redo the hit probabilities for each nch
+bool useEtaSymmetry = false; // solve only eta >= 0 and mirror the negative eta bins, if the detector response is symmetric
+
+int lutFormat = 1;          // 1 = one lutEntry_t per bin (LUTCOVM_VERSION), 2 = compact sections (LUTCOVM_VERSION_V2)
+int lutCovmFormat = kLutFloat32; // covariance storage of the compact format: kLutFloat32, kLutFloat16 or kLutLog16
+bool lutStoreEigen = true;  // store the eigen decomposition in the compact format, otherwise rebuilt by the readers
+
+bool useAdaptiveBinning = false;   // refine the eta and pt bins only where the response changes, needs the compact format
+float lutAdaptiveTolerance = 0.01; // max relative deviation of sqrt(covm[14]) and absolute deviation of eff from the interpolation across an adaptive bin
+
+int nThreads = 1;           // number of threads solving the LUT bins, 0 = all available cores
+int ptBinsPerTile = 20;     // pt bins in one unit of work handed to the threads
+
+bool useMaterialTables = false; // tabulated Bethe-Bloch and multiple scattering in the solver (MaterialTableK), within 5e-5 of the exact ones
+
+int traceLevel = TraceK::kWarning; // run time level of the solver messages (TraceK), kDebug prints every layer of every bin
+std::string traceSink = "";        // binary file of per-track records of the solver (TraceKTrack_t), none if empty
+
+// diagnostic tracing of the solver for the duration of a LUT job
+struct lutTrace_t {
+  int level;          // run time level before the job, restored at its end
+  bool sink = false;  // the sink was opened by this job (not by an enclosing one)
+  lutTrace_t() : level(TraceK::GetLevel())
+  {
+    TraceK::SetLevel(traceLevel);
+    if (!traceSink.empty() && !TraceK::IsSinkOpen())
+      sink = TraceK::OpenSink(traceSink.c_str());
+  };
+  ~lutTrace_t()
+  {
+    if (sink)
+      TraceK::CloseSink();
+    TraceK::SetLevel(level);
+  };
+};
+
+// multiplicity independent part of a FAT track solution, kept to be reused for all nch bins
+struct fatSolution_t {
+  bool solved = false;
+  bool valid = false;
+  float eta = 0.;
+  int q = 0;
+  float covm[15] = {0.};
+  std::vector<double> sigY2; // Y variance of the combined track at each layer, negative if not reached
+  std::vector<double> sigZ2; // Z variance of the combined track at each layer, negative if not reached
+};
+
+// solutions needed for a LUT bin, i.e. at the bin eta and/or at the edge of the barrel
+struct fatCache_t {
+  fatSolution_t sol[2];
+  fatSolution_t* get(float eta, int q)
+  {
+    for (auto& s : sol) {
+      if (!s.solved) {
+        s.eta = eta;
+        s.q = q;
+        return &s;
+      }
+      if (s.eta == eta && s.q == q)
+        return &s;
+    }
+    return nullptr;
+  };
+};
+
 void printLutWriterConfiguration()
 {
   std::cout << " --- Printing configuration of LUT writer --- " << std::endl;
@@ -21,40 +99,83 @@ void printLutWriterConfiguration()
   std::cout << "    -> usePara       = " << usePara << std::endl;
   std::cout << "    -> useDipole     = " << useDipole << std::endl;
   std::cout << "    -> useFlatDipole = " << useFlatDipole << std::endl;
+  std::cout << "    -> useSplitSolve = " << useSplitSolve << std::endl;
+  std::cout << "    -> useEtaSymmetry = " << useEtaSymmetry << std::endl;
+  std::cout << "    -> lutFormat     = " << lutFormat << std::endl;
+  std::cout << "    -> lutCovmFormat = " << lutCovmFormat << std::endl;
+  std::cout << "    -> lutStoreEigen = " << lutStoreEigen << std::endl;
+  std::cout << "    -> useAdaptiveBinning   = " << useAdaptiveBinning << std::endl;
+  std::cout << "    -> lutAdaptiveTolerance = " << lutAdaptiveTolerance << std::endl;
+  std::cout << "    -> nThreads      = " << nThreads << std::endl;
+  std::cout << "    -> ptBinsPerTile = " << ptBinsPerTile << std::endl;
+  std::cout << "    -> useMaterialTables = " << useMaterialTables << std::endl;
+  std::cout << "    -> traceLevel    = " << traceLevel << std::endl;
+  std::cout << "    -> traceSink     = " << traceSink << std::endl;
 }
 
-bool fatSolve(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass = 0.13957000, int itof = 0, int otof = 0, int q = 1)
+bool fatSolve(const DetectorK& det, TrackSol& ws, lutEntry_t& lutEntry, float pt, float eta, float mass, int itof, int otof, int q, fatCache_t* cache = nullptr)
 {
+  // the detector is shared by the threads, each with its own workspace ws
+  // holding the multiplicity and the track solution
   lutEntry.valid = false;
 
-  // solve track
-  if (q > 1)
-    mass = -mass;
-  TrackSol tr(1, pt, eta, q, mass);
-  if (!fat.SolveTrack(tr))
-    return false;
-  AliExternalTrackParam* trPtr = (AliExternalTrackParam*)tr.fTrackCmb.At(0);
-  if (!trPtr)
-    return false;
+  fatSolution_t* sol = cache ? cache->get(eta, q) : nullptr;
+  if (sol && sol->solved) {
+    // reuse the track solution, only the hit probabilities depend on the current nch
+    if (!sol->valid)
+      return false;
+    det.CalcGoodHitProb(ws, sol->sigY2.size(), sol->sigY2.data(), sol->sigZ2.data());
+    for (int i = 0; i < 15; ++i)
+      lutEntry.covm[i] = sol->covm[i];
+  } else {
+    // solve track
+    if (sol)
+      sol->solved = true;
+    if (q > 1)
+      mass = -mass;
+    ws.Clear("");
+    ws.fPt = pt;
+    ws.fEta = eta;
+    ws.fMass = mass;
+    ws.fCharge = q;
+    if (!det.SolveTrack(ws))
+      return false;
+    const TrackParK* trPtr = ws.GetPar(TrackSol::kParCmb, 0);
+    if (!trPtr)
+      return false;
+    for (int i = 0; i < 15; ++i)
+      lutEntry.covm[i] = trPtr->c[i];
+    if (sol) {
+      sol->valid = true;
+      for (int i = 0; i < 15; ++i)
+        sol->covm[i] = lutEntry.covm[i];
+      const int nlayers = det.GetNumberOfLayers();
+      sol->sigY2.resize(nlayers);
+      sol->sigZ2.resize(nlayers);
+      for (int j = 0; j < nlayers; ++j) {
+        auto trCmb = ws.GetPar(TrackSol::kParCmb, j);
+        sol->sigY2[j] = trCmb ? trCmb->GetSigmaY2() : -1.;
+        sol->sigZ2[j] = trCmb ? trCmb->GetSigmaZ2() : -1.;
+      }
+    }
+  }
 
   lutEntry.valid = true;
-  lutEntry.itof = fat.GetGoodHitProb(itof);
-  lutEntry.otof = fat.GetGoodHitProb(otof);
-  for (int i = 0; i < 15; ++i)
-    lutEntry.covm[i] = trPtr->GetCovariance()[i];
+  lutEntry.itof = ws.fGoodHitProb[itof];
+  lutEntry.otof = ws.fGoodHitProb[otof];
 
   // define the efficiency
   auto totfake = 0.;
   lutEntry.eff = 1.;
   for (int i = 1; i < 20; ++i) {
-    auto igoodhit = fat.GetGoodHitProb(i);
+    auto igoodhit = ws.fGoodHitProb[i];
     if (igoodhit <= 0. || i == itof || i == otof)
       continue;
-    Printf(" Layer %d: good hit prob = %f", i, igoodhit);
+    TRACEK(TraceK::kDebug, " Layer %d: good hit prob = %f\n", i, igoodhit);
     lutEntry.eff *= igoodhit;
     auto pairfake = 0.;
     for (int j = i + 1; j < 20; ++j) {
-      auto jgoodhit = fat.GetGoodHitProb(j);
+      auto jgoodhit = ws.fGoodHitProb[j];
       if (jgoodhit <= 0. || j == itof || j == otof)
         continue;
       pairfake = (1. - igoodhit) * (1. - jgoodhit);
@@ -67,6 +188,12 @@ bool fatSolve(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass
   return true;
 }
 
+bool fatSolve(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass = 0.13957000, int itof = 0, int otof = 0, int q = 1)
+{
+  TrackSol ws(1, pt, eta, q, mass);
+  return fatSolve(fat, ws, lutEntry, pt, eta, mass, itof, otof, q);
+}
+
 bool fwdSolve(float* covm, float pt = 0.1, float eta = 0.0, float mass = 0.13957000)
 {
   if (fwdRes(covm, pt, eta, mass) < 0)
@@ -74,7 +201,7 @@ bool fwdSolve(float* covm, float pt = 0.1, float eta = 0.0, float mass = 0.13957
   return true;
 }
 
-bool fwdPara(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass = 0.13957000, float Bfield = 0.5)
+bool fwdPara(const DetectorK& det, TrackSol& ws, lutEntry_t& lutEntry, float pt, float eta, float mass, float Bfield, fatCache_t* cache = nullptr)
 {
   lutEntry.valid = false;
 
@@ -82,7 +209,7 @@ bool fwdPara(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass =
   if (fabs(eta) < etaMaxBarrel || fabs(eta) > 4)
     return false;
 
-  if (!fatSolve(lutEntry, pt, etaMaxBarrel, mass))
+  if (!fatSolve(det, ws, lutEntry, pt, etaMaxBarrel, mass, 0, 0, 1, cache))
     return false;
   float covmbarrel[15] = {0};
   for (int i = 0; i < 15; ++i) {
@@ -132,31 +259,323 @@ bool fwdPara(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass =
   return true;
 }
 
-void lutWrite() {}
-void lutWrite(const char* filename, int pdg = 211, float field = 0.2, int itof = 0, int otof = 0)
+bool fwdPara(lutEntry_t& lutEntry, float pt = 0.1, float eta = 0.0, float mass = 0.13957000, float Bfield = 0.5)
 {
+  TrackSol ws(1, pt, eta, 1, mass);
+  return fwdPara(fat, ws, lutEntry, pt, eta, mass, Bfield);
+}
 
-  if (useFlatDipole && useDipole) {
-    Printf("Both dipole and dipole flat flags are on, please use only one of them");
-    return;
+void lutSolveBin(const DetectorK& det, TrackSol& ws, lutHeader_t& lutHeader, lutEntry_t& lutEntry, float nch, float eta, float pt, int itof, int otof, int q, fatCache_t* cache = nullptr)
+{
+  // the entry is reset (padding included) so that every bin is independent of the
+  // previously solved ones and the output does not depend on the solving order
+  memset(&lutEntry, 0, sizeof(lutEntry_t));
+  lutEntry.nch = nch;
+  lutEntry.eta = eta;
+  lutEntry.pt = pt;
+  lutEntry.valid = true;
+  ws.fdNdEta = nch;
+  const float field = lutHeader.field;
+  if (fabs(lutEntry.eta) <= etaMaxBarrel) { // full lever arm ends at etaMaxBarrel
+    // printf(" --- fatSolve: pt = %f, eta = %f, mass = %f, field=%f \n", lutEntry.pt, lutEntry.eta, lutHeader.mass, lutHeader.field);
+    if (!fatSolve(det, ws, lutEntry, lutEntry.pt, lutEntry.eta, lutHeader.mass, itof, otof, q, cache)) {
+      // printf(" --- fatSolve: error \n");
+      lutEntry.valid = false;
+      lutEntry.eff = 0.;
+      lutEntry.eff2 = 0.;
+      for (int i = 0; i < 15; ++i)
+        lutEntry.covm[i] = 0.;
+    }
+  } else {
+    // printf(" --- fwdSolve: pt = %f, eta = %f, mass = %f, field=%f \n", lutEntry.pt, lutEntry.eta, lutHeader.mass, lutHeader.field);
+    lutEntry.eff = 1.;
+    lutEntry.eff2 = 1.;
+    bool retval = true;
+    if (useFlatDipole) { // Using the parametrization at the border of the barrel
+      retval = fatSolve(det, ws, lutEntry, lutEntry.pt, etaMaxBarrel, lutHeader.mass, itof, otof, q, cache);
+    } else if (usePara) {
+      retval = fwdPara(det, ws, lutEntry, lutEntry.pt, lutEntry.eta, lutHeader.mass, field, cache);
+    } else {
+      retval = fwdSolve(lutEntry.covm, lutEntry.pt, lutEntry.eta, lutHeader.mass);
+    }
+    if (useDipole) { // Using the parametrization at the border of the barrel only for efficiency and momentum resolution
+      lutEntry_t lutEntryBarrel;
+      retval = fatSolve(det, ws, lutEntryBarrel, lutEntry.pt, etaMaxBarrel, lutHeader.mass, itof, otof, q, cache);
+      lutEntry.valid = lutEntryBarrel.valid;
+      lutEntry.covm[14] = lutEntryBarrel.covm[14];
+      lutEntry.eff = lutEntryBarrel.eff;
+      lutEntry.eff2 = lutEntryBarrel.eff2;
+    }
+    if (!retval) {
+      // printf(" --- fwdSolve: error \n");
+      lutEntry.valid = false;
+      for (int i = 0; i < 15; ++i)
+        lutEntry.covm[i] = 0.;
+    }
+  }
+}
+
+void lutMirrorEta(const lutEntry_t& lutEntry, lutEntry_t& lutMirror, float eta)
+{
+  // entry at -eta: z and tan(lambda) change sign, hence their correlations with
+  // y, sin(phi) and q/pt do, and so do the corresponding eigenvector components
+  memcpy(&lutMirror, &lutEntry, sizeof(lutEntry_t));
+  lutMirror.eta = eta;
+  for (int i : {1, 4, 6, 8, 11, 13})
+    if (lutMirror.covm[i] != 0.)
+      lutMirror.covm[i] = -lutMirror.covm[i];
+  for (int i : {1, 3})
+    for (int j = 0; j < 5; ++j) {
+      lutMirror.eigvec[i][j] = -lutMirror.eigvec[i][j];
+      lutMirror.eiginv[j][i] = -lutMirror.eiginv[j][i];
+    }
+}
+
+bool lutCheckEtaSymmetry(const DetectorK& det, TrackSol& ws, lutHeader_t& lutHeader, const lutAxis_t& etaaxis, const lutAxis_t& ptaxis, float nch, int itof, int otof, int q)
+{
+  // the symmetric mode needs an eta axis symmetric around zero and a detector
+  // response that is, which is checked on a few pairs of mirrored bins
+  const int neta = etaaxis.nbins();
+  const int npt = ptaxis.nbins();
+  bool symmetricAxis = !etaaxis.map.log;
+  for (int ieta = 0; ieta < neta; ++ieta)
+    if (fabs(etaaxis.eval(ieta) + etaaxis.eval(neta - 1 - ieta)) > 1.e-5)
+      symmetricAxis = false;
+  if (!symmetricAxis) {
+    Printf("The eta map is not symmetric, the eta symmetry will not be used");
+    return false;
+  }
+  const float kTolerance = 1.e-4;
+  lutEntry_t lutPos, lutNeg, lutMirror;
+  for (int ieta = neta - 1; ieta >= neta / 2; ieta -= std::max(1, neta / 10)) {
+    for (int ipt : {npt / 10, npt / 2, npt - 1 - npt / 10}) {
+      lutSolveBin(det, ws, lutHeader, lutPos, nch, etaaxis.eval(ieta), ptaxis.eval(ipt), itof, otof, q);
+      lutSolveBin(det, ws, lutHeader, lutNeg, nch, etaaxis.eval(neta - 1 - ieta), ptaxis.eval(ipt), itof, otof, q);
+      lutMirrorEta(lutPos, lutMirror, lutNeg.eta);
+      bool symmetric = lutMirror.valid == lutNeg.valid && fabs(lutMirror.eff - lutNeg.eff) <= kTolerance && fabs(lutMirror.eff2 - lutNeg.eff2) <= kTolerance;
+      for (int i = 0, k = 0; i < 5; ++i)
+        for (int j = 0; j < i + 1; ++j, ++k) {
+          auto scale = sqrt(fabs(lutMirror.covm[i * (i + 1) / 2 + i] * lutMirror.covm[j * (j + 1) / 2 + j]));
+          if (fabs(lutMirror.covm[k] - lutNeg.covm[k]) > kTolerance * scale)
+            symmetric = false;
+        }
+      if (!symmetric) {
+        Printf("The detector response is not symmetric in eta (eta = %f, pt = %f), the eta symmetry will not be used", lutPos.eta, lutPos.pt);
+        return false;
+      }
+    }
   }
+  return true;
+}
 
-  // output file
-  ofstream lutFile(filename, std::ofstream::binary);
-  if (!lutFile.is_open()) {
-    Printf("Did not manage to open output file!!");
+void lutSolveSlice(const DetectorK& det, std::vector<TrackSol*>& workspaces, lutHeader_t& lutHeader, const lutAxis_t& etaaxis, const lutAxis_t& ptaxis, std::vector<lutEntry_t>& lutSlice, float nch, int itof, int otof, int q, std::vector<fatCache_t>* lutCache = nullptr, bool etaSymmetric = false)
+{
+  // solves all the (rad, eta, pt) bins at a given nch, the bins are grouped in tiles
+  // of consecutive pt bins which are picked up by the threads, one per workspace, as soon as they are free.
+  // With the eta symmetry only the rows with eta >= 0 are solved and the others mirrored
+  const int nrad = lutHeader.radmap.nbins;
+  const int neta = etaaxis.nbins();
+  const int npt = ptaxis.nbins();
+  const int netasolve = etaSymmetric ? neta - neta / 2 : neta;
+  const int ptTile = ptBinsPerTile > 0 ? ptBinsPerTile : npt;
+  const int ntilept = (npt + ptTile - 1) / ptTile;
+  const int ntiles = nrad * netasolve * ntilept;
+  std::atomic<int> nextTile(0), nfailed(0);
+  auto worker = [&](TrackSol* ws) {
+    for (int itile = nextTile++; itile < ntiles; itile = nextTile++) {
+      const int irad = itile / ntilept / netasolve;
+      const int ieta = neta - netasolve + (itile / ntilept) % netasolve;
+      const int irow = irad * neta + ieta; // (rad, eta) row
+      const int iptmin = (itile % ntilept) * ptTile;
+      const int iptmax = std::min(iptmin + ptTile, npt);
+      for (int ipt = iptmin; ipt < iptmax; ++ipt)
+        lutSolveBin(det, *ws, lutHeader, lutSlice[irow * npt + ipt], nch, etaaxis.eval(ieta), ptaxis.eval(ipt), itof, otof, q, lutCache ? &(*lutCache)[irow * npt + ipt] : nullptr);
+      nfailed += diagonalise(&lutSlice[irow * npt + iptmin], iptmax - iptmin);
+    }
+  };
+  if (workspaces.size() == 1) {
+    worker(workspaces[0]);
+  } else {
+    std::vector<std::thread> threads;
+    for (auto ws : workspaces)
+      threads.emplace_back(worker, ws);
+    for (auto& thread : threads)
+      thread.join();
+  }
+  if (nfailed > 0)
+    Printf("The eigen decomposition did not converge for %d bins at nch = %f, not valid", (int)nfailed, nch);
+  if (!etaSymmetric)
     return;
+  for (int irad = 0; irad < nrad; ++irad)
+    for (int ieta = 0; ieta < neta / 2; ++ieta) {
+      const float eta = etaaxis.eval(ieta);
+      for (int ipt = 0; ipt < npt; ++ipt)
+        lutMirrorEta(lutSlice[(irad * neta + neta - 1 - ieta) * npt + ipt], lutSlice[(irad * neta + ieta) * npt + ipt], eta);
+    }
+}
+
+// response in a LUT bin, as seen by the adaptive binning
+struct lutSample_t {
+  bool valid = false;
+  float ptres = 0.; // sqrt(covm[14])
+  float eff = 0.;
+};
+
+// bisection of an interval of an adaptive axis
+struct lutSplit_t {
+  float lo = 0.;
+  float hi = 0.;
+  float score = 0.;
+};
+
+float lutSplitScore(const lutSample_t& lo, const lutSample_t& mid, const lutSample_t& hi)
+{
+  // the entries are interpolated linearly in the map variable between the bin centres:
+  // deviation of the response at the middle of an interval from the interpolation of the
+  // ones at its ends, in units of the tolerance, infinite if the validity changes
+  if (lo.valid != mid.valid || hi.valid != mid.valid)
+    return std::numeric_limits<float>::infinity();
+  if (!mid.valid)
+    return 0.;
+  float score = fabs(mid.eff - 0.5 * (lo.eff + hi.eff)) / lutAdaptiveTolerance;
+  if (mid.ptres > 0.)
+    score = std::max(score, (float)(fabs(mid.ptres - 0.5 * (lo.ptres + hi.ptres)) / (lutAdaptiveTolerance * mid.ptres)));
+  return score;
+}
+
+void lutAdaptAxis(const DetectorK& det, std::vector<TrackSol*>& workspaces, lutHeader_t& lutHeader, int iaxis, float nch, int itof, int otof, int q, std::vector<float>& edges, bool mirror = false)
+{
+  // bin edges of the eta or pt axis, in the variable of its map: the bins start 8 times
+  // wider than the uniform ones, with an edge at the barrel/forward transition, and
+  // are bisected, down to half the uniform width, as long as the response at the centre
+  // is not within the tolerance of the interpolation of the ones at the edges for any of
+  // a few probe values of the other axis. The bisections are then kept by decreasing
+  // deviation, up to the number of uniform bins, so that the adaptive grid is never
+  // larger than the uniform one. The positive half of the eta axis is mirrored if the
+  // response was found symmetric (lutCheckEtaSymmetry)
+  const bool isEta = iaxis == kLutAxisEta;
+  const map_t& map = isEta ? lutHeader.etamap : lutHeader.ptmap;
+  const map_t& probemap = isEta ? lutHeader.ptmap : lutHeader.etamap;
+  const float width = (map.max - map.min) / map.nbins;
+  mirror = mirror && isEta;
+  const float umin = mirror ? 0. : map.min;
+  const int ncoarse = std::max(1, (int)std::lround((map.max - umin) / width / 8.));
+  std::set<float> start = {umin, map.max};
+  for (int i = 1; i < ncoarse; ++i)
+    start.insert(umin + (map.max - umin) * i / ncoarse);
+  if (isEta)
+    for (float u : {-etaMaxBarrel, etaMaxBarrel})
+      if (u > umin + 0.5 * width && u < map.max - 0.5 * width && !start.count(u)) {
+        auto next = start.upper_bound(u);
+        if (*next - u < 0.5 * width)
+          start.erase(next);
+        else if (u - *std::prev(next) < 0.5 * width)
+          start.erase(std::prev(next));
+        start.insert(u);
+      }
+
+  const int nprobes = std::min(7, probemap.nbins);
+  std::vector<float> probes;
+  for (int ip = 0; ip < nprobes; ++ip)
+    probes.push_back(probemap.eval(nprobes > 1 ? ip * (probemap.nbins - 1) / (nprobes - 1) : 0));
+
+  std::vector<std::map<float, lutSplit_t>> probeSplits(nprobes);
+  std::atomic<int> nextProbe(0), nsolve(0);
+  auto worker = [&](TrackSol* ws) {
+    for (int ip = nextProbe++; ip < nprobes; ip = nextProbe++) {
+      std::map<float, lutSample_t> samples;
+      auto sample = [&](float u) -> const lutSample_t& {
+        auto it = samples.find(u);
+        if (it != samples.end())
+          return it->second;
+        const float val = map.log ? std::pow(10., u) : u;
+        lutEntry_t lutEntry;
+        lutSolveBin(det, *ws, lutHeader, lutEntry, nch, isEta ? val : probes[ip], isEta ? probes[ip] : val, itof, otof, q);
+        ++nsolve;
+        lutSample_t& s = samples[u];
+        s.valid = lutEntry.valid;
+        s.ptres = sqrt(lutEntry.covm[14]);
+        s.eff = lutEntry.eff;
+        return s;
+      };
+      std::function<void(float, float)> refine = [&](float lo, float hi) {
+        const float mid = 0.5 * (lo + hi);
+        if (mid - lo < 0.499 * width)
+          return;
+        const float score = lutSplitScore(sample(lo), sample(mid), sample(hi));
+        if (score <= 1.)
+          return;
+        probeSplits[ip][mid] = {lo, hi, score};
+        refine(lo, mid);
+        refine(mid, hi);
+      };
+      for (auto it = start.begin(); std::next(it) != start.end(); ++it)
+        refine(*it, *std::next(it));
+    }
+  };
+  if (workspaces.size() == 1) {
+    worker(workspaces[0]);
+  } else {
+    std::vector<std::thread> threads;
+    for (auto ws : workspaces)
+      threads.emplace_back(worker, ws);
+    for (auto& thread : threads)
+      thread.join();
   }
 
-  // write header
-  lutHeader_t lutHeader;
+  // the bisections needed by any of the probes, with the largest deviation among them,
+  // a bisection scoring at most as its parent so that the parents are kept first
+  std::map<float, lutSplit_t> splits;
+  for (auto& probeSplit : probeSplits)
+    for (auto& split : probeSplit) {
+      auto it = splits.emplace(split).first;
+      it->second.score = std::max(it->second.score, split.second.score);
+    }
+  std::vector<std::pair<float, lutSplit_t>> ordered(splits.begin(), splits.end());
+  std::sort(ordered.begin(), ordered.end(), [](const std::pair<float, lutSplit_t>& a, const std::pair<float, lutSplit_t>& b) {
+    return a.second.hi - a.second.lo > b.second.hi - b.second.lo;
+  });
+  for (auto& split : ordered) {
+    for (float parent : {split.second.lo, split.second.hi}) {
+      auto it = splits.find(parent);
+      if (it != splits.end())
+        split.second.score = std::min(split.second.score, it->second.score);
+    }
+    splits[split.first].score = split.second.score;
+  }
+  std::stable_sort(ordered.begin(), ordered.end(), [](const std::pair<float, lutSplit_t>& a, const std::pair<float, lutSplit_t>& b) {
+    return a.second.score > b.second.score;
+  });
+  const int nmax = mirror ? map.nbins / 2 : map.nbins;
+  int nsplit = 0;
+  for (auto& split : ordered) {
+    if ((int)start.size() - 1 >= nmax)
+      break;
+    start.insert(split.first);
+    ++nsplit;
+  }
+  edges.clear();
+  if (mirror)
+    for (auto it = start.rbegin(); *it > 0.; ++it)
+      edges.push_back(-*it);
+  edges.insert(edges.end(), start.begin(), start.end());
+  Printf(" --- adaptive %s axis: %d bins (%d uniform), %d probe solutions, %d of %d bisections", isEta ? "eta" : "pt", (int)edges.size() - 1, map.nbins, (int)nsolve, nsplit, (int)ordered.size());
+}
+
+bool lutMakeHeader(lutHeader_t& lutHeader, int& q, int pdg, float field)
+{
   // pid
+  auto particle = TDatabasePDG::Instance()->GetParticle(pdg);
+  if (!particle) {
+    Printf("Unknown pdg code %i", pdg);
+    return false;
+  }
   lutHeader.pdg = pdg;
-  lutHeader.mass = TDatabasePDG::Instance()->GetParticle(pdg)->Mass();
-  const int q = std::abs(TDatabasePDG::Instance()->GetParticle(pdg)->Charge()) / 3;
+  lutHeader.mass = particle->Mass();
+  q = std::abs(particle->Charge()) / 3;
   if (q <= 0) {
-    Printf("Negative or null charge (%f) for pdg code %i. Fix the charge!", TDatabasePDG::Instance()->GetParticle(pdg)->Charge(), pdg);
-    return;
+    Printf("Negative or null charge (%f) for pdg code %i. Fix the charge!", particle->Charge(), pdg);
+    return false;
   }
   lutHeader.field = field;
   // nch
@@ -179,100 +598,215 @@ void lutWrite(const char* filename, int pdg = 211, float field = 0.2, int itof =
   lutHeader.ptmap.nbins = 200;
   lutHeader.ptmap.min = -2;
   lutHeader.ptmap.max = 2.;
-  lutFile.write(reinterpret_cast<char*>(&lutHeader), sizeof(lutHeader));
+  return true;
+}
+
+int lutNThreads()
+{
+  return nThreads > 0 ? nThreads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// checksum of everything the entries depend on, the key of the checkpoints of a LUT:
+// the header, the adaptive bin edges, the compiled detector layers and its settings,
+// the forward parametrisation and the solver options (not the number of threads)
+uint64_t lutSetupChecksum(const DetectorK& detector, const lutHeader_t& lutHeader, const std::vector<float>& etaedges, const std::vector<float>& ptedges, int itof, int otof)
+{
+  uint64_t setup = lutChecksum(lutHeader);
+  auto add = [&setup](const void* data, size_t size) { setup = lutChecksum(data, size, setup); };
+  auto addValue = [&add](double value) { add(&value, sizeof(value)); };
+  add(etaedges.data(), etaedges.size() * sizeof(float));
+  add(ptedges.data(), ptedges.size() * sizeof(float));
+  // detector
+  LayerGeometryK geo;
+  detector.CompileGeometry(geo);
+  add(geo.radius.data(), geo.radius.size() * sizeof(Float_t));
+  add(geo.radL.data(), geo.radL.size() * sizeof(Float_t));
+  add(geo.xrho.data(), geo.xrho.size() * sizeof(Float_t));
+  add(geo.phiRes.data(), geo.phiRes.size() * sizeof(Float_t));
+  add(geo.zRes.data(), geo.zRes.size() * sizeof(Float_t));
+  add(geo.eff.data(), geo.eff.size() * sizeof(Float_t));
+  add(geo.flags.data(), geo.flags.size() * sizeof(UInt_t));
+  for (double value : {(double)detector.GetBField(), (double)detector.GetMaxSnp(), (double)detector.GetIntegrationTime(),
+                       (double)detector.GetMaxRadiusOfSlowDetectors(), (double)detector.GetAvgRapidity(), (double)detector.GetConfidenceLevel(),
+                       (double)detector.GetAtLeastHits(), (double)detector.GetAtLeastCorr(), (double)detector.GetAtLeastFake(),
+                       (double)detector.GetMaxSeedRadius(), (double)detector.GetptScale(), (double)detector.GetdNdEtaCent(),
+                       detector.GetMinRadTrack(), (double)detector.GetLhcUPCscale()})
+    addValue(value);
+  // forward parametrisation (fwdRes.C)
+  addValue(NPlanes);
+  add(ZPlane, sizeof(ZPlane));
+  add(X2X0, sizeof(X2X0));
+  add(Res, sizeof(Res));
+  addValue(Bz);
+  // solver options
+  for (double value : {(double)usePara, (double)useDipole, (double)useFlatDipole, (double)useSplitSolve, (double)useEtaSymmetry,
+                       (double)useMaterialTables, (double)AliExternalTrackParam::GetUseLogTermMS(), (double)etaMaxBarrel, (double)itof, (double)otof})
+    addValue(value);
+  return setup;
+}
+
+// the checkpoints are removed once the file is complete, unless kept for a caller assembling
+// the file into another one (lutWriteBundle), which removes them with lutCheckpoint_t::remove
+bool lutWrite(const DetectorK& detector, const char* filename, lutHeader_t lutHeader, int q, int itof, int otof, int nthreads, bool keepCheckpoints = false)
+{
+  // format
+  const bool compact = lutFormat == 2 || useAdaptiveBinning;
+  if (lutFormat != 2 && useAdaptiveBinning)
+    Printf("Adaptive bins are only described by the compact format, which is used");
+  lutWriterV2_t lutWriterV2;
+  lutWriterV2.covmFormat = lutCovmFormat;
+  lutWriterV2.storeEigen = lutStoreEigen;
+
+  // the threads share the detector, each one solving the tracks in its own workspace
+  if (nthreads > 1)
+    ROOT::EnableThreadSafety();
+  std::vector<TrackSol*> workspaces;
+  for (int ithread = 0; ithread < nthreads; ++ithread)
+    workspaces.push_back(new TrackSol(detector.GetNumberOfLayers(), 0., 0., q, lutHeader.mass));
+
+  // eta symmetry, checked with the first nch on the uniform axes, before the adaptive
+  // binning which mirrors the eta edges if it holds
+  bool etaSymmetric = false;
+  if (useEtaSymmetry)
+    etaSymmetric = lutCheckEtaSymmetry(detector, *workspaces[0], lutHeader, lutAxis_t(lutHeader.etamap), lutAxis_t(lutHeader.ptmap), lutHeader.nchmap.eval(0), itof, otof, q);
+
+  // adaptive bins, decided at the highest nch where the efficiency changes the most
+  if (useAdaptiveBinning) {
+    const float nch = lutHeader.nchmap.eval(lutHeader.nchmap.nbins - 1);
+    auto& etaedges = lutWriterV2.axes[kLutAxisEta];
+    auto& ptedges = lutWriterV2.axes[kLutAxisPt];
+    lutAdaptAxis(detector, workspaces, lutHeader, kLutAxisEta, nch, itof, otof, q, etaedges, etaSymmetric);
+    lutAdaptAxis(detector, workspaces, lutHeader, kLutAxisPt, nch, itof, otof, q, ptedges);
+    lutHeader.etamap.nbins = etaedges.size() - 1;
+    lutHeader.ptmap.nbins = ptedges.size() - 1;
+  }
+  const auto& etaedges = lutWriterV2.axes[kLutAxisEta];
+  const auto& ptedges = lutWriterV2.axes[kLutAxisPt];
+  const lutAxis_t etaaxis(lutHeader.etamap, etaedges.empty() ? nullptr : etaedges.data());
+  const lutAxis_t ptaxis(lutHeader.ptmap, ptedges.empty() ? nullptr : ptedges.data());
 
   // entries
   const int nnch = lutHeader.nchmap.nbins;
   const int nrad = lutHeader.radmap.nbins;
-  const int neta = lutHeader.etamap.nbins;
-  const int npt = lutHeader.ptmap.nbins;
-  lutEntry_t lutEntry;
-
-  // write entries
-  for (int inch = 0; inch < nnch; ++inch) {
-    auto nch = lutHeader.nchmap.eval(inch);
-    lutEntry.nch = nch;
-    fat.SetdNdEtaCent(nch);
-    std::cout << " --- setting FAT dN/deta: " << nch << std::endl;
-    for (int irad = 0; irad < nrad; ++irad) {
-      for (int ieta = 0; ieta < neta; ++ieta) {
-        auto eta = lutHeader.etamap.eval(ieta);
-        lutEntry.eta = lutHeader.etamap.eval(ieta);
-        for (int ipt = 0; ipt < npt; ++ipt) {
-          lutEntry.pt = lutHeader.ptmap.eval(ipt);
-          lutEntry.valid = true;
-          if (fabs(eta) <= etaMaxBarrel) { // full lever arm ends at etaMaxBarrel
-            // printf(" --- fatSolve: pt = %f, eta = %f, mass = %f, field=%f \n", lutEntry.pt, lutEntry.eta, lutHeader.mass, lutHeader.field);
-            if (!fatSolve(lutEntry, lutEntry.pt, lutEntry.eta, lutHeader.mass, itof, otof, q)) {
-              // printf(" --- fatSolve: error \n");
-              lutEntry.valid = false;
-              lutEntry.eff = 0.;
-              lutEntry.eff2 = 0.;
-              for (int i = 0; i < 15; ++i)
-                lutEntry.covm[i] = 0.;
-            }
-          } else {
-            // printf(" --- fwdSolve: pt = %f, eta = %f, mass = %f, field=%f \n", lutEntry.pt, lutEntry.eta, lutHeader.mass, lutHeader.field);
-            lutEntry.eff = 1.;
-            lutEntry.eff2 = 1.;
-            bool retval = true;
-            if (useFlatDipole) { // Using the parametrization at the border of the barrel
-              retval = fatSolve(lutEntry, lutEntry.pt, etaMaxBarrel, lutHeader.mass, itof, otof, q);
-            } else if (usePara) {
-              retval = fwdPara(lutEntry, lutEntry.pt, lutEntry.eta, lutHeader.mass, field);
-            } else {
-              retval = fwdSolve(lutEntry.covm, lutEntry.pt, lutEntry.eta, lutHeader.mass);
-            }
-            if (useDipole) { // Using the parametrization at the border of the barrel only for efficiency and momentum resolution
-              lutEntry_t lutEntryBarrel;
-              retval = fatSolve(lutEntryBarrel, lutEntry.pt, etaMaxBarrel, lutHeader.mass, itof, otof, q);
-              lutEntry.valid = lutEntryBarrel.valid;
-              lutEntry.covm[14] = lutEntryBarrel.covm[14];
-              lutEntry.eff = lutEntryBarrel.eff;
-              lutEntry.eff2 = lutEntryBarrel.eff2;
-            }
-            if (!retval) {
-              // printf(" --- fwdSolve: error \n");
-              lutEntry.valid = false;
-              for (int i = 0; i < 15; ++i)
-                lutEntry.covm[i] = 0.;
-            }
-          }
-          diagonalise(lutEntry);
-          lutFile.write(reinterpret_cast<char*>(&lutEntry), sizeof(lutEntry_t));
-        }
-      }
+  const int neta = etaaxis.nbins();
+  const int npt = ptaxis.nbins();
+  std::vector<lutEntry_t> lutSlice(nrad * neta * npt);
+  std::vector<fatCache_t> lutCache(useSplitSolve ? nrad * neta * npt : 0); // track solutions of the first nch slice
+
+  // checkpoints, in the output file for the original format, resumed if a previous run was interrupted
+  const std::string ckptname = compact ? std::string(filename) + ".ckpt" : std::string(filename);
+  const uint64_t setup = lutSetupChecksum(detector, lutHeader, etaedges, ptedges, itof, otof);
+  lutCheckpoint_t lutCheckpoint;
+  const int nresume = lutCheckpoint.open(ckptname.c_str(), lutHeader, setup, lutSlice.size());
+
+  // write entries, one nch slice at the time in the (nch, rad, eta, pt) order
+  bool ok = nresume >= 0;
+  for (int inch = 0; ok && inch < nnch; ++inch) {
+    if (inch < nresume) {
+      ok = !compact || lutCheckpoint.read(inch, lutSlice.data());
+    } else {
+      auto nch = lutHeader.nchmap.eval(inch);
+      std::cout << " --- setting FAT dN/deta: " << nch << std::endl;
+      lutSolveSlice(detector, workspaces, lutHeader, etaaxis, ptaxis, lutSlice, nch, itof, otof, q, useSplitSolve ? &lutCache : nullptr, etaSymmetric);
+      ok = lutCheckpoint.commit(lutSlice.data());
     }
+    if (compact)
+      for (auto& lutEntry : lutSlice)
+        lutWriterV2.add(lutEntry);
+  }
+  for (auto ws : workspaces)
+    delete ws;
+  if (!ok) {
+    Printf("Did not manage to write the entries of %s, the complete slices are kept to resume", ckptname.c_str());
+    return false;
   }
 
-  lutFile.close();
+  // complete the file
+  if (compact) {
+    ofstream lutFile(filename, std::ofstream::binary);
+    if (!lutFile.is_open() || !lutWriterV2.write(lutFile, lutHeader)) {
+      Printf("Failed to write the compact LUT");
+      return false;
+    }
+    lutFile.close();
+    if (lutFile.fail())
+      return false;
+  }
+  return lutCheckpoint.finish(compact, keepCheckpoints);
 }
 
-void diagonalise(lutEntry_t& lutEntry)
+void lutWrite() {}
+void lutWrite(const char* filename, int pdg = 211, float field = 0.2, int itof = 0, int otof = 0)
 {
-  TMatrixDSym m(5);
-  double fcovm[5][5];
-  for (int i = 0, k = 0; i < 5; ++i)
-    for (int j = 0; j < i + 1; ++j, ++k) {
-      fcovm[i][j] = lutEntry.covm[k];
-      fcovm[j][i] = lutEntry.covm[k];
-    }
-  m.SetMatrixArray((double*)fcovm);
-  TMatrixDSymEigen eigen(m);
-  // eigenvalues vector
-  TVectorD eigenVal = eigen.GetEigenValues();
-  for (int i = 0; i < 5; ++i)
-    lutEntry.eigval[i] = eigenVal[i];
-  // eigenvectors matrix
-  TMatrixD eigenVec = eigen.GetEigenVectors();
-  for (int i = 0; i < 5; ++i)
-    for (int j = 0; j < 5; ++j)
-      lutEntry.eigvec[i][j] = eigenVec[i][j];
-  // inverse eigenvectors matrix
-  eigenVec.Invert();
-  for (int i = 0; i < 5; ++i)
-    for (int j = 0; j < 5; ++j)
-      lutEntry.eiginv[i][j] = eigenVec[i][j];
+
+  if (useFlatDipole && useDipole) {
+    Printf("Both dipole and dipole flat flags are on, please use only one of them");
+    return;
+  }
+
+  lutHeader_t lutHeader;
+  int q = 0;
+  if (!lutMakeHeader(lutHeader, q, pdg, field))
+    return;
+  lutTrace_t lutTrace;
+  MaterialTableK::SetTabulated(useMaterialTables);
+  lutWrite(fat, filename, lutHeader, q, itof, otof, lutNThreads());
+}
+
+void lutWriteBundle(const char* filename, std::vector<int> pdgs, float field = 0.2, int itof = 0, int otof = 0)
+{
+  // all species in a single file (see lutBundle.hh), from the current FAT setup:
+  // the species are solved concurrently, all threads sharing the detector. The species
+  // files are kept with their checkpoints until the bundle is assembled, so that a rerun
+  // with the same setup only solves the species and slices that were not complete
+
+  if (useFlatDipole && useDipole) {
+    Printf("Both dipole and dipole flat flags are on, please use only one of them");
+    return;
+  }
+
+  std::vector<lutHeader_t> lutHeaders(pdgs.size());
+  std::vector<int> charges(pdgs.size());
+  std::vector<std::string> tmpnames(pdgs.size());
+  for (size_t is = 0; is < pdgs.size(); ++is) {
+    if (!lutMakeHeader(lutHeaders[is], charges[is], pdgs[is], field))
+      return;
+    tmpnames[is] = std::string(filename) + "." + std::to_string(pdgs[is]) + ".tmp";
+  }
+
+  // solve, the threads beyond the number of species solve the bins of a species
+  lutTrace_t lutTrace;
+  MaterialTableK::SetTabulated(useMaterialTables);
+  const int nthreads = lutNThreads();
+  const int nworkers = std::min<int>(nthreads, pdgs.size());
+  const int nthreadsspecies = std::max(1, nthreads / std::max(1, nworkers));
+  if (nthreads > 1)
+    ROOT::EnableThreadSafety();
+  std::atomic<int> nextSpecies(0);
+  std::vector<char> done(pdgs.size(), false);
+  auto worker = [&]() {
+    for (int is = nextSpecies++; is < (int)pdgs.size(); is = nextSpecies++)
+      done[is] = lutWrite(fat, tmpnames[is].c_str(), lutHeaders[is], charges[is], itof, otof, nthreadsspecies, true);
+  };
+  std::vector<std::thread> threads;
+  for (int iworker = 0; iworker < nworkers; ++iworker)
+    threads.emplace_back(worker);
+  for (auto& thread : threads)
+    thread.join();
+
+  // assemble the bundle
+  bool ok = std::find(done.begin(), done.end(), false) == done.end();
+  if (ok)
+    ok = lutBundleWrite(filename, pdgs, tmpnames);
+  if (!ok) {
+    Printf("Did not manage to write the LUT bundle %s, the species files are kept to resume", filename);
+    return;
+  }
+  const bool compact = lutFormat == 2 || useAdaptiveBinning;
+  for (auto& tmpname : tmpnames) {
+    std::remove(tmpname.c_str());
+    lutCheckpoint_t::remove(compact ? tmpname + ".ckpt" : tmpname);
+  }
 }
 
 #endif
@@ -74,3 +74,12 @@ void lutWrite_tenv(const char* filename = "lutCovm.dat", int pdg = 211, float fi
   // write
   lutWrite(filename, pdg, field);
 }
+
+void lutWriteBundle_tenv(const char* filename = "lutCovm.20kG.20cm.bundle", std::vector<int> pdgs = {11, 13, 211, 321, 2212}, float field = 0.5, float rmin = 100.)
+{
+
+  // init FAT
+  fatInit_tenv(field, rmin);
+  // write
+  lutWriteBundle(filename, pdgs, field);
+}
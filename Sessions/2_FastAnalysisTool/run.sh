@@ -17,11 +17,19 @@ root -l -b <<EOF
     .L AliExternalTrackParam.cxx+
 
     .L DetectorK/HistoManager.cxx+
+    .L DetectorK/MaterialTableK.cxx+
+    .L DetectorK/TrackBatchK.cxx+
     .L DetectorK/DetectorK.cxx+
     .L lutWrite.cc
     .L lutWrite.detector.cc
+    .L designScan.cc
+    .L lutPrecision.cc
     .L lutWrite.tenv.cc
+    .L lutInterpolatorCheck.C+
+    .L lutEigenCheck.C+
+    .L trackBatchCheck.C+
     printLutWriterConfiguration();
+    MaterialTableK::Check();
 
     TDatabasePDG::Instance()->AddParticle("deuteron", "deuteron", 1.8756134, kTRUE, 0.0, 3, "Nucleus", 1000010020);
     TDatabasePDG::Instance()->AddAntiParticle("anti-deuteron", -1000010020);
@@ -37,6 +45,12 @@ root -l -b <<EOF
 
     if (0) {
         lutWrite_detector("lutCovm.el.5kG.20cm.dat", 11, 50, 20);
+    } else if (0) {
+        fatInit_tenv(20, 20);
+        lutPrecision(211);
+        lutMaterialTables(211);
+    } else if (0) {
+        lutWriteBundle_tenv("lutCovm.20kG.20cm.bundle", {11, 13, 211, 321, 2212, 1000010020, 1000010030, 1000020030, 1000020040}, 20, 20);
     } else{
         lutWrite_tenv("lutCovm.el.20kG.20cm.dat", 11, 20, 20);
         lutWrite_tenv("lutCovm.mu.20kG.20cm.dat", 13, 20, 20);
@@ -48,4 +62,10 @@ root -l -b <<EOF
         lutWrite_tenv("lutCovm.he.20kG.20cm.dat", 1000020030, 20, 20);
         lutWrite_tenv("lutCovm.al.20kG.20cm.dat", 1000020040, 20, 20);
     }
+
+    if (0) {
+        lutInterpolatorCheck("lutCovm.pi.20kG.20cm.dat");
+        lutEigenCheck("lutCovm.pi.20kG.20cm.dat");
+        trackBatchCheck();
+    }
 EOF